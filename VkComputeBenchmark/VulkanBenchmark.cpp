@@ -0,0 +1,1401 @@
+//
+//  VulkanBenchmark.cpp
+//  VkComputeBenchmark
+//
+//  Created by James Perlman on 10/29/21.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <sstream>
+
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+#include "VulkanBenchmark.hpp"
+
+#include "FileUtils.hpp"
+#include "VulkanComputeApplication.hpp"
+#include "VulkanDebugUtils.hpp"
+#include "VulkanDeviceSelector.hpp"
+#include "VulkanKernels.hpp"
+#include "VulkanReduction.hpp"
+
+// MARK: - Statistics
+
+VulkanBenchmarkStatistics VulkanBenchmarkResult::getStatistics() const
+{
+    VulkanBenchmarkStatistics statistics;
+    
+    if (samples.empty())
+    {
+        return statistics;
+    }
+    
+    std::vector<double> sorted = samples;
+    std::sort(sorted.begin(), sorted.end());
+    
+    size_t count = sorted.size();
+    
+    statistics.min = sorted.front();
+    statistics.median = count % 2 == 1 ? sorted[count / 2] : 0.5 * (sorted[count / 2 - 1] + sorted[count / 2]);
+    statistics.mean = std::accumulate(sorted.begin(), sorted.end(), 0.0) / count;
+    statistics.p99 = sorted[std::min(count - 1, static_cast<size_t>(std::ceil(count * 0.99)) - 1)];
+    
+    double variance = 0.0;
+    for (double sample : sorted)
+    {
+        variance += (sample - statistics.mean) * (sample - statistics.mean);
+    }
+    statistics.standardDeviation = std::sqrt(variance / count);
+    
+    return statistics;
+}
+
+// MARK: - Constructor
+
+VulkanBenchmark::VulkanBenchmark(const VulkanBenchmarkConfiguration& configuration)
+: configuration(configuration)
+{
+    if (configuration.repetitionCount == 0)
+    {
+        throw std::runtime_error("A benchmark needs at least one repetition!");
+    }
+    
+    createVulkanInstance();
+    assignPhysicalDevice();
+    createLogicalDevice();
+    createPipeline();
+    createCommandResources();
+}
+
+// MARK: - Destructor
+
+VulkanBenchmark::~VulkanBenchmark()
+{
+    destroyCommandResources();
+    destroyPipeline();
+    destroyLogicalDevice();
+    destroyVulkanInstance();
+}
+
+// MARK: - Vulkan Instance
+
+// Validation layers are left off on purpose, since they would be part of every measurement.
+void VulkanBenchmark::createVulkanInstance()
+{
+    VkApplicationInfo appInfo{};
+    appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    appInfo.pApplicationName = "VkComputeBenchmark";
+    appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+    appInfo.pEngineName = "No Engine";
+    appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
+    appInfo.apiVersion = instanceApiVersion;
+    
+    VkInstanceCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    createInfo.pNext = nullptr;
+    createInfo.pApplicationInfo = &appInfo;
+    createInfo.enabledLayerCount = 0;
+    createInfo.enabledExtensionCount = 0;
+    
+    VK_ASSERT_SUCCESS(vkCreateInstance(&createInfo, nullptr, &instance),
+                      "Failed to create Vulkan instance!");
+}
+
+void VulkanBenchmark::destroyVulkanInstance()
+{
+    vkDestroyInstance(instance, nullptr);
+}
+
+// MARK: - Physical Device
+
+void VulkanBenchmark::assignPhysicalDevice()
+{
+    // Any device with a compute queue can be measured, the check below finds the queue.
+    VulkanDeviceSelector selector(instance, instanceApiVersion, FileUtils::getCacheDirectory());
+    physicalDevice = selector.select(configuration.device, [](VkPhysicalDevice) { return true; });
+    
+    vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+    
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+    
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+    
+    // Copies, dispatches and readbacks all go through one compute queue, so they're timed on the same engine.
+    for (uint32_t i = 0; i < queueFamilyCount; ++i)
+    {
+        if (queueFamilies[i].queueFlags & VK_QUEUE_COMPUTE_BIT)
+        {
+            queueFamilyIndex = i;
+            timestampValidBits = queueFamilies[i].timestampValidBits;
+            return;
+        }
+    }
+    
+    throw std::runtime_error("The GPU has no compute queue!");
+}
+
+// MARK: - Logical Device
+
+void VulkanBenchmark::createLogicalDevice()
+{
+    float queuePriority = 1.0f;
+    
+    VkDeviceQueueCreateInfo deviceQueueCreateInfo{};
+    deviceQueueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    deviceQueueCreateInfo.queueFamilyIndex = queueFamilyIndex;
+    deviceQueueCreateInfo.queueCount = 1;
+    deviceQueueCreateInfo.pQueuePriorities = &queuePriority;
+    
+    // Portability implementations like MoltenVK require VK_KHR_portability_subset, and other drivers don't have it.
+    uint32_t extensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+    
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, extensions.data());
+    
+    std::vector<const char*> enabledExtensions;
+    for (const auto& extension : extensions)
+    {
+        if (strcmp(extension.extensionName, "VK_KHR_portability_subset") == 0)
+        {
+            enabledExtensions.push_back("VK_KHR_portability_subset");
+        }
+    }
+    
+    VkPhysicalDeviceFeatures deviceFeatures{};
+    
+    VkDeviceCreateInfo deviceCreateInfo{};
+    deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    deviceCreateInfo.pQueueCreateInfos = &deviceQueueCreateInfo;
+    deviceCreateInfo.queueCreateInfoCount = 1;
+    deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
+    deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
+    deviceCreateInfo.ppEnabledExtensionNames = enabledExtensions.data();
+    deviceCreateInfo.enabledLayerCount = 0;
+    
+    VK_ASSERT_SUCCESS(vkCreateDevice(physicalDevice, &deviceCreateInfo, nullptr, &logicalDevice),
+                      "Failed to create logical device!");
+    
+    vkGetDeviceQueue(logicalDevice, queueFamilyIndex, 0, &queue);
+    
+    memoryAllocator = std::make_unique<VulkanMemoryAllocator>(physicalDevice, logicalDevice);
+    
+    if (timestampValidBits > 0)
+    {
+        profiler = std::make_unique<VulkanProfiler>(logicalDevice, physicalDeviceProperties, queryCount);
+    }
+}
+
+void VulkanBenchmark::destroyLogicalDevice()
+{
+    profiler.reset();
+    memoryAllocator.reset();
+    
+    vkDestroyDevice(logicalDevice, nullptr);
+}
+
+// MARK: - Pipeline
+
+void VulkanBenchmark::createPipeline()
+{
+    const auto& kernel = VulkanKernels::getKernel("copy");
+    
+    VkShaderModuleCreateInfo shaderModuleCreateInfo{};
+    shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shaderModuleCreateInfo.pNext = nullptr;
+    shaderModuleCreateInfo.flags = 0;
+    shaderModuleCreateInfo.codeSize = kernel.code.size_bytes();
+    shaderModuleCreateInfo.pCode = kernel.code.data();
+    
+    VK_ASSERT_SUCCESS(vkCreateShaderModule(logicalDevice, &shaderModuleCreateInfo, nullptr, &shaderModule),
+                      "Failed to create shader module!");
+    
+    VkDescriptorSetLayoutBinding bindings[2]{};
+    for (uint32_t i = 0; i < 2; ++i)
+    {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        bindings[i].pImmutableSamplers = nullptr;
+    }
+    
+    VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo{};
+    descriptorSetLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descriptorSetLayoutCreateInfo.pNext = nullptr;
+    descriptorSetLayoutCreateInfo.flags = 0;
+    descriptorSetLayoutCreateInfo.bindingCount = 2;
+    descriptorSetLayoutCreateInfo.pBindings = bindings;
+    
+    VK_ASSERT_SUCCESS(vkCreateDescriptorSetLayout(logicalDevice, &descriptorSetLayoutCreateInfo, nullptr, &descriptorSetLayout),
+                      "Failed to create descriptor set layout!");
+    
+    VkPushConstantRange pushConstantRange = VulkanKernels::getPushConstantRange<VulkanKernels::CopyParameters>();
+    
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
+    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreateInfo.pNext = nullptr;
+    pipelineLayoutCreateInfo.flags = 0;
+    pipelineLayoutCreateInfo.setLayoutCount = 1;
+    pipelineLayoutCreateInfo.pSetLayouts = &descriptorSetLayout;
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+    
+    VK_ASSERT_SUCCESS(vkCreatePipelineLayout(logicalDevice, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout),
+                      "Failed to create pipeline layout!");
+    
+    const auto& limits = physicalDeviceProperties.limits;
+    workgroupWidth = std::min({ copyWorkgroupSize, limits.maxComputeWorkGroupSize[0], limits.maxComputeWorkGroupInvocations });
+    
+    VkSpecializationMapEntry specializationMapEntry{};
+    specializationMapEntry.constantID = 0;
+    specializationMapEntry.offset = 0;
+    specializationMapEntry.size = sizeof(uint32_t);
+    
+    VkSpecializationInfo specializationInfo{};
+    specializationInfo.mapEntryCount = 1;
+    specializationInfo.pMapEntries = &specializationMapEntry;
+    specializationInfo.dataSize = sizeof(uint32_t);
+    specializationInfo.pData = &workgroupWidth;
+    
+    VkPipelineShaderStageCreateInfo pipelineShaderStageCreateInfo{};
+    pipelineShaderStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineShaderStageCreateInfo.pNext = nullptr;
+    pipelineShaderStageCreateInfo.flags = 0;
+    pipelineShaderStageCreateInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineShaderStageCreateInfo.module = shaderModule;
+    pipelineShaderStageCreateInfo.pName = kernel.entryPoint;
+    pipelineShaderStageCreateInfo.pSpecializationInfo = &specializationInfo;
+    
+    VkComputePipelineCreateInfo pipelineCreateInfo{};
+    pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineCreateInfo.pNext = nullptr;
+    pipelineCreateInfo.flags = 0;
+    pipelineCreateInfo.stage = pipelineShaderStageCreateInfo;
+    pipelineCreateInfo.layout = pipelineLayout;
+    pipelineCreateInfo.basePipelineHandle = VK_NULL_HANDLE;
+    pipelineCreateInfo.basePipelineIndex = 0;
+    
+    VK_ASSERT_SUCCESS(vkCreateComputePipelines(logicalDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &pipeline),
+                      "Failed to create compute pipeline!");
+    
+    VkDescriptorPoolSize descriptorPoolSize{};
+    descriptorPoolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descriptorPoolSize.descriptorCount = 2;
+    
+    VkDescriptorPoolCreateInfo descriptorPoolCreateInfo{};
+    descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptorPoolCreateInfo.pNext = nullptr;
+    descriptorPoolCreateInfo.flags = 0;
+    descriptorPoolCreateInfo.maxSets = 1;
+    descriptorPoolCreateInfo.poolSizeCount = 1;
+    descriptorPoolCreateInfo.pPoolSizes = &descriptorPoolSize;
+    
+    VK_ASSERT_SUCCESS(vkCreateDescriptorPool(logicalDevice, &descriptorPoolCreateInfo, nullptr, &descriptorPool),
+                      "Failed to create descriptor pool!");
+    
+    VkDescriptorSetAllocateInfo descriptorSetAllocateInfo{};
+    descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descriptorSetAllocateInfo.pNext = nullptr;
+    descriptorSetAllocateInfo.descriptorPool = descriptorPool;
+    descriptorSetAllocateInfo.descriptorSetCount = 1;
+    descriptorSetAllocateInfo.pSetLayouts = &descriptorSetLayout;
+    
+    VK_ASSERT_SUCCESS(vkAllocateDescriptorSets(logicalDevice, &descriptorSetAllocateInfo, &descriptorSet),
+                      "Failed to allocate descriptor set!");
+}
+
+void VulkanBenchmark::destroyPipeline()
+{
+    vkDestroyDescriptorPool(logicalDevice, descriptorPool, nullptr);
+    vkDestroyPipeline(logicalDevice, pipeline, nullptr);
+    vkDestroyPipelineLayout(logicalDevice, pipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(logicalDevice, descriptorSetLayout, nullptr);
+    vkDestroyShaderModule(logicalDevice, shaderModule, nullptr);
+}
+
+// MARK: - Command Resources
+
+void VulkanBenchmark::createCommandResources()
+{
+    VkCommandPoolCreateInfo commandPoolCreateInfo{};
+    commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    commandPoolCreateInfo.pNext = nullptr;
+    commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    commandPoolCreateInfo.queueFamilyIndex = queueFamilyIndex;
+    
+    VK_ASSERT_SUCCESS(vkCreateCommandPool(logicalDevice, &commandPoolCreateInfo, nullptr, &commandPool),
+                      "Failed to create command pool!");
+    
+    VkCommandBufferAllocateInfo commandBufferAllocateInfo{};
+    commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    commandBufferAllocateInfo.pNext = nullptr;
+    commandBufferAllocateInfo.commandPool = commandPool;
+    commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    commandBufferAllocateInfo.commandBufferCount = 1;
+    
+    VK_ASSERT_SUCCESS(vkAllocateCommandBuffers(logicalDevice, &commandBufferAllocateInfo, &commandBuffer),
+                      "Failed to allocate command buffer!");
+    
+    VkFenceCreateInfo fenceCreateInfo{};
+    fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fenceCreateInfo.pNext = nullptr;
+    fenceCreateInfo.flags = 0;
+    
+    VK_ASSERT_SUCCESS(vkCreateFence(logicalDevice, &fenceCreateInfo, nullptr, &fence),
+                      "Failed to create fence!");
+}
+
+void VulkanBenchmark::destroyCommandResources()
+{
+    vkDestroyFence(logicalDevice, fence, nullptr);
+    vkDestroyCommandPool(logicalDevice, commandPool, nullptr);
+}
+
+// MARK: - Recording
+
+// Nothing is in flight between measurements, so the descriptor set can be rewritten in place.
+void VulkanBenchmark::bindBuffers(const VulkanBuffer& input, const VulkanBuffer& output)
+{
+    VkDescriptorBufferInfo bufferInfos[2]{};
+    bufferInfos[0].buffer = input.buffer;
+    bufferInfos[0].offset = 0;
+    bufferInfos[0].range = VK_WHOLE_SIZE;
+    bufferInfos[1].buffer = output.buffer;
+    bufferInfos[1].offset = 0;
+    bufferInfos[1].range = VK_WHOLE_SIZE;
+    
+    VkWriteDescriptorSet writeDescriptorSet{};
+    writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writeDescriptorSet.pNext = nullptr;
+    writeDescriptorSet.dstSet = descriptorSet;
+    writeDescriptorSet.dstBinding = 0;
+    writeDescriptorSet.dstArrayElement = 0;
+    writeDescriptorSet.descriptorCount = 2;
+    writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writeDescriptorSet.pBufferInfo = bufferInfos;
+    
+    vkUpdateDescriptorSets(logicalDevice, 1, &writeDescriptorSet, 0, nullptr);
+}
+
+// The kernel loops over the buffer, so the grid only needs to be big enough to fill the GPU.
+void VulkanBenchmark::recordCopyDispatch(VkCommandBuffer commandBuffer, VkDeviceSize size) const
+{
+    VulkanKernels::CopyParameters parameters;
+    parameters.vectorCount = static_cast<uint32_t>(size / 16);
+    
+    uint32_t groupCount = (parameters.vectorCount + workgroupWidth - 1) / workgroupWidth;
+    groupCount = std::clamp(groupCount, 1u, physicalDeviceProperties.limits.maxComputeWorkGroupCount[0]);
+    
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+    VulkanKernels::cmdPushParameters(commandBuffer, pipelineLayout, parameters);
+    vkCmdDispatch(commandBuffer, groupCount, 1, 1);
+}
+
+void VulkanBenchmark::submitAndWait(VkCommandBuffer commandBuffer)
+{
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = nullptr;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    
+    VK_ASSERT_SUCCESS(vkQueueSubmit(queue, 1, &submitInfo, fence),
+                      "Failed to submit queue!");
+    
+    VK_ASSERT_SUCCESS(vkWaitForFences(logicalDevice, 1, &fence, VK_TRUE, UINT64_MAX),
+                      "Failed to wait for fence!");
+    
+    VK_ASSERT_SUCCESS(vkResetFences(logicalDevice, 1, &fence),
+                      "Failed to reset fence!");
+}
+
+template <typename Record>
+double VulkanBenchmark::timeCommands(Record record)
+{
+    VK_ASSERT_SUCCESS(vkResetCommandBuffer(commandBuffer, 0),
+                      "Failed to reset command buffer!");
+    
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.pNext = nullptr;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    beginInfo.pInheritanceInfo = nullptr;
+    
+    VK_ASSERT_SUCCESS(vkBeginCommandBuffer(commandBuffer, &beginInfo),
+                      "Failed to begin command buffer!");
+    
+    // Make the previous measurement's writes visible, and keep its work out of this one's timestamps.
+    VkMemoryBarrier previousWorkBarrier{};
+    previousWorkBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    previousWorkBarrier.pNext = nullptr;
+    previousWorkBarrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+    previousWorkBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                         0, 1, &previousWorkBarrier, 0, nullptr, 0, nullptr);
+    
+    if (profiler)
+    {
+        profiler->cmdResetQueries(commandBuffer, 0, queryCount);
+        profiler->cmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0);
+    }
+    
+    record(commandBuffer);
+    
+    if (profiler)
+    {
+        profiler->cmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 1);
+    }
+    
+    VkMemoryBarrier hostBarrier{};
+    hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    hostBarrier.pNext = nullptr;
+    hostBarrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+    hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                         0, 1, &hostBarrier, 0, nullptr, 0, nullptr);
+    
+    VK_ASSERT_SUCCESS(vkEndCommandBuffer(commandBuffer),
+                      "Failed to end command buffer!");
+    
+    auto start = std::chrono::steady_clock::now();
+    submitAndWait(commandBuffer);
+    auto end = std::chrono::steady_clock::now();
+    
+    double seconds = std::chrono::duration<double>(end - start).count();
+    
+    if (profiler)
+    {
+        auto timestamps = profiler->readTimestamps(0, queryCount, timestampValidBits);
+        if (timestamps[0] && timestamps[1])
+        {
+            seconds = (*timestamps[1] - *timestamps[0]) * 1e-9;
+        }
+    }
+    
+    // Tiny copies can finish inside one timestamp tick. Clamp so bandwidths stay finite.
+    return std::max(seconds, 1e-9);
+}
+
+template <typename Measure>
+void VulkanBenchmark::sample(VulkanBenchmarkResult& result, Measure measure) const
+{
+    for (uint32_t i = 0; i < configuration.warmupCount; ++i)
+    {
+        measure();
+    }
+    
+    for (uint32_t i = 0; i < configuration.repetitionCount; ++i)
+    {
+        result.samples.push_back(measure());
+    }
+}
+
+// MARK: - Measurements
+
+static VulkanBenchmarkResult makeResult(const std::string& name, const std::string& unit, VkDeviceSize size = 0)
+{
+    VulkanBenchmarkResult result;
+    result.name = name;
+    result.unit = unit;
+    result.size = size;
+    return result;
+}
+
+
+static double getGigabytesPerSecond(VkDeviceSize bytes, double seconds)
+{
+    return bytes / seconds * 1e-9;
+}
+
+static double getMicroseconds(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+    return std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+// The same seed always produces the same data, so the copy can be checked without keeping a second copy around.
+static void fillPattern(void* data, VkDeviceSize size, uint32_t seed)
+{
+    std::mt19937 random(seed);
+    
+    uint32_t* words = static_cast<uint32_t*>(data);
+    for (VkDeviceSize i = 0; i < size / sizeof(uint32_t); ++i)
+    {
+        words[i] = random();
+    }
+}
+
+static bool matchesPattern(const void* data, VkDeviceSize size, uint32_t seed)
+{
+    std::mt19937 random(seed);
+    
+    const uint32_t* words = static_cast<const uint32_t*>(data);
+    for (VkDeviceSize i = 0; i < size / sizeof(uint32_t); ++i)
+    {
+        if (words[i] != random())
+        {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+std::vector<VulkanBenchmarkResult> VulkanBenchmark::run()
+{
+    std::vector<VulkanBenchmarkResult> results;
+    
+    measureDispatchOverhead(results);
+    
+    for (VkDeviceSize size = configuration.minimumSize; size <= configuration.maximumSize; size *= 2)
+    {
+        measureSize(size, results);
+        measureMap(size, results);
+        
+        if (configuration.includeApplication)
+        {
+            measureApplication(size, results);
+        }
+    }
+    
+    if (configuration.includeReductions)
+    {
+        measureReductions(results);
+    }
+    
+    return results;
+}
+
+// Submits one empty dispatch at a time. The time spent inside vkQueueSubmit is the submit overhead, and the time
+// until the fence is seen signaled is the shortest round trip the GPU can make.
+void VulkanBenchmark::measureDispatchOverhead(std::vector<VulkanBenchmarkResult>& results)
+{
+    VulkanBenchmarkResult submitResult = makeResult("submit", "us");
+    VulkanBenchmarkResult dispatchResult = makeResult("empty_dispatch", "us");
+    
+    VulkanBuffer input = memoryAllocator->createBuffer(configuration.minimumSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VulkanMemoryUsage::GpuOnly);
+    VulkanBuffer output = memoryAllocator->createBuffer(configuration.minimumSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VulkanMemoryUsage::GpuOnly);
+    bindBuffers(input, output);
+    
+    VK_ASSERT_SUCCESS(vkResetCommandBuffer(commandBuffer, 0),
+                      "Failed to reset command buffer!");
+    
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.pNext = nullptr;
+    beginInfo.flags = 0;
+    beginInfo.pInheritanceInfo = nullptr;
+    
+    VK_ASSERT_SUCCESS(vkBeginCommandBuffer(commandBuffer, &beginInfo),
+                      "Failed to begin command buffer!");
+    
+    // A size of zero leaves every invocation with nothing to copy.
+    recordCopyDispatch(commandBuffer, 0);
+    
+    VK_ASSERT_SUCCESS(vkEndCommandBuffer(commandBuffer),
+                      "Failed to end command buffer!");
+    
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = nullptr;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    
+    for (uint32_t i = 0; i < configuration.warmupCount + configuration.repetitionCount; ++i)
+    {
+        auto start = std::chrono::steady_clock::now();
+        
+        VK_ASSERT_SUCCESS(vkQueueSubmit(queue, 1, &submitInfo, fence),
+                          "Failed to submit queue!");
+        
+        auto submitted = std::chrono::steady_clock::now();
+        
+        VK_ASSERT_SUCCESS(vkWaitForFences(logicalDevice, 1, &fence, VK_TRUE, UINT64_MAX),
+                          "Failed to wait for fence!");
+        
+        auto completed = std::chrono::steady_clock::now();
+        
+        VK_ASSERT_SUCCESS(vkResetFences(logicalDevice, 1, &fence),
+                          "Failed to reset fence!");
+        
+        if (i >= configuration.warmupCount)
+        {
+            submitResult.samples.push_back(getMicroseconds(start, submitted));
+            dispatchResult.samples.push_back(getMicroseconds(start, completed));
+        }
+    }
+    
+    memoryAllocator->destroyBuffer(output);
+    memoryAllocator->destroyBuffer(input);
+    
+    results.push_back(submitResult);
+    results.push_back(dispatchResult);
+}
+
+// Copies between two device-local buffers with vkCmdCopyBuffer and with the copy kernel, then reads the kernel's
+// output back into host-visible memory, and copies it out of the mapping on the host.
+// Copy bandwidths count both the read and the write.
+void VulkanBenchmark::measureSize(VkDeviceSize size, std::vector<VulkanBenchmarkResult>& results)
+{
+    VulkanBenchmarkResult transferResult = makeResult("copy_transfer", "GB/s", size);
+    VulkanBenchmarkResult kernelResult = makeResult("copy_kernel", "GB/s", size);
+    VulkanBenchmarkResult readbackResult = makeResult("readback_gpu", "GB/s", size);
+    VulkanBenchmarkResult hostReadResult = makeResult("readback_host", "GB/s", size);
+    
+    auto skip = [&](const std::string& reason) {
+        for (auto* result : { &transferResult, &kernelResult, &readbackResult, &hostReadResult })
+        {
+            result->skipReason = reason;
+            results.push_back(*result);
+        }
+    };
+    
+    VkDeviceSize deviceLocalHeapSize = 0;
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; ++i)
+    {
+        if (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+        {
+            deviceLocalHeapSize = std::max(deviceLocalHeapSize, memoryProperties.memoryHeaps[i].size);
+        }
+    }
+    
+    if (2 * size > deviceLocalHeapSize)
+    {
+        skip("Both buffers don't fit in device local memory");
+        return;
+    }
+    
+    const VkBufferUsageFlags deviceUsage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    const VkBufferUsageFlags hostUsage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    
+    VulkanBuffer input, output, host;
+    std::vector<char> hostCopy;
+    
+    auto destroyBuffers = [&]() {
+        for (auto* buffer : { &host, &output, &input })
+        {
+            if (buffer->buffer != VK_NULL_HANDLE)
+            {
+                memoryAllocator->destroyBuffer(*buffer);
+            }
+        }
+    };
+    
+    // Big sizes can run out of memory on smaller devices. That's a result, not a failure.
+    try
+    {
+        input = memoryAllocator->createBuffer(size, deviceUsage, VulkanMemoryUsage::GpuOnly);
+        output = memoryAllocator->createBuffer(size, deviceUsage, VulkanMemoryUsage::GpuOnly);
+        host = memoryAllocator->createBuffer(size, hostUsage, VulkanMemoryUsage::GpuToCpu);
+        hostCopy.resize(size);
+    } catch (const std::exception& error)
+    {
+        destroyBuffers();
+        skip(error.what());
+        return;
+    }
+    
+    const uint32_t seed = static_cast<uint32_t>(size);
+    
+    // Upload the pattern, then clear the host buffer so the readback has to bring it back to pass verification.
+    fillPattern(host.allocation.mappedData, size, seed);
+    memoryAllocator->flush(host.allocation, 0, size);
+    
+    timeCommands([&](VkCommandBuffer commandBuffer) {
+        VkBufferCopy region{ 0, 0, size };
+        vkCmdCopyBuffer(commandBuffer, host.buffer, input.buffer, 1, &region);
+    });
+    
+    memset(host.allocation.mappedData, 0, size);
+    memoryAllocator->flush(host.allocation, 0, size);
+    
+    sample(transferResult, [&]() {
+        double seconds = timeCommands([&](VkCommandBuffer commandBuffer) {
+            VkBufferCopy region{ 0, 0, size };
+            vkCmdCopyBuffer(commandBuffer, input.buffer, output.buffer, 1, &region);
+        });
+        return getGigabytesPerSecond(2 * size, seconds);
+    });
+    
+    // Whichever copy ran last is the one the readback verifies.
+    VulkanBenchmarkResult* verifiedResult = &transferResult;
+    
+    if (size > physicalDeviceProperties.limits.maxStorageBufferRange)
+    {
+        kernelResult.skipReason = "Larger than maxStorageBufferRange";
+    } else
+    {
+        bindBuffers(input, output);
+        
+        timeCommands([&](VkCommandBuffer commandBuffer) {
+            vkCmdFillBuffer(commandBuffer, output.buffer, 0, VK_WHOLE_SIZE, 0);
+        });
+        
+        sample(kernelResult, [&]() {
+            double seconds = timeCommands([&](VkCommandBuffer commandBuffer) {
+                recordCopyDispatch(commandBuffer, size);
+            });
+            return getGigabytesPerSecond(2 * size, seconds);
+        });
+        
+        verifiedResult = &kernelResult;
+    }
+    
+    sample(readbackResult, [&]() {
+        double seconds = timeCommands([&](VkCommandBuffer commandBuffer) {
+            VkBufferCopy region{ 0, 0, size };
+            vkCmdCopyBuffer(commandBuffer, output.buffer, host.buffer, 1, &region);
+        });
+        return getGigabytesPerSecond(size, seconds);
+    });
+    
+    sample(hostReadResult, [&]() {
+        auto start = std::chrono::steady_clock::now();
+        memoryAllocator->invalidate(host.allocation, 0, size);
+        memcpy(hostCopy.data(), host.allocation.mappedData, size);
+        auto end = std::chrono::steady_clock::now();
+        return getGigabytesPerSecond(size, std::max(std::chrono::duration<double>(end - start).count(), 1e-9));
+    });
+    
+    bool verified = matchesPattern(hostCopy.data(), size, seed);
+    verifiedResult->verified = verified;
+    readbackResult.verified = verified;
+    hostReadResult.verified = verified;
+    
+    destroyBuffers();
+    
+    results.push_back(transferResult);
+    results.push_back(kernelResult);
+    results.push_back(readbackResult);
+    results.push_back(hostReadResult);
+}
+
+// Maps and unmaps a dedicated host-visible allocation. Some drivers set up the mapping lazily, so this is a lower bound.
+void VulkanBenchmark::measureMap(VkDeviceSize size, std::vector<VulkanBenchmarkResult>& results)
+{
+    VulkanBenchmarkResult mapResult = makeResult("map", "us", size);
+    
+    VkMemoryAllocateInfo allocateInfo{};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocateInfo.pNext = nullptr;
+    allocateInfo.allocationSize = size;
+    allocateInfo.memoryTypeIndex = memoryAllocator->findMemoryTypeIndex(UINT32_MAX, VulkanMemoryUsage::GpuToCpu, size);
+    
+    VkDeviceMemory memory;
+    if (vkAllocateMemory(logicalDevice, &allocateInfo, nullptr, &memory) != VK_SUCCESS)
+    {
+        mapResult.skipReason = "Failed to allocate host visible memory";
+        results.push_back(mapResult);
+        return;
+    }
+    
+    sample(mapResult, [&]() {
+        void* data;
+        
+        auto start = std::chrono::steady_clock::now();
+        VK_ASSERT_SUCCESS(vkMapMemory(logicalDevice, memory, 0, VK_WHOLE_SIZE, 0, &data),
+                          "Failed to map memory!");
+        vkUnmapMemory(logicalDevice, memory);
+        auto end = std::chrono::steady_clock::now();
+        
+        return getMicroseconds(start, end);
+    });
+    
+    vkFreeMemory(logicalDevice, memory, nullptr);
+    
+    results.push_back(mapResult);
+}
+
+// Upload, dispatch and readback through the application, with one frame in flight so every run is a full round trip.
+// Each size gets its own application with storage buffers of exactly that size.
+void VulkanBenchmark::measureApplication(VkDeviceSize size, std::vector<VulkanBenchmarkResult>& results)
+{
+    VulkanBenchmarkResult applicationResult = makeResult("application_round_trip", "us", size);
+    
+    // Like the copies, sizes the device can't hold are skipped rather than failing the whole run.
+    try
+    {
+        VulkanComputeConfiguration applicationConfiguration;
+        applicationConfiguration.framesInFlight = 1;
+        applicationConfiguration.tuneWorkgroupSize = false;
+        applicationConfiguration.device = configuration.device;
+        applicationConfiguration.storageBufferSize = size;
+        
+        VulkanComputeApplication application(applicationConfiguration);
+        
+        std::vector<uint32_t> input(size / sizeof(uint32_t), 0);
+        std::span<const uint32_t> output;
+        
+        sample(applicationResult, [&]() {
+            auto start = std::chrono::steady_clock::now();
+            output = application.run(input);
+            auto end = std::chrono::steady_clock::now();
+            
+            return getMicroseconds(start, end);
+        });
+        
+        // simple.comp writes a 1 for every element.
+        applicationResult.verified = std::all_of(output.begin(), output.end(), [](uint32_t value) { return value == 1; });
+    } catch (const std::exception& error)
+    {
+        applicationResult.skipReason = error.what();
+    }
+    
+    results.push_back(applicationResult);
+}
+
+// MARK: - Reductions
+
+using VulkanKernels::ElementType;
+using VulkanKernels::ReduceOperation;
+
+static const char* getElementTypeName(ElementType elementType)
+{
+    switch (elementType)
+    {
+        case ElementType::U32: return "u32";
+        case ElementType::I32: return "i32";
+        case ElementType::F32: return "f32";
+        case ElementType::F16: return "f16";
+    }
+    return "?";
+}
+
+static const char* getOperationName(ReduceOperation operation)
+{
+    switch (operation)
+    {
+        case ReduceOperation::Sum: return "sum";
+        case ReduceOperation::Min: return "min";
+        case ReduceOperation::Max: return "max";
+        case ReduceOperation::ArgMax: return "argmax";
+    }
+    return "?";
+}
+
+static float halfToFloat(uint16_t half)
+{
+    int exponent = (half >> 10) & 0x1F;
+    int mantissa = half & 0x3FF;
+    
+    float value;
+    if (exponent == 0)
+    {
+        value = std::ldexp(static_cast<float>(mantissa), -24);
+    } else if (exponent == 31)
+    {
+        value = mantissa != 0 ? std::numeric_limits<float>::quiet_NaN() : std::numeric_limits<float>::infinity();
+    } else
+    {
+        value = std::ldexp(static_cast<float>(mantissa + 1024), exponent - 25);
+    }
+    
+    return (half & 0x8000) != 0 ? -value : value;
+}
+
+// Eight independent lanes let the compiler keep the loop in vector registers, since it may not reassociate a single
+// float accumulator on its own.
+static constexpr uint32_t cpuReduceLaneCount = 8;
+
+// Halves are widened this many at a time into a buffer that stays in L1, so the reduction itself reads plain floats.
+// A multiple of the lane count, so every block but the last is whole vectors.
+static constexpr uint32_t cpuHalfBlockSize = 1024;
+
+// Without branches, so the loop vectorizes. The magnitude bits are moved into a float's exponent and mantissa and
+// rescaled by 2^112, which also normalizes subnormals, and a maximal exponent becomes infinity or NaN.
+static float halfToFloatBranchless(uint16_t half)
+{
+    const uint32_t magnitudeBits = static_cast<uint32_t>(half & 0x7FFF) << 13;
+    
+    float magnitude;
+    memcpy(&magnitude, &magnitudeBits, sizeof(magnitude));
+    magnitude *= 0x1p112f;
+    
+    uint32_t bits;
+    memcpy(&bits, &magnitude, sizeof(bits));
+    bits |= (half & 0x7C00) == 0x7C00 ? 0x7F800000u : 0u;
+    bits |= static_cast<uint32_t>(half & 0x8000) << 16;
+    
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Widens the halves packed in words, low half first, into floats. count is even.
+static void convertHalves(const uint32_t* words, uint32_t count, float* values)
+{
+    uint32_t i = 0;
+
+#ifdef __F16C__
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i halves = _mm_loadu_si128(reinterpret_cast<const __m128i*>(words + i / 2));
+        _mm256_storeu_ps(values + i, _mm256_cvtph_ps(halves));
+    }
+#endif
+    
+    for (; i < count; i += 2)
+    {
+        values[i] = halfToFloatBranchless(static_cast<uint16_t>(words[i / 2]));
+        values[i + 1] = halfToFloatBranchless(static_cast<uint16_t>(words[i / 2] >> 16));
+    }
+}
+
+// The hot loop, instantiated once per operation so it is a plain loop the compiler can vectorize, rather than one it
+// would have to unswitch first. The lanes are copied into locals so they stay in registers instead of being stored back
+// through the pointers every iteration, and ArgMax keeps its index with selects rather than a branch.
+// load(i) returns element firstIndex + i.
+template <ReduceOperation Operation, typename Value, typename Load>
+static void reduceLanesOnCpu(uint32_t firstIndex, uint32_t vectorCount, Load load, Value* values, uint32_t* indices)
+{
+    Value laneValues[cpuReduceLaneCount];
+    uint32_t laneIndices[cpuReduceLaneCount];
+    std::copy(values, values + cpuReduceLaneCount, laneValues);
+    std::copy(indices, indices + cpuReduceLaneCount, laneIndices);
+    
+    for (uint32_t i = 0; i < vectorCount; i += cpuReduceLaneCount)
+    {
+        for (uint32_t lane = 0; lane < cpuReduceLaneCount; ++lane)
+        {
+            Value value = load(i + lane);
+            
+            if constexpr (Operation == ReduceOperation::Sum)
+            {
+                laneValues[lane] += value;
+            } else if constexpr (Operation == ReduceOperation::Min)
+            {
+                laneValues[lane] = value < laneValues[lane] ? value : laneValues[lane];
+            } else if constexpr (Operation == ReduceOperation::Max)
+            {
+                laneValues[lane] = value > laneValues[lane] ? value : laneValues[lane];
+            } else
+            {
+                bool isGreater = value > laneValues[lane];
+                laneIndices[lane] = isGreater ? firstIndex + i + lane : laneIndices[lane];
+                laneValues[lane] = isGreater ? value : laneValues[lane];
+            }
+        }
+    }
+    
+    std::copy(std::begin(laneValues), std::end(laneValues), values);
+    std::copy(std::begin(laneIndices), std::end(laneIndices), indices);
+}
+
+template <typename Value, typename Load>
+static void reduceLanesOnCpu(ReduceOperation operation, uint32_t firstIndex, uint32_t vectorCount, Load load, Value* values, uint32_t* indices)
+{
+    switch (operation)
+    {
+        case ReduceOperation::Sum: reduceLanesOnCpu<ReduceOperation::Sum>(firstIndex, vectorCount, load, values, indices); break;
+        case ReduceOperation::Min: reduceLanesOnCpu<ReduceOperation::Min>(firstIndex, vectorCount, load, values, indices); break;
+        case ReduceOperation::Max: reduceLanesOnCpu<ReduceOperation::Max>(firstIndex, vectorCount, load, values, indices); break;
+        case ReduceOperation::ArgMax: reduceLanesOnCpu<ReduceOperation::ArgMax>(firstIndex, vectorCount, load, values, indices); break;
+    }
+}
+
+// The CPU side of the comparison. ArgMax ties go to the lower index, as on the GPU.
+// reduceVectors(values, indices, vectorCount) folds the first vectorCount elements into the lanes, and load(i) returns
+// any element after them.
+template <typename Value, typename ReduceVectors, typename Load>
+static VulkanReductionResult reduceOnCpu(uint32_t count, ReduceOperation operation, ReduceVectors reduceVectors, Load load)
+{
+    constexpr uint32_t laneCount = cpuReduceLaneCount;
+    
+    Value identity = Value(0);
+    if (operation == ReduceOperation::Min)
+    {
+        identity = std::numeric_limits<Value>::has_infinity ? std::numeric_limits<Value>::infinity() : std::numeric_limits<Value>::max();
+    } else if (operation != ReduceOperation::Sum)
+    {
+        identity = std::numeric_limits<Value>::has_infinity ? -std::numeric_limits<Value>::infinity() : std::numeric_limits<Value>::lowest();
+    }
+    
+    Value values[laneCount];
+    uint32_t indices[laneCount];
+    std::fill(std::begin(values), std::end(values), identity);
+    std::fill(std::begin(indices), std::end(indices), UINT32_MAX);
+    
+    uint32_t vectorCount = count - count % laneCount;
+    reduceVectors(values, indices, vectorCount);
+    
+    Value value = identity;
+    uint32_t index = UINT32_MAX;
+    
+    auto combine = [&](Value otherValue, uint32_t otherIndex) {
+        switch (operation)
+        {
+            case ReduceOperation::Sum: value += otherValue; break;
+            case ReduceOperation::Min: value = std::min(value, otherValue); break;
+            case ReduceOperation::Max: value = std::max(value, otherValue); break;
+            case ReduceOperation::ArgMax:
+                if (otherValue > value || (!(value > otherValue) && otherIndex < index))
+                {
+                    value = otherValue;
+                    index = otherIndex;
+                }
+                break;
+        }
+    };
+    
+    for (uint32_t lane = 0; lane < laneCount; ++lane)
+    {
+        combine(values[lane], indices[lane]);
+    }
+    
+    for (uint32_t i = vectorCount; i < count; ++i)
+    {
+        combine(load(i), i);
+    }
+    
+    VulkanReductionResult result;
+    memcpy(&result.bits, &value, sizeof(uint32_t));
+    result.index = operation == ReduceOperation::ArgMax ? index : UINT32_MAX;
+    return result;
+}
+
+template <typename Value, typename Load>
+static VulkanReductionResult reduceOnCpu(uint32_t count, ReduceOperation operation, Load load)
+{
+    return reduceOnCpu<Value>(count, operation, [&](Value* values, uint32_t* indices, uint32_t vectorCount) {
+        reduceLanesOnCpu(operation, 0, vectorCount, load, values, indices);
+    }, load);
+}
+
+// Widens a block of halves at a time, then reduces the block like f32 elements.
+static VulkanReductionResult reduceHalvesOnCpu(const uint32_t* words, uint32_t count, ReduceOperation operation)
+{
+    return reduceOnCpu<float>(count, operation, [&](float* values, uint32_t* indices, uint32_t vectorCount) {
+        float block[cpuHalfBlockSize];
+        
+        for (uint32_t first = 0; first < vectorCount; first += cpuHalfBlockSize)
+        {
+            uint32_t blockCount = std::min(cpuHalfBlockSize, vectorCount - first);
+            convertHalves(words + first / 2, blockCount, block);
+            reduceLanesOnCpu(operation, first, blockCount, [&](uint32_t i) { return block[i]; }, values, indices);
+        }
+    }, [&](uint32_t i) {
+        return halfToFloat(static_cast<uint16_t>(words[i / 2] >> (16 * (i % 2))));
+    });
+}
+
+// Reduces the same seeded input with every operation, once through VulkanReduction and once on the CPU. The input is
+// uploaded to device-local memory first, so the GPU numbers are its own memory bandwidth. Both sides read back a
+// single result, and the GPU time includes the submission and the wait for it.
+void VulkanBenchmark::measureReductions(std::vector<VulkanBenchmarkResult>& results)
+{
+    const ElementType elementTypes[] = { ElementType::U32, ElementType::I32, ElementType::F32, ElementType::F16 };
+    const ReduceOperation operations[] = { ReduceOperation::Sum, ReduceOperation::Min, ReduceOperation::Max, ReduceOperation::ArgMax };
+    
+    const VkDeviceSize size = configuration.reductionSize - configuration.reductionSize % sizeof(uint32_t);
+    
+    std::vector<VulkanBenchmarkResult> reductionResults;
+    for (ElementType elementType : elementTypes)
+    {
+        for (ReduceOperation operation : operations)
+        {
+            std::string name = std::string("reduce_") + getOperationName(operation) + "_" + getElementTypeName(elementType);
+            reductionResults.push_back(makeResult(name + "_gpu", "GB/s", size));
+            reductionResults.push_back(makeResult(name + "_cpu", "GB/s", size));
+        }
+    }
+    
+    try
+    {
+        if (size == 0 || size > physicalDeviceProperties.limits.maxStorageBufferRange)
+        {
+            throw std::runtime_error("Reduction size is zero or larger than maxStorageBufferRange");
+        }
+        
+        VulkanComputeConfiguration applicationConfiguration;
+        applicationConfiguration.framesInFlight = 1;
+        applicationConfiguration.tuneWorkgroupSize = false;
+        applicationConfiguration.device = configuration.device;
+        
+        VulkanComputeApplication application(applicationConfiguration);
+        VulkanReduction reduction(application);
+        
+        auto& allocator = application.getMemoryAllocator();
+        VulkanBuffer staging = allocator.createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VulkanMemoryUsage::CpuToGpu);
+        VulkanBuffer input = allocator.createBuffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VulkanMemoryUsage::GpuOnly);
+        
+        std::vector<uint32_t> words(size / sizeof(uint32_t));
+        auto* result = reductionResults.data();
+        
+        for (ElementType elementType : elementTypes)
+        {
+            // Small values keep integer sums from wrapping and float sums meaningful, and make ArgMax ties likely.
+            std::mt19937 random(static_cast<uint32_t>(elementType) + 1);
+            double magnitudeSum = 0.0;
+            
+            for (uint32_t& word : words)
+            {
+                switch (elementType)
+                {
+                    case ElementType::U32:
+                        word = random() % 1000;
+                        break;
+                    case ElementType::I32:
+                        word = static_cast<uint32_t>(static_cast<int32_t>(random() % 2001) - 1000);
+                        break;
+                    case ElementType::F32:
+                    {
+                        float value = std::uniform_real_distribution<float>(-1.0f, 1.0f)(random);
+                        memcpy(&word, &value, sizeof(word));
+                        magnitudeSum += std::abs(value);
+                        break;
+                    }
+                    case ElementType::F16:
+                    {
+                        // A random sign and mantissa with an exponent below 15, so every half is under 1 in magnitude.
+                        auto makeHalf = [&]() { return static_cast<uint16_t>((random() & 0x83FF) | ((1 + random() % 14) << 10)); };
+                        uint16_t low = makeHalf();
+                        uint16_t high = makeHalf();
+                        word = low | (static_cast<uint32_t>(high) << 16);
+                        magnitudeSum += std::abs(halfToFloat(low)) + std::abs(halfToFloat(high));
+                        break;
+                    }
+                }
+            }
+            
+            memcpy(staging.allocation.mappedData, words.data(), size);
+            allocator.flush(staging.allocation, 0, size);
+            
+            {
+                auto upload = application.createComputeGraph();
+                upload->copyBuffer(staging.buffer, input.buffer, VkBufferCopy{ 0, 0, size });
+                upload->submit().wait();
+            }
+            
+            uint32_t elementCount = static_cast<uint32_t>(elementType == ElementType::F16 ? words.size() * 2 : words.size());
+            
+            for (ReduceOperation operation : operations)
+            {
+                VulkanBenchmarkResult& gpuResult = *result++;
+                VulkanBenchmarkResult& cpuResult = *result++;
+                
+                VulkanReductionResult gpuValue;
+                sample(gpuResult, [&]() {
+                    auto start = std::chrono::steady_clock::now();
+                    gpuValue = reduction.reduce(input.buffer, elementCount, elementType, operation);
+                    auto end = std::chrono::steady_clock::now();
+                    return getGigabytesPerSecond(size, std::chrono::duration<double>(end - start).count());
+                });
+                
+                VulkanReductionResult cpuValue;
+                sample(cpuResult, [&]() {
+                    auto start = std::chrono::steady_clock::now();
+                    switch (elementType)
+                    {
+                        case ElementType::U32:
+                            cpuValue = reduceOnCpu<uint32_t>(elementCount, operation, [&](uint32_t i) { return words[i]; });
+                            break;
+                        case ElementType::I32:
+                            cpuValue = reduceOnCpu<int32_t>(elementCount, operation, [&](uint32_t i) { return static_cast<int32_t>(words[i]); });
+                            break;
+                        case ElementType::F32:
+                            cpuValue = reduceOnCpu<float>(elementCount, operation, [&](uint32_t i) {
+                                float value;
+                                memcpy(&value, &words[i], sizeof(value));
+                                return value;
+                            });
+                            break;
+                        case ElementType::F16:
+                            cpuValue = reduceHalvesOnCpu(words.data(), elementCount, operation);
+                            break;
+                    }
+                    auto end = std::chrono::steady_clock::now();
+                    return getGigabytesPerSecond(size, std::chrono::duration<double>(end - start).count());
+                });
+                
+                // Float sums come out in a different order on each side, so they only have to agree to rounding.
+                bool isFloat = elementType == ElementType::F32 || elementType == ElementType::F16;
+                bool verified = gpuValue.bits == cpuValue.bits && gpuValue.index == cpuValue.index;
+                if (isFloat && operation == ReduceOperation::Sum)
+                {
+                    verified = std::abs(gpuValue.asF32() - cpuValue.asF32()) <= 1e-5 * magnitudeSum;
+                }
+                
+                gpuResult.verified = verified;
+                cpuResult.verified = verified;
+            }
+        }
+        
+        allocator.destroyBuffer(input);
+        allocator.destroyBuffer(staging);
+        
+        if (reduction.usesSubgroups())
+        {
+            std::cout << "Reductions use subgroup arithmetic, " << application.getSubgroupSize() << " wide." << std::endl;
+        }
+    } catch (const std::exception& error)
+    {
+        for (VulkanBenchmarkResult& result : reductionResults)
+        {
+            result.samples.clear();
+            result.skipReason = error.what();
+        }
+    }
+    
+    results.insert(results.end(), reductionResults.begin(), reductionResults.end());
+}
+
+// MARK: - Reporting
+
+static std::string formatSize(VkDeviceSize size)
+{
+    const char* units[] = { "B", "KiB", "MiB", "GiB" };
+    
+    size_t unit = 0;
+    while (unit + 1 < std::size(units) && size >= 1024 && size % 1024 == 0)
+    {
+        size /= 1024;
+        ++unit;
+    }
+    
+    return std::to_string(size) + " " + units[unit];
+}
+
+static std::string escapeJson(const std::string& string)
+{
+    std::string escaped;
+    for (char c : string)
+    {
+        if (c == '"' || c == '\\')
+        {
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+    return escaped;
+}
+
+static const char* getDeviceTypeName(VkPhysicalDeviceType deviceType)
+{
+    switch (deviceType)
+    {
+        case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return "integrated";
+        case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: return "discrete";
+        case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: return "virtual";
+        case VK_PHYSICAL_DEVICE_TYPE_CPU: return "cpu";
+        default: return "other";
+    }
+}
+
+void VulkanBenchmark::printSummary(const std::vector<VulkanBenchmarkResult>& results) const
+{
+    std::cout << physicalDeviceProperties.deviceName << " (" << getDeviceTypeName(physicalDeviceProperties.deviceType) << "), "
+              << (profiler ? "GPU timestamps" : "host timers") << std::endl << std::endl;
+    
+    std::cout << std::left << std::setw(24) << "benchmark" << std::setw(10) << "size"
+              << std::right << std::setw(12) << "median" << std::setw(12) << "min" << std::setw(12) << "p99"
+              << std::setw(12) << "stddev" << "  unit" << std::endl;
+    
+    std::cout << std::fixed << std::setprecision(3);
+    
+    for (const auto& result : results)
+    {
+        std::cout << std::left << std::setw(24) << result.name << std::setw(10) << (result.size > 0 ? formatSize(result.size) : "-");
+        
+        if (!result.skipReason.empty())
+        {
+            std::cout << "  skipped: " << result.skipReason << std::endl;
+            continue;
+        }
+        
+        auto statistics = result.getStatistics();
+        
+        std::cout << std::right << std::setw(12) << statistics.median << std::setw(12) << statistics.min
+                  << std::setw(12) << statistics.p99 << std::setw(12) << statistics.standardDeviation
+                  << "  " << result.unit << (result.verified ? "" : "  VERIFICATION FAILED") << std::endl;
+    }
+    
+    std::cout.unsetf(std::ios::floatfield);
+}
+
+bool VulkanBenchmark::writeJson(const std::string& filePath, const std::vector<VulkanBenchmarkResult>& results) const
+{
+    const auto& properties = physicalDeviceProperties;
+    
+    std::ostringstream json;
+    json << std::setprecision(9);
+    
+    json << "{\n";
+    json << "  \"schema_version\": 1,\n";
+
+#ifdef DEBUG
+    json << "  \"build\": { \"configuration\": \"Debug\", ";
+#else
+    json << "  \"build\": { \"configuration\": \"Release\", ";
+#endif
+    json << "\"compiler\": \"" << escapeJson(__VERSION__) << "\" },\n";
+    
+    json << "  \"device\": { "
+         << "\"name\": \"" << escapeJson(properties.deviceName) << "\", "
+         << "\"type\": \"" << getDeviceTypeName(properties.deviceType) << "\", "
+         << "\"vendor_id\": " << properties.vendorID << ", "
+         << "\"device_id\": " << properties.deviceID << ", "
+         << "\"driver_version\": " << properties.driverVersion << ", "
+         << "\"api_version\": \"" << VK_VERSION_MAJOR(properties.apiVersion) << "." << VK_VERSION_MINOR(properties.apiVersion) << "." << VK_VERSION_PATCH(properties.apiVersion) << "\", "
+         << "\"gpu_timestamps\": " << (profiler ? "true" : "false") << " },\n";
+    
+    json << "  \"settings\": { "
+         << "\"warmup_count\": " << configuration.warmupCount << ", "
+         << "\"repetition_count\": " << configuration.repetitionCount << ", "
+         << "\"minimum_size\": " << configuration.minimumSize << ", "
+         << "\"maximum_size\": " << configuration.maximumSize << " },\n";
+    
+    json << "  \"results\": [\n";
+    
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const auto& result = results[i];
+        
+        json << "    { \"name\": \"" << result.name << "\", \"size\": " << result.size << ", \"unit\": \"" << result.unit << "\", ";
+        
+        if (!result.skipReason.empty())
+        {
+            json << "\"skipped\": \"" << escapeJson(result.skipReason) << "\" }";
+        } else
+        {
+            auto statistics = result.getStatistics();
+            
+            json << "\"verified\": " << (result.verified ? "true" : "false") << ", "
+                 << "\"min\": " << statistics.min << ", "
+                 << "\"median\": " << statistics.median << ", "
+                 << "\"mean\": " << statistics.mean << ", "
+                 << "\"p99\": " << statistics.p99 << ", "
+                 << "\"stddev\": " << statistics.standardDeviation << ", "
+                 << "\"samples\": [";
+            
+            for (size_t j = 0; j < result.samples.size(); ++j)
+            {
+                json << (j > 0 ? ", " : "") << result.samples[j];
+            }
+            
+            json << "] }";
+        }
+        
+        json << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    
+    json << "  ]\n}\n";
+    
+    std::string contents = json.str();
+    return FileUtils::writeFileAtomically(filePath, std::vector<char>(contents.begin(), contents.end()));
+}
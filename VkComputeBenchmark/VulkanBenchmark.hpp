@@ -0,0 +1,150 @@
+//
+//  VulkanBenchmark.hpp
+//  VkComputeBenchmark
+//
+//  Created by James Perlman on 10/29/21.
+//
+
+#ifndef VulkanBenchmark_hpp
+#define VulkanBenchmark_hpp
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "VulkanMemoryAllocator.hpp"
+#include "VulkanProfiler.hpp"
+
+struct VulkanBenchmarkConfiguration
+{
+    // Buffer sizes are swept in powers of two from minimumSize up to and including maximumSize.
+    VkDeviceSize minimumSize = 4ull * 1024;
+    VkDeviceSize maximumSize = 1024ull * 1024 * 1024;
+    
+    // Every measurement is run warmupCount times and thrown away, then repetitionCount times and kept.
+    uint32_t warmupCount = 3;
+    uint32_t repetitionCount = 20;
+    
+    // Empty for the best device, or a device index or UUID. Passed through to VulkanComputeApplication too.
+    std::string device;
+    
+    // Also time round trips through VulkanComputeApplication at every size of the sweep.
+    bool includeApplication = true;
+    
+    // Also time GPU reductions of this many bytes of every element type against the same reductions on the CPU.
+    bool includeReductions = true;
+    VkDeviceSize reductionSize = 64ull * 1024 * 1024;
+};
+
+struct VulkanBenchmarkStatistics
+{
+    double  min = 0.0;
+    double  median = 0.0;
+    double  mean = 0.0;
+    double  p99 = 0.0;
+    double  standardDeviation = 0.0;
+};
+
+struct VulkanBenchmarkResult
+{
+    std::string             name;
+    std::string             unit;
+    
+    // Zero for measurements that don't depend on a buffer size.
+    VkDeviceSize            size = 0;
+    
+    std::vector<double>     samples;
+    
+    // Set when the measurement couldn't run on this device, e.g. because the buffer is over a device limit.
+    std::string             skipReason;
+    
+    // False if the data that came back didn't match what went in.
+    bool                    verified = true;
+    
+    VulkanBenchmarkStatistics getStatistics() const;
+};
+
+// Measures copy bandwidth, readback and map cost across a sweep of buffer sizes, plus the fixed cost of a submit
+// and of an empty dispatch. GPU-side times come from timestamp queries when the queue supports them, and from
+// host timers around the submission otherwise. Inputs are seeded, so runs are repeatable.
+class VulkanBenchmark {
+public:
+    VulkanBenchmark(const VulkanBenchmarkConfiguration& configuration = VulkanBenchmarkConfiguration());
+    ~VulkanBenchmark();
+    
+    VulkanBenchmark(const VulkanBenchmark&) = delete;
+    VulkanBenchmark& operator=(const VulkanBenchmark&) = delete;
+    
+    std::vector<VulkanBenchmarkResult> run();
+    
+    void printSummary(const std::vector<VulkanBenchmarkResult>& results) const;
+    
+    // Includes the device, driver and build, so files from different machines and builds can be told apart.
+    bool writeJson(const std::string& filePath, const std::vector<VulkanBenchmarkResult>& results) const;
+
+private:
+    
+    static constexpr uint32_t instanceApiVersion = VK_API_VERSION_1_0;
+    static constexpr uint32_t copyWorkgroupSize = 256;
+    static constexpr uint32_t queryCount = 2;
+    
+    VulkanBenchmarkConfiguration    configuration;
+    VkInstance                      instance;
+    VkPhysicalDevice                physicalDevice = VK_NULL_HANDLE;
+    VkPhysicalDeviceProperties      physicalDeviceProperties;
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    uint32_t                        queueFamilyIndex;
+    uint32_t                        timestampValidBits;
+    VkDevice                        logicalDevice;
+    VkQueue                         queue;
+    std::unique_ptr<VulkanMemoryAllocator> memoryAllocator;
+    std::unique_ptr<VulkanProfiler> profiler;
+    VkShaderModule                  shaderModule;
+    VkDescriptorSetLayout           descriptorSetLayout;
+    VkPipelineLayout                pipelineLayout;
+    uint32_t                        workgroupWidth;
+    VkPipeline                      pipeline;
+    VkDescriptorPool                descriptorPool;
+    VkDescriptorSet                 descriptorSet;
+    VkCommandPool                   commandPool;
+    VkCommandBuffer                 commandBuffer;
+    VkFence                         fence;
+    
+    // Instance methods
+    void createVulkanInstance();
+    void destroyVulkanInstance();
+    
+    void assignPhysicalDevice();
+    
+    void createLogicalDevice();
+    void destroyLogicalDevice();
+    
+    void createPipeline();
+    void destroyPipeline();
+    
+    void createCommandResources();
+    void destroyCommandResources();
+    
+    void bindBuffers(const VulkanBuffer& input, const VulkanBuffer& output);
+    void recordCopyDispatch(VkCommandBuffer commandBuffer, VkDeviceSize size) const;
+    
+    void submitAndWait(VkCommandBuffer commandBuffer);
+    
+    // Records the commands between a pair of timestamps, runs them, and returns how long they took in seconds.
+    template <typename Record>
+    double timeCommands(Record record);
+    
+    // Runs the measurement warmupCount times, then records repetitionCount samples.
+    template <typename Measure>
+    void sample(VulkanBenchmarkResult& result, Measure measure) const;
+    
+    void measureDispatchOverhead(std::vector<VulkanBenchmarkResult>& results);
+    void measureSize(VkDeviceSize size, std::vector<VulkanBenchmarkResult>& results);
+    void measureMap(VkDeviceSize size, std::vector<VulkanBenchmarkResult>& results);
+    void measureApplication(VkDeviceSize size, std::vector<VulkanBenchmarkResult>& results);
+    void measureReductions(std::vector<VulkanBenchmarkResult>& results);
+
+};
+
+#endif /* VulkanBenchmark_hpp */
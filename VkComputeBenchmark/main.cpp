@@ -0,0 +1,117 @@
+//
+//  main.cpp
+//  VkComputeBenchmark
+//
+//  Created by James Perlman on 10/29/21.
+//
+
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "VulkanBenchmark.hpp"
+
+// Accepts plain byte counts, or a K, M or G suffix for binary multiples.
+static VkDeviceSize parseSize(const std::string& text)
+{
+    size_t length = 0;
+    VkDeviceSize size = std::stoull(text, &length);
+    
+    switch (length < text.size() ? text[length] : '\0')
+    {
+        case 'G': case 'g': size *= 1024; [[fallthrough]];
+        case 'M': case 'm': size *= 1024; [[fallthrough]];
+        case 'K': case 'k': size *= 1024;
+        default: break;
+    }
+    
+    return size;
+}
+
+static void printUsage()
+{
+    std::cout << "usage: VkComputeBenchmark [options]\n"
+              << "  --min-size <bytes>     smallest buffer size, e.g. 4K (default 4K)\n"
+              << "  --max-size <bytes>     largest buffer size, e.g. 1G (default 1G)\n"
+              << "  --warmup <count>       runs discarded before sampling (default 3)\n"
+              << "  --repetitions <count>  samples kept per measurement (default 20)\n"
+              << "  --device <index|uuid>  physical device (default: the best one)\n"
+              << "  --output <path>        JSON results file (default vkcompute_benchmark.json)\n"
+              << "  --no-application       skip the VulkanComputeApplication round trips\n"
+              << "  --reduction-size <bytes> input size for the reductions, e.g. 64M (default 64M)\n"
+              << "  --no-reductions        skip the GPU and CPU reductions" << std::endl;
+}
+
+int main(int argc, const char * argv[]) {
+    VulkanBenchmarkConfiguration configuration;
+    std::string outputPath = "vkcompute_benchmark.json";
+    
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string argument = argv[i];
+        bool hasValue = i + 1 < argc;
+        
+        if (argument == "--min-size" && hasValue)
+        {
+            configuration.minimumSize = parseSize(argv[++i]);
+        } else if (argument == "--max-size" && hasValue)
+        {
+            configuration.maximumSize = parseSize(argv[++i]);
+        } else if (argument == "--warmup" && hasValue)
+        {
+            configuration.warmupCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else if (argument == "--repetitions" && hasValue)
+        {
+            configuration.repetitionCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else if (argument == "--device" && hasValue)
+        {
+            configuration.device = argv[++i];
+        } else if (argument == "--output" && hasValue)
+        {
+            outputPath = argv[++i];
+        } else if (argument == "--no-application")
+        {
+            configuration.includeApplication = false;
+        } else if (argument == "--reduction-size" && hasValue)
+        {
+            configuration.reductionSize = parseSize(argv[++i]);
+        } else if (argument == "--no-reductions")
+        {
+            configuration.includeReductions = false;
+        } else
+        {
+            printUsage();
+            return argument == "--help" ? 0 : 1;
+        }
+    }
+    
+    // Sizes are swept in powers of two, and the copy kernel moves 16 bytes at a time.
+    if (configuration.minimumSize < 16 || (configuration.minimumSize & (configuration.minimumSize - 1)) != 0)
+    {
+        std::cerr << "The minimum size must be a power of two of at least 16 bytes." << std::endl;
+        return 1;
+    }
+    
+    try
+    {
+        VulkanBenchmark benchmark(configuration);
+        
+        auto results = benchmark.run();
+        
+        benchmark.printSummary(results);
+        
+        if (!benchmark.writeJson(outputPath, results))
+        {
+            std::cerr << "Failed to write " << outputPath << std::endl;
+            return 1;
+        }
+        
+        std::cout << std::endl << "Wrote " << outputPath << std::endl;
+    } catch (const std::exception& error)
+    {
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+    
+    return 0;
+}
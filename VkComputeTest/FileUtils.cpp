@@ -5,6 +5,9 @@
 //  Created by James Perlman on 10/23/21.
 //
 
+#include <atomic>
+#include <cstdlib>
+
 #include "FileUtils.hpp"
 
 std::vector<char> FileUtils::readLocalFile(const std::string& filename)
@@ -21,7 +24,7 @@ std::vector<char> FileUtils::readLocalFile(const std::string& filename)
     }
     
     size_t fileSize = (size_t)file.tellg();
-
+    
     std::vector<char> buffer(fileSize);
     
     file.seekg(0);
@@ -30,3 +33,88 @@ std::vector<char> FileUtils::readLocalFile(const std::string& filename)
     
     return buffer;
 }
+
+std::optional<std::vector<char>> FileUtils::readFileIfPresent(const std::string& filePath)
+{
+    std::ifstream file(filePath, std::ios::ate | std::ios::binary);
+    
+    if (!file.is_open())
+    {
+        return std::nullopt;
+    }
+    
+    size_t fileSize = (size_t)file.tellg();
+    
+    std::vector<char> buffer(fileSize);
+    
+    file.seekg(0);
+    file.read(buffer.data(), fileSize);
+    
+    if (!file)
+    {
+        return std::nullopt;
+    }
+    
+    return buffer;
+}
+
+bool FileUtils::writeFileAtomically(const std::string& filePath, const std::vector<char>& data)
+{
+    // The process ID tells processes apart, and the counter tells apart the threads and writes of this one.
+    static std::atomic<uint64_t> writeCount = 0;
+    std::string temporaryPath = filePath + ".tmp." + std::to_string(getpid()) + "." + std::to_string(writeCount++);
+    
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        
+        if (!file.is_open())
+        {
+            return false;
+        }
+        
+        file.write(data.data(), data.size());
+        file.flush();
+        
+        if (!file)
+        {
+            file.close();
+            unlink(temporaryPath.c_str());
+            return false;
+        }
+    }
+    
+    // rename() replaces the destination atomically, so the last writer wins and nobody reads a torn file.
+    if (rename(temporaryPath.c_str(), filePath.c_str()) != 0)
+    {
+        unlink(temporaryPath.c_str());
+        return false;
+    }
+    
+    return true;
+}
+
+std::string FileUtils::getCacheDirectory()
+{
+    const char* cacheDirectory = getenv("VKCOMPUTE_CACHE_DIR");
+    if (cacheDirectory != nullptr && cacheDirectory[0] != '\0')
+    {
+        return cacheDirectory;
+    }
+    
+    // getcwd() fails if the working directory was removed, and caches are never worth failing over.
+    char* cwd = getcwd(NULL, 0);
+    if (cwd == nullptr)
+    {
+        return ".";
+    }
+    
+    std::string directory(cwd);
+    free(cwd);
+    return directory;
+}
+
+std::mutex& FileUtils::getCacheMutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
@@ -9,7 +9,10 @@
 #define FileUtils_hpp
 
 #include <fstream>
+#include <mutex>
+#include <optional>
 #include <stdio.h>
+#include <string>
 #include <unistd.h>
 #include <vector>
 
@@ -18,6 +21,21 @@ namespace FileUtils
 
 std::vector<char> readLocalFile(const std::string& filename);
 
+// Returns std::nullopt if the file doesn't exist or can't be read.
+std::optional<std::vector<char>> readFileIfPresent(const std::string& filePath);
+
+// Writes to a temporary file next to filePath and renames it into place, so readers never see a partial file.
+// Every call gets its own temporary file, so concurrent writers in any thread or process can't clobber each other.
+// Returns false if the file couldn't be written.
+bool writeFileAtomically(const std::string& filePath, const std::vector<char>& data);
+
+// The directory caches are written to. Set VKCOMPUTE_CACHE_DIR to override the current working directory.
+std::string getCacheDirectory();
+
+// Hold while loading, merging and saving a cache file. Applications in one process, such as one per shard on their own
+// threads, share cache files, and would otherwise lose each other's updates between reading a file and replacing it.
+std::mutex& getCacheMutex();
+    
 }
 
 #endif /* FileUtils_hpp */
@@ -0,0 +1,320 @@
+//
+//  VulkanCommandSubmitter.cpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/31/21.
+//
+
+#include <chrono>
+
+#include "VulkanCommandSubmitter.hpp"
+#include "VulkanDebugUtils.hpp"
+
+static std::atomic<uint64_t> nextSubmitterId = 1;
+
+thread_local std::unordered_map<uint64_t, VulkanCommandSubmitter::ThreadPool*> VulkanCommandSubmitter::threadPoolLookup;
+
+static VkCommandPool createCommandPool(VkDevice logicalDevice, uint32_t queueFamilyIndex)
+{
+    VkCommandPoolCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    createInfo.pNext = nullptr;
+    createInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    createInfo.queueFamilyIndex = queueFamilyIndex;
+    
+    VkCommandPool commandPool;
+    VK_ASSERT_SUCCESS(vkCreateCommandPool(logicalDevice, &createInfo, nullptr, &commandPool),
+                      "Failed to create command pool!");
+    
+    return commandPool;
+}
+
+// MARK: - Constructor
+
+VulkanCommandSubmitter::VulkanCommandSubmitter(VkDevice logicalDevice, VulkanQueueScheduler& queueScheduler, uint32_t maxBatchSize)
+: logicalDevice(logicalDevice)
+, queueScheduler(queueScheduler)
+, maxBatchSize(maxBatchSize)
+, id(nextSubmitterId.fetch_add(1))
+{
+    if (maxBatchSize == 0)
+    {
+        throw std::runtime_error("A batch must hold at least one command buffer!");
+    }
+    
+    batchCommandPool = createCommandPool(logicalDevice, queueScheduler.getQueueFamilyIndex());
+    
+    submitterThread = std::thread(&VulkanCommandSubmitter::runSubmitter, this);
+}
+
+// MARK: - Destructor
+
+VulkanCommandSubmitter::~VulkanCommandSubmitter()
+{
+    isStopping.store(true, std::memory_order_release);
+    workSignal.fetch_add(1, std::memory_order_release);
+    workSignal.notify_one();
+    
+    submitterThread.join();
+    
+    for (const Batch& batch : batches)
+    {
+        batch.submission.wait();
+    }
+    
+    // Destroying a pool frees every command buffer that came from it.
+    vkDestroyCommandPool(logicalDevice, batchCommandPool, nullptr);
+    
+    for (auto& threadPool : threadPools)
+    {
+        vkDestroyCommandPool(logicalDevice, threadPool->commandPool, nullptr);
+    }
+}
+
+// MARK: - Recording
+
+VulkanCommandSubmitter::ThreadPool& VulkanCommandSubmitter::getThreadPool()
+{
+    auto it = threadPoolLookup.find(id);
+    if (it != threadPoolLookup.end())
+    {
+        return *it->second;
+    }
+    
+    auto threadPool = std::make_unique<ThreadPool>();
+    threadPool->commandPool = createCommandPool(logicalDevice, queueScheduler.getQueueFamilyIndex());
+    
+    ThreadPool& result = *threadPool;
+    {
+        std::lock_guard<std::mutex> lock(threadPoolsMutex);
+        threadPools.push_back(std::move(threadPool));
+    }
+    
+    threadPoolLookup[id] = &result;
+    return result;
+}
+
+// Secondaries are recycled once the GPU is done with the batch they went out in. The oldest are checked first, and
+// the search stops at the first one still in use, so this stays cheap however many are pending.
+VkCommandBuffer VulkanCommandSubmitter::acquireSecondary(ThreadPool& threadPool)
+{
+    while (!threadPool.pendingCommandBuffers.empty())
+    {
+        auto& [commandBuffer, future] = threadPool.pendingCommandBuffers.front();
+        
+        if (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            break;
+        }
+        
+        // Work whose batch failed to submit never reached the GPU, so its command buffer is free too.
+        bool isFinished = true;
+        try
+        {
+            isFinished = future.get().poll();
+        } catch (...)
+        {
+        }
+        
+        if (!isFinished)
+        {
+            break;
+        }
+        
+        threadPool.freeCommandBuffers.push_back(commandBuffer);
+        threadPool.pendingCommandBuffers.pop_front();
+    }
+    
+    if (!threadPool.freeCommandBuffers.empty())
+    {
+        VkCommandBuffer commandBuffer = threadPool.freeCommandBuffers.back();
+        threadPool.freeCommandBuffers.pop_back();
+        return commandBuffer;
+    }
+    
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.pNext = nullptr;
+    allocInfo.commandPool = threadPool.commandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+    allocInfo.commandBufferCount = 1;
+    
+    VkCommandBuffer commandBuffer;
+    VK_ASSERT_SUCCESS(vkAllocateCommandBuffers(logicalDevice, &allocInfo, &commandBuffer),
+                      "Failed to allocate secondary command buffer!");
+    
+    return commandBuffer;
+}
+
+std::shared_future<VulkanSubmission> VulkanCommandSubmitter::enqueue(const Record& record)
+{
+    ThreadPool& threadPool = getThreadPool();
+    VkCommandBuffer commandBuffer = acquireSecondary(threadPool);
+    
+    // Compute work runs outside of any render pass, so there is nothing to inherit.
+    VkCommandBufferInheritanceInfo inheritanceInfo{};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritanceInfo.pNext = nullptr;
+    inheritanceInfo.renderPass = VK_NULL_HANDLE;
+    inheritanceInfo.subpass = 0;
+    inheritanceInfo.framebuffer = VK_NULL_HANDLE;
+    inheritanceInfo.occlusionQueryEnable = VK_FALSE;
+    inheritanceInfo.queryFlags = 0;
+    inheritanceInfo.pipelineStatistics = 0;
+    
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.pNext = nullptr;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    beginInfo.pInheritanceInfo = &inheritanceInfo;
+    
+    VK_ASSERT_SUCCESS(vkBeginCommandBuffer(commandBuffer, &beginInfo),
+                      "Failed to begin secondary command buffer!");
+    
+    try
+    {
+        record(commandBuffer);
+    } catch (...)
+    {
+        vkResetCommandBuffer(commandBuffer, 0);
+        threadPool.freeCommandBuffers.push_back(commandBuffer);
+        throw;
+    }
+    
+    VK_ASSERT_SUCCESS(vkEndCommandBuffer(commandBuffer),
+                      "Failed to end secondary command buffer!");
+    
+    Work work;
+    work.commandBuffer = commandBuffer;
+    
+    auto future = work.promise.get_future().share();
+    threadPool.pendingCommandBuffers.emplace_back(commandBuffer, future);
+    
+    workQueue.push(std::move(work));
+    
+    workSignal.fetch_add(1, std::memory_order_release);
+    workSignal.notify_one();
+    
+    return future;
+}
+
+// MARK: - Submitter Thread
+
+void VulkanCommandSubmitter::runSubmitter()
+{
+    std::vector<Work> batch;
+    
+    while (true)
+    {
+        // Read before draining, so a push that lands after the drain still changes it and wakes the wait below.
+        uint64_t signal = workSignal.load(std::memory_order_acquire);
+        
+        Work work;
+        while (batch.size() < maxBatchSize && workQueue.tryPop(work))
+        {
+            batch.push_back(std::move(work));
+        }
+        
+        if (!batch.empty())
+        {
+            submitBatch(batch);
+            batch.clear();
+            continue;
+        }
+        
+        if (isStopping.load(std::memory_order_acquire))
+        {
+            return;
+        }
+        
+        workSignal.wait(signal, std::memory_order_acquire);
+    }
+}
+
+// Primaries are reused in submission order once their batch has finished.
+VkCommandBuffer VulkanCommandSubmitter::acquirePrimary()
+{
+    if (!batches.empty() && batches.front().submission.poll())
+    {
+        VkCommandBuffer commandBuffer = batches.front().commandBuffer;
+        batches.pop_front();
+        return commandBuffer;
+    }
+    
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.pNext = nullptr;
+    allocInfo.commandPool = batchCommandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+    
+    VkCommandBuffer commandBuffer;
+    VK_ASSERT_SUCCESS(vkAllocateCommandBuffers(logicalDevice, &allocInfo, &commandBuffer),
+                      "Failed to allocate batch command buffer!");
+    
+    return commandBuffer;
+}
+
+void VulkanCommandSubmitter::submitBatch(std::vector<Work>& batch)
+{
+    VkCommandBuffer primaryCommandBuffer = VK_NULL_HANDLE;
+    
+    try
+    {
+        primaryCommandBuffer = acquirePrimary();
+        
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.pNext = nullptr;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        beginInfo.pInheritanceInfo = nullptr;
+        
+        VK_ASSERT_SUCCESS(vkBeginCommandBuffer(primaryCommandBuffer, &beginInfo),
+                          "Failed to begin batch command buffer!");
+        
+        std::vector<VkCommandBuffer> secondaryCommandBuffers;
+        for (const Work& work : batch)
+        {
+            secondaryCommandBuffers.push_back(work.commandBuffer);
+        }
+        
+        vkCmdExecuteCommands(primaryCommandBuffer, static_cast<uint32_t>(secondaryCommandBuffers.size()), secondaryCommandBuffers.data());
+        
+        VK_ASSERT_SUCCESS(vkEndCommandBuffer(primaryCommandBuffer),
+                          "Failed to end batch command buffer!");
+        
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.pNext = nullptr;
+        submitInfo.waitSemaphoreCount = 0;
+        submitInfo.pWaitSemaphores = nullptr;
+        submitInfo.pWaitDstStageMask = nullptr;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &primaryCommandBuffer;
+        submitInfo.signalSemaphoreCount = 0;
+        submitInfo.pSignalSemaphores = nullptr;
+        
+        // Batches are independent of each other, so each one goes wherever the scheduler has room.
+        uint32_t queueIndex = queueScheduler.acquireQueue();
+        VulkanSubmission submission = queueScheduler.submit(queueIndex, 1, &submitInfo);
+        
+        batches.push_back({ primaryCommandBuffer, submission });
+        
+        for (Work& work : batch)
+        {
+            work.promise.set_value(submission);
+        }
+    } catch (...)
+    {
+        // An empty submission counts as finished, so the primary is simply reused.
+        if (primaryCommandBuffer != VK_NULL_HANDLE)
+        {
+            batches.push_back({ primaryCommandBuffer, VulkanSubmission() });
+        }
+        
+        for (Work& work : batch)
+        {
+            work.promise.set_exception(std::current_exception());
+        }
+    }
+}
@@ -0,0 +1,108 @@
+//
+//  VulkanCommandSubmitter.hpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/31/21.
+//
+
+#ifndef VulkanCommandSubmitter_hpp
+#define VulkanCommandSubmitter_hpp
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "VulkanMpscQueue.hpp"
+#include "VulkanQueueScheduler.hpp"
+
+// Lets any number of threads record GPU work at once. Each thread records into secondary command buffers from its
+// own command pool, found through a thread-local lookup, so recording never takes a lock. Finished secondaries go
+// onto a lock-free queue that a single submitter thread drains. It executes a whole batch of them from one primary
+// command buffer, and hands that to the queue scheduler in one vkQueueSubmit.
+//
+// Work from different enqueue() calls is unordered, both within a batch and across batches, which may land on
+// different queues. Anything that depends on other work has to wait for that work's submission first.
+class VulkanCommandSubmitter {
+public:
+    using Record = std::function<void(VkCommandBuffer commandBuffer)>;
+    
+    VulkanCommandSubmitter(VkDevice logicalDevice, VulkanQueueScheduler& queueScheduler, uint32_t maxBatchSize = 64);
+    
+    // Submits whatever has been enqueued, waits for all of it, then destroys every thread's pool.
+    ~VulkanCommandSubmitter();
+    
+    VulkanCommandSubmitter(const VulkanCommandSubmitter&) = delete;
+    VulkanCommandSubmitter& operator=(const VulkanCommandSubmitter&) = delete;
+    
+    // Records a secondary command buffer on the calling thread, and queues it for submission. Safe to call from any
+    // thread. The future is ready once the batch the work went out in has been submitted, and the submission it
+    // holds says when the GPU is done. Errors from recording are thrown here, errors from submitting are in the future.
+    std::shared_future<VulkanSubmission> enqueue(const Record& record);
+
+private:
+    
+    struct Work
+    {
+        VkCommandBuffer                     commandBuffer = VK_NULL_HANDLE;
+        std::promise<VulkanSubmission>      promise;
+    };
+    
+    // One per recording thread. Only that thread touches it while the submitter is alive.
+    struct ThreadPool
+    {
+        VkCommandPool                       commandPool;
+        std::vector<VkCommandBuffer>        freeCommandBuffers;
+        
+        // Secondaries that have been enqueued, in order, with the submission each one went out in.
+        std::deque<std::pair<VkCommandBuffer, std::shared_future<VulkanSubmission>>> pendingCommandBuffers;
+    };
+    
+    struct Batch
+    {
+        VkCommandBuffer                     commandBuffer;
+        VulkanSubmission                    submission;
+    };
+    
+    VkDevice                                logicalDevice;
+    VulkanQueueScheduler&                   queueScheduler;
+    uint32_t                                maxBatchSize;
+    
+    // Tells this submitter's entries in the thread-local lookup apart from those of earlier submitters.
+    uint64_t                                id;
+    
+    // Every thread's pools, keyed by submitter id. Ids are never reused, so entries a destroyed submitter left behind
+    // are never looked up again.
+    static thread_local std::unordered_map<uint64_t, ThreadPool*> threadPoolLookup;
+    
+    std::mutex                              threadPoolsMutex;
+    std::vector<std::unique_ptr<ThreadPool>> threadPools;
+    
+    VulkanMpscQueue<Work>                   workQueue;
+    
+    // Bumped after every push, and on shutdown, so the submitter thread can sleep on it.
+    std::atomic<uint64_t>                   workSignal = 0;
+    std::atomic<bool>                       isStopping = false;
+    
+    // Only the submitter thread uses these.
+    VkCommandPool                           batchCommandPool;
+    std::deque<Batch>                       batches;
+    
+    std::thread                             submitterThread;
+    
+    ThreadPool& getThreadPool();
+    VkCommandBuffer acquireSecondary(ThreadPool& threadPool);
+    
+    void runSubmitter();
+    VkCommandBuffer acquirePrimary();
+    void submitBatch(std::vector<Work>& batch);
+
+};
+
+#endif /* VulkanCommandSubmitter_hpp */
@@ -0,0 +1,120 @@
+//
+//  VulkanCompaction.cpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/31/21.
+//
+
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+
+#include "VulkanCompaction.hpp"
+
+// MARK: - Filters
+
+VulkanCompactionFilter VulkanCompactionFilter::compare(VulkanKernels::CompareOperation operation, uint32_t threshold)
+{
+    return { operation, VulkanKernels::ElementType::U32, threshold };
+}
+
+VulkanCompactionFilter VulkanCompactionFilter::compare(VulkanKernels::CompareOperation operation, int32_t threshold)
+{
+    return { operation, VulkanKernels::ElementType::I32, std::bit_cast<uint32_t>(threshold) };
+}
+
+VulkanCompactionFilter VulkanCompactionFilter::compare(VulkanKernels::CompareOperation operation, float threshold)
+{
+    return { operation, VulkanKernels::ElementType::F32, std::bit_cast<uint32_t>(threshold) };
+}
+
+// MARK: - Constructor
+
+VulkanCompaction::VulkanCompaction(VulkanComputeGraph& graph, const VkPhysicalDeviceLimits& limits)
+: graph(graph)
+{
+    VulkanWorkgroupSize localSize = { VulkanKernels::getPowerOfTwoLocalSize(limits, preferredLocalSize), 1, 1 };
+    
+    compactKernel = graph.addKernel(VulkanKernels::getKernel("compact"), localSize);
+    argumentsKernel = graph.addKernel(VulkanKernels::getKernel("compact_arguments"));
+    
+    groupWidth = localSize.x;
+    maxGroupCount = limits.maxComputeWorkGroupCount[0];
+}
+
+// MARK: - Recording
+
+void VulkanCompaction::record(const VulkanGraphBinding& input, const VulkanGraphBinding& output, const std::optional<VulkanGraphBinding>& indices,
+                              VkBuffer counter, uint32_t elementCount, const VulkanCompactionFilter& filter, uint32_t nextGroupWidth)
+{
+    recordCompaction(input, output, indices, counter, VK_NULL_HANDLE, elementCount, filter, nextGroupWidth);
+}
+
+void VulkanCompaction::recordIndirect(const VulkanGraphBinding& input, const VulkanGraphBinding& output, const std::optional<VulkanGraphBinding>& indices,
+                                      VkBuffer counter, VkBuffer inputCounter, uint32_t elementCount, const VulkanCompactionFilter& filter,
+                                      uint32_t nextGroupWidth)
+{
+    if (inputCounter == VK_NULL_HANDLE)
+    {
+        throw std::runtime_error("Indirect compaction needs the counter of the compaction before it!");
+    }
+    
+    recordCompaction(input, output, indices, counter, inputCounter, elementCount, filter, nextGroupWidth);
+}
+
+void VulkanCompaction::recordCompaction(const VulkanGraphBinding& input, const VulkanGraphBinding& output, const std::optional<VulkanGraphBinding>& indices,
+                                        VkBuffer counter, VkBuffer inputCounter, uint32_t elementCount, const VulkanCompactionFilter& filter,
+                                        uint32_t nextGroupWidth)
+{
+    if (filter.elementType == VulkanKernels::ElementType::F16)
+    {
+        throw std::runtime_error("Compaction doesn't support f16 elements!");
+    }
+    
+    if (inputCounter == counter)
+    {
+        throw std::runtime_error("A compaction can't count into the counter it reads!");
+    }
+    
+    const bool isIndirect = inputCounter != VK_NULL_HANDLE;
+    
+    // Resets the count, and the arguments too, so nothing stale is left if the compaction never runs.
+    graph.fillBuffer(counter, 0, sizeof(VulkanKernels::CompactionCounter), 0);
+    
+    VulkanKernels::CompactParameters parameters;
+    parameters.elementCount = elementCount;
+    parameters.operation = filter.operation;
+    parameters.elementType = filter.elementType;
+    parameters.threshold = filter.threshold;
+    parameters.hasIndices = indices ? 1 : 0;
+    parameters.hasInputCounter = isIndirect ? 1 : 0;
+    
+    // Unused bindings still need a buffer. The output stands in for the indices and the counter for the input
+    // counter, and the kernel leaves both alone.
+    const VulkanGraphBinding bindings[] = {
+        input.withAccess(VulkanAccess::Read),
+        output.withAccess(VulkanAccess::Write),
+        indices ? indices->withAccess(VulkanAccess::Write) : output.withAccess(VulkanAccess::Write),
+        { counter, VulkanAccess::ReadWrite },
+        { isIndirect ? inputCounter : counter, isIndirect ? VulkanAccess::Read : VulkanAccess::ReadWrite },
+    };
+    
+    if (isIndirect)
+    {
+        graph.dispatchIndirect(compactKernel, bindings, inputCounter, argumentsOffset, parameters);
+    } else
+    {
+        // Workgroups stride over the input, so capping the group count only makes each one do more.
+        uint32_t groupCount = elementCount / groupWidth + (elementCount % groupWidth != 0 ? 1 : 0);
+        graph.dispatch(compactKernel, bindings, std::clamp(groupCount, 1u, maxGroupCount), 1, 1, parameters);
+    }
+    
+    VulkanKernels::CompactArgumentsParameters argumentsParameters;
+    argumentsParameters.groupWidth = nextGroupWidth != 0 ? nextGroupWidth : groupWidth;
+    argumentsParameters.maxGroupCount = maxGroupCount;
+    
+    const VulkanGraphBinding argumentsBindings[] = {
+        { counter, VulkanAccess::ReadWrite },
+    };
+    graph.dispatch(argumentsKernel, argumentsBindings, 1, 1, 1, argumentsParameters);
+}
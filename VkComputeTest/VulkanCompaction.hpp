@@ -0,0 +1,82 @@
+//
+//  VulkanCompaction.hpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/31/21.
+//
+
+#ifndef VulkanCompaction_hpp
+#define VulkanCompaction_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vulkan/vulkan.h>
+
+#include "VulkanComputeGraph.hpp"
+#include "VulkanKernels.hpp"
+
+// Which elements a compaction keeps: those where element <operation> threshold holds.
+struct VulkanCompactionFilter
+{
+    VulkanKernels::CompareOperation operation = VulkanKernels::CompareOperation::NotEqual;
+    VulkanKernels::ElementType elementType = VulkanKernels::ElementType::U32;
+    
+    // The bits of a value of elementType.
+    uint32_t threshold = 0;
+    
+    static VulkanCompactionFilter compare(VulkanKernels::CompareOperation operation, uint32_t threshold);
+    static VulkanCompactionFilter compare(VulkanKernels::CompareOperation operation, int32_t threshold);
+    static VulkanCompactionFilter compare(VulkanKernels::CompareOperation operation, float threshold);
+};
+
+// Stream compaction of 32-bit elements, recorded into a compute graph: the elements that pass a filter are packed at
+// the front of an output buffer, and counted into a VulkanKernels::CompactionCounter. Survivors come out in no
+// particular order.
+//
+// The counter is what keeps sparse results cheap. The host can read the count back and then only that many elements,
+// rather than the whole output, and the counter also holds the arguments of an indirect dispatch with one invocation
+// per survivor, so the next stage can be sized on the GPU with no host round trip. A counter buffer needs storage,
+// indirect and transfer destination usage, and transfer source usage to copy the count back.
+class VulkanCompaction {
+public:
+    // The graph must outlive the compaction.
+    VulkanCompaction(VulkanComputeGraph& graph, const VkPhysicalDeviceLimits& limits);
+    
+    VulkanCompaction(const VulkanCompaction&) = delete;
+    VulkanCompaction& operator=(const VulkanCompaction&) = delete;
+    
+    // Where the indirect dispatch arguments sit in a counter buffer.
+    static constexpr VkDeviceSize argumentsOffset = offsetof(VulkanKernels::CompactionCounter, arguments);
+    
+    // Appends a compaction of the first elementCount elements of input. output, and indices if given, need room for
+    // every element in the worst case. indices gets where each survivor was in the input. counter is reset first, and
+    // its dispatch arguments are for workgroups nextGroupWidth wide, or as wide as the compaction's own if that's 0.
+    void record(const VulkanGraphBinding& input, const VulkanGraphBinding& output, const std::optional<VulkanGraphBinding>& indices, VkBuffer counter,
+                uint32_t elementCount, const VulkanCompactionFilter& filter, uint32_t nextGroupWidth = 0);
+    
+    // The same, over the output of an earlier compaction whose counter is inputCounter. The compaction looks at as
+    // many elements as that one kept, up to elementCount, and is dispatched indirectly from its counter, which is
+    // sized right when it was recorded with the default group width.
+    void recordIndirect(const VulkanGraphBinding& input, const VulkanGraphBinding& output, const std::optional<VulkanGraphBinding>& indices, VkBuffer counter,
+                        VkBuffer inputCounter, uint32_t elementCount, const VulkanCompactionFilter& filter, uint32_t nextGroupWidth = 0);
+    
+    uint32_t getGroupWidth() const { return groupWidth; }
+
+private:
+    
+    static constexpr uint32_t preferredLocalSize = 256;
+    
+    VulkanComputeGraph&             graph;
+    VulkanComputeGraph::KernelId    compactKernel;
+    VulkanComputeGraph::KernelId    argumentsKernel;
+    uint32_t                        groupWidth;
+    uint32_t                        maxGroupCount;
+    
+    // inputCounter is VK_NULL_HANDLE for a direct dispatch.
+    void recordCompaction(const VulkanGraphBinding& input, const VulkanGraphBinding& output, const std::optional<VulkanGraphBinding>& indices, VkBuffer counter,
+                          VkBuffer inputCounter, uint32_t elementCount, const VulkanCompactionFilter& filter, uint32_t nextGroupWidth);
+
+};
+
+#endif /* VulkanCompaction_hpp */
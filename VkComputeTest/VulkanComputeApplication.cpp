@@ -5,45 +5,74 @@
 //  Created by James Perlman on 10/23/21.
 //
 
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
 #include <set>
 
 #include "VulkanComputeApplication.hpp"
 
 #include "FileUtils.hpp"
 #include "VulkanDebugUtils.hpp"
-
-#define VK_ASSERT_SUCCESS(result, message) if (result != VK_SUCCESS) { throw std::runtime_error(message); }
+#include "VulkanDeviceSelector.hpp"
+#include "VulkanKernels.hpp"
+#include "VulkanStartupProfile.hpp"
 
 // MARK: - Constructor
 
-VulkanComputeApplication::VulkanComputeApplication()
-{
-    createVulkanInstance();
-    createDebugMessenger();
-    assignPhysicalDevice();
-    createLogicalDevice();
-    createDeviceMemory();
-    createStorageBuffers();
-    createShaderModule();
-    createDescriptorSetLayout();
-    createPipelineLayout();
-    createPipeline();
-    createDescriptorPools();
-    createDescriptorSets();
-    createCommandPool();
-    createCommandBuffer();
-    recordCommandBuffer();
+VulkanComputeApplication::VulkanComputeApplication(const VulkanComputeConfiguration& configuration)
+: configuration(configuration)
+{
+    if (configuration.framesInFlight == 0)
+    {
+        throw std::runtime_error("At least one frame must be in flight!");
+    }
+    
+    // Element counts are pushed to the kernel as 32-bit values.
+    if (configuration.storageBufferSize == 0 || configuration.storageBufferSize % sizeof(uint32_t) != 0
+        || configuration.storageBufferSize / sizeof(uint32_t) > UINT32_MAX)
+    {
+        throw std::runtime_error("Storage buffer size must be a non-zero multiple of 4 bytes, holding at most 2^32 - 1 elements!");
+    }
+    
+    frames.resize(configuration.framesInFlight);
+    
+    STARTUP_STEP(createVulkanInstance());
+    STARTUP_STEP(createDebugMessenger());
+    STARTUP_STEP(assignPhysicalDevice());
+    STARTUP_STEP(createLogicalDevice());
+    STARTUP_STEP(createDeviceMemory());
+    STARTUP_STEP(createStorageBuffers());
+    STARTUP_STEP(createShaderModule());
+    STARTUP_STEP(createDescriptorSetLayout());
+    STARTUP_STEP(createPipelineLayout());
+    STARTUP_STEP(createPipelineCache());
+    STARTUP_STEP(createPipeline());
+    STARTUP_STEP(createDescriptorPools());
+    STARTUP_STEP(createDescriptorSets());
+    STARTUP_STEP(createProfiler());
+    STARTUP_STEP(createQueueScheduler());
+    STARTUP_STEP(createCommandBuffer());
+    STARTUP_STEP(tuneWorkgroupSize());
+    STARTUP_STEP(recordCommandBuffer());
+    STARTUP_STEP(createTransferResources());
+    STARTUP_STEP(createCommandSubmitter());
+    
+    STARTUP_REPORT();
 }
 
 // MARK: - Destructor
 
 VulkanComputeApplication::~VulkanComputeApplication()
 {
+    destroyCommandSubmitter();
+    destroyTransferResources();
     destroyCommandBuffer();
-    destroyCommandPool();
-    destroyDescriptorSets();
+    destroyQueueScheduler();
+    destroyProfiler();
     destroyDescriptorPools();
     destroyPipeline();
+    destroyPipelineCache();
     destroyPipelineLayout();
     destroyDescriptorSetLayout();
     destroyShaderModule();
@@ -56,13 +85,235 @@ VulkanComputeApplication::~VulkanComputeApplication()
 
 // MARK: - Run
 
-void VulkanComputeApplication::run()
+VulkanSubmission VulkanComputeApplication::submit(std::span<const uint32_t> input, uint32_t iterations)
+{
+    return submitFrame(input, iterations, std::nullopt);
+}
+
+VulkanSubmission VulkanComputeApplication::submit(std::span<const uint32_t> input, const VulkanDispatchArguments& arguments, uint32_t iterations)
+{
+    if (!configuration.indirectDispatch)
+    {
+        throw std::runtime_error("Dispatch arguments need indirect dispatch!");
+    }
+    
+    if (arguments.buffer == VK_NULL_HANDLE || arguments.offset % 4 != 0)
+    {
+        throw std::runtime_error("Dispatch arguments need a buffer and an offset that is a multiple of 4!");
+    }
+    
+    return submitFrame(input, iterations, arguments);
+}
+
+VulkanSubmission VulkanComputeApplication::submitFrame(std::span<const uint32_t> input, uint32_t iterations,
+                                                       const std::optional<VulkanDispatchArguments>& arguments)
+{
+    if (iterations == 0)
+    {
+        throw std::runtime_error("A run needs at least one iteration!");
+    }
+    
+    if (input.empty())
+    {
+        throw std::runtime_error("Input must not be empty!");
+    }
+    
+    auto submitStart = std::chrono::steady_clock::now();
+    
+    // Frames are used round robin, so this is the oldest submission. The other frames stay in flight.
+    Frame& frame = frames[frameIndex];
+    frameIndex = (frameIndex + 1) % frames.size();
+    
+    waitForFrame(frame);
+    releaseCompletedStaging();
+    
+    // The GPU is done with every set the frame has bound, so its descriptor pools can go back if they have grown.
+    frame.descriptorAllocator->recycle();
+    
+    frame.transferSerial = transferSerial + 1;
+    
+    auto uploadRegion = stageInput(frame, input.data(), input.size_bytes());
+    
+    // The frame's previous submission has finished, so its compute command buffers can be re-recorded. That happens
+    // when the job size, the dispatch arguments or the frame's descriptor set changed, or when the frame moves to
+    // another queue and needs buffers from that queue's pool.
+    auto parameters = makeParameters(static_cast<uint32_t>(input.size()));
+    uint32_t queueIndex = queueScheduler->acquireQueue(frame.queueIndex);
+    VkDescriptorSet descriptorSet = getDescriptorSet(frame);
+    
+    if (queueIndex != frame.queueIndex)
+    {
+        freeComputeCommandBuffers(frame);
+        frame.queueIndex = queueIndex;
+        allocateComputeCommandBuffers(frame);
+        
+        frame.parameters = parameters;
+        frame.descriptorSet = descriptorSet;
+        frame.dispatchArguments = arguments;
+        recordDispatchCommandBuffers(frame);
+        recordReleaseCommandBuffer(frame);
+        recordQueryResetCommandBuffer(frame);
+    } else if (parameters != frame.parameters || descriptorSet != frame.descriptorSet || arguments != frame.dispatchArguments)
+    {
+        frame.parameters = parameters;
+        frame.descriptorSet = descriptorSet;
+        frame.dispatchArguments = arguments;
+        recordDispatchCommandBuffers(frame);
+    }
+    
+    auto now = std::chrono::steady_clock::now();
+    if (!firstSubmitTime.has_value())
+    {
+        firstSubmitTime = now;
+    }
+    
+    frame.submitTime = now;
+    frame.isTimed = true;
+    frame.iterations = iterations;
+    frame.hasTimestamps = profiler != nullptr;
+    
+    if (hasTransferTimestamps())
+    {
+        submitQueryReset(frame);
+    }
+    
+    submitUpload(frame, uploadRegion);
+    submitComputeQueue(frame, iterations);
+    frame.submission = submitReadback(frame);
+    
+    transferSerial = frame.transferSerial;
+    
+    throughputReport.submissionCount += 1;
+    throughputReport.bytesUploaded += uploadRegion.size;
+    throughputReport.bytesReadBack += frame.readbackRegion.size;
+    
+    if (profiler)
+    {
+        profiler->addHostSpan("submit", submitStart, std::chrono::steady_clock::now());
+    }
+    
+    return frame.submission;
+}
+
+std::span<const uint32_t> VulkanComputeApplication::getOutput(const VulkanSubmission& submission)
+{
+    auto frame = std::find_if(frames.begin(), frames.end(), [&](const Frame& candidate) {
+        return candidate.submission.isValid() && candidate.submission.getSerial() == submission.getSerial();
+    });
+    
+    if (!submission.isValid() || frame == frames.end())
+    {
+        throw std::runtime_error("The submission's frame has already been reused!");
+    }
+    
+    waitForFrame(*frame);
+    
+    // Only the range this run wrote needs to be pulled into the CPU caches.
+    readbackRing->invalidate(frame->readbackRegion);
+    
+    return std::span<const uint32_t>(static_cast<const uint32_t*>(frame->readbackRegion.mappedData), frame->parameters.elementCount);
+}
+
+std::optional<size_t> VulkanComputeApplication::waitAny(std::span<const VulkanSubmission> submissions, uint64_t timeoutNanoseconds)
+{
+    auto stallStart = std::chrono::steady_clock::now();
+    auto index = submissionTracker->waitAny(submissions, timeoutNanoseconds);
+    auto stallEnd = std::chrono::steady_clock::now();
+    
+    throughputReport.stallSeconds += std::chrono::duration<double>(stallEnd - stallStart).count();
+    
+    if (profiler)
+    {
+        profiler->addHostSpan("wait", stallStart, stallEnd);
+    }
+    
+    return index;
+}
+
+std::span<const uint32_t> VulkanComputeApplication::run(std::span<const uint32_t> input, uint32_t iterations)
+{
+    return getOutput(submit(input, iterations));
+}
+
+std::span<const uint32_t> VulkanComputeApplication::run(std::span<const uint32_t> input, const VulkanDispatchArguments& arguments, uint32_t iterations)
+{
+    return getOutput(submit(input, arguments, iterations));
+}
+
+void VulkanComputeApplication::resetThroughputReport()
+{
+    throughputReport = VulkanThroughputReport();
+    firstSubmitTime.reset();
+    
+    for (Frame& frame : frames)
+    {
+        frame.isTimed = false;
+    }
+}
+
+// Latencies are measured by the host, so they include however long it took to notice a submission had finished.
+void VulkanComputeApplication::waitForFrame(Frame& frame)
+{
+    if (!frame.submission.poll())
+    {
+        auto stallStart = std::chrono::steady_clock::now();
+        frame.submission.wait();
+        auto stallEnd = std::chrono::steady_clock::now();
+        
+        throughputReport.stallSeconds += std::chrono::duration<double>(stallEnd - stallStart).count();
+        
+        if (profiler)
+        {
+            profiler->addHostSpan("wait", stallStart, stallEnd);
+        }
+    }
+    
+    if (frame.hasTimestamps)
+    {
+        collectTimestamps(frame);
+    }
+    
+    if (frame.isTimed)
+    {
+        auto now = std::chrono::steady_clock::now();
+        throughputReport.latencySeconds += std::chrono::duration<double>(now - frame.submitTime).count();
+        throughputReport.elapsedSeconds = std::chrono::duration<double>(now - *firstSubmitTime).count();
+        frame.isTimed = false;
+    }
+}
+
+// MARK: - Compute Graphs
+
+std::unique_ptr<VulkanComputeGraph> VulkanComputeApplication::createComputeGraph()
 {
-    submitComputeQueue();
+    return std::make_unique<VulkanComputeGraph>(logicalDevice, *memoryAllocator, *queueScheduler, *layoutCache, pipelineCache->getHandle());
 }
 
 // MARK: - Vulkan Instance
 
+// Vulkan 1.1 when the loader has it, for subgroup operations. A 1.0 loader has no vkEnumerateInstanceVersion, and may
+// reject any other version.
+uint32_t VulkanComputeApplication::getInstanceApiVersion()
+{
+    auto enumerateInstanceVersion = reinterpret_cast<PFN_vkEnumerateInstanceVersion>(vkGetInstanceProcAddr(nullptr, "vkEnumerateInstanceVersion"));
+    
+    uint32_t apiVersion = VK_API_VERSION_1_0;
+    if (enumerateInstanceVersion == nullptr || enumerateInstanceVersion(&apiVersion) != VK_SUCCESS)
+    {
+        return VK_API_VERSION_1_0;
+    }
+    
+    return std::min(apiVersion, static_cast<uint32_t>(VK_API_VERSION_1_1));
+}
+
+bool VulkanComputeApplication::supportsSubgroupArithmetic() const
+{
+    const VkSubgroupFeatureFlags requiredOperations = VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_ARITHMETIC_BIT;
+    
+    return (subgroupProperties.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) &&
+           (subgroupProperties.supportedOperations & requiredOperations) == requiredOperations;
+}
+
 const std::vector<const char*> baseInstanceExtensions = {
     VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME,
 };
@@ -81,9 +332,15 @@ std::vector<const char*> getRequiredInstanceExtensionNames()
 
 void VulkanComputeApplication::createVulkanInstance()
 {
-    if (VulkanDebugUtils::isValidationEnabled() && !VulkanDebugUtils::isValidationSupported())
+    if (VulkanDebugUtils::isValidationEnabled())
     {
-        throw std::runtime_error("Validation layers requested, but not available!");
+        // The first call into the loader, so this includes scanning the layer manifests.
+        STARTUP_SCOPE("enumerate instance layers");
+        
+        if (!VulkanDebugUtils::isValidationSupported())
+        {
+            throw std::runtime_error("Validation layers requested, but not available!");
+        }
     }
     
     VkApplicationInfo appInfo{};
@@ -92,7 +349,7 @@ void VulkanComputeApplication::createVulkanInstance()
     appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
     appInfo.pEngineName = "No Engine";
     appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-    appInfo.apiVersion = VK_API_VERSION_1_0;
+    appInfo.apiVersion = getInstanceApiVersion();
     
     auto requiredExtensionNames = getRequiredInstanceExtensionNames();
     
@@ -115,9 +372,13 @@ void VulkanComputeApplication::createVulkanInstance()
         createInfo.enabledLayerCount = 0;
     }
     
-    // Create the instance!
-    VK_ASSERT_SUCCESS(vkCreateInstance(&createInfo, nullptr, &instance),
-                      "failed to create Vulkan instance!");
+    // Create the instance! This is where the loader opens the layer and driver libraries.
+    {
+        STARTUP_SCOPE("vkCreateInstance");
+        
+        VK_ASSERT_SUCCESS(vkCreateInstance(&createInfo, nullptr, &instance),
+                          "failed to create Vulkan instance!");
+    }
 }
 
 void VulkanComputeApplication::destroyVulkanInstance()
@@ -151,10 +412,55 @@ void VulkanComputeApplication::destroyDebugMessenger()
 
 // MARK: - Physical Device
 
+uint32_t VulkanComputeApplication::getPhysicalDeviceCount()
+{
+    // Enumerating devices needs an instance, but no extensions or layers.
+    VkInstanceCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    createInfo.pNext = nullptr;
+    
+    VkInstance instance;
+    VK_ASSERT_SUCCESS(vkCreateInstance(&createInfo, nullptr, &instance),
+                      "failed to create Vulkan instance!");
+    
+    uint32_t physicalDeviceCount = 0;
+    vkEnumeratePhysicalDevices(instance, &physicalDeviceCount, nullptr);
+    
+    vkDestroyInstance(instance, nullptr);
+    
+    return physicalDeviceCount;
+}
+
+// Enabled when the device has them. VK_KHR_portability_subset must be enabled on MoltenVK, but most other drivers
+// don't expose it, and asking for an extension the device lacks fails vkCreateDevice.
 const std::vector<const char*> deviceExtensions = {
     "VK_KHR_portability_subset",
 };
 
+std::vector<const char*> getEnabledDeviceExtensions(VkPhysicalDevice device)
+{
+    uint32_t extensionPropertiesCount;
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionPropertiesCount, nullptr);
+    
+    std::vector<VkExtensionProperties> deviceExtensionProperties(extensionPropertiesCount);
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionPropertiesCount, deviceExtensionProperties.data());
+    
+    std::vector<const char*> enabledExtensions;
+    for (const char* extensionName : deviceExtensions)
+    {
+        for (const auto& extension : deviceExtensionProperties)
+        {
+            if (strcmp(extension.extensionName, extensionName) == 0)
+            {
+                enabledExtensions.push_back(extensionName);
+                break;
+            }
+        }
+    }
+    
+    return enabledExtensions;
+}
+
 const std::vector<const char*> requiredDeviceExtensions = {
     // No special extensions for compute
 };
@@ -200,84 +506,143 @@ std::optional<uint32_t> getComputeQueueFamilyIndex(VkPhysicalDevice physicalDevi
         {
             return i;
         }
+    }
+    
+    return std::nullopt;
+}
+
+// Prefers a transfer-only queue family (a dedicated DMA engine), then a compute-only family, then anything that can copy.
+std::optional<uint32_t> getTransferQueueFamilyIndex(VkPhysicalDevice physicalDevice)
+{
+    uint32_t queueFamilyPropertiesCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyPropertiesCount, nullptr);
+    
+    std::vector<VkQueueFamilyProperties> queueFamilyProperties(queueFamilyPropertiesCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyPropertiesCount, queueFamilyProperties.data());
+    
+    for (uint32_t i = 0; i < queueFamilyPropertiesCount; ++i)
+    {
+        // Mask out the sparse binding bit, we don't care about it.
+        const VkQueueFlags maskedFlags = ~VK_QUEUE_SPARSE_BINDING_BIT & queueFamilyProperties[i].queueFlags;
+        
+        if (!((VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT) & maskedFlags) && (VK_QUEUE_TRANSFER_BIT & maskedFlags))
+        {
+            return i;
+        }
+    }
+    
+    // Having compute on the queue implicitly enables transfer.
+    for (uint32_t i = 0; i < queueFamilyPropertiesCount; ++i)
+    {
+        const VkQueueFlags maskedFlags = ~VK_QUEUE_SPARSE_BINDING_BIT & queueFamilyProperties[i].queueFlags;
+        
+        if (!(VK_QUEUE_GRAPHICS_BIT & maskedFlags) && (VK_QUEUE_COMPUTE_BIT & maskedFlags))
+        {
+            return i;
+        }
+    }
+    
+    for (uint32_t i = 0; i < queueFamilyPropertiesCount; ++i)
+    {
+        const VkQueueFlags maskedFlags = ~VK_QUEUE_SPARSE_BINDING_BIT & queueFamilyProperties[i].queueFlags;
         
-        ++i;
+        if ((VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT) & maskedFlags)
+        {
+            return i;
+        }
     }
     
-    return NULL;
+    return std::nullopt;
 }
 
+// Whether the device can run the application at all. Picking the best of the suitable devices is VulkanDeviceSelector's job.
 bool isPhysicalDeviceSuitable(VkPhysicalDevice device)
 {
-    // TODO: Check for optimal device, not just the first one with the Compute capability.
-     VkPhysicalDeviceProperties properties;
-     vkGetPhysicalDeviceProperties(device, &properties);
-     
-     VkPhysicalDeviceFeatures features;
-     vkGetPhysicalDeviceFeatures(device, &features);
-  
     auto allRequiredExtensionsSupported = isPhysicalDeviceExtensionSupportAdequate(device);
     
     auto computeQueueFamilyIndex = getComputeQueueFamilyIndex(device);
     
-    return allRequiredExtensionsSupported && computeQueueFamilyIndex.has_value();
+    auto transferQueueFamilyIndex = getTransferQueueFamilyIndex(device);
+    
+    return allRequiredExtensionsSupported && computeQueueFamilyIndex.has_value() && transferQueueFamilyIndex.has_value();
 }
 
 void VulkanComputeApplication::assignPhysicalDevice()
 {
-    // Find out how many devices there are.
-    uint32_t physicalDeviceCount = 0;
-    vkEnumeratePhysicalDevices(instance, &physicalDeviceCount, nullptr);
+    VulkanDeviceSelector selector(instance, getInstanceApiVersion(), FileUtils::getCacheDirectory());
+    physicalDevice = selector.select(configuration.device, isPhysicalDeviceSuitable);
     
-    // No devices? Throw an error. :(
-    if (physicalDeviceCount == 0)
-    {
-        throw std::runtime_error("Failed to find any GPUs with Vulkan support!");
-    }
+    vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
     
-    // Fetch all of the physical devices
-    std::vector<VkPhysicalDevice> physicalDevices(physicalDeviceCount);
-    vkEnumeratePhysicalDevices(instance, &physicalDeviceCount, physicalDevices.data());
+    // Subgroup properties need Vulkan 1.1 from both the instance and the device. Left zeroed otherwise.
+    subgroupProperties = {};
+    subgroupProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+    subgroupProperties.pNext = nullptr;
     
-    for (const auto& device : physicalDevices)
+    if (getInstanceApiVersion() >= VK_API_VERSION_1_1 && physicalDeviceProperties.apiVersion >= VK_API_VERSION_1_1)
     {
+        auto getPhysicalDeviceProperties2 = reinterpret_cast<PFN_vkGetPhysicalDeviceProperties2>(vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceProperties2"));
         
-        // TODO: Find the most suitable device, not just the first
-        if (isPhysicalDeviceSuitable(device))
-        {
-            physicalDevice = device;
-            break;
-        }
+        VkPhysicalDeviceProperties2 properties2{};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties2.pNext = &subgroupProperties;
+        
+        getPhysicalDeviceProperties2(physicalDevice, &properties2);
     }
     
-    if (physicalDevice == VK_NULL_HANDLE)
+    computeQueueFamilyIndex = getComputeQueueFamilyIndex(physicalDevice).value();
+    transferQueueFamilyIndex = getTransferQueueFamilyIndex(physicalDevice).value();
+    
+    uint32_t queueFamilyPropertiesCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyPropertiesCount, nullptr);
+    
+    std::vector<VkQueueFamilyProperties> queueFamilyProperties(queueFamilyPropertiesCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyPropertiesCount, queueFamilyProperties.data());
+    
+    computeQueueCount = queueFamilyProperties[computeQueueFamilyIndex].queueCount;
+    
+    // A queue family with zero valid bits doesn't support timestamps, so its queries are skipped.
+    computeTimestampValidBits = queueFamilyProperties[computeQueueFamilyIndex].timestampValidBits;
+    transferTimestampValidBits = queueFamilyProperties[transferQueueFamilyIndex].timestampValidBits;
+    
+    if (configuration.maxComputeQueues > 0)
     {
-        throw std::runtime_error("Failed to find a suitable GPU!");
+        computeQueueCount = std::min(computeQueueCount, configuration.maxComputeQueues);
     }
-    computeQueueFamilyIndex = getComputeQueueFamilyIndex(physicalDevice).value();
 }
 
 // MARK: - Logical Device
 
 void VulkanComputeApplication::createLogicalDevice()
 {
-    float queuePriority = 1.0f;
+    // Every compute queue gets the same priority, so none of them is starved.
+    std::vector<float> queuePriorities(computeQueueCount, 1.0f);
+    
+    // The compute and transfer queues may come from the same family, in which case the transfer queue is the first
+    // compute queue.
+    std::set<uint32_t> queueFamilyIndices = { computeQueueFamilyIndex, transferQueueFamilyIndex };
     
-    VkDeviceQueueCreateInfo deviceQueueCreateInfo{};
-    deviceQueueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    deviceQueueCreateInfo.queueFamilyIndex = computeQueueFamilyIndex;
-    deviceQueueCreateInfo.queueCount = 1;
-    deviceQueueCreateInfo.pQueuePriorities = &queuePriority;
+    std::vector<VkDeviceQueueCreateInfo> deviceQueueCreateInfos;
+    for (auto queueFamilyIndex : queueFamilyIndices)
+    {
+        VkDeviceQueueCreateInfo deviceQueueCreateInfo{};
+        deviceQueueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        deviceQueueCreateInfo.queueFamilyIndex = queueFamilyIndex;
+        deviceQueueCreateInfo.queueCount = queueFamilyIndex == computeQueueFamilyIndex ? computeQueueCount : 1;
+        deviceQueueCreateInfo.pQueuePriorities = queuePriorities.data();
+        deviceQueueCreateInfos.emplace_back(deviceQueueCreateInfo);
+    }
     
     VkPhysicalDeviceFeatures deviceFeatures{};
     
     VkDeviceCreateInfo deviceCreateInfo{};
     deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    deviceCreateInfo.pQueueCreateInfos = &deviceQueueCreateInfo;
-    deviceCreateInfo.queueCreateInfoCount = 1;
+    deviceCreateInfo.pQueueCreateInfos = deviceQueueCreateInfos.data();
+    deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(deviceQueueCreateInfos.size());
     deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
-    deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-    deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
+    auto enabledExtensions = getEnabledDeviceExtensions(physicalDevice);
+    deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
+    deviceCreateInfo.ppEnabledExtensionNames = enabledExtensions.data();
     
     if (VulkanDebugUtils::isValidationEnabled())
     {
@@ -291,7 +656,8 @@ void VulkanComputeApplication::createLogicalDevice()
     VK_ASSERT_SUCCESS(vkCreateDevice(physicalDevice, &deviceCreateInfo, nullptr, &logicalDevice),
                       "Failed to create logical device!");
     
-    vkGetDeviceQueue(logicalDevice, computeQueueFamilyIndex, 0, &computeQueue);
+    // The compute queues are fetched by the queue scheduler.
+    vkGetDeviceQueue(logicalDevice, transferQueueFamilyIndex, 0, &transferQueue);
 }
 
 void VulkanComputeApplication::destroyLogicalDevice()
@@ -303,90 +669,72 @@ void VulkanComputeApplication::destroyLogicalDevice()
 
 void VulkanComputeApplication::createDeviceMemory()
 {
-    // TODO: Figure out how to do this dynamically and repeatably for different memory sizes.
-    VkDeviceSize memorySize = 2048;
-    
-    // Fetch device memory properties.
-    VkPhysicalDeviceMemoryProperties memoryProperties;
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
-    
-    uint32_t memoryTypeIndex = VK_MAX_MEMORY_TYPES;
-    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i)
-    {
-        auto memoryType = memoryProperties.memoryTypes[i];
-        
-        if (memoryType.propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
-            && memoryType.propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-            && memorySize <= memoryProperties.memoryHeaps[memoryType.heapIndex].size)
-        {
-            memoryTypeIndex = i;
-        }
-    }
-    
-    if (memoryTypeIndex == VK_MAX_MEMORY_TYPES)
-    {
-        throw std::runtime_error("Failed to find suitable memory!");
-    }
-    
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.pNext = nullptr;
-    allocInfo.allocationSize = memorySize;
-    allocInfo.memoryTypeIndex = memoryTypeIndex;
-    
-    VK_ASSERT_SUCCESS(vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &deviceMemory),
-                      "Failed to allocate device memory!");
+    memoryAllocator = std::make_unique<VulkanMemoryAllocator>(physicalDevice, logicalDevice);
 }
 
 void VulkanComputeApplication::destroyDeviceMemory()
 {
-    vkFreeMemory(logicalDevice, deviceMemory, nullptr);
+    memoryAllocator.reset();
 }
 
 // MARK: - Buffers
 
 void VulkanComputeApplication::createStorageBuffers()
 {
-    // TODO: change this
-    VkDeviceSize bufferSize = 1024;
-    
-    VkBufferCreateInfo createInfo{};
-    createInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    createInfo.pNext = nullptr;
-    createInfo.flags = 0;
-    createInfo.size = bufferSize;
-    createInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
-    createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    createInfo.queueFamilyIndexCount = 1;
-    createInfo.pQueueFamilyIndices = &computeQueueFamilyIndex;
-    
-    VK_ASSERT_SUCCESS(vkCreateBuffer(logicalDevice, &createInfo, nullptr, &inputBuffer),
-                      "Failed to create input buffer!");
-    
-    vkBindBufferMemory(logicalDevice, inputBuffer, deviceMemory, 0);
-    
-    VK_ASSERT_SUCCESS(vkCreateBuffer(logicalDevice, &createInfo, nullptr, &outputBuffer),
-                      "Failed to create input buffer!");
-    
-    vkBindBufferMemory(logicalDevice, outputBuffer, deviceMemory, bufferSize);
-    
-    
+    // Only the kernel touches these, data moves in and out through the staging ring on the transfer queue.
+    for (Frame& frame : frames)
+    {
+        frame.inputBuffer = memoryAllocator->createBuffer(configuration.storageBufferSize,
+                                                          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                                          VulkanMemoryUsage::GpuOnly);
+        
+        frame.outputBuffer = memoryAllocator->createBuffer(configuration.storageBufferSize,
+                                                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                                           VulkanMemoryUsage::GpuOnly);
+        
+        // Storage usage lets a kernel write the group counts for the next dispatch.
+        frame.indirectBuffer = memoryAllocator->createBuffer(sizeof(VkDispatchIndirectCommand),
+                                                             VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                                             VulkanMemoryUsage::GpuOnly);
+    }
 }
 
 void VulkanComputeApplication::destroyStorageBuffers()
 {
-    vkDestroyBuffer(logicalDevice, inputBuffer, nullptr);
-    vkDestroyBuffer(logicalDevice, outputBuffer, nullptr);
+    for (Frame& frame : frames)
+    {
+        memoryAllocator->destroyBuffer(frame.inputBuffer);
+        memoryAllocator->destroyBuffer(frame.outputBuffer);
+        memoryAllocator->destroyBuffer(frame.indirectBuffer);
+    }
 }
 
 // MARK: - Shader Modules
 void VulkanComputeApplication::createShaderModule()
 {
-    auto computeShaderCode = FileUtils::readLocalFile("shaders/simple.comp");
+    // The SPIR-V is embedded in the binary, so this never touches the disk.
+    const auto& kernel = VulkanKernels::getKernel("simple");
+    
+    // Everything the pipeline needs to know about the kernel's interface comes from the kernel itself.
+    shaderReflection = std::make_unique<VulkanShaderReflection>(kernel.code, kernel.entryPoint);
+    
+    if (shaderReflection->getPushConstantSize() != sizeof(VulkanKernels::SimpleParameters))
+    {
+        throw std::runtime_error("simple.comp's push constant block doesn't match SimpleParameters!");
+    }
+    
+    for (const auto& constantId : shaderReflection->getLocalSizeConstantIds())
+    {
+        if (!constantId.has_value())
+        {
+            throw std::runtime_error("simple.comp's local size must be set through specialization constants!");
+        }
+    }
+    
     VkShaderModuleCreateInfo createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    createInfo.codeSize = computeShaderCode.size();
-    createInfo.pCode = reinterpret_cast<const uint32_t*>(computeShaderCode.data());
+    createInfo.codeSize = kernel.code.size_bytes();
+    createInfo.pCode = kernel.code.data();
     
     VK_ASSERT_SUCCESS(vkCreateShaderModule(logicalDevice, &createInfo, nullptr, &shaderModule),
                       "Failed to create shader module!");
@@ -395,73 +743,67 @@ void VulkanComputeApplication::createShaderModule()
 void VulkanComputeApplication::destroyShaderModule()
 {
     vkDestroyShaderModule(logicalDevice, shaderModule, nullptr);
+    shaderReflection.reset();
 }
 
 // MARK: - Descriptor Set Layout
 void VulkanComputeApplication::createDescriptorSetLayout()
 {
-    VkDescriptorSetLayoutBinding inputLayoutBinding{};
-    inputLayoutBinding.binding = 0;
-    inputLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    inputLayoutBinding.descriptorCount = 1;
-    inputLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-    inputLayoutBinding.pImmutableSamplers = nullptr;
-    
-    VkDescriptorSetLayoutBinding outputLayoutBinding{};
-    outputLayoutBinding.binding = 1;
-    outputLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    outputLayoutBinding.descriptorCount = 1;
-    outputLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-    outputLayoutBinding.pImmutableSamplers = nullptr;
-    
-    VkDescriptorSetLayoutBinding descriptorSetLayoutBindings[2] = {
-        inputLayoutBinding,
-        outputLayoutBinding,
-    };
+    layoutCache = std::make_unique<VulkanLayoutCache>(logicalDevice);
     
-    VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo{};
-    descriptorSetLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    descriptorSetLayoutCreateInfo.pNext = nullptr;
-    descriptorSetLayoutCreateInfo.flags = 0;
-    descriptorSetLayoutCreateInfo.bindingCount = 2;
-    descriptorSetLayoutCreateInfo.pBindings = descriptorSetLayoutBindings;
-    
-    VK_ASSERT_SUCCESS(vkCreateDescriptorSetLayout(logicalDevice, &descriptorSetLayoutCreateInfo, nullptr, &descriptorSetLayout),
-                      "Failed to create descriptor set layout!");
+    descriptorSetLayout = layoutCache->getDescriptorSetLayout(*shaderReflection, 0);
 }
 
 void VulkanComputeApplication::destroyDescriptorSetLayout()
 {
-    vkDestroyDescriptorSetLayout(logicalDevice, descriptorSetLayout, nullptr);
+    // The cache owns every layout it handed out.
+    layoutCache.reset();
 }
 
 // MARK: - Pipeline Layout
 
 void VulkanComputeApplication::createPipelineLayout()
 {
-    // Create pipeline layout
-    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
-    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutCreateInfo.pNext = nullptr;
-    pipelineLayoutCreateInfo.flags = 0;
-    pipelineLayoutCreateInfo.setLayoutCount = 1;
-    pipelineLayoutCreateInfo.pSetLayouts = &descriptorSetLayout;
-    pipelineLayoutCreateInfo.pushConstantRangeCount = 0;
-    pipelineLayoutCreateInfo.pPushConstantRanges = nullptr;
-    
-    VK_ASSERT_SUCCESS(vkCreatePipelineLayout(logicalDevice, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout),
-                      "Failed to create pipeline layout!");
+    pipelineLayout = layoutCache->getPipelineLayout(*shaderReflection);
 }
 
 void VulkanComputeApplication::destroyPipelineLayout()
 {
-    vkDestroyPipelineLayout(logicalDevice, pipelineLayout, nullptr);
+    // Destroyed with the layout cache.
+    pipelineLayout = VK_NULL_HANDLE;
+}
+
+// MARK: - Pipeline Cache
+
+void VulkanComputeApplication::createPipelineCache()
+{
+    pipelineCache = std::make_unique<VulkanPipelineCache>(physicalDevice, logicalDevice, FileUtils::getCacheDirectory());
+}
+
+void VulkanComputeApplication::destroyPipelineCache()
+{
+    // Saves anything compiled since startup.
+    pipelineCache.reset();
 }
 
 // MARK: - Compute Pipeline
 
-void VulkanComputeApplication::createPipeline()
+VkPipeline VulkanComputeApplication::buildPipeline(const VulkanWorkgroupSize& size)
 {
+    // The shader reads its local size from the specialization constants reflection found behind it.
+    const auto& constantIds = shaderReflection->getLocalSizeConstantIds();
+    const VkSpecializationMapEntry specializationMapEntries[3] = {
+        { *constantIds[0], offsetof(VulkanWorkgroupSize, x), sizeof(uint32_t) },
+        { *constantIds[1], offsetof(VulkanWorkgroupSize, y), sizeof(uint32_t) },
+        { *constantIds[2], offsetof(VulkanWorkgroupSize, z), sizeof(uint32_t) },
+    };
+    
+    VkSpecializationInfo specializationInfo{};
+    specializationInfo.mapEntryCount = 3;
+    specializationInfo.pMapEntries = specializationMapEntries;
+    specializationInfo.dataSize = sizeof(VulkanWorkgroupSize);
+    specializationInfo.pData = &size;
+    
     // Create shader stage
     VkPipelineShaderStageCreateInfo pipelineShaderStageCreateInfo{};
     pipelineShaderStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -469,8 +811,8 @@ void VulkanComputeApplication::createPipeline()
     pipelineShaderStageCreateInfo.flags = 0;
     pipelineShaderStageCreateInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
     pipelineShaderStageCreateInfo.module = shaderModule;
-    pipelineShaderStageCreateInfo.pName = "main";
-    pipelineShaderStageCreateInfo.pSpecializationInfo = nullptr;
+    pipelineShaderStageCreateInfo.pName = VulkanKernels::getKernel("simple").entryPoint;
+    pipelineShaderStageCreateInfo.pSpecializationInfo = &specializationInfo;
     
     // Create pipeline
     VkComputePipelineCreateInfo pipelineCreateInfo{};
@@ -482,171 +824,811 @@ void VulkanComputeApplication::createPipeline()
     pipelineCreateInfo.basePipelineHandle = VK_NULL_HANDLE;
     pipelineCreateInfo.basePipelineIndex = 0;
     
-    VK_ASSERT_SUCCESS(vkCreateComputePipelines(logicalDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &pipeline),
+    VkPipeline newPipeline;
+    VK_ASSERT_SUCCESS(vkCreateComputePipelines(logicalDevice, pipelineCache->getHandle(), 1, &pipelineCreateInfo, nullptr, &newPipeline),
                       "Failed to create compute pipeline!");
+    
+    return newPipeline;
 }
 
-void VulkanComputeApplication::destroyPipeline()
+void VulkanComputeApplication::createPipeline()
+{
+    workgroupTuner = std::make_unique<VulkanWorkgroupTuner>(instance, getInstanceApiVersion(), physicalDevice, FileUtils::getCacheDirectory());
+    workgroupSize = workgroupTuner->lookup("simple", getProblemSize(static_cast<uint32_t>(getMaxElementCount()))).value_or(defaultWorkgroupSize);
+    
+    pipeline = buildPipeline(workgroupSize);
+    
+    // Save right away on a cold start, so the next process benefits even if this one never shuts down cleanly.
+    pipelineCache->save();
+}
+
+void VulkanComputeApplication::destroyPipeline()
 {
     vkDestroyPipeline(logicalDevice, pipeline, nullptr);
+    workgroupTuner.reset();
 }
 
-// MARK: - Descriptor Pools
-void VulkanComputeApplication::createDescriptorPools()
+// MARK: - Workgroup Size Tuning
+
+// The grid the simple kernel runs over for elementCount elements, as one invocation per element.
+VulkanWorkgroupSize VulkanComputeApplication::getProblemSize(uint32_t elementCount) const
+{
+    return VulkanWorkgroupSize{ (elementCount + rowStride - 1) / rowStride, rowStride, 1 };
+}
+
+// Runs once per kernel, device and size class. Later runs find the winner in the tuner's file and skip straight past this.
+void VulkanComputeApplication::tuneWorkgroupSize()
 {
-    VkDescriptorPoolSize poolSize{};
-    poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    poolSize.descriptorCount = 2;
+    // Tune for a full storage buffer, the size the application was configured to run.
+    const VulkanWorkgroupSize problemSize = getProblemSize(static_cast<uint32_t>(getMaxElementCount()));
     
-    VkDescriptorPoolCreateInfo createInfo{};
-    createInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    createInfo.pNext = nullptr;
-    createInfo.flags = 0;
-    createInfo.maxSets = 1;
-    createInfo.poolSizeCount = 1;
-    createInfo.pPoolSizes = &poolSize;
+    if (!configuration.tuneWorkgroupSize || workgroupTuner->lookup("simple", problemSize).has_value())
+    {
+        return;
+    }
+    
+    // Bursts are timed on the GPU itself when the compute queue can write timestamps.
+    std::unique_ptr<VulkanProfiler> timer;
+    if (computeTimestampValidBits > 0)
+    {
+        timer = std::make_unique<VulkanProfiler>(logicalDevice, physicalDeviceProperties, 2);
+    }
     
-    VK_ASSERT_SUCCESS(vkCreateDescriptorPool(logicalDevice, &createInfo, nullptr, &descriptorPool),
-                      "Failed to create descriptor pool!");
+    VulkanWorkgroupSize tunedSize = workgroupTuner->tune("simple", problemSize, [&](const VulkanWorkgroupSize& size) {
+        return measureWorkgroupSize(size, timer.get());
+    });
+    
+    vkDestroyPipeline(logicalDevice, pipeline, nullptr);
+    
+    workgroupSize = tunedSize;
+    pipeline = buildPipeline(workgroupSize);
+    
+    pipelineCache->save();
+}
+
+// Times bursts of dispatches with the candidate size on the first frame's buffers, and returns the median burst in
+// seconds. The buffer contents don't matter here. With a timer, only the GPU time between the first dispatch and the
+// last one counts, not the submission or the fence wait.
+double VulkanComputeApplication::measureWorkgroupSize(const VulkanWorkgroupSize& size, const VulkanProfiler* timer)
+{
+    VkPipeline candidatePipeline = buildPipeline(size);
+    
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.pNext = nullptr;
+    allocInfo.commandPool = queueScheduler->getCommandPool(0);
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+    
+    VkCommandBuffer tuningCommandBuffer;
+    VK_ASSERT_SUCCESS(vkAllocateCommandBuffers(logicalDevice, &allocInfo, &tuningCommandBuffer),
+                      "Failed to allocate tuning command buffer!");
+    
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.pNext = nullptr;
+    beginInfo.flags = 0;
+    beginInfo.pInheritanceInfo = nullptr;
+    
+    VK_ASSERT_SUCCESS(vkBeginCommandBuffer(tuningCommandBuffer, &beginInfo),
+                      "Failed to begin tuning command buffer!");
+    
+    // Every pass waits for the one before it, so the same two queries can be reset and written again each time.
+    if (timer)
+    {
+        timer->cmdResetQueries(tuningCommandBuffer, 0, 2);
+        timer->cmdWriteTimestamp(tuningCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0);
+    }
+    
+    vkCmdBindPipeline(tuningCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, candidatePipeline);
+    
+    vkCmdBindDescriptorSets(tuningCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &frames.front().descriptorSet, 0, nullptr);
+    
+    auto parameters = makeParameters(static_cast<uint32_t>(getMaxElementCount()));
+    
+    VkMemoryBarrier iterationBarrier{};
+    iterationBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    iterationBarrier.pNext = nullptr;
+    iterationBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    iterationBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    
+    for (uint32_t i = 0; i < tuningDispatchCount; ++i)
+    {
+        recordDirectDispatch(tuningCommandBuffer, parameters, size);
+        
+        vkCmdPipelineBarrier(tuningCommandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0, 1, &iterationBarrier, 0, nullptr, 0, nullptr);
+    }
+    
+    if (timer)
+    {
+        timer->cmdWriteTimestamp(tuningCommandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 1);
+    }
+    
+    VK_ASSERT_SUCCESS(vkEndCommandBuffer(tuningCommandBuffer),
+                      "Failed to end tuning command buffer!");
+    
+    VkFenceCreateInfo fenceCreateInfo{};
+    fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fenceCreateInfo.pNext = nullptr;
+    fenceCreateInfo.flags = 0;
+    
+    VkFence fence;
+    VK_ASSERT_SUCCESS(vkCreateFence(logicalDevice, &fenceCreateInfo, nullptr, &fence),
+                      "Failed to create tuning fence!");
+    
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = nullptr;
+    submitInfo.waitSemaphoreCount = 0;
+    submitInfo.pWaitSemaphores = nullptr;
+    submitInfo.pWaitDstStageMask = nullptr;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &tuningCommandBuffer;
+    submitInfo.signalSemaphoreCount = 0;
+    submitInfo.pSignalSemaphores = nullptr;
+    
+    // The first passes warm up caches and clocks, and aren't counted.
+    std::vector<double> passSeconds;
+    for (uint32_t pass = 0; pass < tuningWarmupPassCount + tuningPassCount; ++pass)
+    {
+        auto start = std::chrono::steady_clock::now();
+        
+        {
+            auto queueLock = queueScheduler->lockQueue(0);
+            
+            VK_ASSERT_SUCCESS(vkQueueSubmit(queueScheduler->getQueue(0), 1, &submitInfo, fence),
+                              "Failed to submit tuning command buffer!");
+        }
+        
+        VK_ASSERT_SUCCESS(vkWaitForFences(logicalDevice, 1, &fence, VK_TRUE, UINT64_MAX),
+                          "Failed to wait for tuning fence!");
+        
+        auto end = std::chrono::steady_clock::now();
+        
+        VK_ASSERT_SUCCESS(vkResetFences(logicalDevice, 1, &fence),
+                          "Failed to reset tuning fence!");
+        
+        if (pass < tuningWarmupPassCount)
+        {
+            continue;
+        }
+        
+        std::vector<std::optional<uint64_t>> timestamps;
+        if (timer)
+        {
+            timestamps = timer->readTimestamps(0, 2, computeTimestampValidBits);
+        }
+        
+        if (timer && timestamps[0] && timestamps[1] && *timestamps[1] >= *timestamps[0])
+        {
+            passSeconds.push_back((*timestamps[1] - *timestamps[0]) * 1e-9);
+        } else
+        {
+            passSeconds.push_back(std::chrono::duration<double>(end - start).count());
+        }
+    }
+    
+    vkDestroyFence(logicalDevice, fence, nullptr);
+    vkFreeCommandBuffers(logicalDevice, queueScheduler->getCommandPool(0), 1, &tuningCommandBuffer);
+    vkDestroyPipeline(logicalDevice, candidatePipeline, nullptr);
+    
+    // The median shrugs off the odd pass that was preempted or caught a clock change.
+    auto median = passSeconds.begin() + passSeconds.size() / 2;
+    std::nth_element(passSeconds.begin(), median, passSeconds.end());
+    return *median;
+}
+
+// MARK: - Descriptor Pools
+void VulkanComputeApplication::createDescriptorPools()
+{
+    // Each frame gets its own allocator, so its sets can be recycled as soon as that frame's submission is done.
+    for (Frame& frame : frames)
+    {
+        frame.descriptorAllocator = std::make_unique<VulkanDescriptorAllocator>(logicalDevice);
+    }
 }
 
 void VulkanComputeApplication::destroyDescriptorPools()
 {
-    vkDestroyDescriptorPool(logicalDevice, descriptorPool, nullptr);
+    for (Frame& frame : frames)
+    {
+        frame.descriptorAllocator.reset();
+    }
 }
 
 // MARK: - Descriptor Sets
 void VulkanComputeApplication::createDescriptorSets()
 {
-    VkDescriptorSetAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    allocInfo.pNext = nullptr;
-    allocInfo.descriptorPool = descriptorPool;
-    allocInfo.descriptorSetCount = 1;
-    allocInfo.pSetLayouts = &descriptorSetLayout;
-    
-    VK_ASSERT_SUCCESS(vkAllocateDescriptorSets(logicalDevice, &allocInfo, &descriptorSet),
-                      "Failed to allocate descriptor set!");
-    
-    // Now we need to update the descriptor sets with input/output buffer info
-    
-    // Input
-    
-    VkDescriptorBufferInfo inputBufferInfo{};
-    inputBufferInfo.buffer = inputBuffer;
-    inputBufferInfo.offset = 0;
-    inputBufferInfo.range = VK_WHOLE_SIZE;
-    
-    VkWriteDescriptorSet inputWriteDescriptorSet{};
-    inputWriteDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    inputWriteDescriptorSet.pNext = nullptr;
-    inputWriteDescriptorSet.dstSet = descriptorSet;
-    inputWriteDescriptorSet.dstBinding = 0;
-    inputWriteDescriptorSet.dstArrayElement = 0;
-    inputWriteDescriptorSet.descriptorCount = 1;
-    inputWriteDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    inputWriteDescriptorSet.pImageInfo = nullptr;
-    inputWriteDescriptorSet.pBufferInfo = &inputBufferInfo;
-    inputWriteDescriptorSet.pTexelBufferView = nullptr;
-    
-    // Output
-    
-    VkDescriptorBufferInfo outputBufferInfo{};
-    outputBufferInfo.buffer = outputBuffer;
-    outputBufferInfo.offset = 0;
-    outputBufferInfo.range = VK_WHOLE_SIZE;
-    
-    VkWriteDescriptorSet outputWriteDescriptorSet{};
-    outputWriteDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    outputWriteDescriptorSet.pNext = nullptr;
-    outputWriteDescriptorSet.dstSet = descriptorSet;
-    outputWriteDescriptorSet.dstBinding = 1;
-    outputWriteDescriptorSet.dstArrayElement = 0;
-    outputWriteDescriptorSet.descriptorCount = 1;
-    outputWriteDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    outputWriteDescriptorSet.pImageInfo = nullptr;
-    outputWriteDescriptorSet.pBufferInfo = &outputBufferInfo;
-    outputWriteDescriptorSet.pTexelBufferView = nullptr;
-    
-    VkWriteDescriptorSet writeDescriptorSets[2] = {
-        inputWriteDescriptorSet,
-        outputWriteDescriptorSet,
-    };
+    for (Frame& frame : frames)
+    {
+        frame.descriptorSet = getDescriptorSet(frame);
+    }
+}
+
+// The set for the frame's input and output buffers. After the first call this is a cache lookup, with no
+// vkUpdateDescriptorSets, until the frame's allocator is recycled.
+VkDescriptorSet VulkanComputeApplication::getDescriptorSet(Frame& frame)
+{
+    VkDescriptorBufferInfo bufferInfos[2]{};
     
-    vkUpdateDescriptorSets(logicalDevice, 2, writeDescriptorSets, 0, nullptr);
+    bufferInfos[0].buffer = frame.inputBuffer.buffer;
+    bufferInfos[0].offset = 0;
+    bufferInfos[0].range = VK_WHOLE_SIZE;
+    
+    bufferInfos[1].buffer = frame.outputBuffer.buffer;
+    bufferInfos[1].offset = 0;
+    bufferInfos[1].range = VK_WHOLE_SIZE;
+    
+    return frame.descriptorAllocator->getStorageBufferSet(descriptorSetLayout, bufferInfos);
 }
 
-void VulkanComputeApplication::destroyDescriptorSets()
+// MARK: - Profiler
+
+void VulkanComputeApplication::createProfiler()
 {
-    // It is invalid to call vkFreeDescriptorSets() with a pool created without setting VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT.
-    // vkFreeDescriptorSets(logicalDevice, descriptorPool, 1, &descriptorSet);
+    if (!configuration.profile)
+    {
+        return;
+    }
+    
+    profiler = std::make_unique<VulkanProfiler>(logicalDevice, physicalDeviceProperties, static_cast<uint32_t>(frames.size()) * FrameQueryCount);
+    
+    for (size_t i = 0; i < frames.size(); ++i)
+    {
+        frames[i].firstQuery = static_cast<uint32_t>(i) * FrameQueryCount;
+    }
 }
 
-// MARK: - Command Pool
+void VulkanComputeApplication::destroyProfiler()
+{
+    profiler.reset();
+}
 
-void VulkanComputeApplication::createCommandPool()
+void VulkanComputeApplication::cmdResetTimestamps(VkCommandBuffer commandBuffer, const Frame& frame, FrameQuery firstQuery, uint32_t queryCount) const
 {
-    VkCommandPoolCreateInfo createInfo{};
-    createInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    createInfo.pNext = nullptr;
-    createInfo.flags = 0;
-    createInfo.queueFamilyIndex = computeQueueFamilyIndex;
+    uint32_t validBits = firstQuery < ComputeBegin ? transferTimestampValidBits : computeTimestampValidBits;
+    if (profiler && validBits > 0)
+    {
+        profiler->cmdResetQueries(commandBuffer, frame.firstQuery + firstQuery, queryCount);
+    }
+}
+
+void VulkanComputeApplication::cmdWriteTimestamp(VkCommandBuffer commandBuffer, const Frame& frame, FrameQuery query, VkPipelineStageFlagBits stage) const
+{
+    uint32_t validBits = query < ComputeBegin ? transferTimestampValidBits : computeTimestampValidBits;
+    if (profiler && validBits > 0)
+    {
+        profiler->cmdWriteTimestamp(commandBuffer, stage, frame.firstQuery + query);
+    }
+}
+
+// Called once the frame's fence has signaled, so every query it wrote is ready.
+void VulkanComputeApplication::collectTimestamps(Frame& frame)
+{
+    frame.hasTimestamps = false;
     
-    VK_ASSERT_SUCCESS(vkCreateCommandPool(logicalDevice, &createInfo, nullptr, &commandPool),
-                      "Failed to create command pool!");
+    if (transferTimestampValidBits > 0)
+    {
+        auto timestamps = profiler->readTimestamps(frame.firstQuery + UploadBegin, ComputeBegin, transferTimestampValidBits);
+        
+        if (timestamps[UploadBegin] && timestamps[UploadEnd])
+        {
+            profiler->addGpuSpan("upload", "Transfer", *timestamps[UploadBegin], *timestamps[UploadEnd]);
+        }
+        
+        if (timestamps[ReadbackBegin] && timestamps[ReadbackEnd])
+        {
+            profiler->addGpuSpan("readback", "Transfer", *timestamps[ReadbackBegin], *timestamps[ReadbackEnd]);
+        }
+    }
+    
+    if (computeTimestampValidBits > 0)
+    {
+        auto timestamps = profiler->readTimestamps(frame.firstQuery + ComputeBegin, FrameQueryCount - ComputeBegin, computeTimestampValidBits);
+        auto timestamp = [&](FrameQuery query) { return timestamps[query - ComputeBegin]; };
+        
+        if (timestamp(ComputeBegin) && timestamp(DispatchBegin))
+        {
+            profiler->addGpuSpan("acquire barrier", "Compute", *timestamp(ComputeBegin), *timestamp(DispatchBegin));
+        }
+        
+        // Only the first iteration is timed on its own. The repeat command buffer is submitted many times at once,
+        // so it can't write its own queries. The rest of the batch is timed as a whole.
+        if (timestamp(DispatchBegin) && timestamp(DispatchEnd))
+        {
+            profiler->addGpuSpan("simple", "Compute", *timestamp(DispatchBegin), *timestamp(DispatchEnd));
+        }
+        
+        if (frame.iterations > 1 && timestamp(DispatchEnd) && timestamp(ComputeEnd))
+        {
+            profiler->addGpuSpan("simple x" + std::to_string(frame.iterations - 1), "Compute", *timestamp(DispatchEnd), *timestamp(ComputeEnd));
+        }
+    }
 }
 
-void VulkanComputeApplication::destroyCommandPool()
+// MARK: - Queue Scheduler
+
+void VulkanComputeApplication::createQueueScheduler()
 {
-    vkDestroyCommandPool(logicalDevice, commandPool, nullptr);
+    queueScheduler = std::make_unique<VulkanQueueScheduler>(logicalDevice, computeQueueFamilyIndex, computeQueueCount, configuration.queuePolicy);
+}
+
+void VulkanComputeApplication::destroyQueueScheduler()
+{
+    queueScheduler.reset();
+}
+
+void VulkanComputeApplication::createCommandSubmitter()
+{
+    if (!configuration.parallelRecording)
+    {
+        return;
+    }
+    
+    commandSubmitter = std::make_unique<VulkanCommandSubmitter>(logicalDevice, *queueScheduler);
+}
+
+void VulkanComputeApplication::destroyCommandSubmitter()
+{
+    // Waits for everything it submitted.
+    commandSubmitter.reset();
+}
+
+std::unique_lock<std::mutex> VulkanComputeApplication::lockTransferQueue()
+{
+    if (transferQueueFamilyIndex != computeQueueFamilyIndex)
+    {
+        return std::unique_lock<std::mutex>();
+    }
+    
+    return queueScheduler->lockQueue(0);
+}
+
+// MARK: - Queue Family Ownership
+
+// Acquires a buffer on the queue family that is about to use it.
+// When the families differ this is the second half of an ownership transfer, and must match a release on the other queue.
+void recordBufferAcquire(VkCommandBuffer commandBuffer,
+                         VkBuffer buffer,
+                         uint32_t srcQueueFamilyIndex,
+                         uint32_t dstQueueFamilyIndex,
+                         VkPipelineStageFlags srcStageMask,
+                         VkAccessFlags srcAccessMask,
+                         VkPipelineStageFlags dstStageMask,
+                         VkAccessFlags dstAccessMask)
+{
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.pNext = nullptr;
+    barrier.srcAccessMask = srcAccessMask;
+    barrier.dstAccessMask = dstAccessMask;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = buffer;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+    
+    if (srcQueueFamilyIndex != dstQueueFamilyIndex)
+    {
+        // The release on the other queue already made the writes available, and a semaphore orders the two.
+        barrier.srcAccessMask = 0;
+        barrier.srcQueueFamilyIndex = srcQueueFamilyIndex;
+        barrier.dstQueueFamilyIndex = dstQueueFamilyIndex;
+        srcStageMask = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    }
+    
+    vkCmdPipelineBarrier(commandBuffer, srcStageMask, dstStageMask, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+// Releases a buffer from the queue family that just wrote it. Nothing to do when both sides share a family.
+void recordBufferRelease(VkCommandBuffer commandBuffer,
+                         VkBuffer buffer,
+                         uint32_t srcQueueFamilyIndex,
+                         uint32_t dstQueueFamilyIndex,
+                         VkPipelineStageFlags srcStageMask,
+                         VkAccessFlags srcAccessMask)
+{
+    if (srcQueueFamilyIndex == dstQueueFamilyIndex)
+    {
+        return;
+    }
+    
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.pNext = nullptr;
+    barrier.srcAccessMask = srcAccessMask;
+    barrier.dstAccessMask = 0;
+    barrier.srcQueueFamilyIndex = srcQueueFamilyIndex;
+    barrier.dstQueueFamilyIndex = dstQueueFamilyIndex;
+    barrier.buffer = buffer;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+    
+    vkCmdPipelineBarrier(commandBuffer, srcStageMask, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
 }
 
 // MARK: - Command Buffer
 
+// Nothing is in flight yet, so the scheduler spreads the frames across the queues in turn.
 void VulkanComputeApplication::createCommandBuffer()
+{
+    for (Frame& frame : frames)
+    {
+        frame.queueIndex = queueScheduler->acquireQueue();
+        allocateComputeCommandBuffers(frame);
+    }
+}
+
+void VulkanComputeApplication::destroyCommandBuffer()
+{
+    for (Frame& frame : frames)
+    {
+        freeComputeCommandBuffers(frame);
+    }
+}
+
+void VulkanComputeApplication::allocateComputeCommandBuffers(Frame& frame)
 {
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     allocInfo.pNext = nullptr;
-    allocInfo.commandPool = commandPool;
+    allocInfo.commandPool = queueScheduler->getCommandPool(frame.queueIndex);
     allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
     allocInfo.commandBufferCount = 1;
     
-    VK_ASSERT_SUCCESS(vkAllocateCommandBuffers(logicalDevice, &allocInfo, &commandBuffer),
+    VK_ASSERT_SUCCESS(vkAllocateCommandBuffers(logicalDevice, &allocInfo, &frame.commandBuffer),
                       "Failed to allocate command buffer!");
+    
+    VK_ASSERT_SUCCESS(vkAllocateCommandBuffers(logicalDevice, &allocInfo, &frame.repeatCommandBuffer),
+                      "Failed to allocate repeat command buffer!");
+    
+    VK_ASSERT_SUCCESS(vkAllocateCommandBuffers(logicalDevice, &allocInfo, &frame.releaseCommandBuffer),
+                      "Failed to allocate release command buffer!");
+    
+    VK_ASSERT_SUCCESS(vkAllocateCommandBuffers(logicalDevice, &allocInfo, &frame.queryResetCommandBuffer),
+                      "Failed to allocate query reset command buffer!");
 }
 
-void VulkanComputeApplication::destroyCommandBuffer()
+void VulkanComputeApplication::freeComputeCommandBuffers(Frame& frame)
+{
+    VkCommandPool commandPool = queueScheduler->getCommandPool(frame.queueIndex);
+    
+    vkFreeCommandBuffers(logicalDevice, commandPool, 1, &frame.queryResetCommandBuffer);
+    vkFreeCommandBuffers(logicalDevice, commandPool, 1, &frame.releaseCommandBuffer);
+    vkFreeCommandBuffers(logicalDevice, commandPool, 1, &frame.repeatCommandBuffer);
+    vkFreeCommandBuffers(logicalDevice, commandPool, 1, &frame.commandBuffer);
+}
+
+VulkanKernels::SimpleParameters VulkanComputeApplication::makeParameters(uint32_t elementCount) const
+{
+    VulkanKernels::SimpleParameters parameters;
+    parameters.elementCount = elementCount;
+    parameters.rowStride = rowStride;
+    parameters.inputOffset = 0;
+    parameters.outputOffset = 0;
+    parameters.baseRow = 0;
+    return parameters;
+}
+
+VkDispatchIndirectCommand VulkanComputeApplication::getDispatchGroupCount(uint32_t elementCount) const
+{
+    return getGroupCount(makeParameters(elementCount), workgroupSize);
+}
+
+// One invocation per element, in rows of rowStride elements. Rows run along x, and the elements of a row along y.
+VkDispatchIndirectCommand VulkanComputeApplication::getGroupCount(const VulkanKernels::SimpleParameters& parameters, const VulkanWorkgroupSize& size) const
 {
-    vkFreeCommandBuffers(logicalDevice, commandPool, 1, &commandBuffer);
+    const uint32_t rowCount = (parameters.elementCount + parameters.rowStride - 1) / parameters.rowStride;
+    
+    VkDispatchIndirectCommand groupCount{};
+    groupCount.x = (rowCount + size.x - 1) / size.x;
+    groupCount.y = (parameters.rowStride + size.y - 1) / size.y;
+    groupCount.z = 1;
+    return groupCount;
+}
+
+void VulkanComputeApplication::recordDispatch(VkCommandBuffer commandBuffer, const Frame& frame)
+{
+    if (configuration.indirectDispatch)
+    {
+        VkBuffer buffer = frame.dispatchArguments ? frame.dispatchArguments->buffer : frame.indirectBuffer.buffer;
+        VkDeviceSize offset = frame.dispatchArguments ? frame.dispatchArguments->offset : 0;
+        
+        VulkanKernels::cmdPushParameters(commandBuffer, pipelineLayout, frame.parameters);
+        vkCmdDispatchIndirect(commandBuffer, buffer, offset);
+        return;
+    }
+    
+    recordDirectDispatch(commandBuffer, frame.parameters, workgroupSize);
+}
+
+// Grids wider than maxComputeWorkGroupCount[0] are split into several dispatches, each starting at a later row.
+void VulkanComputeApplication::recordDirectDispatch(VkCommandBuffer commandBuffer, const VulkanKernels::SimpleParameters& parameters,
+                                                    const VulkanWorkgroupSize& size) const
+{
+    const VkDispatchIndirectCommand groupCount = getGroupCount(parameters, size);
+    uint32_t maxGroupCountX = physicalDeviceProperties.limits.maxComputeWorkGroupCount[0];
+    if (configuration.maxGroupCountPerDispatch > 0)
+    {
+        maxGroupCountX = std::min(maxGroupCountX, configuration.maxGroupCountPerDispatch);
+    }
+    
+    if (groupCount.y > physicalDeviceProperties.limits.maxComputeWorkGroupCount[1])
+    {
+        throw std::runtime_error("Row stride needs more workgroups than the device allows!");
+    }
+    
+    VulkanKernels::SimpleParameters chunkParameters = parameters;
+    
+    for (uint32_t firstGroup = 0; firstGroup < groupCount.x; firstGroup += maxGroupCountX)
+    {
+        chunkParameters.baseRow = parameters.baseRow + firstGroup * size.x;
+        
+        VulkanKernels::cmdPushParameters(commandBuffer, pipelineLayout, chunkParameters);
+        vkCmdDispatch(commandBuffer, std::min(maxGroupCountX, groupCount.x - firstGroup), groupCount.y, groupCount.z);
+    }
 }
 
+// The command buffers are recorded once and resubmitted for every run:
+//  - commandBuffer acquires the input and runs the first iteration.
+//  - repeatCommandBuffer waits for the previous iteration and runs another one. It is submitted many times per batch.
+//  - releaseCommandBuffer hands the output over to the transfer queue.
+// The first two bake in the frame's parameters, and are re-recorded by submit() only when the job size changes.
 void VulkanComputeApplication::recordCommandBuffer()
+{
+    for (Frame& frame : frames)
+    {
+        frame.parameters = makeParameters(static_cast<uint32_t>(getMaxElementCount()));
+        recordDispatchCommandBuffers(frame);
+        recordReleaseCommandBuffer(frame);
+        recordQueryResetCommandBuffer(frame);
+    }
+}
+
+void VulkanComputeApplication::recordReleaseCommandBuffer(Frame& frame)
 {
     VkCommandBufferBeginInfo beginInfo{};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
     beginInfo.pNext = nullptr;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    beginInfo.flags = 0;
+    beginInfo.pInheritanceInfo = nullptr;
+    
+    VK_ASSERT_SUCCESS(vkBeginCommandBuffer(frame.releaseCommandBuffer, &beginInfo),
+                      "Failed to begin release command buffer!");
+    
+    recordBufferRelease(frame.releaseCommandBuffer, frame.outputBuffer.buffer, computeQueueFamilyIndex, transferQueueFamilyIndex,
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+    
+    cmdWriteTimestamp(frame.releaseCommandBuffer, frame, ComputeEnd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+    
+    VK_ASSERT_SUCCESS(vkEndCommandBuffer(frame.releaseCommandBuffer),
+                      "Failed to end release command buffer!");
+}
+
+// vkCmdResetQueryPool needs a graphics or compute queue, and the transfer queue is often neither. The upload and
+// readback queries are reset here instead, and the upload waits for it.
+void VulkanComputeApplication::recordQueryResetCommandBuffer(Frame& frame)
+{
+    if (!hasTransferTimestamps())
+    {
+        return;
+    }
+    
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.pNext = nullptr;
+    beginInfo.flags = 0;
     beginInfo.pInheritanceInfo = nullptr;
     
-    VK_ASSERT_SUCCESS(vkBeginCommandBuffer(commandBuffer, &beginInfo),
+    VK_ASSERT_SUCCESS(vkBeginCommandBuffer(frame.queryResetCommandBuffer, &beginInfo),
+                      "Failed to begin query reset command buffer!");
+    
+    cmdResetTimestamps(frame.queryResetCommandBuffer, frame, UploadBegin, ComputeBegin - UploadBegin);
+    
+    VK_ASSERT_SUCCESS(vkEndCommandBuffer(frame.queryResetCommandBuffer),
+                      "Failed to end query reset command buffer!");
+}
+
+void VulkanComputeApplication::recordDispatchCommandBuffers(Frame& frame)
+{
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.pNext = nullptr;
+    beginInfo.flags = 0;
+    beginInfo.pInheritanceInfo = nullptr;
+    
+    VK_ASSERT_SUCCESS(vkBeginCommandBuffer(frame.commandBuffer, &beginInfo),
                       "Failed to begin command buffer!");
     
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    // The release command buffer writes ComputeEnd, so all four compute queries are reset here.
+    cmdResetTimestamps(frame.commandBuffer, frame, ComputeBegin, FrameQueryCount - ComputeBegin);
+    cmdWriteTimestamp(frame.commandBuffer, frame, ComputeBegin, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
     
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+    recordBufferAcquire(frame.commandBuffer, frame.inputBuffer.buffer, transferQueueFamilyIndex, computeQueueFamilyIndex,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
     
-    vkCmdDispatch(commandBuffer, 32, 32, 1);
+    cmdWriteTimestamp(frame.commandBuffer, frame, DispatchBegin, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
     
-    VK_ASSERT_SUCCESS(vkEndCommandBuffer(commandBuffer),
+    vkCmdBindPipeline(frame.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    
+    vkCmdBindDescriptorSets(frame.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &frame.descriptorSet, 0, nullptr);
+    
+    if (configuration.indirectDispatch)
+    {
+        // Only the frame's own buffer is filled here. Arguments passed to submit() are left for the pass that wrote them.
+        if (!frame.dispatchArguments)
+        {
+            VkDispatchIndirectCommand groupCount = getGroupCount(frame.parameters, workgroupSize);
+            
+            vkCmdUpdateBuffer(frame.commandBuffer, frame.indirectBuffer.buffer, 0, sizeof(groupCount), &groupCount);
+        }
+        
+        // Make the arguments visible to the indirect read, whether a copy, a fill or a kernel wrote them.
+        VkMemoryBarrier indirectBarrier{};
+        indirectBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        indirectBarrier.pNext = nullptr;
+        indirectBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        indirectBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+        
+        vkCmdPipelineBarrier(frame.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                             0, 1, &indirectBarrier, 0, nullptr, 0, nullptr);
+    }
+    
+    recordDispatch(frame.commandBuffer, frame);
+    
+    cmdWriteTimestamp(frame.commandBuffer, frame, DispatchEnd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+    
+    VK_ASSERT_SUCCESS(vkEndCommandBuffer(frame.commandBuffer),
                       "Failed to end command buffer!");
+    
+    // The same repeat buffer appears many times in a single submission, so it must allow simultaneous use.
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+    
+    VK_ASSERT_SUCCESS(vkBeginCommandBuffer(frame.repeatCommandBuffer, &beginInfo),
+                      "Failed to begin repeat command buffer!");
+    
+    VkMemoryBarrier iterationBarrier{};
+    iterationBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    iterationBarrier.pNext = nullptr;
+    iterationBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    iterationBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    
+    vkCmdPipelineBarrier(frame.repeatCommandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &iterationBarrier, 0, nullptr, 0, nullptr);
+    
+    vkCmdBindPipeline(frame.repeatCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    
+    vkCmdBindDescriptorSets(frame.repeatCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &frame.descriptorSet, 0, nullptr);
+    
+    recordDispatch(frame.repeatCommandBuffer, frame);
+    
+    VK_ASSERT_SUCCESS(vkEndCommandBuffer(frame.repeatCommandBuffer),
+                      "Failed to end repeat command buffer!");
 }
 
-// MARK: Submit Compute Queue
+// MARK: - Transfer Resources
+
+void VulkanComputeApplication::createTransferResources()
+{
+    // Transfer command buffers are re-recorded for every run, since the copy sizes and staging offsets change.
+    VkCommandPoolCreateInfo commandPoolCreateInfo{};
+    commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    commandPoolCreateInfo.pNext = nullptr;
+    commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    commandPoolCreateInfo.queueFamilyIndex = transferQueueFamilyIndex;
+    
+    VK_ASSERT_SUCCESS(vkCreateCommandPool(logicalDevice, &commandPoolCreateInfo, nullptr, &transferCommandPool),
+                      "Failed to create transfer command pool!");
+    
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.pNext = nullptr;
+    allocInfo.commandPool = transferCommandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+    
+    VkSemaphoreCreateInfo semaphoreCreateInfo{};
+    semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreCreateInfo.pNext = nullptr;
+    semaphoreCreateInfo.flags = 0;
+    
+    for (Frame& frame : frames)
+    {
+        VK_ASSERT_SUCCESS(vkAllocateCommandBuffers(logicalDevice, &allocInfo, &frame.uploadCommandBuffer),
+                          "Failed to allocate upload command buffer!");
+        
+        VK_ASSERT_SUCCESS(vkAllocateCommandBuffers(logicalDevice, &allocInfo, &frame.readbackCommandBuffer),
+                          "Failed to allocate readback command buffer!");
+        
+        VK_ASSERT_SUCCESS(vkCreateSemaphore(logicalDevice, &semaphoreCreateInfo, nullptr, &frame.queryResetSemaphore),
+                          "Failed to create query reset semaphore!");
+        
+        VK_ASSERT_SUCCESS(vkCreateSemaphore(logicalDevice, &semaphoreCreateInfo, nullptr, &frame.uploadCompleteSemaphore),
+                          "Failed to create upload semaphore!");
+        
+        VK_ASSERT_SUCCESS(vkCreateSemaphore(logicalDevice, &semaphoreCreateInfo, nullptr, &frame.computeCompleteSemaphore),
+                          "Failed to create compute semaphore!");
+    }
+    
+    // Every frame can have a full storage buffer's worth of staging in flight in each direction.
+    const VkDeviceSize stagingRingSize = std::max(minimumStagingRingSize, frames.size() * (configuration.storageBufferSize + stagingAlignment));
+    
+    uploadRing = std::make_unique<VulkanStagingRing>(*memoryAllocator, stagingRingSize, VulkanMemoryUsage::CpuToGpu);
+    readbackRing = std::make_unique<VulkanStagingRing>(*memoryAllocator, stagingRingSize, VulkanMemoryUsage::GpuToCpu);
+    
+    submissionTracker = std::make_unique<VulkanSubmissionTracker>(logicalDevice);
+}
+
+void VulkanComputeApplication::destroyTransferResources()
+{
+    // Destroying the tracker waits for anything still in flight.
+    submissionTracker.reset();
+    readbackRing.reset();
+    uploadRing.reset();
+    for (Frame& frame : frames)
+    {
+        vkDestroySemaphore(logicalDevice, frame.computeCompleteSemaphore, nullptr);
+        vkDestroySemaphore(logicalDevice, frame.uploadCompleteSemaphore, nullptr);
+        vkDestroySemaphore(logicalDevice, frame.queryResetSemaphore, nullptr);
+        vkFreeCommandBuffers(logicalDevice, transferCommandPool, 1, &frame.readbackCommandBuffer);
+        vkFreeCommandBuffers(logicalDevice, transferCommandPool, 1, &frame.uploadCommandBuffer);
+    }
+    vkDestroyCommandPool(logicalDevice, transferCommandPool, nullptr);
+}
+
+// MARK: - Upload
+
+// Staging memory is tagged with the transfer serial of its submission, and recycled once that submission has finished.
+void VulkanComputeApplication::releaseCompletedStaging()
+{
+    // Frames can finish in any order, so only release up to just before the oldest one still in flight.
+    uint64_t completedSerial = transferSerial;
+    for (Frame& frame : frames)
+    {
+        if (!frame.submission.poll())
+        {
+            completedSerial = std::min(completedSerial, frame.transferSerial - 1);
+        }
+    }
+    
+    uploadRing->release(completedSerial);
+    readbackRing->release(completedSerial);
+}
+
+VulkanStagingRing::Region VulkanComputeApplication::stageInput(const Frame& frame, const void* data, VkDeviceSize size)
+{
+    if (size > frame.inputBuffer.size)
+    {
+        throw std::runtime_error("Input is larger than the input buffer!");
+    }
+    
+    auto region = uploadRing->allocate(size, stagingAlignment, frame.transferSerial);
+    if (!region.has_value())
+    {
+        // Make room by waiting for every frame to finish with its staging memory.
+        for (Frame& otherFrame : frames)
+        {
+            waitForFrame(otherFrame);
+        }
+        releaseCompletedStaging();
+        
+        region = uploadRing->allocate(size, stagingAlignment, frame.transferSerial);
+        if (!region.has_value())
+        {
+            throw std::runtime_error("Staging ring is full!");
+        }
+    }
+    
+    memcpy(region->mappedData, data, size);
+    uploadRing->flush(*region);
+    
+    return *region;
+}
 
-void VulkanComputeApplication::submitComputeQueue()
+void VulkanComputeApplication::submitQueryReset(Frame& frame)
 {
-    // TODO: Use semaphores and fences
     VkSubmitInfo submitInfo{};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     submitInfo.pNext = nullptr;
@@ -654,21 +1636,176 @@ void VulkanComputeApplication::submitComputeQueue()
     submitInfo.pWaitSemaphores = nullptr;
     submitInfo.pWaitDstStageMask = nullptr;
     submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffer;
-    submitInfo.signalSemaphoreCount = 0;
-    submitInfo.pSignalSemaphores = nullptr;
+    submitInfo.pCommandBuffers = &frame.queryResetCommandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &frame.queryResetSemaphore;
+    
+    queueScheduler->submit(frame.queueIndex, 1, &submitInfo);
+}
+
+void VulkanComputeApplication::submitUpload(Frame& frame, const VulkanStagingRing::Region& region)
+{
+    const VkDeviceSize size = region.size;
+    
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.pNext = nullptr;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    beginInfo.pInheritanceInfo = nullptr;
+    
+    VK_ASSERT_SUCCESS(vkBeginCommandBuffer(frame.uploadCommandBuffer, &beginInfo),
+                      "Failed to begin upload command buffer!");
+    
+    cmdWriteTimestamp(frame.uploadCommandBuffer, frame, UploadBegin, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+    
+    if (size > 0)
+    {
+        VkBufferCopy copyRegion{};
+        copyRegion.srcOffset = region.offset;
+        copyRegion.dstOffset = 0;
+        copyRegion.size = size;
+        
+        vkCmdCopyBuffer(frame.uploadCommandBuffer, uploadRing->getBuffer(), frame.inputBuffer.buffer, 1, &copyRegion);
+    }
+    
+    recordBufferRelease(frame.uploadCommandBuffer, frame.inputBuffer.buffer, transferQueueFamilyIndex, computeQueueFamilyIndex,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
     
-    VK_ASSERT_SUCCESS(vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE),
-                      "Failed to submit compute queue!");
+    cmdWriteTimestamp(frame.uploadCommandBuffer, frame, UploadEnd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
     
-    VK_ASSERT_SUCCESS(vkQueueWaitIdle(computeQueue),
-                      "Failed to wait for compute queue idle!");
+    VK_ASSERT_SUCCESS(vkEndCommandBuffer(frame.uploadCommandBuffer),
+                      "Failed to end upload command buffer!");
     
-    void* payload;
-    VK_ASSERT_SUCCESS(vkMapMemory(logicalDevice, deviceMemory, 0, 2048, 0, &payload),
-                      "Failed to map memory!");
+    // The timestamps can't be written until the compute queue has reset their queries.
+    VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
     
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = nullptr;
+    submitInfo.waitSemaphoreCount = hasTransferTimestamps() ? 1 : 0;
+    submitInfo.pWaitSemaphores = hasTransferTimestamps() ? &frame.queryResetSemaphore : nullptr;
+    submitInfo.pWaitDstStageMask = hasTransferTimestamps() ? &waitStageMask : nullptr;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &frame.uploadCommandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &frame.uploadCompleteSemaphore;
+    
+    auto queueLock = lockTransferQueue();
+    
+    VK_ASSERT_SUCCESS(vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE),
+                      "Failed to submit transfer queue!");
+}
+
+// MARK: Submit Compute Queue
+
+void VulkanComputeApplication::submitComputeQueue(Frame& frame, uint32_t iterations)
+{
+    VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    
+    std::vector<VkCommandBuffer> commandBuffers(iterations + 1, frame.repeatCommandBuffer);
+    commandBuffers.front() = frame.commandBuffer;
+    commandBuffers.back() = frame.releaseCommandBuffer;
+    
+    // Every iteration goes out in a single vkQueueSubmit, split into batches to keep each one a reasonable size.
+    std::vector<VkSubmitInfo> submitInfos;
+    for (size_t first = 0; first < commandBuffers.size(); first += maxCommandBuffersPerSubmit)
+    {
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.pNext = nullptr;
+        submitInfo.waitSemaphoreCount = 0;
+        submitInfo.pWaitSemaphores = nullptr;
+        submitInfo.pWaitDstStageMask = nullptr;
+        submitInfo.commandBufferCount = static_cast<uint32_t>(std::min<size_t>(maxCommandBuffersPerSubmit, commandBuffers.size() - first));
+        submitInfo.pCommandBuffers = &commandBuffers[first];
+        submitInfo.signalSemaphoreCount = 0;
+        submitInfo.pSignalSemaphores = nullptr;
+        submitInfos.emplace_back(submitInfo);
+    }
+    
+    submitInfos.front().waitSemaphoreCount = 1;
+    submitInfos.front().pWaitSemaphores = &frame.uploadCompleteSemaphore;
+    submitInfos.front().pWaitDstStageMask = &waitStageMask;
+    
+    submitInfos.back().signalSemaphoreCount = 1;
+    submitInfos.back().pSignalSemaphores = &frame.computeCompleteSemaphore;
+    
+    // The queue's own fence tells the scheduler how busy the queue is. The readback's fence still covers the whole run.
+    queueScheduler->submit(frame.queueIndex, static_cast<uint32_t>(submitInfos.size()), submitInfos.data());
+}
+
+// MARK: - Readback
+
+VulkanSubmission VulkanComputeApplication::submitReadback(Frame& frame)
+{
+    // Only the elements this job covered are copied back.
+    const VkDeviceSize size = frame.parameters.elementCount * sizeof(uint32_t);
+    
+    auto region = readbackRing->allocate(size, stagingAlignment, frame.transferSerial);
+    if (!region.has_value())
+    {
+        throw std::runtime_error("Staging ring is full!");
+    }
+    
+    frame.readbackRegion = *region;
+    
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.pNext = nullptr;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    beginInfo.pInheritanceInfo = nullptr;
+    
+    VK_ASSERT_SUCCESS(vkBeginCommandBuffer(frame.readbackCommandBuffer, &beginInfo),
+                      "Failed to begin readback command buffer!");
+    
+    cmdWriteTimestamp(frame.readbackCommandBuffer, frame, ReadbackBegin, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+    
+    recordBufferAcquire(frame.readbackCommandBuffer, frame.outputBuffer.buffer, computeQueueFamilyIndex, transferQueueFamilyIndex,
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+    
+    VkBufferCopy copyRegion{};
+    copyRegion.srcOffset = 0;
+    copyRegion.dstOffset = region->offset;
+    copyRegion.size = size;
+    
+    vkCmdCopyBuffer(frame.readbackCommandBuffer, frame.outputBuffer.buffer, readbackRing->getBuffer(), 1, &copyRegion);
+    
+    // Make the copied data visible to the host.
+    VkBufferMemoryBarrier hostBarrier{};
+    hostBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    hostBarrier.pNext = nullptr;
+    hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    hostBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    hostBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    hostBarrier.buffer = readbackRing->getBuffer();
+    hostBarrier.offset = region->offset;
+    hostBarrier.size = region->size;
+    
+    vkCmdPipelineBarrier(frame.readbackCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                         0, 0, nullptr, 1, &hostBarrier, 0, nullptr);
+    
+    cmdWriteTimestamp(frame.readbackCommandBuffer, frame, ReadbackEnd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+    
+    VK_ASSERT_SUCCESS(vkEndCommandBuffer(frame.readbackCommandBuffer),
+                      "Failed to end readback command buffer!");
+    
+    VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = nullptr;
+    submitInfo.waitSemaphoreCount = 1;
+    submitInfo.pWaitSemaphores = &frame.computeCompleteSemaphore;
+    submitInfo.pWaitDstStageMask = &waitStageMask;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &frame.readbackCommandBuffer;
+    submitInfo.signalSemaphoreCount = 0;
+    submitInfo.pSignalSemaphores = nullptr;
     
-    vkUnmapMemory(logicalDevice, deviceMemory);
+    // The readback waits on the compute work, which waits on the upload, so this fence signals once the whole run is done.
+    auto queueLock = lockTransferQueue();
     
+    return submissionTracker->submit(transferQueue, 1, &submitInfo);
 }
@@ -8,39 +8,273 @@
 #ifndef VulkanComputeApplication_hpp
 #define VulkanComputeApplication_hpp
 
+#include <chrono>
+#include <memory>
 #include <optional>
+#include <span>
+#include <string>
 #include <vector>
 #include <vulkan/vulkan.h>
 
+#include "VulkanCommandSubmitter.hpp"
+#include "VulkanComputeGraph.hpp"
+#include "VulkanDescriptorAllocator.hpp"
+#include "VulkanKernels.hpp"
+#include "VulkanLayoutCache.hpp"
+#include "VulkanMemoryAllocator.hpp"
+#include "VulkanPipelineCache.hpp"
+#include "VulkanProfiler.hpp"
+#include "VulkanQueueScheduler.hpp"
+#include "VulkanShaderReflection.hpp"
+#include "VulkanStagingRing.hpp"
+#include "VulkanSubmissionTracker.hpp"
+#include "VulkanWorkgroupTuner.hpp"
+
+struct VulkanComputeConfiguration
+{
+    // How many submissions can be in flight at once. Each one gets its own storage buffers, descriptor set and
+    // command buffers, so the upload of one batch, the dispatch of the next and the readback of a third can overlap.
+    uint32_t framesInFlight = 3;
+    
+    // The size in bytes of each frame's input and output storage buffers, which caps how many elements a single
+    // submit() can take. Must be a non-zero multiple of 4.
+    VkDeviceSize storageBufferSize = 1024 * 1024;
+    
+    // Time every candidate workgroup size on the first run on a new device, and keep the fastest.
+    // When this is off, untuned kernels use a default size.
+    bool tuneWorkgroupSize = true;
+    
+    // Read the group counts from a VkDispatchIndirectCommand with vkCmdDispatchIndirect, instead of baking them into
+    // the command buffer. submit() with VulkanDispatchArguments reads them from a buffer an earlier GPU pass wrote, so
+    // that pass can size this one without a round trip through the CPU. Plain submit() fills a per-frame buffer from
+    // the element count.
+    bool indirectDispatch = false;
+    
+    // The most workgroups a direct dispatch launches along x before it's split into several, each starting at a later
+    // row. 0 uses the device's maxComputeWorkGroupCount[0], and smaller values make small jobs exercise the split.
+    uint32_t maxGroupCountPerDispatch = 0;
+    
+    // Write GPU timestamps around every upload, dispatch and readback, and record host-side spans to go with them.
+    bool profile = false;
+    
+    // The most compute queues to spread frames across. Frames are independent, so frames on different queues can run
+    // concurrently. 0 uses every queue the compute family has.
+    uint32_t maxComputeQueues = 0;
+    
+    // How each submission picks its compute queue.
+    VulkanQueuePolicy queuePolicy = VulkanQueuePolicy::LeastLoaded;
+    
+    // Create a VulkanCommandSubmitter on the compute queues, so other threads can record and submit their own work.
+    bool parallelRecording = false;
+    
+    // Empty to pick the best suitable device, or a device index or UUID as listed by VulkanDeviceSelector.
+    // When empty, the VKCOMPUTE_DEVICE environment variable is checked first.
+    std::string device;
+};
+
+// Where an indirect dispatch reads its VkDispatchIndirectCommand. The buffer needs INDIRECT_BUFFER usage and must be
+// owned by the compute queue family, and the offset must be a multiple of 4.
+struct VulkanDispatchArguments
+{
+    VkBuffer        buffer = VK_NULL_HANDLE;
+    VkDeviceSize    offset = 0;
+    
+    bool operator==(const VulkanDispatchArguments&) const = default;
+};
+
+// Host-side timings of every submission since the application was created, or since the report was last reset.
+struct VulkanThroughputReport
+{
+    uint64_t        submissionCount = 0;
+    VkDeviceSize    bytesUploaded = 0;
+    VkDeviceSize    bytesReadBack = 0;
+    
+    // Wall clock time from the first submission to the last observed completion.
+    double          elapsedSeconds = 0.0;
+    
+    // Sum of the time each submission took from submit() until the host saw it complete.
+    double          latencySeconds = 0.0;
+    
+    // Time the host spent blocked waiting for the GPU.
+    double          stallSeconds = 0.0;
+    
+    double getSubmissionsPerSecond() const { return elapsedSeconds > 0.0 ? submissionCount / elapsedSeconds : 0.0; }
+    
+    // The average number of submissions in flight. Anything above 1 means uploads, dispatches and readbacks overlapped.
+    double getAverageDepth() const { return elapsedSeconds > 0.0 ? latencySeconds / elapsedSeconds : 0.0; }
+};
 
 class VulkanComputeApplication {
 public:
-    VulkanComputeApplication();
+    VulkanComputeApplication(const VulkanComputeConfiguration& configuration = VulkanComputeConfiguration());
     ~VulkanComputeApplication();
     
-    void run();
+    // How many physical devices the loader reports. Any index below this can be passed as configuration.device,
+    // though not every device is suitable.
+    static uint32_t getPhysicalDeviceCount();
+    
+    // Uploads the input once, runs the kernel `iterations` times back to back, and reads the output back once.
+    // The kernel runs over input.size() elements, which can vary from call to call up to the storage buffer size.
+    // Returns as soon as the work is queued. The input is copied into staging memory before submit() returns.
+    // Only blocks if every frame is still in flight, in which case it waits for the oldest one.
+    VulkanSubmission submit(std::span<const uint32_t> input, uint32_t iterations = 1);
+    
+    // The same, but every iteration reads its group counts from arguments when it runs, and nothing the application
+    // records writes them. Needs configuration.indirectDispatch. Whatever writes the arguments must have finished
+    // before this is called, e.g. a compute graph submission that has been waited on. The group counts must stay
+    // within maxComputeWorkGroupCount, and invocations past input.size() do nothing.
+    VulkanSubmission submit(std::span<const uint32_t> input, const VulkanDispatchArguments& arguments, uint32_t iterations = 1);
+    
+    // Waits for a submission and returns its output.
+    // The returned span points straight into mapped readback memory, and stays valid until the submission's frame is
+    // reused, which is framesInFlight calls to submit() later.
+    std::span<const uint32_t> getOutput(const VulkanSubmission& submission);
+    
+    // Blocks until at least one of the submissions, all returned by submit(), has finished, and returns its index.
+    // Returns std::nullopt if the timeout expired first. getOutput() on the finished one won't block.
+    std::optional<size_t> waitAny(std::span<const VulkanSubmission> submissions, uint64_t timeoutNanoseconds = UINT64_MAX);
+    
+    // Equivalent to getOutput(submit(input, iterations)).
+    std::span<const uint32_t> run(std::span<const uint32_t> input, uint32_t iterations = 1);
+    std::span<const uint32_t> run(std::span<const uint32_t> input, const VulkanDispatchArguments& arguments, uint32_t iterations = 1);
+    
+    // The most elements a single submit() can take.
+    size_t getMaxElementCount() const { return configuration.storageBufferSize / sizeof(uint32_t); }
+    
+    const char* getDeviceName() const { return physicalDeviceProperties.deviceName; }
+    
+    const VkPhysicalDeviceLimits& getLimits() const { return physicalDeviceProperties.limits; }
+    
+    // The group counts a direct dispatch over elementCount elements uses, before any split. This is what a GPU pass
+    // writes into VulkanDispatchArguments to cover that many elements.
+    VkDispatchIndirectCommand getDispatchGroupCount(uint32_t elementCount) const;
+    
+    // Whether compute kernels can use basic and arithmetic subgroup operations. Always false on Vulkan 1.0.
+    bool supportsSubgroupArithmetic() const;
     
+    // Zero on Vulkan 1.0.
+    uint32_t getSubgroupSize() const { return subgroupProperties.subgroupSize; }
+    
+    VulkanThroughputReport getThroughputReport() const { return throughputReport; }
+    void resetThroughputReport();
+    
+    // Only available when the configuration turns profiling on.
+    const VulkanProfiler* getProfiler() const { return profiler.get(); }
+    
+    // Only available when the configuration turns parallel recording on. Safe to use from any thread.
+    VulkanCommandSubmitter* getCommandSubmitter() const { return commandSubmitter.get(); }
+    
+    VkDevice getLogicalDevice() const { return logicalDevice; }
+    
+    // Builds an empty graph on this device. It shares the application's queues, layouts and pipeline cache, so it must
+    // be destroyed before the application.
+    std::unique_ptr<VulkanComputeGraph> createComputeGraph();
+    
+    // Where the buffers a graph works on come from.
+    VulkanMemoryAllocator& getMemoryAllocator() const { return *memoryAllocator; }
+
 private:
     
+    // The timestamp queries each frame writes. Transfer queue queries come first, then compute queue queries.
+    enum FrameQuery : uint32_t
+    {
+        UploadBegin,
+        UploadEnd,
+        ReadbackBegin,
+        ReadbackEnd,
+        ComputeBegin,
+        DispatchBegin,
+        DispatchEnd,
+        ComputeEnd,
+        FrameQueryCount,
+    };
+    
+    // Everything a single submission needs for itself, so several can be in flight at once.
+    struct Frame
+    {
+        VulkanBuffer                inputBuffer;
+        VulkanBuffer                outputBuffer;
+        
+        // Filled from the element count for a plain submit() in indirect mode.
+        VulkanBuffer                indirectBuffer;
+        
+        // Where the frame's command buffers read their group counts when they were recorded for submit() with arguments.
+        std::optional<VulkanDispatchArguments> dispatchArguments;
+        std::unique_ptr<VulkanDescriptorAllocator> descriptorAllocator;
+        VkDescriptorSet             descriptorSet;
+        VulkanKernels::SimpleParameters parameters;
+        VkCommandBuffer             commandBuffer;
+        VkCommandBuffer             repeatCommandBuffer;
+        VkCommandBuffer             releaseCommandBuffer;
+        
+        // Resets the transfer queries on the compute queue ahead of the upload, since a transfer-only queue can't.
+        VkCommandBuffer             queryResetCommandBuffer;
+        VkCommandBuffer             uploadCommandBuffer;
+        VkCommandBuffer             readbackCommandBuffer;
+        
+        // The compute queue the frame's compute command buffers were allocated for.
+        uint32_t                    queueIndex = 0;
+        VkSemaphore                 queryResetSemaphore;
+        VkSemaphore                 uploadCompleteSemaphore;
+        VkSemaphore                 computeCompleteSemaphore;
+        VulkanSubmission            submission;
+        uint64_t                    transferSerial = 0;
+        VulkanStagingRing::Region   readbackRegion;
+        std::chrono::steady_clock::time_point submitTime;
+        bool                        isTimed = false;
+        uint32_t                    iterations = 0;
+        uint32_t                    firstQuery = 0;
+        bool                        hasTimestamps = false;
+    };
+    
+    static constexpr VkDeviceSize minimumStagingRingSize = 16 * 1024 * 1024;
+    static constexpr VkDeviceSize stagingAlignment = 16;
+    static constexpr uint32_t maxCommandBuffersPerSubmit = 1024;
+    static constexpr uint32_t rowStride = 32;
+    static constexpr VulkanWorkgroupSize defaultWorkgroupSize = { 8, 8, 1 };
+    static constexpr uint32_t tuningDispatchCount = 64;
+    static constexpr uint32_t tuningWarmupPassCount = 1;
+    static constexpr uint32_t tuningPassCount = 5;
+    
     VkInstance                  instance;
     VkDebugUtilsMessengerEXT    debugMessenger;
     uint32_t                    computeQueueFamilyIndex;
+    uint32_t                    computeQueueCount;
+    uint32_t                    transferQueueFamilyIndex;
     VkPhysicalDevice            physicalDevice = VK_NULL_HANDLE;
+    VkPhysicalDeviceProperties  physicalDeviceProperties;
+    VkPhysicalDeviceSubgroupProperties subgroupProperties;
     VkDevice                    logicalDevice;
-    VkQueue                     computeQueue;
-    VkDeviceMemory              deviceMemory;
-    VkBuffer                    inputBuffer;
-    VkBuffer                    outputBuffer;
+    VkQueue                     transferQueue;
+    VulkanComputeConfiguration  configuration;
+    std::unique_ptr<VulkanMemoryAllocator> memoryAllocator;
+    std::vector<Frame>          frames;
+    uint32_t                    frameIndex = 0;
     VkShaderModule              shaderModule;
+    std::unique_ptr<VulkanShaderReflection> shaderReflection;
+    std::unique_ptr<VulkanLayoutCache> layoutCache;
     VkDescriptorSetLayout       descriptorSetLayout;
     VkPipelineLayout            pipelineLayout;
+    std::unique_ptr<VulkanPipelineCache> pipelineCache;
+    std::unique_ptr<VulkanWorkgroupTuner> workgroupTuner;
+    VulkanWorkgroupSize         workgroupSize;
     VkPipeline                  pipeline;
-    VkDescriptorPool            descriptorPool;
-    VkDescriptorSet             descriptorSet;
-    VkCommandPool               commandPool;
-    VkCommandBuffer             commandBuffer;
+    std::unique_ptr<VulkanQueueScheduler> queueScheduler;
+    std::unique_ptr<VulkanCommandSubmitter> commandSubmitter;
+    VkCommandPool               transferCommandPool;
+    std::unique_ptr<VulkanStagingRing> uploadRing;
+    std::unique_ptr<VulkanStagingRing> readbackRing;
+    std::unique_ptr<VulkanSubmissionTracker> submissionTracker;
+    uint64_t                    transferSerial = 0;
+    VulkanThroughputReport      throughputReport;
+    std::unique_ptr<VulkanProfiler> profiler;
+    uint32_t                    computeTimestampValidBits = 0;
+    uint32_t                    transferTimestampValidBits = 0;
+    std::optional<std::chrono::steady_clock::time_point> firstSubmitTime;
     
     // Instance methods
+    static uint32_t getInstanceApiVersion();
+    
     void createVulkanInstance();
     void destroyVulkanInstance();
     
@@ -67,25 +301,80 @@ private:
     void createPipelineLayout();
     void destroyPipelineLayout();
     
+    void createPipelineCache();
+    void destroyPipelineCache();
+    
+    VkPipeline buildPipeline(const VulkanWorkgroupSize& size);
+    
     void createPipeline();
     void destroyPipeline();
     
+    VulkanWorkgroupSize getProblemSize(uint32_t elementCount) const;
+    
+    void tuneWorkgroupSize();
+    double measureWorkgroupSize(const VulkanWorkgroupSize& size, const VulkanProfiler* timer);
+    
     void createDescriptorPools();
     void destroyDescriptorPools();
     
     void createDescriptorSets();
-    void destroyDescriptorSets();
+    VkDescriptorSet getDescriptorSet(Frame& frame);
+    
+    void createProfiler();
+    void destroyProfiler();
     
-    void createCommandPool();
-    void destroyCommandPool();
+    void cmdResetTimestamps(VkCommandBuffer commandBuffer, const Frame& frame, FrameQuery firstQuery, uint32_t queryCount) const;
+    void cmdWriteTimestamp(VkCommandBuffer commandBuffer, const Frame& frame, FrameQuery query, VkPipelineStageFlagBits stage) const;
+    void collectTimestamps(Frame& frame);
+    
+    // Whether the upload and readback write timestamps, and so need their queries reset on the compute queue first.
+    bool hasTransferTimestamps() const { return profiler && transferTimestampValidBits > 0; }
+    
+    void createQueueScheduler();
+    void destroyQueueScheduler();
     
     void createCommandBuffer();
     void destroyCommandBuffer();
     
+    void createCommandSubmitter();
+    void destroyCommandSubmitter();
+    
+    // Only needed when the transfer queue is also the first compute queue, which the command submitter may use.
+    std::unique_lock<std::mutex> lockTransferQueue();
+    
+    void allocateComputeCommandBuffers(Frame& frame);
+    void freeComputeCommandBuffers(Frame& frame);
+    
+    VulkanKernels::SimpleParameters makeParameters(uint32_t elementCount) const;
+    
     void recordCommandBuffer();
+    void recordDispatchCommandBuffers(Frame& frame);
+    void recordReleaseCommandBuffer(Frame& frame);
+    void recordQueryResetCommandBuffer(Frame& frame);
+    
+    VkDispatchIndirectCommand getGroupCount(const VulkanKernels::SimpleParameters& parameters, const VulkanWorkgroupSize& size) const;
+    VulkanSubmission submitFrame(std::span<const uint32_t> input, uint32_t iterations, const std::optional<VulkanDispatchArguments>& arguments);
+    
+    void recordDispatch(VkCommandBuffer commandBuffer, const Frame& frame);
+    void recordDirectDispatch(VkCommandBuffer commandBuffer, const VulkanKernels::SimpleParameters& parameters, const VulkanWorkgroupSize& size) const;
     
-    void submitComputeQueue();
+    void createTransferResources();
+    void destroyTransferResources();
     
+    void waitForFrame(Frame& frame);
+    
+    void releaseCompletedStaging();
+    
+    VulkanStagingRing::Region stageInput(const Frame& frame, const void* data, VkDeviceSize size);
+    
+    void submitQueryReset(Frame& frame);
+    
+    void submitUpload(Frame& frame, const VulkanStagingRing::Region& region);
+    
+    void submitComputeQueue(Frame& frame, uint32_t iterations);
+    
+    VulkanSubmission submitReadback(Frame& frame);
+
 };
 
 
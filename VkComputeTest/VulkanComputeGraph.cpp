@@ -0,0 +1,684 @@
+//
+//  VulkanComputeGraph.cpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/31/21.
+//
+
+#include <algorithm>
+#include <cstddef>
+#include <numeric>
+#include <stdexcept>
+
+#include "VulkanComputeGraph.hpp"
+#include "VulkanDebugUtils.hpp"
+
+static bool isRead(VulkanAccess access)
+{
+    return access == VulkanAccess::Read || access == VulkanAccess::ReadWrite;
+}
+
+static bool isWrite(VulkanAccess access)
+{
+    return access == VulkanAccess::Write || access == VulkanAccess::ReadWrite;
+}
+
+// MARK: - Constructor
+
+VulkanComputeGraph::VulkanComputeGraph(VkDevice logicalDevice, VulkanMemoryAllocator& memoryAllocator, VulkanQueueScheduler& queueScheduler, VulkanLayoutCache& layoutCache,
+                                       VkPipelineCache pipelineCache)
+: logicalDevice(logicalDevice)
+, memoryAllocator(memoryAllocator)
+, queueScheduler(queueScheduler)
+, layoutCache(layoutCache)
+, pipelineCache(pipelineCache)
+, descriptorAllocator(logicalDevice)
+{
+    VkCommandPoolCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    createInfo.pNext = nullptr;
+    createInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    createInfo.queueFamilyIndex = queueScheduler.getQueueFamilyIndex();
+    
+    VK_ASSERT_SUCCESS(vkCreateCommandPool(logicalDevice, &createInfo, nullptr, &commandPool),
+                      "Failed to create command pool!");
+    
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.pNext = nullptr;
+    allocInfo.commandPool = commandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+    
+    VK_ASSERT_SUCCESS(vkAllocateCommandBuffers(logicalDevice, &allocInfo, &commandBuffer),
+                      "Failed to allocate graph command buffer!");
+}
+
+// MARK: - Destructor
+
+VulkanComputeGraph::~VulkanComputeGraph()
+{
+    lastSubmission.wait();
+    
+    destroyTransients();
+    
+    // Destroying the pool frees the command buffer.
+    vkDestroyCommandPool(logicalDevice, commandPool, nullptr);
+    
+    for (const Kernel& kernel : kernels)
+    {
+        vkDestroyPipeline(logicalDevice, kernel.pipeline, nullptr);
+    }
+    
+    for (const auto& [name, shaderModule] : shaderModules)
+    {
+        vkDestroyShaderModule(logicalDevice, shaderModule, nullptr);
+    }
+}
+
+// MARK: - Kernels
+
+VulkanComputeGraph::KernelId VulkanComputeGraph::addKernel(const VulkanKernels::Kernel& kernel, std::optional<VulkanWorkgroupSize> localSize)
+{
+    auto reflection = std::make_unique<VulkanShaderReflection>(kernel.code, kernel.entryPoint);
+    
+    const auto& constantIds = reflection->getLocalSizeConstantIds();
+    bool hasSpecializedLocalSize = std::all_of(constantIds.begin(), constantIds.end(), [](const auto& id) { return id.has_value(); });
+    
+    VulkanWorkgroupSize size = { reflection->getLocalSize()[0], reflection->getLocalSize()[1], reflection->getLocalSize()[2] };
+    if (localSize.has_value())
+    {
+        if (!hasSpecializedLocalSize)
+        {
+            throw std::runtime_error("Kernel " + std::string(kernel.name) + " has a fixed local size!");
+        }
+        size = *localSize;
+    }
+    
+    auto key = std::make_pair(std::string(kernel.name), std::make_tuple(size.x, size.y, size.z));
+    auto it = kernelLookup.find(key);
+    if (it != kernelLookup.end())
+    {
+        return it->second;
+    }
+    
+    const auto& reflectedBindings = reflection->getBindings();
+    
+    for (const VulkanShaderBinding& binding : reflectedBindings)
+    {
+        if (binding.set != 0 || binding.descriptorType != VK_DESCRIPTOR_TYPE_STORAGE_BUFFER || binding.descriptorCount != 1)
+        {
+            throw std::runtime_error("Graph kernels may only bind single storage buffers in set 0!");
+        }
+    }
+    
+    // Stages write bindings[i] to binding i, so the kernel's bindings have to be exactly 0 to n - 1.
+    for (size_t i = 0; i < reflectedBindings.size(); ++i)
+    {
+        if (reflectedBindings[i].binding != i)
+        {
+            throw std::runtime_error("Graph kernels must number their bindings from 0 without gaps!");
+        }
+    }
+    
+    // Kernels at several local sizes share one shader module.
+    VkShaderModule& shaderModule = shaderModules[key.first];
+    if (shaderModule == VK_NULL_HANDLE)
+    {
+        VkShaderModuleCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        createInfo.codeSize = kernel.code.size_bytes();
+        createInfo.pCode = kernel.code.data();
+        
+        VK_ASSERT_SUCCESS(vkCreateShaderModule(logicalDevice, &createInfo, nullptr, &shaderModule),
+                          "Failed to create shader module!");
+    }
+    
+    Kernel newKernel;
+    newKernel.name = key.first;
+    newKernel.localSize = size;
+    newKernel.shaderModule = shaderModule;
+    newKernel.descriptorSetLayout = layoutCache.getDescriptorSetLayout(*reflection, 0);
+    newKernel.pipelineLayout = layoutCache.getPipelineLayout(*reflection);
+    
+    VkSpecializationMapEntry specializationMapEntries[3] = {};
+    if (hasSpecializedLocalSize)
+    {
+        specializationMapEntries[0] = { *constantIds[0], offsetof(VulkanWorkgroupSize, x), sizeof(uint32_t) };
+        specializationMapEntries[1] = { *constantIds[1], offsetof(VulkanWorkgroupSize, y), sizeof(uint32_t) };
+        specializationMapEntries[2] = { *constantIds[2], offsetof(VulkanWorkgroupSize, z), sizeof(uint32_t) };
+    }
+    
+    VkSpecializationInfo specializationInfo{};
+    specializationInfo.mapEntryCount = hasSpecializedLocalSize ? 3 : 0;
+    specializationInfo.pMapEntries = specializationMapEntries;
+    specializationInfo.dataSize = sizeof(VulkanWorkgroupSize);
+    specializationInfo.pData = &size;
+    
+    VkPipelineShaderStageCreateInfo pipelineShaderStageCreateInfo{};
+    pipelineShaderStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineShaderStageCreateInfo.pNext = nullptr;
+    pipelineShaderStageCreateInfo.flags = 0;
+    pipelineShaderStageCreateInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineShaderStageCreateInfo.module = shaderModule;
+    pipelineShaderStageCreateInfo.pName = kernel.entryPoint;
+    pipelineShaderStageCreateInfo.pSpecializationInfo = &specializationInfo;
+    
+    VkComputePipelineCreateInfo pipelineCreateInfo{};
+    pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineCreateInfo.pNext = nullptr;
+    pipelineCreateInfo.flags = 0;
+    pipelineCreateInfo.stage = pipelineShaderStageCreateInfo;
+    pipelineCreateInfo.layout = newKernel.pipelineLayout;
+    pipelineCreateInfo.basePipelineHandle = VK_NULL_HANDLE;
+    pipelineCreateInfo.basePipelineIndex = 0;
+    
+    VK_ASSERT_SUCCESS(vkCreateComputePipelines(logicalDevice, pipelineCache, 1, &pipelineCreateInfo, nullptr, &newKernel.pipeline),
+                      "Failed to create compute pipeline!");
+    
+    newKernel.reflection = std::move(reflection);
+    
+    KernelId id = static_cast<KernelId>(kernels.size());
+    kernels.push_back(std::move(newKernel));
+    kernelLookup.emplace(std::move(key), id);
+    return id;
+}
+
+// MARK: - Stages
+
+const VulkanComputeGraph::Kernel& VulkanComputeGraph::validateDispatch(KernelId kernel, std::span<const VulkanGraphBinding> bindings,
+                                                                      std::span<const std::byte> pushConstants) const
+{
+    if (kernel >= kernels.size())
+    {
+        throw std::runtime_error("Unknown graph kernel!");
+    }
+    
+    const Kernel& graphKernel = kernels[kernel];
+    const auto& reflectedBindings = graphKernel.reflection->getBindings();
+    
+    // Every buffer is written to the set, so one the kernel doesn't declare would be invalid usage, not just unused.
+    if (bindings.size() != reflectedBindings.size())
+    {
+        throw std::runtime_error("Kernel " + graphKernel.name + " has " + std::to_string(reflectedBindings.size()) + " bindings, but "
+                                 + std::to_string(bindings.size()) + " buffers were given!");
+    }
+    
+    for (size_t i = 0; i < bindings.size(); ++i)
+    {
+        if (bindings[i].buffer == VK_NULL_HANDLE && !bindings[i].transient.isValid())
+        {
+            throw std::runtime_error("Kernel " + graphKernel.name + " is missing a buffer for binding " + std::to_string(i) + "!");
+        }
+    }
+    
+    for (const VulkanGraphBinding& binding : bindings)
+    {
+        if (binding.transient.isValid() && binding.transient.index >= transients.size())
+        {
+            throw std::runtime_error("Unknown transient buffer!");
+        }
+    }
+    
+    if (pushConstants.size() != graphKernel.reflection->getPushConstantSize())
+    {
+        throw std::runtime_error("Push constants don't match kernel " + graphKernel.name + "'s block!");
+    }
+    
+    return graphKernel;
+}
+
+void VulkanComputeGraph::dispatch(KernelId kernel, std::span<const VulkanGraphBinding> bindings, uint32_t groupCountX, uint32_t groupCountY, uint32_t groupCountZ,
+                                  std::span<const std::byte> pushConstants)
+{
+    validateDispatch(kernel, bindings, pushConstants);
+    
+    Stage stage;
+    stage.type = StageType::Dispatch;
+    stage.kernel = kernel;
+    stage.bindings.assign(bindings.begin(), bindings.end());
+    stage.pushConstants.assign(pushConstants.begin(), pushConstants.end());
+    stage.groupCount[0] = groupCountX;
+    stage.groupCount[1] = groupCountY;
+    stage.groupCount[2] = groupCountZ;
+    
+    std::vector<std::pair<ResourceKey, VulkanAccess>> accesses;
+    for (const VulkanGraphBinding& binding : bindings)
+    {
+        accesses.emplace_back(getResourceKey(binding), binding.access);
+    }
+    
+    addStage(std::move(stage), accesses);
+}
+
+void VulkanComputeGraph::dispatchIndirect(KernelId kernel, std::span<const VulkanGraphBinding> bindings, VkBuffer argumentBuffer, VkDeviceSize argumentOffset,
+                                          std::span<const std::byte> pushConstants)
+{
+    validateDispatch(kernel, bindings, pushConstants);
+    
+    Stage stage;
+    stage.type = StageType::DispatchIndirect;
+    stage.kernel = kernel;
+    stage.bindings.assign(bindings.begin(), bindings.end());
+    stage.pushConstants.assign(pushConstants.begin(), pushConstants.end());
+    stage.buffer = argumentBuffer;
+    stage.offset = argumentOffset;
+    
+    std::vector<std::pair<ResourceKey, VulkanAccess>> accesses;
+    for (const VulkanGraphBinding& binding : bindings)
+    {
+        accesses.emplace_back(getResourceKey(binding), binding.access);
+    }
+    accesses.emplace_back(ResourceKey(argumentBuffer, UINT32_MAX), VulkanAccess::Read);
+    
+    addStage(std::move(stage), accesses);
+}
+
+void VulkanComputeGraph::fillBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, uint32_t value)
+{
+    Stage stage;
+    stage.type = StageType::Fill;
+    stage.buffer = buffer;
+    stage.offset = offset;
+    stage.size = size;
+    stage.value = value;
+    
+    const std::pair<ResourceKey, VulkanAccess> access = { ResourceKey(buffer, UINT32_MAX), VulkanAccess::Write };
+    addStage(std::move(stage), std::span(&access, 1));
+}
+
+void VulkanComputeGraph::copyBuffer(VkBuffer source, VkBuffer destination, const VkBufferCopy& region)
+{
+    Stage stage;
+    stage.type = StageType::Copy;
+    stage.buffer = destination;
+    stage.offset = region.dstOffset;
+    stage.size = region.size;
+    stage.sourceBuffer = source;
+    stage.sourceOffset = region.srcOffset;
+    
+    const std::pair<ResourceKey, VulkanAccess> accesses[] = {
+        { ResourceKey(source, UINT32_MAX), VulkanAccess::Read },
+        { ResourceKey(destination, UINT32_MAX), VulkanAccess::Write },
+    };
+    addStage(std::move(stage), accesses);
+}
+
+void VulkanComputeGraph::addStage(Stage stage, std::span<const std::pair<ResourceKey, VulkanAccess>> accesses)
+{
+    // Read after write and write after write wait for the last write. Write after read waits for the reads too.
+    int32_t level = 0;
+    for (const auto& [buffer, access] : accesses)
+    {
+        const BufferState& state = bufferStates[buffer];
+        
+        level = std::max(level, state.lastWriteLevel + 1);
+        if (isWrite(access))
+        {
+            level = std::max(level, state.lastReadLevel + 1);
+        }
+    }
+    
+    for (const auto& [buffer, access] : accesses)
+    {
+        BufferState& state = bufferStates[buffer];
+        
+        if (isWrite(access))
+        {
+            // Reads of the old contents all come before this level, so only reads of the new contents matter now.
+            state.lastWriteLevel = level;
+            state.lastReadLevel = -1;
+        } else
+        {
+            state.lastReadLevel = std::max(state.lastReadLevel, level);
+        }
+    }
+    
+    stage.level = static_cast<uint32_t>(level);
+    levelCount = std::max(levelCount, stage.level + 1);
+    
+    // A new stage only changes the lifetimes of the transient buffers it uses.
+    for (const auto& [key, access] : accesses)
+    {
+        isPlanned = isPlanned && key.second == UINT32_MAX;
+    }
+    
+    stages.push_back(std::move(stage));
+    isRecorded = false;
+}
+
+void VulkanComputeGraph::clear()
+{
+    stages.clear();
+    bufferStates.clear();
+    levelCount = 0;
+    isRecorded = false;
+    isPlanned = false;
+}
+
+// MARK: - Transient Buffers
+
+VulkanTransientBuffer VulkanComputeGraph::createTransientBuffer(VkDeviceSize size)
+{
+    if (size == 0)
+    {
+        throw std::runtime_error("Transient buffers can't be empty!");
+    }
+    
+    transients.push_back({ size });
+    return { static_cast<uint32_t>(transients.size() - 1) };
+}
+
+VulkanComputeGraph::ResourceKey VulkanComputeGraph::getResourceKey(const VulkanGraphBinding& binding)
+{
+    return binding.transient.isValid() ? ResourceKey(VK_NULL_HANDLE, binding.transient.index) : ResourceKey(binding.buffer, UINT32_MAX);
+}
+
+VkBuffer VulkanComputeGraph::getBuffer(const VulkanGraphBinding& binding) const
+{
+    return binding.transient.isValid() ? transients[binding.transient.index].buffer : binding.buffer;
+}
+
+void VulkanComputeGraph::destroyTransients()
+{
+    for (Transient& transient : transients)
+    {
+        vkDestroyBuffer(logicalDevice, transient.buffer, nullptr);
+        transient.buffer = VK_NULL_HANDLE;
+    }
+    
+    if (transientAllocation.memory != VK_NULL_HANDLE)
+    {
+        memoryAllocator.free(transientAllocation);
+        transientAllocation = VulkanAllocation();
+    }
+    
+    memoryPlan = VulkanMemoryPlan();
+}
+
+// A buffer's memory can only be bound once, so planning again means new buffers, and new descriptor sets for them.
+void VulkanComputeGraph::planTransients()
+{
+    destroyTransients();
+    descriptorAllocator.reset();
+    isRecorded = false;
+    
+    std::vector<std::optional<std::pair<uint32_t, uint32_t>>> lifetimes(transients.size());
+    for (const Stage& stage : stages)
+    {
+        for (const VulkanGraphBinding& binding : stage.bindings)
+        {
+            if (!binding.transient.isValid())
+            {
+                continue;
+            }
+            
+            auto& lifetime = lifetimes[binding.transient.index];
+            lifetime = lifetime.has_value() ? std::make_pair(std::min(lifetime->first, stage.level), std::max(lifetime->second, stage.level))
+                                            : std::make_pair(stage.level, stage.level);
+        }
+    }
+    
+    VkBufferCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    createInfo.pNext = nullptr;
+    createInfo.flags = 0;
+    createInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    createInfo.queueFamilyIndexCount = 0;
+    createInfo.pQueueFamilyIndices = nullptr;
+    
+    // Transient buffers no stage uses get no buffer and no memory.
+    VulkanMemoryPlanner planner;
+    std::vector<uint32_t> planned;
+    VkMemoryRequirements sharedRequirements{};
+    sharedRequirements.alignment = 1;
+    sharedRequirements.memoryTypeBits = ~0u;
+    
+    for (uint32_t index = 0; index < transients.size(); ++index)
+    {
+        if (!lifetimes[index].has_value())
+        {
+            continue;
+        }
+        
+        createInfo.size = transients[index].size;
+        VK_ASSERT_SUCCESS(vkCreateBuffer(logicalDevice, &createInfo, nullptr, &transients[index].buffer),
+                          "Failed to create transient buffer!");
+        
+        VkMemoryRequirements requirements;
+        vkGetBufferMemoryRequirements(logicalDevice, transients[index].buffer, &requirements);
+        
+        sharedRequirements.alignment = std::max(sharedRequirements.alignment, requirements.alignment);
+        sharedRequirements.memoryTypeBits &= requirements.memoryTypeBits;
+        
+        planner.addBuffer(requirements.size, requirements.alignment, lifetimes[index]->first, lifetimes[index]->second);
+        planned.push_back(index);
+    }
+    
+    if (planned.empty())
+    {
+        isPlanned = true;
+        return;
+    }
+    
+    if (sharedRequirements.memoryTypeBits == 0)
+    {
+        throw std::runtime_error("Transient buffers have no memory type in common!");
+    }
+    
+    memoryPlan = planner.plan();
+    sharedRequirements.size = memoryPlan.plannedBytes;
+    transientAllocation = memoryAllocator.allocate(sharedRequirements, VulkanMemoryUsage::GpuOnly);
+    
+    for (size_t i = 0; i < planned.size(); ++i)
+    {
+        VK_ASSERT_SUCCESS(vkBindBufferMemory(logicalDevice, transients[planned[i]].buffer, transientAllocation.memory,
+                                             transientAllocation.offset + memoryPlan.offsets[i]),
+                          "Failed to bind transient buffer memory!");
+    }
+    
+    isPlanned = true;
+}
+
+// MARK: - Recording
+
+void VulkanComputeGraph::recordStage(const Stage& stage)
+{
+    if (stage.type == StageType::Fill)
+    {
+        vkCmdFillBuffer(commandBuffer, stage.buffer, stage.offset, stage.size, stage.value);
+        return;
+    }
+    
+    if (stage.type == StageType::Copy)
+    {
+        VkBufferCopy region{ stage.sourceOffset, stage.offset, stage.size };
+        vkCmdCopyBuffer(commandBuffer, stage.sourceBuffer, stage.buffer, 1, &region);
+        return;
+    }
+    
+    const Kernel& kernel = kernels[stage.kernel];
+    
+    std::vector<VkDescriptorBufferInfo> bufferInfos;
+    for (const VulkanGraphBinding& binding : stage.bindings)
+    {
+        bufferInfos.push_back({ getBuffer(binding), binding.offset, binding.range });
+    }
+    
+    // Stages that bind the same buffers share one set, and re-recording an unchanged graph writes none.
+    VkDescriptorSet descriptorSet = descriptorAllocator.getStorageBufferSet(kernel.descriptorSetLayout, bufferInfos);
+    
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+    
+    if (!stage.pushConstants.empty())
+    {
+        vkCmdPushConstants(commandBuffer, kernel.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                           static_cast<uint32_t>(stage.pushConstants.size()), stage.pushConstants.data());
+    }
+    
+    if (stage.type == StageType::DispatchIndirect)
+    {
+        vkCmdDispatchIndirect(commandBuffer, stage.buffer, stage.offset);
+    } else
+    {
+        vkCmdDispatch(commandBuffer, stage.groupCount[0], stage.groupCount[1], stage.groupCount[2]);
+    }
+}
+
+void VulkanComputeGraph::record()
+{
+    struct Level
+    {
+        VkPipelineStageFlags    stageMask = 0;
+        VkAccessFlags           accessMask = 0;
+        VkAccessFlags           writeMask = 0;
+    };
+    
+    // What each level does, so each barrier waits on exactly the stages and writes of the level before it.
+    std::vector<Level> levels(levelCount);
+    for (const Stage& stage : stages)
+    {
+        Level& level = levels[stage.level];
+        
+        if (stage.type == StageType::Fill)
+        {
+            level.stageMask |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+            level.accessMask |= VK_ACCESS_TRANSFER_WRITE_BIT;
+            level.writeMask |= VK_ACCESS_TRANSFER_WRITE_BIT;
+            continue;
+        }
+        
+        if (stage.type == StageType::Copy)
+        {
+            level.stageMask |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+            level.accessMask |= VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+            level.writeMask |= VK_ACCESS_TRANSFER_WRITE_BIT;
+            continue;
+        }
+        
+        level.stageMask |= VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        for (const VulkanGraphBinding& binding : stage.bindings)
+        {
+            level.accessMask |= isRead(binding.access) ? VK_ACCESS_SHADER_READ_BIT : 0;
+            level.accessMask |= isWrite(binding.access) ? VK_ACCESS_SHADER_WRITE_BIT : 0;
+            level.writeMask |= isWrite(binding.access) ? VK_ACCESS_SHADER_WRITE_BIT : 0;
+        }
+        
+        if (stage.type == StageType::DispatchIndirect)
+        {
+            level.stageMask |= VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+            level.accessMask |= VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+        }
+    }
+    
+    // Levels go out in order. Within a level, stages keep the order they were declared in.
+    std::vector<size_t> order(stages.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return stages[a].level < stages[b].level; });
+    
+    // The GPU is done with the previous recording, so its sets can go back if the cache has grown.
+    descriptorAllocator.recycle();
+    
+    VK_ASSERT_SUCCESS(vkResetCommandBuffer(commandBuffer, 0),
+                      "Failed to reset graph command buffer!");
+    
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.pNext = nullptr;
+    beginInfo.flags = 0;
+    beginInfo.pInheritanceInfo = nullptr;
+    
+    VK_ASSERT_SUCCESS(vkBeginCommandBuffer(commandBuffer, &beginInfo),
+                      "Failed to begin graph command buffer!");
+    
+    VkPipelineStageFlags allStages = 0;
+    VkAccessFlags allWrites = 0;
+    uint32_t currentLevel = 0;
+    
+    for (size_t index : order)
+    {
+        const Stage& stage = stages[index];
+        
+        if (stage.level != currentLevel)
+        {
+            // Levels are dense, so this is always the very next one.
+            const Level& previous = levels[currentLevel];
+            const Level& next = levels[stage.level];
+            
+            VkMemoryBarrier memoryBarrier{};
+            memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            memoryBarrier.pNext = nullptr;
+            memoryBarrier.srcAccessMask = previous.writeMask;
+            memoryBarrier.dstAccessMask = next.accessMask;
+            
+            vkCmdPipelineBarrier(commandBuffer, previous.stageMask, next.stageMask, 0,
+                                 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+            
+            currentLevel = stage.level;
+        }
+        
+        allStages |= levels[stage.level].stageMask;
+        allWrites |= levels[stage.level].writeMask;
+        
+        recordStage(stage);
+    }
+    
+    // Lets the host read whatever the graph wrote once the submission's fence has signaled.
+    if (allWrites != 0)
+    {
+        VkMemoryBarrier memoryBarrier{};
+        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        memoryBarrier.pNext = nullptr;
+        memoryBarrier.srcAccessMask = allWrites;
+        memoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        
+        vkCmdPipelineBarrier(commandBuffer, allStages, VK_PIPELINE_STAGE_HOST_BIT, 0,
+                             1, &memoryBarrier, 0, nullptr, 0, nullptr);
+    }
+    
+    VK_ASSERT_SUCCESS(vkEndCommandBuffer(commandBuffer),
+                      "Failed to end graph command buffer!");
+    
+    isRecorded = true;
+}
+
+// MARK: - Submission
+
+VulkanSubmission VulkanComputeGraph::submit()
+{
+    if (stages.empty())
+    {
+        throw std::runtime_error("A graph needs at least one stage!");
+    }
+    
+    // The command buffer and descriptor sets can't change while the GPU may still be using them.
+    lastSubmission.wait();
+    
+    if (!isPlanned)
+    {
+        planTransients();
+    }
+    
+    if (!isRecorded)
+    {
+        record();
+    }
+    
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = nullptr;
+    submitInfo.waitSemaphoreCount = 0;
+    submitInfo.pWaitSemaphores = nullptr;
+    submitInfo.pWaitDstStageMask = nullptr;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    submitInfo.signalSemaphoreCount = 0;
+    submitInfo.pSignalSemaphores = nullptr;
+    
+    queueIndex = queueScheduler.acquireQueue(queueIndex);
+    lastSubmission = queueScheduler.submit(*queueIndex, 1, &submitInfo);
+    
+    return lastSubmission;
+}
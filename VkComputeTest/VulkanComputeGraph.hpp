@@ -0,0 +1,261 @@
+//
+//  VulkanComputeGraph.hpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/31/21.
+//
+
+#ifndef VulkanComputeGraph_hpp
+#define VulkanComputeGraph_hpp
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "VulkanDescriptorAllocator.hpp"
+#include "VulkanKernels.hpp"
+#include "VulkanLayoutCache.hpp"
+#include "VulkanMemoryAllocator.hpp"
+#include "VulkanMemoryPlanner.hpp"
+#include "VulkanQueueScheduler.hpp"
+#include "VulkanShaderReflection.hpp"
+#include "VulkanSubmissionTracker.hpp"
+#include "VulkanWorkgroupTuner.hpp"
+
+enum class VulkanAccess
+{
+    Read,
+    Write,
+    ReadWrite,
+};
+
+// An intermediate buffer that only exists inside one graph. See VulkanComputeGraph::createTransientBuffer().
+struct VulkanTransientBuffer
+{
+    uint32_t                    index = UINT32_MAX;
+    
+    bool isValid() const { return index != UINT32_MAX; }
+};
+
+// A storage buffer bound to a kernel, and what the kernel does with it. bindings[i] goes to binding i of set 0.
+struct VulkanGraphBinding
+{
+    VkBuffer                    buffer = VK_NULL_HANDLE;
+    VulkanAccess                access = VulkanAccess::ReadWrite;
+    VkDeviceSize                offset = 0;
+    VkDeviceSize                range = VK_WHOLE_SIZE;
+    
+    // Set instead of buffer to bind one of the graph's transient buffers.
+    VulkanTransientBuffer       transient;
+    
+    static VulkanGraphBinding fromTransient(VulkanTransientBuffer transient, VulkanAccess access)
+    {
+        VulkanGraphBinding binding;
+        binding.access = access;
+        binding.transient = transient;
+        return binding;
+    }
+    
+    // The same buffer and range, used another way.
+    VulkanGraphBinding withAccess(VulkanAccess newAccess) const
+    {
+        VulkanGraphBinding binding = *this;
+        binding.access = newAccess;
+        return binding;
+    }
+};
+
+// A chain of kernels recorded into one command buffer and submitted as one job, so a multi-kernel workload runs back
+// to back on the GPU with no host round trips in between.
+//
+// Stages are declared in order with the buffers they read and write, and the graph works out the barriers. Every stage
+// goes into the earliest level after everything it depends on: the last write to each buffer it touches, and for a
+// write, every read of the old contents too. Levels are recorded in order, with a single barrier between one level and
+// the next, so stages that don't depend on each other share one barrier however they were declared.
+//
+// Hazards are tracked per VkBuffer, so two stages using disjoint ranges of one buffer are still ordered. Separate
+// graphs are not ordered against each other. Wait for one graph's submission before submitting another that uses the
+// same buffers. A graph belongs to one thread.
+//
+// Intermediate results can live in transient buffers, which the graph owns. Their memory is planned when the graph is
+// recorded: each one is live from the first level that uses it to the last, and transient buffers that are never live
+// at the same time share memory.
+class VulkanComputeGraph {
+public:
+    using KernelId = uint32_t;
+    
+    VulkanComputeGraph(VkDevice logicalDevice, VulkanMemoryAllocator& memoryAllocator, VulkanQueueScheduler& queueScheduler, VulkanLayoutCache& layoutCache,
+                       VkPipelineCache pipelineCache);
+    
+    // Waits for the last submission before destroying anything.
+    ~VulkanComputeGraph();
+    
+    VulkanComputeGraph(const VulkanComputeGraph&) = delete;
+    VulkanComputeGraph& operator=(const VulkanComputeGraph&) = delete;
+    
+    // Builds a pipeline for the kernel, or returns the one already built for it. localSize only applies to kernels
+    // that take their local size from specialization constants, and defaults to the size compiled into the kernel.
+    KernelId addKernel(const VulkanKernels::Kernel& kernel, std::optional<VulkanWorkgroupSize> localSize = std::nullopt);
+    
+    // The local size the kernel's pipeline was built with, for working out group counts.
+    VulkanWorkgroupSize getLocalSize(KernelId kernel) const { return kernels[kernel].localSize; }
+    
+    // Appends a dispatch. bindings needs exactly one buffer per set 0 binding of the kernel, and the push constants
+    // must match the kernel's block exactly.
+    void dispatch(KernelId kernel, std::span<const VulkanGraphBinding> bindings, uint32_t groupCountX, uint32_t groupCountY, uint32_t groupCountZ,
+                  std::span<const std::byte> pushConstants = {});
+    
+    // Appends a dispatch that reads its group counts from a VkDispatchIndirectCommand in argumentBuffer, which an
+    // earlier stage may have written.
+    void dispatchIndirect(KernelId kernel, std::span<const VulkanGraphBinding> bindings, VkBuffer argumentBuffer, VkDeviceSize argumentOffset,
+                          std::span<const std::byte> pushConstants = {});
+    
+    template <typename Parameters>
+    void dispatch(KernelId kernel, std::span<const VulkanGraphBinding> bindings, uint32_t groupCountX, uint32_t groupCountY, uint32_t groupCountZ,
+                  const Parameters& parameters)
+    {
+        dispatch(kernel, bindings, groupCountX, groupCountY, groupCountZ, std::as_bytes(std::span<const Parameters>(&parameters, 1)));
+    }
+    
+    template <typename Parameters>
+    void dispatchIndirect(KernelId kernel, std::span<const VulkanGraphBinding> bindings, VkBuffer argumentBuffer, VkDeviceSize argumentOffset,
+                          const Parameters& parameters)
+    {
+        dispatchIndirect(kernel, bindings, argumentBuffer, argumentOffset, std::as_bytes(std::span<const Parameters>(&parameters, 1)));
+    }
+    
+    // A device-local storage buffer for passing data from one stage to another. Its contents are undefined until a
+    // stage writes them in each submission, since its memory may have held another transient buffer in between.
+    VulkanTransientBuffer createTransientBuffer(VkDeviceSize size);
+    
+    // Appends a vkCmdFillBuffer, e.g. to reset a counter before the stage that increments it.
+    void fillBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, uint32_t value);
+    
+    // Appends a vkCmdCopyBuffer, e.g. to upload from a host-visible buffer the host filled before submit().
+    void copyBuffer(VkBuffer source, VkBuffer destination, const VkBufferCopy& region);
+    
+    // Drops every stage, but keeps the kernels, their pipelines and the transient buffers. A submission already made
+    // is unaffected.
+    void clear();
+    
+    // Records the graph if it changed since it was last recorded, and submits it. Waits for the previous submission
+    // first, since the graph has one command buffer. Every write the graph makes is visible to the host once the
+    // returned submission has finished.
+    VulkanSubmission submit();
+    
+    // How many levels, and so barriers between them, the stages were packed into when the graph was last recorded.
+    uint32_t getLevelCount() const { return levelCount; }
+    size_t getStageCount() const { return stages.size(); }
+    
+    // Where the transient buffers went when the graph was last recorded, and how much memory aliasing saved.
+    const VulkanMemoryPlan& getMemoryPlan() const { return memoryPlan; }
+
+private:
+    
+    struct Kernel
+    {
+        std::string                 name;
+        VulkanWorkgroupSize         localSize;
+        std::unique_ptr<VulkanShaderReflection> reflection;
+        VkShaderModule              shaderModule;
+        VkDescriptorSetLayout       descriptorSetLayout;
+        VkPipelineLayout            pipelineLayout;
+        VkPipeline                  pipeline;
+    };
+    
+    enum class StageType
+    {
+        Dispatch,
+        DispatchIndirect,
+        Fill,
+        Copy,
+    };
+    
+    struct Stage
+    {
+        StageType                   type;
+        KernelId                    kernel = 0;
+        std::vector<VulkanGraphBinding> bindings;
+        std::vector<std::byte>      pushConstants;
+        uint32_t                    groupCount[3] = { 0, 0, 0 };
+        
+        // The indirect arguments for DispatchIndirect, or the buffer to fill for Fill, or to copy to for Copy.
+        VkBuffer                    buffer = VK_NULL_HANDLE;
+        VkDeviceSize                offset = 0;
+        VkDeviceSize                size = 0;
+        uint32_t                    value = 0;
+        
+        // Where Copy reads from.
+        VkBuffer                    sourceBuffer = VK_NULL_HANDLE;
+        VkDeviceSize                sourceOffset = 0;
+        
+        uint32_t                    level = 0;
+    };
+    
+    struct Transient
+    {
+        VkDeviceSize                size;
+        VkBuffer                    buffer = VK_NULL_HANDLE;
+    };
+    
+    // Buffers the caller owns have no transient index, transient buffers have no handle until they are planned.
+    using ResourceKey = std::pair<VkBuffer, uint32_t>;
+    
+    // Where each buffer was last written, and the latest level that has read it since. -1 means never.
+    struct BufferState
+    {
+        int32_t                     lastWriteLevel = -1;
+        int32_t                     lastReadLevel = -1;
+    };
+    
+    VkDevice                        logicalDevice;
+    VulkanMemoryAllocator&          memoryAllocator;
+    VulkanQueueScheduler&           queueScheduler;
+    VulkanLayoutCache&              layoutCache;
+    VkPipelineCache                 pipelineCache;
+    
+    std::vector<Kernel>             kernels;
+    std::map<std::pair<std::string, std::tuple<uint32_t, uint32_t, uint32_t>>, KernelId> kernelLookup;
+    std::map<std::string, VkShaderModule> shaderModules;
+    
+    std::vector<Stage>              stages;
+    std::map<ResourceKey, BufferState> bufferStates;
+    uint32_t                        levelCount = 0;
+    
+    std::vector<Transient>          transients;
+    VulkanAllocation                transientAllocation;
+    VulkanMemoryPlan                memoryPlan;
+    bool                            isPlanned = true;
+    
+    VkCommandPool                   commandPool;
+    VkCommandBuffer                 commandBuffer;
+    VulkanDescriptorAllocator       descriptorAllocator;
+    VulkanSubmission                lastSubmission;
+    std::optional<uint32_t>         queueIndex;
+    bool                            isRecorded = false;
+    
+    const Kernel& validateDispatch(KernelId kernel, std::span<const VulkanGraphBinding> bindings, std::span<const std::byte> pushConstants) const;
+    
+    // Places the stage in its level, and updates what every buffer it touches was last used by.
+    void addStage(Stage stage, std::span<const std::pair<ResourceKey, VulkanAccess>> accesses);
+    
+    static ResourceKey getResourceKey(const VulkanGraphBinding& binding);
+    VkBuffer getBuffer(const VulkanGraphBinding& binding) const;
+    
+    // Works out the transient buffers' lifetimes from the levels that use them, and gives them memory.
+    void planTransients();
+    void destroyTransients();
+    
+    void record();
+    void recordStage(const Stage& stage);
+
+};
+
+#endif /* VulkanComputeGraph_hpp */
@@ -8,10 +8,13 @@
 #ifndef VulkanDebugUtils_hpp
 #define VulkanDebugUtils_hpp
 
+#include <stdexcept>
 #include <stdio.h>
 #include <vulkan/vulkan.h>
 #include <vector>
 
+#define VK_ASSERT_SUCCESS(result, message) if (result != VK_SUCCESS) { throw std::runtime_error(message); }
+
 namespace VulkanDebugUtils {
 
 const std::vector<const char*> validationLayers = { "VK_LAYER_KHRONOS_validation" };
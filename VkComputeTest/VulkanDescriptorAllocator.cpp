@@ -0,0 +1,184 @@
+//
+//  VulkanDescriptorAllocator.cpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/31/21.
+//
+
+#include <algorithm>
+#include <functional>
+
+#include "VulkanDebugUtils.hpp"
+#include "VulkanDescriptorAllocator.hpp"
+
+// MARK: - Key
+
+bool VulkanDescriptorAllocator::Key::operator==(const Key& other) const
+{
+    return layout == other.layout && std::equal(buffers.begin(), buffers.end(), other.buffers.begin(), other.buffers.end(),
+                                                [](const VkDescriptorBufferInfo& a, const VkDescriptorBufferInfo& b) {
+        return a.buffer == b.buffer && a.offset == b.offset && a.range == b.range;
+    });
+}
+
+size_t VulkanDescriptorAllocator::KeyHash::operator()(const Key& key) const
+{
+    size_t hash = std::hash<VkDescriptorSetLayout>()(key.layout);
+    
+    auto combine = [&](size_t value) {
+        hash ^= value + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+    };
+    
+    for (const auto& buffer : key.buffers)
+    {
+        combine(std::hash<VkBuffer>()(buffer.buffer));
+        combine(std::hash<VkDeviceSize>()(buffer.offset));
+        combine(std::hash<VkDeviceSize>()(buffer.range));
+    }
+    
+    return hash;
+}
+
+// MARK: - Constructor
+
+VulkanDescriptorAllocator::VulkanDescriptorAllocator(VkDevice logicalDevice, uint32_t initialSetCount, uint32_t maxCachedSets)
+: logicalDevice(logicalDevice)
+, maxCachedSets(maxCachedSets)
+{
+    createPool(std::max(initialSetCount, 1u));
+}
+
+// MARK: - Destructor
+
+VulkanDescriptorAllocator::~VulkanDescriptorAllocator()
+{
+    // Destroying a pool frees every set that came from it.
+    for (const Pool& pool : pools)
+    {
+        vkDestroyDescriptorPool(logicalDevice, pool.pool, nullptr);
+    }
+}
+
+// MARK: - Pools
+
+void VulkanDescriptorAllocator::createPool(uint32_t setCount)
+{
+    VkDescriptorPoolSize poolSize{};
+    poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSize.descriptorCount = setCount * descriptorsPerSet;
+    
+    // No FREE_DESCRIPTOR_SET_BIT. Sets only ever go back all at once, which lets the driver use a simple linear pool.
+    VkDescriptorPoolCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    createInfo.pNext = nullptr;
+    createInfo.flags = 0;
+    createInfo.maxSets = setCount;
+    createInfo.poolSizeCount = 1;
+    createInfo.pPoolSizes = &poolSize;
+    
+    VkDescriptorPool pool;
+    VK_ASSERT_SUCCESS(vkCreateDescriptorPool(logicalDevice, &createInfo, nullptr, &pool),
+                      "Failed to create descriptor pool!");
+    
+    pools.push_back({ pool, setCount });
+}
+
+VkDescriptorSet VulkanDescriptorAllocator::allocate(VkDescriptorSetLayout layout)
+{
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.pNext = nullptr;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &layout;
+    
+    while (true)
+    {
+        Pool& pool = pools[currentPool];
+        allocInfo.descriptorPool = pool.pool;
+        
+        VkDescriptorSet descriptorSet;
+        VkResult result = vkAllocateDescriptorSets(logicalDevice, &allocInfo, &descriptorSet);
+        
+        if (result == VK_SUCCESS)
+        {
+            pool.allocatedCount += 1;
+            return descriptorSet;
+        }
+        
+        if (result != VK_ERROR_OUT_OF_POOL_MEMORY && result != VK_ERROR_FRAGMENTED_POOL)
+        {
+            VK_ASSERT_SUCCESS(result, "Failed to allocate descriptor set!");
+        }
+        
+        // A set that doesn't fit in an empty pool of the largest size never will.
+        if (pool.allocatedCount == 0 && pool.setCount == maxSetsPerPool)
+        {
+            throw std::runtime_error("Descriptor set is too large for a descriptor pool!");
+        }
+        
+        if (++currentPool == pools.size())
+        {
+            createPool(std::min(pools.back().setCount * 2, maxSetsPerPool));
+        }
+    }
+}
+
+// MARK: - Sets
+
+VkDescriptorSet VulkanDescriptorAllocator::getStorageBufferSet(VkDescriptorSetLayout layout, std::span<const VkDescriptorBufferInfo> buffers)
+{
+    Key key{ layout, std::vector<VkDescriptorBufferInfo>(buffers.begin(), buffers.end()) };
+    
+    auto it = cache.find(key);
+    if (it != cache.end())
+    {
+        return it->second;
+    }
+    
+    VkDescriptorSet descriptorSet = allocate(layout);
+    
+    std::vector<VkWriteDescriptorSet> writeDescriptorSets;
+    for (uint32_t binding = 0; binding < buffers.size(); ++binding)
+    {
+        VkWriteDescriptorSet writeDescriptorSet{};
+        writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writeDescriptorSet.pNext = nullptr;
+        writeDescriptorSet.dstSet = descriptorSet;
+        writeDescriptorSet.dstBinding = binding;
+        writeDescriptorSet.dstArrayElement = 0;
+        writeDescriptorSet.descriptorCount = 1;
+        writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writeDescriptorSet.pImageInfo = nullptr;
+        writeDescriptorSet.pBufferInfo = &buffers[binding];
+        writeDescriptorSet.pTexelBufferView = nullptr;
+        writeDescriptorSets.push_back(writeDescriptorSet);
+    }
+    
+    vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+    updateCount += 1;
+    
+    cache.emplace(std::move(key), descriptorSet);
+    return descriptorSet;
+}
+
+void VulkanDescriptorAllocator::recycle()
+{
+    if (cache.size() > maxCachedSets)
+    {
+        reset();
+    }
+}
+
+void VulkanDescriptorAllocator::reset()
+{
+    for (Pool& pool : pools)
+    {
+        VK_ASSERT_SUCCESS(vkResetDescriptorPool(logicalDevice, pool.pool, 0),
+                          "Failed to reset descriptor pool!");
+        
+        pool.allocatedCount = 0;
+    }
+    
+    currentPool = 0;
+    cache.clear();
+}
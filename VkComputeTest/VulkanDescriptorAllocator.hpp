@@ -0,0 +1,82 @@
+//
+//  VulkanDescriptorAllocator.hpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/31/21.
+//
+
+#ifndef VulkanDescriptorAllocator_hpp
+#define VulkanDescriptorAllocator_hpp
+
+#include <span>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// Hands out storage buffer descriptor sets from a chain of pools, and remembers what each set points at.
+// Asking again for the same layout and buffers returns the same set, without another vkUpdateDescriptorSets.
+// When a pool runs out, the next one in the chain is used, and a new one twice as big is added if there is none.
+// Sets are never freed one by one. Instead everything goes back at once with vkResetDescriptorPool, so an allocator
+// belongs to something that knows when the GPU is done with all of its sets, like a frame.
+class VulkanDescriptorAllocator {
+public:
+    VulkanDescriptorAllocator(VkDevice logicalDevice, uint32_t initialSetCount = 4, uint32_t maxCachedSets = 256);
+    ~VulkanDescriptorAllocator();
+    
+    VulkanDescriptorAllocator(const VulkanDescriptorAllocator&) = delete;
+    VulkanDescriptorAllocator& operator=(const VulkanDescriptorAllocator&) = delete;
+    
+    // Returns a set with buffers[i] bound as a storage buffer at binding i.
+    VkDescriptorSet getStorageBufferSet(VkDescriptorSetLayout layout, std::span<const VkDescriptorBufferInfo> buffers);
+    
+    // Call only once the GPU is done with every set handed out so far. Resets the pools if the cache has grown past
+    // maxCachedSets, and otherwise keeps every set, so the next lookups still hit.
+    void recycle();
+    
+    // Call only once the GPU is done with every set handed out so far. Every set is invalid afterwards.
+    void reset();
+    
+    // How many sets have been written, over the allocator's lifetime. Cache hits don't count.
+    uint64_t getUpdateCount() const { return updateCount; }
+
+private:
+    
+    struct Key
+    {
+        VkDescriptorSetLayout               layout;
+        std::vector<VkDescriptorBufferInfo> buffers;
+        
+        bool operator==(const Key& other) const;
+    };
+    
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const;
+    };
+    
+    struct Pool
+    {
+        VkDescriptorPool                    pool;
+        uint32_t                            setCount;
+        
+        // Sets allocated since the pool was created or last reset.
+        uint32_t                            allocatedCount = 0;
+    };
+    
+    // Storage buffer descriptors each pool holds per set, on average. Sets with more bindings just fill a pool sooner.
+    static constexpr uint32_t descriptorsPerSet = 4;
+    static constexpr uint32_t maxSetsPerPool = 1024;
+    
+    VkDevice                            logicalDevice;
+    uint32_t                            maxCachedSets;
+    std::vector<Pool>                   pools;
+    size_t                              currentPool = 0;
+    std::unordered_map<Key, VkDescriptorSet, KeyHash> cache;
+    uint64_t                            updateCount = 0;
+    
+    void createPool(uint32_t setCount);
+    VkDescriptorSet allocate(VkDescriptorSetLayout layout);
+
+};
+
+#endif /* VulkanDescriptorAllocator_hpp */
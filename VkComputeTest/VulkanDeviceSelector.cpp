@@ -0,0 +1,347 @@
+//
+//  VulkanDeviceSelector.cpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/30/21.
+//
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+
+#include "FileUtils.hpp"
+#include "VulkanDeviceSelector.hpp"
+
+static std::string formatHex(const uint8_t* bytes, size_t count)
+{
+    std::string result;
+    for (size_t i = 0; i < count; ++i)
+    {
+        char hex[3];
+        snprintf(hex, sizeof(hex), "%02x", bytes[i]);
+        result += hex;
+    }
+    return result;
+}
+
+// MARK: - Constructor
+
+VulkanDeviceSelector::VulkanDeviceSelector(VkInstance instance, uint32_t instanceApiVersion, const std::string& cacheDirectory)
+: instance(instance)
+, instanceApiVersion(instanceApiVersion)
+, filePath(cacheDirectory + "/device_probes.txt")
+{
+    load();
+}
+
+// MARK: - Probing
+
+// vkGetPhysicalDeviceProperties2, VkPhysicalDeviceIDProperties and VkPhysicalDeviceSubgroupProperties are all core in
+// Vulkan 1.1, but only usable when the instance was created for 1.1 as well as the device supporting it.
+bool VulkanDeviceSelector::canQueryVulkan11Properties(const VkPhysicalDeviceProperties& properties) const
+{
+    return instanceApiVersion >= VK_API_VERSION_1_1 && properties.apiVersion >= VK_API_VERSION_1_1;
+}
+
+std::string VulkanDeviceSelector::getSignature(const VkPhysicalDeviceProperties& properties) const
+{
+    std::ostringstream stream;
+    stream << std::hex << properties.vendorID << "-" << properties.deviceID << "-" << properties.driverVersion << "-"
+           << formatHex(properties.pipelineCacheUUID, VK_UUID_SIZE) << (canQueryVulkan11Properties(properties) ? "" : "-1.0");
+    return stream.str();
+}
+
+// Identical GPUs, and the same GPU seen through two ICDs, share a signature and therefore a cached probe, so the UUID
+// that tells them apart is read again on every run instead of being cached.
+std::string VulkanDeviceSelector::getUUID(VkPhysicalDevice physicalDevice, const VkPhysicalDeviceProperties& properties) const
+{
+    if (!canQueryVulkan11Properties(properties))
+    {
+        return formatHex(properties.pipelineCacheUUID, VK_UUID_SIZE);
+    }
+    
+    auto getPhysicalDeviceProperties2 = reinterpret_cast<PFN_vkGetPhysicalDeviceProperties2>(vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceProperties2"));
+    
+    VkPhysicalDeviceIDProperties idProperties{};
+    idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+    idProperties.pNext = nullptr;
+    
+    VkPhysicalDeviceProperties2 properties2{};
+    properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties2.pNext = &idProperties;
+    
+    getPhysicalDeviceProperties2(physicalDevice, &properties2);
+    
+    return formatHex(idProperties.deviceUUID, VK_UUID_SIZE);
+}
+
+VulkanDeviceProbe VulkanDeviceSelector::probe(VkPhysicalDevice physicalDevice, const VkPhysicalDeviceProperties& properties) const
+{
+    VulkanDeviceProbe probe;
+    probe.name = properties.deviceName;
+    probe.deviceType = properties.deviceType;
+    
+    if (canQueryVulkan11Properties(properties))
+    {
+        auto getPhysicalDeviceProperties2 = reinterpret_cast<PFN_vkGetPhysicalDeviceProperties2>(vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceProperties2"));
+        
+        VkPhysicalDeviceSubgroupProperties subgroupProperties{};
+        subgroupProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+        subgroupProperties.pNext = nullptr;
+        
+        VkPhysicalDeviceProperties2 properties2{};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties2.pNext = &subgroupProperties;
+        
+        getPhysicalDeviceProperties2(physicalDevice, &properties2);
+        
+        probe.subgroupSize = subgroupProperties.subgroupSize;
+    }
+    
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+    
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; ++i)
+    {
+        if (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+        {
+            probe.deviceLocalBytes = std::max(probe.deviceLocalBytes, memoryProperties.memoryHeaps[i].size);
+        }
+    }
+    
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+    
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+    
+    for (const auto& queueFamily : queueFamilies)
+    {
+        if ((queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT) && !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT))
+        {
+            probe.hasDedicatedComputeQueue = true;
+        }
+    }
+    
+    return probe;
+}
+
+// Devices that are already in the cache only get vkGetPhysicalDeviceProperties, to tell whether the cached probe still
+// describes the device, the UUID query and the caller's suitability check, which is much cheaper than probing
+// everything again.
+void VulkanDeviceSelector::probeDevices(const SuitabilityCheck& isSuitable)
+{
+    uint32_t physicalDeviceCount = 0;
+    vkEnumeratePhysicalDevices(instance, &physicalDeviceCount, nullptr);
+    
+    physicalDevices.resize(physicalDeviceCount);
+    vkEnumeratePhysicalDevices(instance, &physicalDeviceCount, physicalDevices.data());
+    
+    probes.clear();
+    bool cacheChanged = false;
+    
+    for (VkPhysicalDevice physicalDevice : physicalDevices)
+    {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        
+        std::string signature = getSignature(properties);
+        
+        auto it = cachedProbes.find(signature);
+        if (it == cachedProbes.end())
+        {
+            it = cachedProbes.emplace(signature, probe(physicalDevice, properties)).first;
+            cacheChanged = true;
+        }
+        
+        probes.push_back(it->second);
+        probes.back().uuid = getUUID(physicalDevice, properties);
+        probes.back().isSuitable = isSuitable(physicalDevice);
+    }
+    
+    if (cacheChanged)
+    {
+        save();
+    }
+}
+
+// MARK: - Selection
+
+// Compared lexicographically. Memory is rounded down to whole GiB, so small differences between otherwise equal
+// devices don't outweigh a dedicated compute queue.
+VulkanDeviceSelector::Rank VulkanDeviceSelector::getRank(const VulkanDeviceProbe& probe)
+{
+    int typeRank = 0;
+    switch (probe.deviceType)
+    {
+        case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: typeRank = 4; break;
+        case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: typeRank = 3; break;
+        case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: typeRank = 2; break;
+        case VK_PHYSICAL_DEVICE_TYPE_CPU: typeRank = 1; break;
+        default: typeRank = 0; break;
+    }
+    
+    return { typeRank, probe.deviceLocalBytes >> 30, probe.hasDedicatedComputeQueue, probe.subgroupSize };
+}
+
+static bool isIndex(const std::string& text)
+{
+    return !text.empty() && std::all_of(text.begin(), text.end(), [](char c) { return c >= '0' && c <= '9'; });
+}
+
+static std::string normalizeUUID(const std::string& text)
+{
+    std::string uuid;
+    for (char c : text)
+    {
+        if (c != '-')
+        {
+            uuid += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        }
+    }
+    return uuid;
+}
+
+VkPhysicalDevice VulkanDeviceSelector::select(const std::string& preference, const SuitabilityCheck& isSuitable)
+{
+    probeDevices(isSuitable);
+    
+    if (physicalDevices.empty())
+    {
+        throw std::runtime_error("Failed to find any GPUs with Vulkan support!");
+    }
+    
+    std::string deviceOverride = preference;
+    const char* environmentValue = std::getenv(environmentVariable);
+    
+    if (deviceOverride.empty() && environmentValue != nullptr)
+    {
+        deviceOverride = environmentValue;
+    }
+    
+    if (!deviceOverride.empty())
+    {
+        for (size_t i = 0; i < probes.size(); ++i)
+        {
+            bool matches = isIndex(deviceOverride) ? std::stoul(deviceOverride) == i : normalizeUUID(deviceOverride) == probes[i].uuid;
+            
+            if (matches && probes[i].isSuitable)
+            {
+                return physicalDevices[i];
+            }
+        }
+        
+        throw std::runtime_error("No suitable GPU matches the device override \"" + deviceOverride + "\"! Available devices:\n" + formatDevices());
+    }
+    
+    // Ties go to the device that was enumerated first.
+    std::optional<size_t> bestIndex;
+    for (size_t i = 0; i < probes.size(); ++i)
+    {
+        if (probes[i].isSuitable && (!bestIndex || getRank(probes[i]) > getRank(probes[*bestIndex])))
+        {
+            bestIndex = i;
+        }
+    }
+    
+    if (!bestIndex)
+    {
+        throw std::runtime_error("Failed to find a suitable GPU!");
+    }
+    
+    return physicalDevices[*bestIndex];
+}
+
+std::string VulkanDeviceSelector::formatDevices() const
+{
+    std::ostringstream stream;
+    
+    for (size_t i = 0; i < probes.size(); ++i)
+    {
+        const auto& probe = probes[i];
+        
+        stream << i << ": " << probe.name << " (uuid " << probe.uuid << ", "
+               << (probe.deviceLocalBytes >> 20) << " MiB device local, "
+               << (probe.hasDedicatedComputeQueue ? "dedicated compute queue, " : "")
+               << "subgroup size " << probe.subgroupSize
+               << (probe.isSuitable ? "" : ", unsuitable") << ")\n";
+    }
+    
+    return stream.str();
+}
+
+// MARK: - Persistence
+
+// A version line, then one device per line:
+// "<signature> <type> <device local bytes> <dedicated compute> <subgroup size> <name>".
+// The name is last because it can contain spaces. Malformed lines are skipped, and a version mismatch drops everything.
+void VulkanDeviceSelector::load()
+{
+    std::lock_guard<std::mutex> lock(FileUtils::getCacheMutex());
+    merge();
+}
+
+// Probes already in memory win, since they were just made.
+void VulkanDeviceSelector::merge()
+{
+    auto data = FileUtils::readFileIfPresent(filePath);
+    if (!data)
+    {
+        return;
+    }
+    
+    std::istringstream stream(std::string(data->begin(), data->end()));
+    std::string line;
+    
+    std::string keyword;
+    uint32_t version = 0;
+    if (!std::getline(stream, line) || !(std::istringstream(line) >> keyword >> version) || keyword != "version" || version != cacheVersion)
+    {
+        return;
+    }
+    
+    while (std::getline(stream, line))
+    {
+        std::istringstream lineStream(line);
+        std::string signature;
+        int deviceType;
+        VulkanDeviceProbe probe;
+        
+        if (lineStream >> signature >> deviceType >> probe.deviceLocalBytes
+                       >> probe.hasDedicatedComputeQueue >> probe.subgroupSize)
+        {
+            probe.deviceType = static_cast<VkPhysicalDeviceType>(deviceType);
+            
+            std::getline(lineStream >> std::ws, probe.name);
+            cachedProbes.try_emplace(signature, probe);
+        }
+    }
+}
+
+void VulkanDeviceSelector::save()
+{
+    // Another application may have probed other devices since this one loaded, e.g. through a 1.0 instance.
+    std::lock_guard<std::mutex> lock(FileUtils::getCacheMutex());
+    merge();
+    
+    std::ostringstream stream;
+    stream << "version " << cacheVersion << "\n";
+    
+    for (auto& [signature, probe] : cachedProbes)
+    {
+        stream << signature << " " << probe.deviceType << " " << probe.deviceLocalBytes << " "
+               << probe.hasDedicatedComputeQueue << " " << probe.subgroupSize << " " << probe.name << "\n";
+    }
+    
+    std::string text = stream.str();
+    
+    if (!FileUtils::writeFileAtomically(filePath, std::vector<char>(text.begin(), text.end())))
+    {
+        std::cerr << "Failed to write device probes to " << filePath << std::endl;
+    }
+}
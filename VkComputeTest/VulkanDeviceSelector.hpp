@@ -0,0 +1,102 @@
+//
+//  VulkanDeviceSelector.hpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/30/21.
+//
+
+#ifndef VulkanDeviceSelector_hpp
+#define VulkanDeviceSelector_hpp
+
+#include <functional>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// Everything the selector needs to rank a physical device. Probes are cached on disk, keyed by the device's
+// vendor ID, device ID, driver version and pipelineCacheUUID, so a driver update probes the device again. Only what the
+// device itself reports is cached, since callers with different requirements share the cache, and the UUID isn't,
+// since identical devices share a signature.
+struct VulkanDeviceProbe
+{
+    std::string             name;
+    
+    // The deviceUUID as 32 hex digits, or the pipelineCacheUUID when the instance or device is older than Vulkan 1.1.
+    // Queried again on every select(), never cached.
+    std::string             uuid;
+    
+    VkPhysicalDeviceType    deviceType = VK_PHYSICAL_DEVICE_TYPE_OTHER;
+    
+    // The largest DEVICE_LOCAL heap.
+    VkDeviceSize            deviceLocalBytes = 0;
+    
+    // A queue family with compute but no graphics, which usually means an async compute engine.
+    bool                    hasDedicatedComputeQueue = false;
+    
+    // Zero when the instance or device is older than Vulkan 1.1.
+    uint32_t                subgroupSize = 0;
+    
+    // Whether the caller's SuitabilityCheck accepts the device. Checked again on every select(), never cached.
+    bool                    isSuitable = false;
+};
+
+// Ranks every suitable physical device by type, DEVICE_LOCAL memory, dedicated compute queues and subgroup size,
+// and picks the best one. The choice can be overridden with a device index or UUID.
+class VulkanDeviceSelector {
+public:
+    using SuitabilityCheck = std::function<bool(VkPhysicalDevice physicalDevice)>;
+    
+    // Used when no preference is configured. An explicit preference wins, so callers that bind one application
+    // per device aren't all redirected to the same one.
+    static constexpr const char* environmentVariable = "VKCOMPUTE_DEVICE";
+    
+    // instanceApiVersion is the apiVersion the instance was created with. The deviceUUID and subgroup size are only
+    // probed when it and the device are both Vulkan 1.1.
+    VulkanDeviceSelector(VkInstance instance, uint32_t instanceApiVersion, const std::string& cacheDirectory);
+    
+    // preference is empty to pick automatically, a decimal index into vkEnumeratePhysicalDevices, or a device UUID
+    // as printed by formatDevices(), with or without dashes. Throws if nothing suitable matches.
+    VkPhysicalDevice select(const std::string& preference, const SuitabilityCheck& isSuitable);
+    
+    // One line per device, in enumeration order, with the UUID and rank. Useful for picking an override.
+    std::string formatDevices() const;
+
+private:
+    
+    using Rank = std::tuple<int, VkDeviceSize, bool, uint32_t>;
+    
+    static constexpr uint32_t cacheVersion = 3;
+    
+    VkInstance                              instance;
+    uint32_t                                instanceApiVersion;
+    std::string                             filePath;
+    std::vector<VkPhysicalDevice>           physicalDevices;
+    std::vector<VulkanDeviceProbe>          probes;
+    
+    // Cached probes, keyed by getSignature().
+    std::map<std::string, VulkanDeviceProbe> cachedProbes;
+    
+    // Includes whether the Vulkan 1.1 properties could be queried, since probes made without them are less complete.
+    std::string getSignature(const VkPhysicalDeviceProperties& properties) const;
+    bool canQueryVulkan11Properties(const VkPhysicalDeviceProperties& properties) const;
+    static Rank getRank(const VulkanDeviceProbe& probe);
+    
+    std::string getUUID(VkPhysicalDevice physicalDevice, const VkPhysicalDeviceProperties& properties) const;
+    
+    VulkanDeviceProbe probe(VkPhysicalDevice physicalDevice, const VkPhysicalDeviceProperties& properties) const;
+    
+    // Probes the devices that aren't in the cache, and saves the cache if any were. Every device is checked for
+    // suitability, cached or not.
+    void probeDevices(const SuitabilityCheck& isSuitable);
+    
+    void load();
+    void save();
+    
+    // Adds the probes on disk that aren't in memory. The caller holds FileUtils::getCacheMutex().
+    void merge();
+
+};
+
+#endif /* VulkanDeviceSelector_hpp */
@@ -0,0 +1,97 @@
+//
+//  VulkanKernels.cpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/27/21.
+//
+
+#include <array>
+#include <stdexcept>
+#include <string>
+
+#include "VulkanKernels.hpp"
+
+// The Compile Shaders build phase runs glslc -mfmt=num over shaders/*.comp, which writes each module as a comma separated
+// list of words into $(DERIVED_FILE_DIR)/shaders/<file>.inc.
+
+static constexpr uint32_t simpleKernelCode[] = {
+#include "shaders/simple.comp.inc"
+};
+
+static constexpr uint32_t copyKernelCode[] = {
+#include "shaders/copy.comp.inc"
+};
+
+static constexpr uint32_t reduceKernelCode[] = {
+#include "shaders/reduce.comp.inc"
+};
+
+static constexpr uint32_t reduceSharedKernelCode[] = {
+#include "shaders/reduce_shared.comp.inc"
+};
+
+static constexpr uint32_t scanReduceKernelCode[] = {
+#include "shaders/scan_reduce.comp.inc"
+};
+
+static constexpr uint32_t scanTilesKernelCode[] = {
+#include "shaders/scan_tiles.comp.inc"
+};
+
+static constexpr uint32_t radixHistogramKernelCode[] = {
+#include "shaders/radix_histogram.comp.inc"
+};
+
+static constexpr uint32_t radixScatterKernelCode[] = {
+#include "shaders/radix_scatter.comp.inc"
+};
+
+static constexpr uint32_t compactKernelCode[] = {
+#include "shaders/compact.comp.inc"
+};
+
+static constexpr uint32_t compactArgumentsKernelCode[] = {
+#include "shaders/compact_arguments.comp.inc"
+};
+
+static constexpr std::array<VulkanKernels::Kernel, 10> kernels = {{
+    { "simple", "main", simpleKernelCode },
+    { "copy", "main", copyKernelCode },
+    { "reduce", "main", reduceKernelCode },
+    { "reduce_shared", "main", reduceSharedKernelCode },
+    { "scan_reduce", "main", scanReduceKernelCode },
+    { "scan_tiles", "main", scanTilesKernelCode },
+    { "radix_histogram", "main", radixHistogramKernelCode },
+    { "radix_scatter", "main", radixScatterKernelCode },
+    { "compact", "main", compactKernelCode },
+    { "compact_arguments", "main", compactArgumentsKernelCode },
+}};
+
+std::span<const VulkanKernels::Kernel> VulkanKernels::getKernels()
+{
+    return kernels;
+}
+
+const VulkanKernels::Kernel& VulkanKernels::getKernel(std::string_view name)
+{
+    for (const Kernel& kernel : kernels)
+    {
+        if (kernel.name == name)
+        {
+            return kernel;
+        }
+    }
+    
+    throw std::runtime_error("Unknown kernel: " + std::string(name));
+}
+
+uint32_t VulkanKernels::getPowerOfTwoLocalSize(const VkPhysicalDeviceLimits& limits, uint32_t preferred)
+{
+    uint32_t localSize = 1;
+    while (localSize * 2 <= preferred && localSize * 2 <= limits.maxComputeWorkGroupInvocations && localSize * 2 <= limits.maxComputeWorkGroupSize[0])
+    {
+        localSize *= 2;
+    }
+    
+    return localSize;
+}
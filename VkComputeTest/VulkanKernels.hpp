@@ -0,0 +1,209 @@
+//
+//  VulkanKernels.hpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/27/21.
+//
+
+#ifndef VulkanKernels_hpp
+#define VulkanKernels_hpp
+
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vulkan/vulkan.h>
+
+namespace VulkanKernels {
+
+// A compute kernel compiled to SPIR-V at build time and embedded in the binary.
+struct Kernel
+{
+    std::string_view            name;
+    const char*                 entryPoint;
+    std::span<const uint32_t>   code;
+};
+
+// Per-dispatch arguments for simple.comp, laid out to match its push_constant block.
+struct SimpleParameters
+{
+    // Invocations at or past this index return without touching memory.
+    uint32_t elementCount = 0;
+    
+    // Elements per row of the dispatch grid. gID = rowStride * (baseRow + x) + y.
+    uint32_t rowStride = 0;
+    
+    // Where the kernel starts reading and writing, in elements, so one buffer can hold several jobs.
+    uint32_t inputOffset = 0;
+    uint32_t outputOffset = 0;
+    
+    // Added to gl_GlobalInvocationID.x, so a grid too big for one dispatch can be split into several.
+    uint32_t baseRow = 0;
+    
+    // Keeps the block a multiple of 8 bytes.
+    uint32_t padding = 0;
+    
+    bool operator==(const SimpleParameters&) const = default;
+};
+
+// Per-dispatch arguments for copy.comp, laid out to match its push_constant block.
+struct CopyParameters
+{
+    // How many 16 byte vectors to copy.
+    uint32_t vectorCount = 0;
+    
+    // Keeps the block a multiple of 8 bytes.
+    uint32_t padding = 0;
+};
+
+// Mirrors the Operation constants in reduce.glsl.
+enum class ReduceOperation : uint32_t
+{
+    Sum,
+    Min,
+    Max,
+    
+    // The largest value and the lowest index it's found at.
+    ArgMax,
+};
+
+// Mirrors the Type constants in reduce.glsl.
+enum class ElementType : uint32_t
+{
+    U32,
+    I32,
+    F32,
+    
+    // Packed two to a 32-bit word, low half first. Reduced as f32.
+    F16,
+};
+
+// Per-dispatch arguments for reduce.comp and reduce_shared.comp, laid out to match their push_constant block.
+struct ReduceParameters
+{
+    // Elements, or partials when isPartialInput is set. Halves are counted one by one.
+    uint32_t elementCount = 0;
+    
+    ReduceOperation operation = ReduceOperation::Sum;
+    ElementType elementType = ElementType::U32;
+    
+    // Nonzero when the input is the uvec2 partials written by an earlier pass.
+    uint32_t isPartialInput = 0;
+};
+
+// Elements each invocation of the scan and radix sort kernels handles, so a tile is this many workgroups wide.
+// Mirrors itemsPerInvocation in their sources.
+constexpr uint32_t scanItemsPerInvocation = 4;
+
+// The bits of the key each radix sort pass looks at. Mirrors radixSize in radix.glsl, which is 1 << radixBits.
+constexpr uint32_t radixBits = 4;
+
+// Per-dispatch arguments for scan_reduce.comp and scan_tiles.comp, laid out to match their push_constant block.
+struct ScanParameters
+{
+    uint32_t elementCount = 0;
+    
+    // Whether each output includes its own element.
+    uint32_t isInclusive = 0;
+    
+    // Whether each tile starts from its entry in the tile offsets rather than from zero.
+    uint32_t hasTileOffsets = 0;
+    
+    // Keeps the block a multiple of 8 bytes.
+    uint32_t padding = 0;
+};
+
+// Per-dispatch arguments for radix_histogram.comp and radix_scatter.comp, laid out to match their push_constant block.
+struct RadixSortParameters
+{
+    uint32_t elementCount = 0;
+    
+    // 1 for 32-bit keys, 2 for 64-bit keys stored low word first.
+    uint32_t keyWords = 1;
+    
+    // The lowest bit of the digit this pass sorts by.
+    uint32_t shift = 0;
+    
+    uint32_t tileCount = 0;
+    uint32_t hasValues = 0;
+    
+    // Keeps the block a multiple of 8 bytes.
+    uint32_t padding = 0;
+};
+
+// Mirrors the comparison constants in compact.comp. Elements pass when element <operation> threshold holds.
+enum class CompareOperation : uint32_t
+{
+    Equal,
+    NotEqual,
+    Less,
+    LessOrEqual,
+    Greater,
+    GreaterOrEqual,
+};
+
+// Per-dispatch arguments for compact.comp, laid out to match its push_constant block.
+struct CompactParameters
+{
+    // The most elements to look at. With an input counter, the count in it if that's fewer.
+    uint32_t elementCount = 0;
+    
+    CompareOperation operation = CompareOperation::NotEqual;
+    
+    // U32, I32 or F32.
+    ElementType elementType = ElementType::U32;
+    
+    // The bits of a value of elementType.
+    uint32_t threshold = 0;
+    
+    uint32_t hasIndices = 0;
+    uint32_t hasInputCounter = 0;
+};
+
+// Per-dispatch arguments for compact_arguments.comp, laid out to match its push_constant block.
+struct CompactArgumentsParameters
+{
+    uint32_t groupWidth = 0;
+    uint32_t maxGroupCount = 0;
+};
+
+// What compact.comp counts survivors into, and compact_arguments.comp then turns into the arguments of an indirect
+// dispatch with one invocation per survivor. The count has to be zero before each compaction.
+struct CompactionCounter
+{
+    uint32_t count = 0;
+    VkDispatchIndirectCommand arguments = { 0, 0, 0 };
+};
+
+// The largest power of two up to preferred that the device takes as the width of a one dimensional workgroup.
+uint32_t getPowerOfTwoLocalSize(const VkPhysicalDeviceLimits& limits, uint32_t preferred);
+
+// The push constant range a pipeline layout needs for a parameter block.
+// Every implementation supports at least 128 bytes, so blocks that fit need no device check.
+template <typename Parameters>
+VkPushConstantRange getPushConstantRange()
+{
+    static_assert(sizeof(Parameters) % 4 == 0, "Push constant blocks must be a multiple of 4 bytes!");
+    static_assert(sizeof(Parameters) <= 128, "Push constant blocks must fit in the guaranteed 128 bytes!");
+    
+    VkPushConstantRange range{};
+    range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    range.offset = 0;
+    range.size = sizeof(Parameters);
+    return range;
+}
+
+template <typename Parameters>
+void cmdPushParameters(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, const Parameters& parameters)
+{
+    vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(Parameters), &parameters);
+}
+
+// Every kernel in the shaders directory, named after its source file without the extension.
+std::span<const Kernel> getKernels();
+
+// Throws if no kernel has that name.
+const Kernel& getKernel(std::string_view name);
+    
+}
+
+#endif /* VulkanKernels_hpp */
@@ -0,0 +1,133 @@
+//
+//  VulkanLayoutCache.cpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/31/21.
+//
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "VulkanDebugUtils.hpp"
+#include "VulkanLayoutCache.hpp"
+
+// MARK: - Constructor
+
+VulkanLayoutCache::VulkanLayoutCache(VkDevice logicalDevice)
+: logicalDevice(logicalDevice)
+{
+}
+
+// MARK: - Destructor
+
+VulkanLayoutCache::~VulkanLayoutCache()
+{
+    // Pipeline layouts first, since they refer to the set layouts.
+    for (const auto& [key, pipelineLayout] : pipelineLayouts)
+    {
+        vkDestroyPipelineLayout(logicalDevice, pipelineLayout, nullptr);
+    }
+    
+    for (const auto& [key, descriptorSetLayout] : descriptorSetLayouts)
+    {
+        vkDestroyDescriptorSetLayout(logicalDevice, descriptorSetLayout, nullptr);
+    }
+}
+
+// MARK: - Descriptor Set Layouts
+
+VkDescriptorSetLayout VulkanLayoutCache::getDescriptorSetLayout(std::span<const VulkanShaderBinding> bindings)
+{
+    std::vector<VulkanShaderBinding> key(bindings.begin(), bindings.end());
+    for (VulkanShaderBinding& binding : key)
+    {
+        if (binding.set != bindings.front().set)
+        {
+            throw std::runtime_error("Bindings for one descriptor set layout span several sets!");
+        }
+        binding.set = 0;
+    }
+    
+    auto it = descriptorSetLayouts.find(key);
+    if (it != descriptorSetLayouts.end())
+    {
+        return it->second;
+    }
+    
+    std::vector<VkDescriptorSetLayoutBinding> layoutBindings;
+    for (const VulkanShaderBinding& binding : key)
+    {
+        VkDescriptorSetLayoutBinding layoutBinding{};
+        layoutBinding.binding = binding.binding;
+        layoutBinding.descriptorType = binding.descriptorType;
+        layoutBinding.descriptorCount = binding.descriptorCount;
+        layoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        layoutBinding.pImmutableSamplers = nullptr;
+        layoutBindings.push_back(layoutBinding);
+    }
+    
+    VkDescriptorSetLayoutCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    createInfo.pNext = nullptr;
+    createInfo.flags = 0;
+    createInfo.bindingCount = static_cast<uint32_t>(layoutBindings.size());
+    createInfo.pBindings = layoutBindings.data();
+    
+    VkDescriptorSetLayout descriptorSetLayout;
+    VK_ASSERT_SUCCESS(vkCreateDescriptorSetLayout(logicalDevice, &createInfo, nullptr, &descriptorSetLayout),
+                      "Failed to create descriptor set layout!");
+    
+    descriptorSetLayouts.emplace(std::move(key), descriptorSetLayout);
+    return descriptorSetLayout;
+}
+
+VkDescriptorSetLayout VulkanLayoutCache::getDescriptorSetLayout(const VulkanShaderReflection& reflection, uint32_t set)
+{
+    // Bindings are sorted by set, so the set's bindings are one contiguous run.
+    const auto& bindings = reflection.getBindings();
+    auto first = std::find_if(bindings.begin(), bindings.end(), [&](const auto& binding) { return binding.set == set; });
+    auto last = std::find_if(first, bindings.end(), [&](const auto& binding) { return binding.set != set; });
+    
+    return getDescriptorSetLayout(std::span<const VulkanShaderBinding>(first, last));
+}
+
+// MARK: - Pipeline Layouts
+
+VkPipelineLayout VulkanLayoutCache::getPipelineLayout(const VulkanShaderReflection& reflection)
+{
+    std::vector<VkDescriptorSetLayout> setLayouts;
+    for (uint32_t set = 0; set < reflection.getSetCount(); ++set)
+    {
+        setLayouts.push_back(getDescriptorSetLayout(reflection, set));
+    }
+    
+    uint32_t pushConstantSize = reflection.getPushConstantSize();
+    
+    auto key = std::make_pair(setLayouts, pushConstantSize);
+    auto it = pipelineLayouts.find(key);
+    if (it != pipelineLayouts.end())
+    {
+        return it->second;
+    }
+    
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = pushConstantSize;
+    
+    VkPipelineLayoutCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    createInfo.pNext = nullptr;
+    createInfo.flags = 0;
+    createInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+    createInfo.pSetLayouts = setLayouts.data();
+    createInfo.pushConstantRangeCount = pushConstantSize > 0 ? 1 : 0;
+    createInfo.pPushConstantRanges = pushConstantSize > 0 ? &pushConstantRange : nullptr;
+    
+    VkPipelineLayout pipelineLayout;
+    VK_ASSERT_SUCCESS(vkCreatePipelineLayout(logicalDevice, &createInfo, nullptr, &pipelineLayout),
+                      "Failed to create pipeline layout!");
+    
+    pipelineLayouts.emplace(std::move(key), pipelineLayout);
+    return pipelineLayout;
+}
@@ -0,0 +1,54 @@
+//
+//  VulkanLayoutCache.hpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/31/21.
+//
+
+#ifndef VulkanLayoutCache_hpp
+#define VulkanLayoutCache_hpp
+
+#include <map>
+#include <span>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "VulkanShaderReflection.hpp"
+
+// Builds descriptor set and pipeline layouts from reflected kernels, and hands back the same object for every kernel
+// with the same interface. Kernels that share a layout can share descriptor sets, and switching pipelines between
+// them keeps every bound set and push constant valid.
+class VulkanLayoutCache {
+public:
+    VulkanLayoutCache(VkDevice logicalDevice);
+    
+    // Destroys every layout it created.
+    ~VulkanLayoutCache();
+    
+    VulkanLayoutCache(const VulkanLayoutCache&) = delete;
+    VulkanLayoutCache& operator=(const VulkanLayoutCache&) = delete;
+    
+    // The layout for the bindings of one set. Every binding must have the same set number.
+    VkDescriptorSetLayout getDescriptorSetLayout(std::span<const VulkanShaderBinding> bindings);
+    
+    // The layout for one descriptor set of a kernel. A set number the kernel doesn't use gets an empty layout.
+    VkDescriptorSetLayout getDescriptorSetLayout(const VulkanShaderReflection& reflection, uint32_t set);
+    
+    // A layout with every set of the kernel, and a compute push constant range if the kernel has a block.
+    VkPipelineLayout getPipelineLayout(const VulkanShaderReflection& reflection);
+    
+    size_t getDescriptorSetLayoutCount() const { return descriptorSetLayouts.size(); }
+    size_t getPipelineLayoutCount() const { return pipelineLayouts.size(); }
+
+private:
+    
+    VkDevice                            logicalDevice;
+    
+    // Keyed by bindings with their set number cleared, so the same bindings in a different set share a layout.
+    std::map<std::vector<VulkanShaderBinding>, VkDescriptorSetLayout> descriptorSetLayouts;
+    std::map<std::pair<std::vector<VkDescriptorSetLayout>, uint32_t>, VkPipelineLayout> pipelineLayouts;
+
+};
+
+#endif /* VulkanLayoutCache_hpp */
@@ -0,0 +1,483 @@
+//
+//  VulkanMemoryAllocator.cpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/25/21.
+//
+
+#include <algorithm>
+
+#include "VulkanMemoryAllocator.hpp"
+
+#include "VulkanDebugUtils.hpp"
+
+// MARK: - Helpers
+
+static uint32_t countBits(uint32_t value)
+{
+    uint32_t count = 0;
+    for (; value != 0; value &= value - 1)
+    {
+        ++count;
+    }
+    return count;
+}
+
+static VkDeviceSize roundUpToPowerOfTwo(VkDeviceSize value)
+{
+    VkDeviceSize result = 1;
+    while (result < value)
+    {
+        result <<= 1;
+    }
+    return result;
+}
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static uint32_t getOrderForSize(VkDeviceSize size)
+{
+    uint32_t order = 0;
+    while ((VulkanMemoryAllocator::minimumNodeSize << order) < size)
+    {
+        ++order;
+    }
+    return order;
+}
+
+// MARK: - Constructor
+
+VulkanMemoryAllocator::VulkanMemoryAllocator(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, VkDeviceSize preferredBlockSize)
+: logicalDevice(logicalDevice)
+, preferredBlockSize(roundUpToPowerOfTwo(std::max(preferredBlockSize, minimumNodeSize)))
+{
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+    blocks.resize(memoryProperties.memoryTypeCount);
+    
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    
+    // Buddy nodes are at least minimumNodeSize (the largest atom size the spec allows), so they never share an atom.
+    nonCoherentAtomSize = std::max<VkDeviceSize>(properties.limits.nonCoherentAtomSize, 1);
+}
+
+// MARK: - Destructor
+
+VulkanMemoryAllocator::~VulkanMemoryAllocator()
+{
+    for (uint32_t memoryTypeIndex = 0; memoryTypeIndex < blocks.size(); ++memoryTypeIndex)
+    {
+        for (uint32_t blockIndex = 0; blockIndex < blocks[memoryTypeIndex].size(); ++blockIndex)
+        {
+            destroyBlock(memoryTypeIndex, blockIndex);
+        }
+    }
+}
+
+// MARK: - Memory Types
+
+uint32_t VulkanMemoryAllocator::findMemoryTypeIndex(uint32_t memoryTypeBits, VulkanMemoryUsage usage, VkDeviceSize size) const
+{
+    VkMemoryPropertyFlags requiredFlags = 0;
+    VkMemoryPropertyFlags preferredFlags = 0;
+    VkMemoryPropertyFlags unwantedFlags = 0;
+    
+    switch (usage)
+    {
+        case VulkanMemoryUsage::GpuOnly:
+            preferredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+            unwantedFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+            break;
+        case VulkanMemoryUsage::CpuToGpu:
+            requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+            preferredFlags = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+            unwantedFlags = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+            break;
+        case VulkanMemoryUsage::GpuToCpu:
+            // CPU reads from uncached memory are very slow, so cached memory wins even if it needs explicit invalidates.
+            requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+            preferredFlags = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+            break;
+    }
+    
+    // Memory types are ordered by the driver from fastest to slowest, so the first type with the lowest cost wins.
+    uint32_t bestMemoryTypeIndex = VK_MAX_MEMORY_TYPES;
+    uint32_t bestCost = UINT32_MAX;
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i)
+    {
+        const auto& memoryType = memoryProperties.memoryTypes[i];
+        
+        if (!(memoryTypeBits & (1u << i))
+            || (memoryType.propertyFlags & requiredFlags) != requiredFlags
+            || size > memoryProperties.memoryHeaps[memoryType.heapIndex].size)
+        {
+            continue;
+        }
+        
+        uint32_t cost = countBits(preferredFlags & ~memoryType.propertyFlags) + countBits(unwantedFlags & memoryType.propertyFlags);
+        if (cost < bestCost)
+        {
+            bestMemoryTypeIndex = i;
+            bestCost = cost;
+        }
+    }
+    
+    if (bestMemoryTypeIndex == VK_MAX_MEMORY_TYPES)
+    {
+        throw std::runtime_error("Failed to find suitable memory!");
+    }
+    
+    return bestMemoryTypeIndex;
+}
+
+VkDeviceSize VulkanMemoryAllocator::getBlockSize(uint32_t memoryTypeIndex) const
+{
+    // Small heaps (such as the 256 MB host-visible BAR on discrete GPUs) get proportionally smaller blocks.
+    const VkDeviceSize minimumBlockSize = 1024 * 1024;
+    VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryTypeIndex].heapIndex].size;
+    
+    VkDeviceSize blockSize = preferredBlockSize;
+    while (blockSize > heapSize / 8 && blockSize > minimumBlockSize)
+    {
+        blockSize >>= 1;
+    }
+    
+    return blockSize;
+}
+
+// MARK: - Blocks
+
+uint32_t VulkanMemoryAllocator::createBlock(uint32_t memoryTypeIndex, VkDeviceSize size, bool dedicated)
+{
+    auto block = std::make_unique<Block>();
+    block->size = size;
+    block->dedicated = dedicated;
+    
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.pNext = nullptr;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryTypeIndex;
+    
+    VK_ASSERT_SUCCESS(vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &block->memory),
+                      "Failed to allocate device memory!");
+    
+    // A VkDeviceMemory can only be mapped once, so host-visible blocks stay mapped for their whole lifetime.
+    if (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+    {
+        try
+        {
+            VK_ASSERT_SUCCESS(vkMapMemory(logicalDevice, block->memory, 0, VK_WHOLE_SIZE, 0, &block->mappedData),
+                              "Failed to map memory!");
+        } catch (...)
+        {
+            vkFreeMemory(logicalDevice, block->memory, nullptr);
+            throw;
+        }
+    }
+    
+    if (!dedicated)
+    {
+        block->maxOrder = getOrderForSize(size);
+        block->freeLists.resize(block->maxOrder + 1);
+        block->freeLists[block->maxOrder].insert(0);
+    }
+    
+    auto& memoryTypeBlocks = blocks[memoryTypeIndex];
+    for (uint32_t blockIndex = 0; blockIndex < memoryTypeBlocks.size(); ++blockIndex)
+    {
+        if (!memoryTypeBlocks[blockIndex])
+        {
+            memoryTypeBlocks[blockIndex] = std::move(block);
+            return blockIndex;
+        }
+    }
+    
+    memoryTypeBlocks.emplace_back(std::move(block));
+    return static_cast<uint32_t>(memoryTypeBlocks.size() - 1);
+}
+
+void VulkanMemoryAllocator::destroyBlock(uint32_t memoryTypeIndex, uint32_t blockIndex)
+{
+    auto& block = blocks[memoryTypeIndex][blockIndex];
+    if (!block)
+    {
+        return;
+    }
+    
+    if (block->mappedData != nullptr)
+    {
+        vkUnmapMemory(logicalDevice, block->memory);
+    }
+    
+    vkFreeMemory(logicalDevice, block->memory, nullptr);
+    block.reset();
+}
+
+bool VulkanMemoryAllocator::allocateFromBlock(Block& block, uint32_t order, VkDeviceSize& offset)
+{
+    if (order > block.maxOrder)
+    {
+        return false;
+    }
+    
+    // Find the smallest free node that fits...
+    uint32_t freeOrder = order;
+    while (freeOrder <= block.maxOrder && block.freeLists[freeOrder].empty())
+    {
+        ++freeOrder;
+    }
+    
+    if (freeOrder > block.maxOrder)
+    {
+        return false;
+    }
+    
+    VkDeviceSize nodeOffset = *block.freeLists[freeOrder].begin();
+    block.freeLists[freeOrder].erase(nodeOffset);
+    
+    // ...then split it in half until it is the requested size, releasing the upper halves.
+    while (freeOrder > order)
+    {
+        --freeOrder;
+        block.freeLists[freeOrder].insert(nodeOffset + (minimumNodeSize << freeOrder));
+    }
+    
+    offset = nodeOffset;
+    return true;
+}
+
+void VulkanMemoryAllocator::freeToBlock(Block& block, VkDeviceSize offset, uint32_t order)
+{
+    // Merge with the buddy node for as long as it is free too.
+    while (order < block.maxOrder)
+    {
+        VkDeviceSize buddyOffset = offset ^ (minimumNodeSize << order);
+        if (block.freeLists[order].erase(buddyOffset) == 0)
+        {
+            break;
+        }
+        
+        offset = std::min(offset, buddyOffset);
+        ++order;
+    }
+    
+    block.freeLists[order].insert(offset);
+}
+
+// MARK: - Allocation
+
+VulkanAllocation VulkanMemoryAllocator::allocate(const VkMemoryRequirements& requirements, VulkanMemoryUsage usage)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    
+    VulkanAllocation allocation{};
+    allocation.size = requirements.size;
+    allocation.memoryTypeIndex = findMemoryTypeIndex(requirements.memoryTypeBits, usage, requirements.size);
+    
+    // Buddy nodes are aligned to their own size, so a node at least as large as the alignment satisfies it.
+    allocation.order = getOrderForSize(std::max(requirements.size, requirements.alignment));
+    
+    auto& memoryTypeBlocks = blocks[allocation.memoryTypeIndex];
+    
+    if ((minimumNodeSize << allocation.order) > getBlockSize(allocation.memoryTypeIndex))
+    {
+        // Round dedicated blocks up to the atom size so that flushing the tail never runs past the end of the memory.
+        allocation.blockIndex = createBlock(allocation.memoryTypeIndex, alignUp(requirements.size, nonCoherentAtomSize), true);
+        allocation.offset = 0;
+    } else
+    {
+        bool allocated = false;
+        for (uint32_t blockIndex = 0; blockIndex < memoryTypeBlocks.size() && !allocated; ++blockIndex)
+        {
+            auto& block = memoryTypeBlocks[blockIndex];
+            if (block && !block->dedicated && allocateFromBlock(*block, allocation.order, allocation.offset))
+            {
+                allocation.blockIndex = blockIndex;
+                allocated = true;
+            }
+        }
+        
+        if (!allocated)
+        {
+            allocation.blockIndex = createBlock(allocation.memoryTypeIndex, getBlockSize(allocation.memoryTypeIndex), false);
+            allocateFromBlock(*memoryTypeBlocks[allocation.blockIndex], allocation.order, allocation.offset);
+        }
+    }
+    
+    auto& block = *memoryTypeBlocks[allocation.blockIndex];
+    ++block.allocationCount;
+    
+    allocation.memory = block.memory;
+    if (block.mappedData != nullptr)
+    {
+        allocation.mappedData = static_cast<char*>(block.mappedData) + allocation.offset;
+    }
+    
+    return allocation;
+}
+
+void VulkanMemoryAllocator::free(const VulkanAllocation& allocation)
+{
+    if (allocation.memory == VK_NULL_HANDLE)
+    {
+        return;
+    }
+    
+    std::lock_guard<std::mutex> lock(mutex);
+    
+    auto& memoryTypeBlocks = blocks[allocation.memoryTypeIndex];
+    auto& block = *memoryTypeBlocks[allocation.blockIndex];
+    
+    if (!block.dedicated)
+    {
+        freeToBlock(block, allocation.offset, allocation.order);
+    }
+    
+    if (--block.allocationCount > 0)
+    {
+        return;
+    }
+    
+    // Keep one empty block around per memory type so that alternating allocate/free doesn't thrash vkAllocateMemory.
+    bool hasOtherEmptyBlock = false;
+    for (uint32_t blockIndex = 0; blockIndex < memoryTypeBlocks.size(); ++blockIndex)
+    {
+        const auto& other = memoryTypeBlocks[blockIndex];
+        if (blockIndex != allocation.blockIndex && other && !other->dedicated && other->allocationCount == 0)
+        {
+            hasOtherEmptyBlock = true;
+        }
+    }
+    
+    if (block.dedicated || hasOtherEmptyBlock)
+    {
+        destroyBlock(allocation.memoryTypeIndex, allocation.blockIndex);
+    }
+}
+
+// MARK: - Mapped Memory
+
+bool VulkanMemoryAllocator::isCoherent(const VulkanAllocation& allocation) const
+{
+    return memoryProperties.memoryTypes[allocation.memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+}
+
+VkMappedMemoryRange VulkanMemoryAllocator::getMappedMemoryRange(const VulkanAllocation& allocation, VkDeviceSize offset, VkDeviceSize size) const
+{
+    // Ranges must start and end on atom boundaries. Allocations are atom aligned, so this stays inside the allocation.
+    VkDeviceSize start = allocation.offset + offset;
+    VkDeviceSize end = allocation.offset + std::min(offset + size, allocation.size);
+    
+    VkMappedMemoryRange range{};
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range.pNext = nullptr;
+    range.memory = allocation.memory;
+    range.offset = start / nonCoherentAtomSize * nonCoherentAtomSize;
+    range.size = alignUp(end, nonCoherentAtomSize) - range.offset;
+    
+    return range;
+}
+
+void VulkanMemoryAllocator::flush(const VulkanAllocation& allocation, VkDeviceSize offset, VkDeviceSize size) const
+{
+    if (isCoherent(allocation) || size == 0)
+    {
+        return;
+    }
+    
+    auto range = getMappedMemoryRange(allocation, offset, size);
+    VK_ASSERT_SUCCESS(vkFlushMappedMemoryRanges(logicalDevice, 1, &range),
+                      "Failed to flush mapped memory!");
+}
+
+void VulkanMemoryAllocator::invalidate(const VulkanAllocation& allocation, VkDeviceSize offset, VkDeviceSize size) const
+{
+    if (isCoherent(allocation) || size == 0)
+    {
+        return;
+    }
+    
+    auto range = getMappedMemoryRange(allocation, offset, size);
+    VK_ASSERT_SUCCESS(vkInvalidateMappedMemoryRanges(logicalDevice, 1, &range),
+                      "Failed to invalidate mapped memory!");
+}
+
+// MARK: - Buffers
+
+VulkanBuffer VulkanMemoryAllocator::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VulkanMemoryUsage memoryUsage)
+{
+    VulkanBuffer buffer{};
+    buffer.size = size;
+    
+    VkBufferCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    createInfo.pNext = nullptr;
+    createInfo.flags = 0;
+    createInfo.size = size;
+    createInfo.usage = usage;
+    createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    createInfo.queueFamilyIndexCount = 0;
+    createInfo.pQueueFamilyIndices = nullptr;
+    
+    VK_ASSERT_SUCCESS(vkCreateBuffer(logicalDevice, &createInfo, nullptr, &buffer.buffer),
+                      "Failed to create buffer!");
+    
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(logicalDevice, buffer.buffer, &requirements);
+    
+    try
+    {
+        buffer.allocation = allocate(requirements, memoryUsage);
+    } catch (...)
+    {
+        vkDestroyBuffer(logicalDevice, buffer.buffer, nullptr);
+        throw;
+    }
+    
+    VK_ASSERT_SUCCESS(vkBindBufferMemory(logicalDevice, buffer.buffer, buffer.allocation.memory, buffer.allocation.offset),
+                      "Failed to bind buffer memory!");
+    
+    return buffer;
+}
+
+void VulkanMemoryAllocator::destroyBuffer(VulkanBuffer& buffer)
+{
+    vkDestroyBuffer(logicalDevice, buffer.buffer, nullptr);
+    free(buffer.allocation);
+    buffer = VulkanBuffer{};
+}
+
+// MARK: - Statistics
+
+VulkanMemoryStatistics VulkanMemoryAllocator::getStatistics()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    
+    VulkanMemoryStatistics statistics{};
+    for (const auto& memoryTypeBlocks : blocks)
+    {
+        for (const auto& block : memoryTypeBlocks)
+        {
+            if (!block)
+            {
+                continue;
+            }
+            
+            ++statistics.blockCount;
+            statistics.allocationCount += block->allocationCount;
+            statistics.blockBytes += block->size;
+            statistics.allocatedBytes += block->size;
+            
+            for (uint32_t order = 0; order < block->freeLists.size(); ++order)
+            {
+                statistics.allocatedBytes -= block->freeLists[order].size() * (minimumNodeSize << order);
+            }
+        }
+    }
+    
+    return statistics;
+}
@@ -0,0 +1,124 @@
+//
+//  VulkanMemoryAllocator.hpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/25/21.
+//
+
+#ifndef VulkanMemoryAllocator_hpp
+#define VulkanMemoryAllocator_hpp
+
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// How a resource is going to be accessed. This drives the choice of memory type.
+enum class VulkanMemoryUsage
+{
+    // Only the GPU reads and writes it. Prefers DEVICE_LOCAL memory.
+    GpuOnly,
+    
+    // Written by the CPU, read by the GPU. Requires HOST_VISIBLE memory, prefers uncached write-combined memory.
+    CpuToGpu,
+    
+    // Written by the GPU, read back by the CPU. Requires HOST_VISIBLE memory, prefers HOST_CACHED memory.
+    GpuToCpu,
+};
+
+struct VulkanAllocation
+{
+    VkDeviceMemory  memory = VK_NULL_HANDLE;
+    VkDeviceSize    offset = 0;
+    VkDeviceSize    size = 0;
+    void*           mappedData = nullptr;
+    uint32_t        memoryTypeIndex = 0;
+    uint32_t        blockIndex = 0;
+    uint32_t        order = 0;
+};
+
+struct VulkanBuffer
+{
+    VkBuffer            buffer = VK_NULL_HANDLE;
+    VkDeviceSize        size = 0;
+    VulkanAllocation    allocation;
+};
+
+struct VulkanMemoryStatistics
+{
+    uint32_t        blockCount = 0;
+    uint32_t        allocationCount = 0;
+    VkDeviceSize    blockBytes = 0;
+    VkDeviceSize    allocatedBytes = 0;
+};
+
+// Sub-allocates buffers out of large VkDeviceMemory blocks using a buddy allocator.
+// One list of blocks is kept per memory type, so thousands of buffers only cost a handful of vkAllocateMemory calls.
+// Requests larger than a block get a dedicated allocation of their own.
+class VulkanMemoryAllocator {
+public:
+    static constexpr VkDeviceSize defaultBlockSize = 64ull * 1024 * 1024;
+    static constexpr VkDeviceSize minimumNodeSize = 256;
+    
+    VulkanMemoryAllocator(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, VkDeviceSize preferredBlockSize = defaultBlockSize);
+    ~VulkanMemoryAllocator();
+    
+    VulkanMemoryAllocator(const VulkanMemoryAllocator&) = delete;
+    VulkanMemoryAllocator& operator=(const VulkanMemoryAllocator&) = delete;
+    
+    VulkanAllocation allocate(const VkMemoryRequirements& requirements, VulkanMemoryUsage usage);
+    void free(const VulkanAllocation& allocation);
+    
+    VulkanBuffer createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VulkanMemoryUsage memoryUsage);
+    void destroyBuffer(VulkanBuffer& buffer);
+    
+    uint32_t findMemoryTypeIndex(uint32_t memoryTypeBits, VulkanMemoryUsage usage, VkDeviceSize size) const;
+    
+    // Host-visible memory may be non-coherent. These make host writes visible to the device, and device writes visible
+    // to the host, for the given byte range of an allocation. They do nothing for HOST_COHERENT memory.
+    void flush(const VulkanAllocation& allocation, VkDeviceSize offset, VkDeviceSize size) const;
+    void invalidate(const VulkanAllocation& allocation, VkDeviceSize offset, VkDeviceSize size) const;
+    bool isCoherent(const VulkanAllocation& allocation) const;
+    
+    VkDeviceSize getNonCoherentAtomSize() const { return nonCoherentAtomSize; }
+    
+    VulkanMemoryStatistics getStatistics();
+
+private:
+    
+    struct Block
+    {
+        VkDeviceMemory  memory = VK_NULL_HANDLE;
+        VkDeviceSize    size = 0;
+        void*           mappedData = nullptr;
+        uint32_t        maxOrder = 0;
+        uint32_t        allocationCount = 0;
+        bool            dedicated = false;
+        
+        // Free node offsets, indexed by order. A node of order k spans (minimumNodeSize << k) bytes.
+        std::vector<std::unordered_set<VkDeviceSize>> freeLists;
+    };
+    
+    VkDevice                            logicalDevice;
+    VkPhysicalDeviceMemoryProperties    memoryProperties;
+    VkDeviceSize                        preferredBlockSize;
+    VkDeviceSize                        nonCoherentAtomSize;
+    std::mutex                          mutex;
+    
+    // Blocks indexed by [memoryTypeIndex][blockIndex]. Freed blocks leave a null slot so indices stay stable.
+    std::vector<std::vector<std::unique_ptr<Block>>> blocks;
+    
+    VkDeviceSize getBlockSize(uint32_t memoryTypeIndex) const;
+    
+    VkMappedMemoryRange getMappedMemoryRange(const VulkanAllocation& allocation, VkDeviceSize offset, VkDeviceSize size) const;
+    
+    uint32_t createBlock(uint32_t memoryTypeIndex, VkDeviceSize size, bool dedicated);
+    void destroyBlock(uint32_t memoryTypeIndex, uint32_t blockIndex);
+    
+    bool allocateFromBlock(Block& block, uint32_t order, VkDeviceSize& offset);
+    void freeToBlock(Block& block, VkDeviceSize offset, uint32_t order);
+
+};
+
+#endif /* VulkanMemoryAllocator_hpp */
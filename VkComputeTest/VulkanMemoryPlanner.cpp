@@ -0,0 +1,85 @@
+//
+//  VulkanMemoryPlanner.cpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/31/21.
+//
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+#include "VulkanMemoryPlanner.hpp"
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// MARK: - Planning
+
+uint32_t VulkanMemoryPlanner::addBuffer(VkDeviceSize size, VkDeviceSize alignment, uint32_t firstStep, uint32_t lastStep)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+    {
+        throw std::runtime_error("Buffer alignment must be a power of two!");
+    }
+    
+    if (lastStep < firstStep)
+    {
+        throw std::runtime_error("A buffer's lifetime can't end before it starts!");
+    }
+    
+    buffers.push_back({ size, alignment, firstStep, lastStep });
+    return static_cast<uint32_t>(buffers.size() - 1);
+}
+
+VulkanMemoryPlan VulkanMemoryPlanner::plan() const
+{
+    VulkanMemoryPlan plan;
+    plan.offsets.resize(buffers.size());
+    
+    // Every buffer starts on an alignment boundary, so the naive total pads each one out to the next buffer's alignment.
+    for (const Buffer& buffer : buffers)
+    {
+        plan.naiveBytes = alignUp(plan.naiveBytes, buffer.alignment) + buffer.size;
+    }
+    
+    std::vector<size_t> order(buffers.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return buffers[a].size > buffers[b].size; });
+    
+    std::vector<size_t> placed;
+    for (size_t index : order)
+    {
+        const Buffer& buffer = buffers[index];
+        
+        // Only buffers alive at the same time are in the way, and they are visited from the lowest offset up.
+        std::vector<size_t> conflicts;
+        for (size_t other : placed)
+        {
+            if (buffers[other].firstStep <= buffer.lastStep && buffer.firstStep <= buffers[other].lastStep)
+            {
+                conflicts.push_back(other);
+            }
+        }
+        
+        std::sort(conflicts.begin(), conflicts.end(), [&](size_t a, size_t b) { return plan.offsets[a] < plan.offsets[b]; });
+        
+        VkDeviceSize offset = 0;
+        for (size_t other : conflicts)
+        {
+            if (offset + buffer.size <= plan.offsets[other])
+            {
+                break;
+            }
+            offset = std::max(offset, alignUp(plan.offsets[other] + buffers[other].size, buffer.alignment));
+        }
+        
+        plan.offsets[index] = offset;
+        plan.plannedBytes = std::max(plan.plannedBytes, offset + buffer.size);
+        placed.push_back(index);
+    }
+    
+    return plan;
+}
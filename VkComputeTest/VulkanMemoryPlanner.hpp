@@ -0,0 +1,53 @@
+//
+//  VulkanMemoryPlanner.hpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/31/21.
+//
+
+#ifndef VulkanMemoryPlanner_hpp
+#define VulkanMemoryPlanner_hpp
+
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+struct VulkanMemoryPlan
+{
+    // Where each buffer goes, in the order they were added, relative to the start of one shared allocation.
+    std::vector<VkDeviceSize>   offsets;
+    
+    // The size of the shared allocation.
+    VkDeviceSize                plannedBytes = 0;
+    
+    // What the buffers would take with an allocation each, aligned the same way.
+    VkDeviceSize                naiveBytes = 0;
+};
+
+// Packs buffers that are only needed for part of a job into one allocation. Each buffer is live from the first step
+// that uses it to the last, inclusive, and buffers whose lifetimes don't overlap may share memory.
+//
+// Buffers are placed largest first, each at the lowest aligned offset that doesn't collide with a buffer already
+// placed whose lifetime overlaps its own. That isn't always optimal, but it is never worse than no aliasing at all.
+class VulkanMemoryPlanner {
+public:
+    // Returns the buffer's index in the plan. Alignment must be a power of two.
+    uint32_t addBuffer(VkDeviceSize size, VkDeviceSize alignment, uint32_t firstStep, uint32_t lastStep);
+    
+    VulkanMemoryPlan plan() const;
+
+private:
+    
+    struct Buffer
+    {
+        VkDeviceSize    size;
+        VkDeviceSize    alignment;
+        uint32_t        firstStep;
+        uint32_t        lastStep;
+    };
+    
+    std::vector<Buffer> buffers;
+
+};
+
+#endif /* VulkanMemoryPlanner_hpp */
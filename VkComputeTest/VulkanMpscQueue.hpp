@@ -0,0 +1,81 @@
+//
+//  VulkanMpscQueue.hpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/31/21.
+//
+
+#ifndef VulkanMpscQueue_hpp
+#define VulkanMpscQueue_hpp
+
+#include <atomic>
+#include <utility>
+
+// A lock-free FIFO for any number of producer threads and a single consumer thread.
+// A push is one atomic exchange plus one store, so producers never wait on each other or on the consumer.
+// An item whose push is still in progress is invisible to tryPop() until the producer links it in, which is why
+// consumers should pair the queue with their own wakeup signal that producers raise after pushing.
+template <typename T>
+class VulkanMpscQueue {
+public:
+    VulkanMpscQueue()
+    {
+        Node* stub = new Node();
+        head.store(stub, std::memory_order_relaxed);
+        tail = stub;
+    }
+    
+    ~VulkanMpscQueue()
+    {
+        T value;
+        while (tryPop(value))
+        {
+        }
+        
+        delete tail;
+    }
+    
+    VulkanMpscQueue(const VulkanMpscQueue&) = delete;
+    VulkanMpscQueue& operator=(const VulkanMpscQueue&) = delete;
+    
+    // Safe to call from any thread.
+    void push(T value)
+    {
+        Node* node = new Node();
+        node->value = std::move(value);
+        
+        Node* previous = head.exchange(node, std::memory_order_acq_rel);
+        previous->next.store(node, std::memory_order_release);
+    }
+    
+    // Only the consumer thread may call this.
+    bool tryPop(T& value)
+    {
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if (next == nullptr)
+        {
+            return false;
+        }
+        
+        // The popped node becomes the new stub, so only its value is taken.
+        value = std::move(next->value);
+        delete tail;
+        tail = next;
+        return true;
+    }
+
+private:
+    
+    struct Node
+    {
+        std::atomic<Node*>  next = nullptr;
+        T                   value;
+    };
+    
+    // Producers append at the head, the consumer takes from the tail. The tail is always a stub whose value is spent.
+    std::atomic<Node*>      head;
+    Node*                   tail;
+
+};
+
+#endif /* VulkanMpscQueue_hpp */
@@ -0,0 +1,218 @@
+//
+//  VulkanPipelineCache.cpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/27/21.
+//
+
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+
+#include "FileUtils.hpp"
+#include "VulkanDebugUtils.hpp"
+#include "VulkanPipelineCache.hpp"
+
+// FNV-1a, to catch truncated or corrupted files before the driver sees them.
+static uint64_t hashData(const char* data, size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= static_cast<uint8_t>(data[i]);
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static std::string toHexString(uint32_t value)
+{
+    char buffer[9];
+    snprintf(buffer, sizeof(buffer), "%08x", value);
+    return buffer;
+}
+
+// MARK: - Constructor
+
+VulkanPipelineCache::VulkanPipelineCache(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, const std::string& directory)
+: logicalDevice(logicalDevice)
+{
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    
+    // One file per device, so machines with several GPUs don't keep overwriting each other's caches.
+    filePath = directory + "/pipeline_cache_" + toHexString(properties.vendorID) + "_" + toHexString(properties.deviceID) + ".bin";
+    
+    std::vector<char> initialData;
+    {
+        std::lock_guard<std::mutex> lock(FileUtils::getCacheMutex());
+        initialData = load();
+    }
+    
+    VkPipelineCacheCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    createInfo.pNext = nullptr;
+    createInfo.flags = 0;
+    createInfo.initialDataSize = initialData.size();
+    createInfo.pInitialData = initialData.empty() ? nullptr : initialData.data();
+    
+    if (vkCreatePipelineCache(logicalDevice, &createInfo, nullptr, &pipelineCache) == VK_SUCCESS)
+    {
+        loadedFromDisk = !initialData.empty();
+        savedDataSize = initialData.size();
+        return;
+    }
+    
+    // The driver rejected the data despite the header matching, so start over with an empty cache.
+    createInfo.initialDataSize = 0;
+    createInfo.pInitialData = nullptr;
+    
+    VK_ASSERT_SUCCESS(vkCreatePipelineCache(logicalDevice, &createInfo, nullptr, &pipelineCache),
+                      "Failed to create pipeline cache!");
+}
+
+// MARK: - Destructor
+
+VulkanPipelineCache::~VulkanPipelineCache()
+{
+    // save() throws if the driver can't hand back the cache, which must not escape a destructor.
+    try
+    {
+        save();
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr << "Failed to save pipeline cache: " << error.what() << std::endl;
+    }
+    
+    vkDestroyPipelineCache(logicalDevice, pipelineCache, nullptr);
+}
+
+// MARK: - File Header
+
+VulkanPipelineCache::FileHeader VulkanPipelineCache::makeFileHeader(const std::vector<char>& data) const
+{
+    FileHeader header{};
+    header.magic = fileMagic;
+    header.version = fileVersion;
+    header.vendorID = properties.vendorID;
+    header.deviceID = properties.deviceID;
+    header.driverVersion = properties.driverVersion;
+    memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+    header.reserved = 0;
+    header.dataSize = data.size();
+    header.dataHash = hashData(data.data(), data.size());
+    return header;
+}
+
+// MARK: - Load
+
+std::vector<char> VulkanPipelineCache::load() const
+{
+    auto file = FileUtils::readFileIfPresent(filePath);
+    if (!file.has_value() || file->size() < sizeof(FileHeader))
+    {
+        return {};
+    }
+    
+    FileHeader header;
+    memcpy(&header, file->data(), sizeof(FileHeader));
+    
+    std::vector<char> data(file->begin() + sizeof(FileHeader), file->end());
+    
+    // Any mismatch means the cache was written by another device or driver, or the file is damaged.
+    FileHeader expectedHeader = makeFileHeader(data);
+    if (memcmp(&header, &expectedHeader, sizeof(FileHeader)) != 0)
+    {
+        std::cerr << "Ignoring stale pipeline cache at " << filePath << std::endl;
+        return {};
+    }
+    
+    // Check the driver's own header too, in case the file was written by a different build of the driver.
+    VkPipelineCacheHeaderVersionOne cacheHeader;
+    if (data.size() < sizeof(cacheHeader))
+    {
+        return {};
+    }
+    
+    memcpy(&cacheHeader, data.data(), sizeof(cacheHeader));
+    
+    if (cacheHeader.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+        cacheHeader.vendorID != properties.vendorID ||
+        cacheHeader.deviceID != properties.deviceID ||
+        memcmp(cacheHeader.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+    {
+        return {};
+    }
+    
+    return data;
+}
+
+// MARK: - Save
+
+void VulkanPipelineCache::mergeFromDisk()
+{
+    std::vector<char> diskData = load();
+    if (diskData.empty())
+    {
+        return;
+    }
+    
+    VkPipelineCacheCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    createInfo.pNext = nullptr;
+    createInfo.flags = 0;
+    createInfo.initialDataSize = diskData.size();
+    createInfo.pInitialData = diskData.data();
+    
+    // Failing to merge only means the other applications' pipelines get compiled again, so it isn't fatal.
+    VkPipelineCache diskCache;
+    if (vkCreatePipelineCache(logicalDevice, &createInfo, nullptr, &diskCache) != VK_SUCCESS)
+    {
+        return;
+    }
+    
+    vkMergePipelineCaches(logicalDevice, pipelineCache, 1, &diskCache);
+    vkDestroyPipelineCache(logicalDevice, diskCache, nullptr);
+}
+
+void VulkanPipelineCache::save()
+{
+    size_t dataSize = 0;
+    VK_ASSERT_SUCCESS(vkGetPipelineCacheData(logicalDevice, pipelineCache, &dataSize, nullptr),
+                      "Failed to get pipeline cache size!");
+    
+    // Caches only ever grow, so the same size means nothing new has been compiled.
+    if (dataSize == savedDataSize)
+    {
+        return;
+    }
+    
+    // Other applications may have saved pipelines this one doesn't have since it loaded, e.g. other shards on the same
+    // device. Merging them in keeps the file from losing them.
+    std::lock_guard<std::mutex> lock(FileUtils::getCacheMutex());
+    mergeFromDisk();
+    
+    VK_ASSERT_SUCCESS(vkGetPipelineCacheData(logicalDevice, pipelineCache, &dataSize, nullptr),
+                      "Failed to get pipeline cache size!");
+    
+    std::vector<char> data(dataSize);
+    VK_ASSERT_SUCCESS(vkGetPipelineCacheData(logicalDevice, pipelineCache, &dataSize, data.data()),
+                      "Failed to get pipeline cache data!");
+    data.resize(dataSize);
+    
+    FileHeader header = makeFileHeader(data);
+    
+    std::vector<char> file(sizeof(FileHeader) + data.size());
+    memcpy(file.data(), &header, sizeof(FileHeader));
+    memcpy(file.data() + sizeof(FileHeader), data.data(), data.size());
+    
+    // A cache that can't be written only costs startup time, so don't treat it as fatal.
+    if (!FileUtils::writeFileAtomically(filePath, file))
+    {
+        std::cerr << "Failed to write pipeline cache to " << filePath << std::endl;
+        return;
+    }
+    
+    savedDataSize = dataSize;
+}
@@ -0,0 +1,71 @@
+//
+//  VulkanPipelineCache.hpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/27/21.
+//
+
+#ifndef VulkanPipelineCache_hpp
+#define VulkanPipelineCache_hpp
+
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// A VkPipelineCache that is loaded from disk when it's created, and written back when it's saved or destroyed.
+// The file is prefixed with the vendor ID, device ID, driver version and pipelineCacheUUID it was built with,
+// and anything that doesn't match the current device is thrown away instead of being handed to the driver.
+class VulkanPipelineCache {
+public:
+    VulkanPipelineCache(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, const std::string& directory);
+    
+    // Saves the cache before destroying it. A failed save is logged, not thrown.
+    ~VulkanPipelineCache();
+    
+    VulkanPipelineCache(const VulkanPipelineCache&) = delete;
+    VulkanPipelineCache& operator=(const VulkanPipelineCache&) = delete;
+    
+    VkPipelineCache getHandle() const { return pipelineCache; }
+    
+    // True if valid data was loaded from disk.
+    bool isWarm() const { return loadedFromDisk; }
+    
+    // Writes the cache to disk if it has grown since it was loaded or last saved. Safe to call periodically.
+    void save();
+
+private:
+    
+    struct FileHeader
+    {
+        uint32_t    magic;
+        uint32_t    version;
+        uint32_t    vendorID;
+        uint32_t    deviceID;
+        uint32_t    driverVersion;
+        uint8_t     pipelineCacheUUID[VK_UUID_SIZE];
+        uint32_t    reserved;
+        uint64_t    dataSize;
+        uint64_t    dataHash;
+    };
+    
+    static constexpr uint32_t fileMagic = 0x4350564b; // "KVPC"
+    static constexpr uint32_t fileVersion = 1;
+    
+    VkDevice                    logicalDevice;
+    VkPhysicalDeviceProperties  properties;
+    std::string                 filePath;
+    VkPipelineCache             pipelineCache = VK_NULL_HANDLE;
+    bool                        loadedFromDisk = false;
+    size_t                      savedDataSize = 0;
+    
+    FileHeader makeFileHeader(const std::vector<char>& data) const;
+    
+    // Returns the pipeline cache data from the file, or nothing if the file is missing, corrupt or from another device.
+    std::vector<char> load() const;
+    
+    // Merges the pipelines in the file into this cache. The caller holds FileUtils::getCacheMutex().
+    void mergeFromDisk();
+
+};
+
+#endif /* VulkanPipelineCache_hpp */
@@ -0,0 +1,172 @@
+//
+//  VulkanProfiler.cpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/28/21.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <numeric>
+#include <sstream>
+
+#include "FileUtils.hpp"
+#include "VulkanDebugUtils.hpp"
+#include "VulkanProfiler.hpp"
+
+static std::string escapeJSON(const std::string& text)
+{
+    std::string escaped;
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+    return escaped;
+}
+
+// MARK: - Constructor
+
+VulkanProfiler::VulkanProfiler(VkDevice logicalDevice, const VkPhysicalDeviceProperties& properties, uint32_t queryCount)
+: logicalDevice(logicalDevice)
+, timestampPeriod(properties.limits.timestampPeriod)
+, creationTime(std::chrono::steady_clock::now())
+{
+    VkQueryPoolCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    createInfo.pNext = nullptr;
+    createInfo.flags = 0;
+    createInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    createInfo.queryCount = queryCount;
+    createInfo.pipelineStatistics = 0;
+    
+    VK_ASSERT_SUCCESS(vkCreateQueryPool(logicalDevice, &createInfo, nullptr, &queryPool),
+                      "Failed to create timestamp query pool!");
+}
+
+// MARK: - Destructor
+
+VulkanProfiler::~VulkanProfiler()
+{
+    vkDestroyQueryPool(logicalDevice, queryPool, nullptr);
+}
+
+// MARK: - Queries
+
+void VulkanProfiler::cmdResetQueries(VkCommandBuffer commandBuffer, uint32_t firstQuery, uint32_t queryCount) const
+{
+    vkCmdResetQueryPool(commandBuffer, queryPool, firstQuery, queryCount);
+}
+
+void VulkanProfiler::cmdWriteTimestamp(VkCommandBuffer commandBuffer, VkPipelineStageFlagBits stage, uint32_t query) const
+{
+    vkCmdWriteTimestamp(commandBuffer, stage, queryPool, query);
+}
+
+std::vector<std::optional<uint64_t>> VulkanProfiler::readTimestamps(uint32_t firstQuery, uint32_t queryCount, uint32_t validBits) const
+{
+    // Each query comes back as a (value, availability) pair.
+    std::vector<uint64_t> results(queryCount * 2);
+    
+    VkResult result = vkGetQueryPoolResults(logicalDevice, queryPool, firstQuery, queryCount,
+                                            results.size() * sizeof(uint64_t), results.data(), 2 * sizeof(uint64_t),
+                                            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+    if (result != VK_SUCCESS && result != VK_NOT_READY)
+    {
+        throw std::runtime_error("Failed to get timestamp query results!");
+    }
+    
+    const uint64_t validMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+    
+    std::vector<std::optional<uint64_t>> timestamps(queryCount);
+    for (uint32_t i = 0; i < queryCount; ++i)
+    {
+        if (results[2 * i + 1] != 0)
+        {
+            timestamps[i] = static_cast<uint64_t>(std::llround((results[2 * i] & validMask) * timestampPeriod));
+        }
+    }
+    
+    return timestamps;
+}
+
+// MARK: - Spans
+
+void VulkanProfiler::addGpuSpan(const std::string& name, const std::string& track, uint64_t startNanoseconds, uint64_t endNanoseconds)
+{
+    if (endNanoseconds < startNanoseconds)
+    {
+        return;
+    }
+    
+    if (!firstGpuNanoseconds.has_value() || startNanoseconds < *firstGpuNanoseconds)
+    {
+        firstGpuNanoseconds = startNanoseconds;
+    }
+    
+    const double durationMicroseconds = (endNanoseconds - startNanoseconds) / 1000.0;
+    
+    // Start times are rebased on the first GPU timestamp when the trace is written.
+    spans.push_back({ name, track, true, startNanoseconds / 1000.0, durationMicroseconds });
+    samples[name].push_back(durationMicroseconds / 1000.0);
+}
+
+void VulkanProfiler::addHostSpan(const std::string& name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+    const double startMicroseconds = std::chrono::duration<double, std::micro>(start - creationTime).count();
+    const double durationMicroseconds = std::chrono::duration<double, std::micro>(end - start).count();
+    
+    spans.push_back({ name, "Host", false, startMicroseconds, durationMicroseconds });
+}
+
+// MARK: - Reporting
+
+std::vector<VulkanProfiler::Statistics> VulkanProfiler::getStatistics() const
+{
+    std::vector<Statistics> statistics;
+    
+    for (auto& [name, durations] : samples)
+    {
+        std::vector<double> sorted = durations;
+        std::sort(sorted.begin(), sorted.end());
+        
+        Statistics entry;
+        entry.name = name;
+        entry.sampleCount = sorted.size();
+        entry.minMilliseconds = sorted.front();
+        entry.meanMilliseconds = std::accumulate(sorted.begin(), sorted.end(), 0.0) / sorted.size();
+        entry.p99Milliseconds = sorted[std::min(sorted.size() - 1, static_cast<size_t>(std::ceil(sorted.size() * 0.99)) - 1)];
+        statistics.push_back(entry);
+    }
+    
+    return statistics;
+}
+
+bool VulkanProfiler::writeChromeTrace(const std::string& filePath) const
+{
+    const double gpuOrigin = firstGpuNanoseconds.value_or(0) / 1000.0;
+    
+    std::ostringstream stream;
+    stream << std::fixed << std::setprecision(3);
+    stream << "{\"traceEvents\":[\n";
+    stream << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"Host\"}},\n";
+    stream << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"GPU\"}}";
+    
+    for (const Span& span : spans)
+    {
+        const double start = span.isGpu ? span.startMicroseconds - gpuOrigin : span.startMicroseconds;
+        
+        stream << ",\n{\"name\":\"" << escapeJSON(span.name) << "\",\"cat\":\"" << (span.isGpu ? "gpu" : "host") << "\","
+               << "\"ph\":\"X\",\"pid\":" << (span.isGpu ? 1 : 0) << ",\"tid\":\"" << escapeJSON(span.track) << "\","
+               << "\"ts\":" << start << ",\"dur\":" << span.durationMicroseconds << "}";
+    }
+    
+    stream << "\n]}\n";
+    
+    std::string text = stream.str();
+    return FileUtils::writeFileAtomically(filePath, std::vector<char>(text.begin(), text.end()));
+}
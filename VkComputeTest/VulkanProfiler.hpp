@@ -0,0 +1,76 @@
+//
+//  VulkanProfiler.hpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/28/21.
+//
+
+#ifndef VulkanProfiler_hpp
+#define VulkanProfiler_hpp
+
+#include <chrono>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// Collects GPU timestamps from a query pool alongside host-side spans.
+// Per-span statistics can be printed, and everything can be exported as a Chrome trace (chrome://tracing or Perfetto).
+class VulkanProfiler {
+public:
+    struct Statistics
+    {
+        std::string name;
+        size_t      sampleCount = 0;
+        double      minMilliseconds = 0.0;
+        double      meanMilliseconds = 0.0;
+        double      p99Milliseconds = 0.0;
+    };
+    
+    VulkanProfiler(VkDevice logicalDevice, const VkPhysicalDeviceProperties& properties, uint32_t queryCount);
+    ~VulkanProfiler();
+    
+    VulkanProfiler(const VulkanProfiler&) = delete;
+    VulkanProfiler& operator=(const VulkanProfiler&) = delete;
+    
+    // Queries must be reset before each reuse, ahead of the writes. Resets need a graphics or compute queue, so queries
+    // written on a transfer-only queue have to be reset on another queue, which the transfer work then waits for.
+    void cmdResetQueries(VkCommandBuffer commandBuffer, uint32_t firstQuery, uint32_t queryCount) const;
+    void cmdWriteTimestamp(VkCommandBuffer commandBuffer, VkPipelineStageFlagBits stage, uint32_t query) const;
+    
+    // Reads queries back once the work that wrote them has finished, converted to nanoseconds.
+    // validBits comes from the queue family the timestamps were written on. Unavailable queries come back empty.
+    std::vector<std::optional<uint64_t>> readTimestamps(uint32_t firstQuery, uint32_t queryCount, uint32_t validBits) const;
+    
+    // GPU spans are in nanoseconds from readTimestamps. The track groups spans in the trace, e.g. by queue.
+    void addGpuSpan(const std::string& name, const std::string& track, uint64_t startNanoseconds, uint64_t endNanoseconds);
+    void addHostSpan(const std::string& name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+    
+    std::vector<Statistics> getStatistics() const;
+    
+    // Host and GPU spans go in separate processes in the trace, since the two clocks aren't calibrated against each other.
+    bool writeChromeTrace(const std::string& filePath) const;
+
+private:
+    
+    struct Span
+    {
+        std::string name;
+        std::string track;
+        bool        isGpu;
+        double      startMicroseconds;
+        double      durationMicroseconds;
+    };
+    
+    VkDevice                    logicalDevice;
+    VkQueryPool                 queryPool;
+    double                      timestampPeriod;
+    std::optional<uint64_t>     firstGpuNanoseconds;
+    std::chrono::steady_clock::time_point creationTime;
+    std::vector<Span>           spans;
+    std::map<std::string, std::vector<double>> samples;
+
+};
+
+#endif /* VulkanProfiler_hpp */
@@ -0,0 +1,141 @@
+//
+//  VulkanQueueScheduler.cpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/30/21.
+//
+
+#include <algorithm>
+
+#include "VulkanDebugUtils.hpp"
+#include "VulkanQueueScheduler.hpp"
+
+// MARK: - Constructor
+
+VulkanQueueScheduler::VulkanQueueScheduler(VkDevice logicalDevice, uint32_t queueFamilyIndex, uint32_t queueCount, VulkanQueuePolicy policy)
+: logicalDevice(logicalDevice)
+, queueFamilyIndex(queueFamilyIndex)
+, policy(policy)
+{
+    if (queueCount == 0)
+    {
+        throw std::runtime_error("The scheduler needs at least one queue!");
+    }
+    
+    queues.resize(queueCount);
+    
+    for (uint32_t i = 0; i < queueCount; ++i)
+    {
+        Queue& queue = queues[i];
+        
+        vkGetDeviceQueue(logicalDevice, queueFamilyIndex, i, &queue.queue);
+        
+        VkCommandPoolCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        createInfo.pNext = nullptr;
+        createInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        createInfo.queueFamilyIndex = queueFamilyIndex;
+        
+        VK_ASSERT_SUCCESS(vkCreateCommandPool(logicalDevice, &createInfo, nullptr, &queue.commandPool),
+                          "Failed to create command pool!");
+        
+        queue.tracker = std::make_unique<VulkanSubmissionTracker>(logicalDevice);
+        queue.mutex = std::make_unique<std::mutex>();
+    }
+}
+
+// MARK: - Destructor
+
+VulkanQueueScheduler::~VulkanQueueScheduler()
+{
+    for (Queue& queue : queues)
+    {
+        // Destroying the tracker waits for anything still in flight.
+        queue.tracker.reset();
+        
+        vkDestroyCommandPool(logicalDevice, queue.commandPool, nullptr);
+    }
+}
+
+// MARK: - Scheduling
+
+uint32_t VulkanQueueScheduler::acquireQueue(std::optional<uint32_t> currentQueue)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    
+    if (policy == VulkanQueuePolicy::RoundRobin)
+    {
+        if (currentQueue.has_value())
+        {
+            return *currentQueue;
+        }
+        
+        uint32_t queueIndex = nextQueue;
+        nextQueue = (nextQueue + 1) % getQueueCount();
+        return queueIndex;
+    }
+    
+    auto pendingCount = [&](uint32_t queueIndex) { return getPendingCountLocked(queues[queueIndex]); };
+    
+    std::optional<uint32_t> bestQueue = currentQueue;
+    uint64_t bestPendingCount = currentQueue.has_value() ? pendingCount(*currentQueue) : UINT64_MAX;
+    
+    for (uint32_t i = 0; i < getQueueCount() && bestPendingCount > 0; ++i)
+    {
+        uint32_t queueIndex = (nextQueue + i) % getQueueCount();
+        uint64_t queuePendingCount = pendingCount(queueIndex);
+        
+        if (queuePendingCount < bestPendingCount)
+        {
+            bestQueue = queueIndex;
+            bestPendingCount = queuePendingCount;
+        }
+    }
+    
+    if (*bestQueue != currentQueue)
+    {
+        nextQueue = (*bestQueue + 1) % getQueueCount();
+    }
+    
+    return *bestQueue;
+}
+
+VulkanSubmission VulkanQueueScheduler::submit(uint32_t queueIndex, uint32_t submitCount, const VkSubmitInfo* submits)
+{
+    Queue& queue = queues[queueIndex];
+    
+    VulkanSubmission submission;
+    {
+        auto queueLock = lockQueue(queueIndex);
+        submission = queue.tracker->submit(queue.queue, submitCount, submits);
+    }
+    
+    // Serials from one tracker only grow, but two threads can get here in either order.
+    std::lock_guard<std::mutex> lock(mutex);
+    queue.lastSerial = std::max(queue.lastSerial, submission.getSerial());
+    
+    return submission;
+}
+
+uint64_t VulkanQueueScheduler::getPendingCount(uint32_t queueIndex)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    
+    return getPendingCountLocked(queues[queueIndex]);
+}
+
+// A submission that is still on its way to lastSerial can already show up as completed, so this can't go below zero.
+uint64_t VulkanQueueScheduler::getPendingCountLocked(Queue& queue)
+{
+    uint64_t completedSerial = queue.tracker->getCompletedSerial();
+    
+    return completedSerial < queue.lastSerial ? queue.lastSerial - completedSerial : 0;
+}
+
+void VulkanQueueScheduler::waitIdle()
+{
+    for (Queue& queue : queues)
+    {
+        queue.tracker->waitAll();
+    }
+}
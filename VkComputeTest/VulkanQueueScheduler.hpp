@@ -0,0 +1,90 @@
+//
+//  VulkanQueueScheduler.hpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/30/21.
+//
+
+#ifndef VulkanQueueScheduler_hpp
+#define VulkanQueueScheduler_hpp
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "VulkanSubmissionTracker.hpp"
+
+enum class VulkanQueuePolicy
+{
+    // Every new job goes to the next queue in turn, and stays there.
+    RoundRobin,
+    
+    // Every job goes to the queue with the fewest unfinished submissions.
+    LeastLoaded,
+};
+
+// Spreads independent jobs across every queue of one family, so they can run concurrently on hardware with more than
+// one queue. Each queue has its own command pool and its own fences, so recording for and waiting on one queue never
+// has to touch another's. Scheduling and submitting are thread-safe, but each command pool belongs to one thread.
+class VulkanQueueScheduler {
+public:
+    // Creates a command pool for each of the first queueCount queues in the family. The device must have been created
+    // with at least that many.
+    VulkanQueueScheduler(VkDevice logicalDevice, uint32_t queueFamilyIndex, uint32_t queueCount, VulkanQueuePolicy policy);
+    
+    // Waits for all pending work before destroying the command pools.
+    ~VulkanQueueScheduler();
+    
+    VulkanQueueScheduler(const VulkanQueueScheduler&) = delete;
+    VulkanQueueScheduler& operator=(const VulkanQueueScheduler&) = delete;
+    
+    // Picks the queue for a job. currentQueue is where the job ran last time, if anywhere. It wins ties, so a job
+    // whose command buffers are already recorded from that queue's pool only moves when another queue is less busy.
+    uint32_t acquireQueue(std::optional<uint32_t> currentQueue = std::nullopt);
+    
+    // Submits to the queue with one of its own fences attached, and returns immediately.
+    VulkanSubmission submit(uint32_t queueIndex, uint32_t submitCount, const VkSubmitInfo* submits);
+    
+    // Submissions to the queue that haven't finished yet.
+    uint64_t getPendingCount(uint32_t queueIndex);
+    
+    // vkQueueSubmit needs the queue externally synchronized. Hold this around anything that uses one of the
+    // scheduler's queues directly, e.g. a transfer queue that shares the compute family.
+    std::unique_lock<std::mutex> lockQueue(uint32_t queueIndex) { return std::unique_lock<std::mutex>(*queues[queueIndex].mutex); }
+    
+    void waitIdle();
+    
+    uint32_t getQueueCount() const { return static_cast<uint32_t>(queues.size()); }
+    uint32_t getQueueFamilyIndex() const { return queueFamilyIndex; }
+    VkQueue getQueue(uint32_t queueIndex) const { return queues[queueIndex].queue; }
+    VkCommandPool getCommandPool(uint32_t queueIndex) const { return queues[queueIndex].commandPool; }
+
+private:
+    
+    struct Queue
+    {
+        VkQueue                     queue;
+        VkCommandPool               commandPool;
+        std::unique_ptr<VulkanSubmissionTracker> tracker;
+        std::unique_ptr<std::mutex> mutex;
+        uint64_t                    lastSerial = 0;
+    };
+    
+    VkDevice                        logicalDevice;
+    uint32_t                        queueFamilyIndex;
+    VulkanQueuePolicy               policy;
+    std::vector<Queue>              queues;
+    
+    // Guards nextQueue and every queue's lastSerial. The queues themselves are guarded by their own mutexes.
+    std::mutex                      mutex;
+    
+    // The queue RoundRobin hands out next, and where LeastLoaded starts looking, so idle queues are used in turn.
+    uint32_t                        nextQueue = 0;
+    
+    uint64_t getPendingCountLocked(Queue& queue);
+
+};
+
+#endif /* VulkanQueueScheduler_hpp */
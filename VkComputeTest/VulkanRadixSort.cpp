@@ -0,0 +1,122 @@
+//
+//  VulkanRadixSort.cpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/31/21.
+//
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "VulkanKernels.hpp"
+#include "VulkanRadixSort.hpp"
+
+static constexpr uint32_t radixSize = 1u << VulkanKernels::radixBits;
+
+// MARK: - Constructor
+
+VulkanRadixSort::VulkanRadixSort(VulkanComputeGraph& graph, const VkPhysicalDeviceLimits& limits)
+: graph(graph)
+, scan(graph, limits)
+{
+    // Every digit needs an invocation to load and store its count.
+    VulkanWorkgroupSize localSize = { VulkanKernels::getPowerOfTwoLocalSize(limits, preferredLocalSize), 1, 1 };
+    if (localSize.x < radixSize)
+    {
+        throw std::runtime_error("Radix sort needs workgroups of at least " + std::to_string(radixSize) + " invocations!");
+    }
+    
+    histogramKernel = graph.addKernel(VulkanKernels::getKernel("radix_histogram"), localSize);
+    scatterKernel = graph.addKernel(VulkanKernels::getKernel("radix_scatter"), localSize);
+    
+    tileSize = localSize.x * VulkanKernels::scanItemsPerInvocation;
+    maxTileCount = limits.maxComputeWorkGroupCount[0];
+}
+
+// MARK: - Recording
+
+uint32_t VulkanRadixSort::getMaxElementCount() const
+{
+    return static_cast<uint32_t>(std::min<uint64_t>(static_cast<uint64_t>(tileSize) * maxTileCount, UINT32_MAX));
+}
+
+VulkanTransientBuffer VulkanRadixSort::getScratch(Scratch& scratch, VkDeviceSize size)
+{
+    if (scratch.size < size)
+    {
+        scratch.size = size;
+        scratch.buffer = graph.createTransientBuffer(size);
+    }
+    
+    return scratch.buffer;
+}
+
+void VulkanRadixSort::record(VkBuffer keys, VkBuffer values, uint32_t elementCount, uint32_t keyBits)
+{
+    if (keyBits != 32 && keyBits != 64)
+    {
+        throw std::runtime_error("Radix sort keys must be 32 or 64 bits!");
+    }
+    
+    if (elementCount > getMaxElementCount())
+    {
+        throw std::runtime_error("Too many elements to sort!");
+    }
+    
+    if (elementCount == 0)
+    {
+        return;
+    }
+    
+    const uint32_t keyWords = keyBits / 32;
+    const uint32_t tileCount = elementCount / tileSize + (elementCount % tileSize != 0 ? 1 : 0);
+    const bool hasValues = values != VK_NULL_HANDLE;
+    
+    VulkanGraphBinding histogramBuffer = VulkanGraphBinding::fromTransient(getScratch(histograms, VkDeviceSize(radixSize) * tileCount * sizeof(uint32_t)),
+                                                                           VulkanAccess::ReadWrite);
+    
+    // Even passes read from the caller's buffers, odd passes from the scratch ones.
+    const VulkanGraphBinding keyBuffers[2] = {
+        { keys, VulkanAccess::ReadWrite },
+        VulkanGraphBinding::fromTransient(getScratch(keysScratch, VkDeviceSize(elementCount) * keyWords * sizeof(uint32_t)), VulkanAccess::ReadWrite),
+    };
+    
+    // Without values, the keys stand in for the value bindings, which the kernel then leaves alone.
+    VulkanGraphBinding valueBuffers[2] = { keyBuffers[0], keyBuffers[1] };
+    if (hasValues)
+    {
+        valueBuffers[0] = { values, VulkanAccess::ReadWrite };
+        valueBuffers[1] = VulkanGraphBinding::fromTransient(getScratch(valuesScratch, VkDeviceSize(elementCount) * sizeof(uint32_t)), VulkanAccess::ReadWrite);
+    }
+    
+    VulkanKernels::RadixSortParameters parameters;
+    parameters.elementCount = elementCount;
+    parameters.keyWords = keyWords;
+    parameters.tileCount = tileCount;
+    parameters.hasValues = hasValues ? 1 : 0;
+    
+    for (uint32_t pass = 0; pass < keyBits / VulkanKernels::radixBits; ++pass)
+    {
+        const uint32_t source = pass % 2;
+        const uint32_t destination = 1 - source;
+        
+        parameters.shift = pass * VulkanKernels::radixBits;
+        
+        const VulkanGraphBinding histogramBindings[] = {
+            keyBuffers[source].withAccess(VulkanAccess::Read),
+            histogramBuffer.withAccess(VulkanAccess::Write),
+        };
+        graph.dispatch(histogramKernel, histogramBindings, tileCount, 1, 1, parameters);
+        
+        scan.record(histogramBuffer, histogramBuffer, radixSize * tileCount, VulkanScanMode::Exclusive);
+        
+        const VulkanGraphBinding scatterBindings[] = {
+            keyBuffers[source].withAccess(VulkanAccess::Read),
+            valueBuffers[source].withAccess(VulkanAccess::Read),
+            keyBuffers[destination].withAccess(VulkanAccess::Write),
+            valueBuffers[destination].withAccess(VulkanAccess::Write),
+            histogramBuffer.withAccess(VulkanAccess::Read),
+        };
+        graph.dispatch(scatterKernel, scatterBindings, tileCount, 1, 1, parameters);
+    }
+}
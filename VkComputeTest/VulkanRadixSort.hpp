@@ -0,0 +1,65 @@
+//
+//  VulkanRadixSort.hpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/31/21.
+//
+
+#ifndef VulkanRadixSort_hpp
+#define VulkanRadixSort_hpp
+
+#include <cstdint>
+#include <vulkan/vulkan.h>
+
+#include "VulkanComputeGraph.hpp"
+#include "VulkanScan.hpp"
+
+// A stable LSD radix sort of unsigned 32 or 64-bit keys, with an optional u32 payload, recorded into a compute graph so
+// the sorted data stays on the device. Signed or float keys can be sorted once they're mapped to unsigned ones that
+// order the same way.
+//
+// Each pass sorts by the next 4 bits. Every tile counts its digits, one exclusive scan over all the counts gives every
+// tile its first slot for each digit, and every tile then scatters its keys to their slots in order. Keys go back and
+// forth between the caller's buffers and transient ones, and the even number of passes leaves them in the caller's.
+class VulkanRadixSort {
+public:
+    // The graph must outlive the sort.
+    VulkanRadixSort(VulkanComputeGraph& graph, const VkPhysicalDeviceLimits& limits);
+    
+    VulkanRadixSort(const VulkanRadixSort&) = delete;
+    VulkanRadixSort& operator=(const VulkanRadixSort&) = delete;
+    
+    // Appends a sort of elementCount keys in place. keyBits is 32 or 64, and 64-bit keys are stored low word first.
+    // values is VK_NULL_HANDLE, or holds one u32 for each key, which moves with it.
+    void record(VkBuffer keys, VkBuffer values, uint32_t elementCount, uint32_t keyBits);
+    
+    // One tile per workgroup has to fit in a single dispatch.
+    uint32_t getMaxElementCount() const;
+
+private:
+    
+    static constexpr uint32_t preferredLocalSize = 256;
+    
+    // A transient buffer that is replaced when a sort needs a bigger one.
+    struct Scratch
+    {
+        VkDeviceSize                size = 0;
+        VulkanTransientBuffer       buffer;
+    };
+    
+    VulkanComputeGraph&             graph;
+    VulkanScan                      scan;
+    VulkanComputeGraph::KernelId    histogramKernel;
+    VulkanComputeGraph::KernelId    scatterKernel;
+    uint32_t                        tileSize;
+    uint32_t                        maxTileCount;
+    
+    Scratch                         histograms;
+    Scratch                         keysScratch;
+    Scratch                         valuesScratch;
+    
+    VulkanTransientBuffer getScratch(Scratch& scratch, VkDeviceSize size);
+
+};
+
+#endif /* VulkanRadixSort_hpp */
@@ -0,0 +1,178 @@
+//
+//  VulkanReduction.cpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/31/21.
+//
+
+#include <algorithm>
+#include <cmath>
+
+#include "VulkanComputeApplication.hpp"
+#include "VulkanReduction.hpp"
+
+// MARK: - Constructor
+
+VulkanReduction::VulkanReduction(VulkanComputeApplication& application)
+: memoryAllocator(application.getMemoryAllocator())
+, graph(application.createComputeGraph())
+, isSubgroupKernel(application.supportsSubgroupArithmetic())
+{
+    // The shared memory tree needs a power of two.
+    uint32_t localSize = VulkanKernels::getPowerOfTwoLocalSize(application.getLimits(), preferredLocalSize);
+    
+    kernel = graph->addKernel(VulkanKernels::getKernel(isSubgroupKernel ? "reduce" : "reduce_shared"), VulkanWorkgroupSize{ localSize, 1, 1 });
+    
+    partials[0] = graph->createTransientBuffer(maxGroupCount * 2 * sizeof(uint32_t));
+    partials[1] = graph->createTransientBuffer(maxGroupCount * 2 * sizeof(uint32_t));
+    
+    // The result, then the last half of an odd f16 count.
+    resultBuffer = memoryAllocator.createBuffer(3 * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                                VulkanMemoryUsage::GpuToCpu);
+}
+
+// MARK: - Destructor
+
+VulkanReduction::~VulkanReduction()
+{
+    // The graph waits for its last submission, which may still be writing the result.
+    graph.reset();
+    
+    memoryAllocator.destroyBuffer(resultBuffer);
+}
+
+// MARK: - Reduction
+
+static bool hasHalfTail(uint32_t elementCount, VulkanKernels::ElementType elementType)
+{
+    return elementType == VulkanKernels::ElementType::F16 && elementCount % 2 != 0;
+}
+
+static float halfToFloat(uint16_t half)
+{
+    const uint32_t exponent = (half >> 10) & 0x1F;
+    const uint32_t mantissa = half & 0x3FF;
+    
+    float magnitude;
+    if (exponent == 0)
+    {
+        magnitude = std::ldexp(static_cast<float>(mantissa), -24);
+    } else if (exponent == 0x1F)
+    {
+        magnitude = mantissa == 0 ? INFINITY : NAN;
+    } else
+    {
+        magnitude = std::ldexp(static_cast<float>(mantissa | 0x400), static_cast<int>(exponent) - 25);
+    }
+    
+    return (half & 0x8000) ? -magnitude : magnitude;
+}
+
+// Folds the last element into the GPU's result the way combine() in reduce.glsl would.
+static VulkanReductionResult combineTail(VulkanReductionResult result, float tail, uint32_t tailIndex, VulkanKernels::ReduceOperation operation)
+{
+    const float value = result.asF32();
+    float combined = value;
+    
+    switch (operation)
+    {
+        case VulkanKernels::ReduceOperation::Sum:
+            combined = value + tail;
+            break;
+        case VulkanKernels::ReduceOperation::Min:
+            combined = tail < value ? tail : value;
+            break;
+        case VulkanKernels::ReduceOperation::Max:
+            combined = value < tail ? tail : value;
+            break;
+        case VulkanKernels::ReduceOperation::ArgMax:
+            if (value < tail || (!(tail < value) && tailIndex < result.index))
+            {
+                combined = tail;
+                result.index = tailIndex;
+            }
+            break;
+    }
+    
+    std::memcpy(&result.bits, &combined, sizeof(combined));
+    return result;
+}
+
+void VulkanReduction::buildPasses(VkBuffer buffer, uint32_t elementCount, VulkanKernels::ElementType elementType,
+                                  VulkanKernels::ReduceOperation operation)
+{
+    graph->clear();
+    passCount = 0;
+    
+    const uint32_t localSize = graph->getLocalSize(kernel).x;
+    
+    // Halves are loaded a word at a time, so the word holding the last of an odd count would run past the end of
+    // the buffer. That half is copied out on its own instead, and folded in on the host.
+    if (hasHalfTail(elementCount, elementType))
+    {
+        --elementCount;
+        
+        VkBufferCopy region{ elementCount * sizeof(uint16_t), 2 * sizeof(uint32_t), sizeof(uint16_t) };
+        graph->copyBuffer(buffer, resultBuffer.buffer, region);
+    }
+    
+    VulkanKernels::ReduceParameters parameters;
+    parameters.elementCount = elementCount;
+    parameters.operation = operation;
+    parameters.elementType = elementType;
+    parameters.isPartialInput = 0;
+    
+    VulkanGraphBinding input = { buffer, VulkanAccess::Read };
+    
+    while (true)
+    {
+        uint32_t groupCount = parameters.elementCount / localSize + (parameters.elementCount % localSize != 0 ? 1 : 0);
+        groupCount = std::clamp(groupCount, 1u, maxGroupCount);
+        
+        // The last pass writes straight to the result, which is the only thing read back.
+        VulkanGraphBinding output = groupCount == 1 ? VulkanGraphBinding{ resultBuffer.buffer, VulkanAccess::Write }
+                                                    : VulkanGraphBinding::fromTransient(partials[passCount % 2], VulkanAccess::Write);
+        
+        const VulkanGraphBinding bindings[] = { input, output };
+        graph->dispatch(kernel, bindings, groupCount, 1, 1, parameters);
+        ++passCount;
+        
+        if (groupCount == 1)
+        {
+            break;
+        }
+        
+        input = VulkanGraphBinding::fromTransient(output.transient, VulkanAccess::Read);
+        parameters.elementCount = groupCount;
+        parameters.isPartialInput = 1;
+    }
+}
+
+VulkanReductionResult VulkanReduction::reduce(VkBuffer buffer, uint32_t elementCount, VulkanKernels::ElementType elementType,
+                                              VulkanKernels::ReduceOperation operation)
+{
+    auto reduction = std::make_tuple(buffer, elementCount, elementType, operation);
+    if (lastReduction != reduction)
+    {
+        buildPasses(buffer, elementCount, elementType, operation);
+        lastReduction = reduction;
+    }
+    
+    graph->submit().wait();
+    
+    memoryAllocator.invalidate(resultBuffer.allocation, 0, resultBuffer.size);
+    const uint32_t* words = static_cast<const uint32_t*>(resultBuffer.allocation.mappedData);
+    
+    VulkanReductionResult result;
+    result.bits = words[0];
+    result.index = operation == VulkanKernels::ReduceOperation::ArgMax ? words[1] : UINT32_MAX;
+    
+    if (hasHalfTail(elementCount, elementType))
+    {
+        uint16_t tail;
+        std::memcpy(&tail, &words[2], sizeof(tail));
+        result = combineTail(result, halfToFloat(tail), elementCount - 1, operation);
+    }
+    
+    return result;
+}
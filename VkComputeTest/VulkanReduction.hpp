@@ -0,0 +1,97 @@
+//
+//  VulkanReduction.hpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/31/21.
+//
+
+#ifndef VulkanReduction_hpp
+#define VulkanReduction_hpp
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <vulkan/vulkan.h>
+
+#include "VulkanComputeGraph.hpp"
+#include "VulkanKernels.hpp"
+#include "VulkanMemoryAllocator.hpp"
+
+class VulkanComputeApplication;
+
+struct VulkanReductionResult
+{
+    // The bits of the result as the element type, or as an f32 for F16 elements.
+    uint32_t                    bits = 0;
+    
+    // Only set for ArgMax, to the lowest index holding the largest value.
+    uint32_t                    index = UINT32_MAX;
+    
+    uint32_t asU32() const { return bits; }
+    int32_t asI32() const { return static_cast<int32_t>(bits); }
+    
+    float asF32() const
+    {
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+};
+
+// Reduces a buffer of u32, i32, f32 or f16 elements on the GPU, and reads back nothing but the result.
+//
+// Each pass folds its input into one partial per workgroup, and passes repeat over the partials until one workgroup
+// is left. Devices with subgroup arithmetic in compute shaders reduce each subgroup with it before going through
+// shared memory. Everything else uses a tree in shared memory.
+//
+// Sums of integers wrap around, and sums of floats are only as exact as their order, which differs from the CPU's.
+class VulkanReduction {
+public:
+    // The application must outlive the reduction.
+    VulkanReduction(VulkanComputeApplication& application);
+    ~VulkanReduction();
+    
+    VulkanReduction(const VulkanReduction&) = delete;
+    VulkanReduction& operator=(const VulkanReduction&) = delete;
+    
+    // The buffer needs STORAGE_BUFFER usage and must hold elementCount elements from offset 0. Waits for the result.
+    // An odd count of F16 elements also needs TRANSFER_SRC usage, since the last one is copied out and reduced on the host.
+    // No elements give the operation's identity, e.g. 0 for Sum and -infinity for a float Max.
+    // Reducing the same buffer the same way again only submits the passes again, so don't destroy a buffer and
+    // reduce a new one with the same handle in between.
+    VulkanReductionResult reduce(VkBuffer buffer, uint32_t elementCount, VulkanKernels::ElementType elementType,
+                                 VulkanKernels::ReduceOperation operation);
+    
+    bool usesSubgroups() const { return isSubgroupKernel; }
+    
+    // How many dispatches the last reduction took.
+    uint32_t getPassCount() const { return passCount; }
+
+private:
+    
+    static constexpr uint32_t preferredLocalSize = 256;
+    
+    // Caps the first pass. Every invocation loops over as many elements as it takes to cover the rest.
+    static constexpr uint32_t maxGroupCount = 1024;
+    
+    VulkanMemoryAllocator&          memoryAllocator;
+    std::unique_ptr<VulkanComputeGraph> graph;
+    VulkanComputeGraph::KernelId    kernel;
+    bool                            isSubgroupKernel;
+    
+    // Passes after the first alternate between these.
+    VulkanTransientBuffer           partials[2];
+    VulkanBuffer                    resultBuffer;
+    
+    // What the graph was last built for, so repeating a reduction only submits it again.
+    std::optional<std::tuple<VkBuffer, uint32_t, VulkanKernels::ElementType, VulkanKernels::ReduceOperation>> lastReduction;
+    uint32_t                        passCount = 0;
+    
+    void buildPasses(VkBuffer buffer, uint32_t elementCount, VulkanKernels::ElementType elementType,
+                     VulkanKernels::ReduceOperation operation);
+
+};
+
+#endif /* VulkanReduction_hpp */
@@ -0,0 +1,108 @@
+//
+//  VulkanScan.cpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/31/21.
+//
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "VulkanKernels.hpp"
+#include "VulkanScan.hpp"
+
+// MARK: - Constructor
+
+VulkanScan::VulkanScan(VulkanComputeGraph& graph, const VkPhysicalDeviceLimits& limits)
+: graph(graph)
+{
+    // The tile sums are reduced with a tree, which needs a power of two.
+    VulkanWorkgroupSize localSize = { VulkanKernels::getPowerOfTwoLocalSize(limits, preferredLocalSize), 1, 1 };
+    
+    reduceKernel = graph.addKernel(VulkanKernels::getKernel("scan_reduce"), localSize);
+    tilesKernel = graph.addKernel(VulkanKernels::getKernel("scan_tiles"), localSize);
+    
+    tileSize = localSize.x * VulkanKernels::scanItemsPerInvocation;
+    maxTileCount = limits.maxComputeWorkGroupCount[0];
+}
+
+// MARK: - Recording
+
+uint32_t VulkanScan::getMaxElementCount() const
+{
+    return static_cast<uint32_t>(std::min<uint64_t>(static_cast<uint64_t>(tileSize) * maxTileCount, UINT32_MAX));
+}
+
+VulkanTransientBuffer VulkanScan::getTileSums(size_t level, uint32_t elementCount)
+{
+    if (level == tileSums.size())
+    {
+        tileSums.emplace_back(0, VulkanTransientBuffer());
+    }
+    
+    auto& [capacity, buffer] = tileSums[level];
+    if (capacity < elementCount)
+    {
+        capacity = elementCount;
+        buffer = graph.createTransientBuffer(elementCount * sizeof(uint32_t));
+    }
+    
+    return buffer;
+}
+
+void VulkanScan::record(const VulkanGraphBinding& input, const VulkanGraphBinding& output, uint32_t elementCount, VulkanScanMode mode)
+{
+    if (elementCount > getMaxElementCount())
+    {
+        throw std::runtime_error("Too many elements to scan!");
+    }
+    
+    if (elementCount == 0)
+    {
+        return;
+    }
+    
+    // The input, then the tile sums of each level, until one tile holds them all.
+    std::vector<VulkanGraphBinding> levels = { input };
+    std::vector<uint32_t> counts = { elementCount };
+    
+    while (counts.back() > tileSize)
+    {
+        uint32_t tileCount = counts.back() / tileSize + (counts.back() % tileSize != 0 ? 1 : 0);
+        
+        levels.push_back(VulkanGraphBinding::fromTransient(getTileSums(levels.size() - 1, tileCount), VulkanAccess::ReadWrite));
+        counts.push_back(tileCount);
+    }
+    
+    VulkanKernels::ScanParameters parameters;
+    
+    for (size_t level = 0; level + 1 < levels.size(); ++level)
+    {
+        parameters.elementCount = counts[level];
+        
+        const VulkanGraphBinding bindings[] = { levels[level].withAccess(VulkanAccess::Read), levels[level + 1].withAccess(VulkanAccess::Write) };
+        graph.dispatch(reduceKernel, bindings, counts[level + 1], 1, 1, parameters);
+    }
+    
+    // Back down. The top level fits in one tile, and every level under it starts each tile from the scanned sums above.
+    for (size_t level = levels.size(); level-- > 0;)
+    {
+        bool isTop = level + 1 == levels.size();
+        bool isOutput = level == 0;
+        
+        parameters.elementCount = counts[level];
+        parameters.isInclusive = isOutput && mode == VulkanScanMode::Inclusive ? 1 : 0;
+        parameters.hasTileOffsets = isTop ? 0 : 1;
+        
+        // Tile sums are scanned in place. The top level has no offsets, but the binding still needs a buffer.
+        const VulkanGraphBinding& destination = isOutput ? output : levels[level];
+        const VulkanGraphBinding& offsets = isTop ? levels[level] : levels[level + 1];
+        
+        const VulkanGraphBinding bindings[] = {
+            levels[level].withAccess(VulkanAccess::Read),
+            destination.withAccess(VulkanAccess::Write),
+            offsets.withAccess(VulkanAccess::Read),
+        };
+        graph.dispatch(tilesKernel, bindings, isTop ? 1 : counts[level + 1], 1, 1, parameters);
+    }
+}
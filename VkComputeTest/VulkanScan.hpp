@@ -0,0 +1,71 @@
+//
+//  VulkanScan.hpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/31/21.
+//
+
+#ifndef VulkanScan_hpp
+#define VulkanScan_hpp
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "VulkanComputeGraph.hpp"
+
+enum class VulkanScanMode
+{
+    // Each output is the sum of the elements before it, starting from 0.
+    Exclusive,
+    
+    // Each output includes its own element.
+    Inclusive,
+};
+
+// Prefix sums of u32 elements, recorded into a compute graph so the results stay on the device for the stages after.
+// Sums wrap around.
+//
+// Reduce-then-scan: every tile of the input is summed, the tile sums are scanned the same way, recursively, until
+// they fit in one tile, and then every tile is scanned starting from its tile's sum. That is 2 * levels - 1
+// dispatches, 3 for up to a million elements. Unlike a single pass with decoupled look-back, it needs no forward
+// progress guarantees between workgroups, which Vulkan doesn't make.
+class VulkanScan {
+public:
+    // The graph must outlive the scan.
+    VulkanScan(VulkanComputeGraph& graph, const VkPhysicalDeviceLimits& limits);
+    
+    VulkanScan(const VulkanScan&) = delete;
+    VulkanScan& operator=(const VulkanScan&) = delete;
+    
+    // Appends a scan of elementCount u32s. The input and output can be the caller's buffers or transient buffers of the
+    // same graph, and can be the same buffer. Only their buffers and ranges matter, the scan sets their access.
+    // Every scan recorded with this object shares its tile sums, so the graph runs them one after another.
+    void record(const VulkanGraphBinding& input, const VulkanGraphBinding& output, uint32_t elementCount, VulkanScanMode mode);
+    
+    // Elements each workgroup scans.
+    uint32_t getTileSize() const { return tileSize; }
+    
+    // One tile per workgroup has to fit in a single dispatch.
+    uint32_t getMaxElementCount() const;
+
+private:
+    
+    static constexpr uint32_t preferredLocalSize = 256;
+    
+    VulkanComputeGraph&             graph;
+    VulkanComputeGraph::KernelId    reduceKernel;
+    VulkanComputeGraph::KernelId    tilesKernel;
+    uint32_t                        tileSize;
+    uint32_t                        maxTileCount;
+    
+    // The tile sums of each level above the input, and how many elements they hold.
+    std::vector<std::pair<uint32_t, VulkanTransientBuffer>> tileSums;
+    
+    // Replaces the level's buffer if it's too small. The old one only keeps its memory while stages still use it.
+    VulkanTransientBuffer getTileSums(size_t level, uint32_t elementCount);
+
+};
+
+#endif /* VulkanScan_hpp */
@@ -0,0 +1,443 @@
+//
+//  VulkanShaderReflection.cpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/31/21.
+//
+
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "VulkanShaderReflection.hpp"
+
+// The parts of the SPIR-V spec reflection needs. Names follow the tables in VkComputeSample.cpp.
+enum {
+    MAGIC = 0x07230203,
+    HEADER_WORD_COUNT = 5,
+    
+    // Storage classes
+    UNIFORM_CONSTANT = 0,
+    UNIFORM = 2,
+    PUSH_CONSTANT = 9,
+    STORAGE_BUFFER = 12,
+    
+    // Decorations
+    SPEC_ID = 1,
+    BUFFER_BLOCK = 3,
+    ARRAY_STRIDE = 6,
+    MATRIX_STRIDE = 7,
+    BUILTIN = 11,
+    BINDING = 33,
+    DESCRIPTOR_SET = 34,
+    OFFSET = 35,
+    
+    // Built-ins
+    WORKGROUP_SIZE = 25,
+    
+    // Execution models and modes
+    GL_COMPUTE = 5,
+    LOCAL_SIZE = 17,
+    LOCAL_SIZE_ID = 38,
+    
+    // Image dimensions
+    DIM_BUFFER = 5,
+    
+    OP_ENTRY_POINT = 15,
+    OP_EXECUTION_MODE = 16,
+    OP_TYPE_VOID = 19,
+    OP_TYPE_BOOL = 20,
+    OP_TYPE_INT = 21,
+    OP_TYPE_FLOAT = 22,
+    OP_TYPE_VECTOR = 23,
+    OP_TYPE_MATRIX = 24,
+    OP_TYPE_IMAGE = 25,
+    OP_TYPE_SAMPLER = 26,
+    OP_TYPE_SAMPLED_IMAGE = 27,
+    OP_TYPE_ARRAY = 28,
+    OP_TYPE_RUNTIME_ARRAY = 29,
+    OP_TYPE_STRUCT = 30,
+    OP_TYPE_POINTER = 32,
+    OP_TYPE_FORWARD_POINTER = 39,
+    OP_CONSTANT_TRUE = 41,
+    OP_CONSTANT_FALSE = 42,
+    OP_CONSTANT = 43,
+    OP_CONSTANT_COMPOSITE = 44,
+    OP_SPEC_CONSTANT_TRUE = 48,
+    OP_SPEC_CONSTANT_FALSE = 49,
+    OP_SPEC_CONSTANT = 50,
+    OP_SPEC_CONSTANT_COMPOSITE = 51,
+    OP_VARIABLE = 59,
+    OP_DECORATE = 71,
+    OP_MEMBER_DECORATE = 72,
+    OP_EXECUTION_MODE_ID = 331,
+};
+
+using Instruction = std::span<const uint32_t>;
+
+// Every instruction reflection looks at, indexed by the id it defines.
+struct SpirvModule
+{
+    std::unordered_map<uint32_t, Instruction> types;
+    std::unordered_map<uint32_t, Instruction> constants;
+    std::vector<Instruction> variables;
+    std::vector<Instruction> entryPoints;
+    std::vector<Instruction> executionModes;
+    
+    // Decoration values by target id, and member decoration values by struct id and member index.
+    std::unordered_map<uint32_t, std::map<uint32_t, uint32_t>> decorations;
+    std::unordered_map<uint32_t, std::map<std::pair<uint32_t, uint32_t>, uint32_t>> memberDecorations;
+    
+    std::optional<uint32_t> getDecoration(uint32_t id, uint32_t decoration) const
+    {
+        auto it = decorations.find(id);
+        if (it == decorations.end() || !it->second.contains(decoration))
+        {
+            return std::nullopt;
+        }
+        return it->second.at(decoration);
+    }
+    
+    std::optional<uint32_t> getMemberDecoration(uint32_t id, uint32_t member, uint32_t decoration) const
+    {
+        auto it = memberDecorations.find(id);
+        if (it == memberDecorations.end() || !it->second.contains({ member, decoration }))
+        {
+            return std::nullopt;
+        }
+        return it->second.at({ member, decoration });
+    }
+    
+    Instruction getType(uint32_t id) const
+    {
+        auto it = types.find(id);
+        if (it == types.end())
+        {
+            throw std::runtime_error("SPIR-V refers to an undefined type!");
+        }
+        return it->second;
+    }
+    
+    // Spec constants give their default value.
+    uint32_t getConstantValue(uint32_t id) const
+    {
+        auto it = constants.find(id);
+        if (it == constants.end())
+        {
+            throw std::runtime_error("SPIR-V refers to an undefined constant!");
+        }
+        
+        switch (it->second[0] & 0xffff)
+        {
+            case OP_CONSTANT_TRUE:
+            case OP_SPEC_CONSTANT_TRUE:
+                return 1;
+            case OP_CONSTANT_FALSE:
+            case OP_SPEC_CONSTANT_FALSE:
+                return 0;
+            case OP_CONSTANT:
+            case OP_SPEC_CONSTANT:
+                return it->second[3];
+            default:
+                throw std::runtime_error("SPIR-V constant is not a scalar!");
+        }
+    }
+    
+    // The size of a type in a buffer or push constant block, honoring the strides and offsets the shader declares.
+    uint32_t getTypeSize(uint32_t id) const
+    {
+        Instruction type = getType(id);
+        
+        switch (type[0] & 0xffff)
+        {
+            case OP_TYPE_BOOL:
+                return sizeof(VkBool32);
+            case OP_TYPE_INT:
+            case OP_TYPE_FLOAT:
+                return type[2] / 8;
+            case OP_TYPE_VECTOR:
+            case OP_TYPE_MATRIX:
+                return type[3] * getTypeSize(type[2]);
+            case OP_TYPE_ARRAY:
+            {
+                uint32_t length = getConstantValue(type[3]);
+                uint32_t stride = getDecoration(id, ARRAY_STRIDE).value_or(getTypeSize(type[2]));
+                return length * stride;
+            }
+            case OP_TYPE_RUNTIME_ARRAY:
+                return 0;
+            case OP_TYPE_STRUCT:
+            {
+                uint32_t size = 0;
+                for (uint32_t member = 0; member + 2 < type.size(); ++member)
+                {
+                    uint32_t memberType = type[member + 2];
+                    uint32_t offset = getMemberDecoration(id, member, OFFSET).value_or(size);
+                    
+                    // Matrix columns are spaced by the member's stride, not packed.
+                    uint32_t memberSize = getTypeSize(memberType);
+                    auto matrixStride = getMemberDecoration(id, member, MATRIX_STRIDE);
+                    if (matrixStride.has_value() && (getType(memberType)[0] & 0xffff) == OP_TYPE_MATRIX)
+                    {
+                        memberSize = getType(memberType)[3] * *matrixStride;
+                    }
+                    
+                    size = std::max(size, offset + memberSize);
+                }
+                return size;
+            }
+            default:
+                throw std::runtime_error("SPIR-V type has no size!");
+        }
+    }
+};
+
+static std::string readLiteralString(Instruction instruction, size_t firstWord)
+{
+    std::string result;
+    for (size_t i = firstWord; i < instruction.size(); ++i)
+    {
+        for (int byte = 0; byte < 4; ++byte)
+        {
+            char c = static_cast<char>((instruction[i] >> (8 * byte)) & 0xff);
+            if (c == '\0')
+            {
+                return result;
+            }
+            result.push_back(c);
+        }
+    }
+    return result;
+}
+
+static SpirvModule parseModule(std::span<const uint32_t> code)
+{
+    if (code.size() < HEADER_WORD_COUNT || code[0] != MAGIC)
+    {
+        throw std::runtime_error("Shader code is not SPIR-V!");
+    }
+    
+    SpirvModule module;
+    
+    size_t offset = HEADER_WORD_COUNT;
+    while (offset < code.size())
+    {
+        uint32_t wordCount = code[offset] >> 16;
+        uint32_t opcode = code[offset] & 0xffff;
+        
+        if (wordCount == 0 || offset + wordCount > code.size())
+        {
+            throw std::runtime_error("SPIR-V instruction runs past the end of the code!");
+        }
+        
+        Instruction instruction = code.subspan(offset, wordCount);
+        offset += wordCount;
+        
+        switch (opcode)
+        {
+            case OP_ENTRY_POINT:
+                module.entryPoints.push_back(instruction);
+                break;
+            case OP_EXECUTION_MODE:
+            case OP_EXECUTION_MODE_ID:
+                module.executionModes.push_back(instruction);
+                break;
+            case OP_DECORATE:
+                if (wordCount >= 3)
+                {
+                    module.decorations[instruction[1]][instruction[2]] = wordCount >= 4 ? instruction[3] : 0;
+                }
+                break;
+            case OP_MEMBER_DECORATE:
+                if (wordCount >= 4)
+                {
+                    module.memberDecorations[instruction[1]][{ instruction[2], instruction[3] }] = wordCount >= 5 ? instruction[4] : 0;
+                }
+                break;
+            case OP_VARIABLE:
+                module.variables.push_back(instruction);
+                break;
+            case OP_CONSTANT_TRUE:
+            case OP_CONSTANT_FALSE:
+            case OP_CONSTANT:
+            case OP_CONSTANT_COMPOSITE:
+            case OP_SPEC_CONSTANT_TRUE:
+            case OP_SPEC_CONSTANT_FALSE:
+            case OP_SPEC_CONSTANT:
+            case OP_SPEC_CONSTANT_COMPOSITE:
+                module.constants[instruction[2]] = instruction;
+                break;
+            default:
+                // Every OpType* instruction defines its result id in the first operand.
+                if (opcode >= OP_TYPE_VOID && opcode < OP_TYPE_FORWARD_POINTER)
+                {
+                    module.types[instruction[1]] = instruction;
+                }
+                break;
+        }
+    }
+    
+    return module;
+}
+
+static VkDescriptorType getDescriptorType(const SpirvModule& module, uint32_t storageClass, uint32_t typeId)
+{
+    Instruction type = module.getType(typeId);
+    
+    switch (storageClass)
+    {
+        case STORAGE_BUFFER:
+            return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        case UNIFORM:
+            // Before SPIR-V 1.3, storage buffers were uniform blocks decorated BufferBlock.
+            return module.getDecoration(typeId, BUFFER_BLOCK).has_value() ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        case UNIFORM_CONSTANT:
+            switch (type[0] & 0xffff)
+            {
+                case OP_TYPE_SAMPLER:
+                    return VK_DESCRIPTOR_TYPE_SAMPLER;
+                case OP_TYPE_SAMPLED_IMAGE:
+                    return VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+                case OP_TYPE_IMAGE:
+                {
+                    // Sampled is 1 for images used with a sampler, and 2 for storage images.
+                    bool isStorage = type[7] == 2;
+                    if (type[3] == DIM_BUFFER)
+                    {
+                        return isStorage ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+                    }
+                    return isStorage ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+                }
+                default:
+                    break;
+            }
+            break;
+        default:
+            break;
+    }
+    
+    throw std::runtime_error("Shader uses an unsupported kind of descriptor!");
+}
+
+// MARK: - Constructor
+
+VulkanShaderReflection::VulkanShaderReflection(std::span<const uint32_t> code, const std::string& entryPoint)
+{
+    SpirvModule module = parseModule(code);
+    
+    // Resources
+    for (Instruction variable : module.variables)
+    {
+        uint32_t id = variable[2];
+        uint32_t storageClass = variable[3];
+        Instruction pointer = module.getType(variable[1]);
+        uint32_t pointeeId = pointer[3];
+        
+        if (storageClass == PUSH_CONSTANT)
+        {
+            pushConstantSize = std::max(pushConstantSize, module.getTypeSize(pointeeId));
+            continue;
+        }
+        
+        auto binding = module.getDecoration(id, BINDING);
+        if (!binding.has_value())
+        {
+            continue;
+        }
+        
+        VulkanShaderBinding shaderBinding;
+        shaderBinding.set = module.getDecoration(id, DESCRIPTOR_SET).value_or(0);
+        shaderBinding.binding = *binding;
+        
+        Instruction pointee = module.getType(pointeeId);
+        if ((pointee[0] & 0xffff) == OP_TYPE_ARRAY)
+        {
+            shaderBinding.descriptorCount = module.getConstantValue(pointee[3]);
+            pointeeId = pointee[2];
+        } else if ((pointee[0] & 0xffff) == OP_TYPE_RUNTIME_ARRAY)
+        {
+            throw std::runtime_error("Shader uses an unsized descriptor array!");
+        }
+        
+        shaderBinding.descriptorType = getDescriptorType(module, storageClass, pointeeId);
+        bindings.push_back(shaderBinding);
+    }
+    
+    std::sort(bindings.begin(), bindings.end());
+    
+    // Specialization constants
+    for (const auto& [id, constant] : module.constants)
+    {
+        auto constantId = module.getDecoration(id, SPEC_ID);
+        if (!constantId.has_value())
+        {
+            continue;
+        }
+        
+        VulkanSpecializationConstant specializationConstant;
+        specializationConstant.constantId = *constantId;
+        specializationConstant.size = module.getTypeSize(constant[1]);
+        specializationConstants.push_back(specializationConstant);
+    }
+    
+    std::sort(specializationConstants.begin(), specializationConstants.end(), [](const auto& a, const auto& b) {
+        return a.constantId < b.constantId;
+    });
+    
+    // Local size
+    auto entry = std::find_if(module.entryPoints.begin(), module.entryPoints.end(), [&](Instruction instruction) {
+        return instruction.size() >= 4 && instruction[1] == GL_COMPUTE && readLiteralString(instruction, 3) == entryPoint;
+    });
+    
+    if (entry == module.entryPoints.end())
+    {
+        throw std::runtime_error("Shader has no compute entry point named " + entryPoint + "!");
+    }
+    
+    uint32_t function = (*entry)[2];
+    
+    // Each dimension is either a literal, or a constant whose spec id (if any) lets the pipeline override it.
+    auto setLocalSize = [&](std::span<const uint32_t> constantIds) {
+        for (size_t i = 0; i < 3; ++i)
+        {
+            localSize[i] = module.getConstantValue(constantIds[i]);
+            localSizeConstantIds[i] = module.getDecoration(constantIds[i], SPEC_ID);
+        }
+    };
+    
+    for (Instruction mode : module.executionModes)
+    {
+        if (mode.size() < 6 || mode[1] != function)
+        {
+            continue;
+        }
+        
+        if (mode[2] == LOCAL_SIZE)
+        {
+            std::copy(mode.begin() + 3, mode.begin() + 6, localSize.begin());
+        } else if (mode[2] == LOCAL_SIZE_ID)
+        {
+            setLocalSize(mode.subspan(3, 3));
+        }
+    }
+    
+    // A WorkgroupSize built-in takes precedence over the execution mode. It's how glslang emits local_size_x_id.
+    for (const auto& [id, constant] : module.constants)
+    {
+        uint32_t opcode = constant[0] & 0xffff;
+        bool isComposite = opcode == OP_CONSTANT_COMPOSITE || opcode == OP_SPEC_CONSTANT_COMPOSITE;
+        
+        if (isComposite && constant.size() == 6 && module.getDecoration(id, BUILTIN) == static_cast<uint32_t>(WORKGROUP_SIZE))
+        {
+            setLocalSize(constant.subspan(3, 3));
+        }
+    }
+}
+
+// MARK: - Queries
+
+uint32_t VulkanShaderReflection::getSetCount() const
+{
+    return bindings.empty() ? 0 : bindings.back().set + 1;
+}
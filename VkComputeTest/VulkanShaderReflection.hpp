@@ -0,0 +1,75 @@
+//
+//  VulkanShaderReflection.hpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/31/21.
+//
+
+#ifndef VulkanShaderReflection_hpp
+#define VulkanShaderReflection_hpp
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+struct VulkanShaderBinding
+{
+    uint32_t                    set = 0;
+    uint32_t                    binding = 0;
+    VkDescriptorType            descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    uint32_t                    descriptorCount = 1;
+    
+    bool operator==(const VulkanShaderBinding&) const = default;
+    auto operator<=>(const VulkanShaderBinding&) const = default;
+};
+
+struct VulkanSpecializationConstant
+{
+    uint32_t                    constantId = 0;
+    
+    // In bytes, as VkSpecializationMapEntry::size wants it. Booleans are 4 byte VkBool32s.
+    uint32_t                    size = 0;
+};
+
+// What a compute kernel expects from its pipeline, read straight from its SPIR-V.
+// Every resource the module declares counts, whether or not the entry point uses it, which is what glslang emits for
+// GLSL anyway. Only GLCompute entry points are supported.
+class VulkanShaderReflection {
+public:
+    // Throws if the code isn't SPIR-V, or has no compute entry point with that name.
+    VulkanShaderReflection(std::span<const uint32_t> code, const std::string& entryPoint);
+    
+    // Sorted by set, then binding.
+    const std::vector<VulkanShaderBinding>& getBindings() const { return bindings; }
+    
+    // How many descriptor set layouts a pipeline layout needs, including empty ones for unused set numbers.
+    uint32_t getSetCount() const;
+    
+    // The end of the last push constant member, or 0 if the kernel has no push_constant block.
+    uint32_t getPushConstantSize() const { return pushConstantSize; }
+    
+    // Sorted by constant id.
+    const std::vector<VulkanSpecializationConstant>& getSpecializationConstants() const { return specializationConstants; }
+    
+    // The local size compiled into the kernel, or the defaults of the specialization constants that override it.
+    const std::array<uint32_t, 3>& getLocalSize() const { return localSize; }
+    
+    // The specialization constant id behind each dimension of the local size, for kernels declared with
+    // local_size_x_id and friends. Dimensions fixed at compile time have none.
+    const std::array<std::optional<uint32_t>, 3>& getLocalSizeConstantIds() const { return localSizeConstantIds; }
+
+private:
+    
+    std::vector<VulkanShaderBinding> bindings;
+    uint32_t                    pushConstantSize = 0;
+    std::vector<VulkanSpecializationConstant> specializationConstants;
+    std::array<uint32_t, 3>     localSize = { 1, 1, 1 };
+    std::array<std::optional<uint32_t>, 3> localSizeConstantIds;
+
+};
+
+#endif /* VulkanShaderReflection_hpp */
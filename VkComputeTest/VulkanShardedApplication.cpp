@@ -0,0 +1,394 @@
+//
+//  VulkanShardedApplication.cpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/30/21.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+
+#include "VulkanShardedApplication.hpp"
+
+// MARK: - Constructor
+
+VulkanShardedApplication::VulkanShardedApplication(const VulkanShardedConfiguration& configuration)
+: configuration(configuration)
+{
+    startShards();
+    
+    // The shard threads have to be joined if the constructor doesn't finish, since the destructor won't run.
+    try
+    {
+        calibrate();
+    } catch (...)
+    {
+        stopShards();
+        throw;
+    }
+}
+
+// MARK: - Destructor
+
+VulkanShardedApplication::~VulkanShardedApplication()
+{
+    stopShards();
+}
+
+// MARK: - Shard Threads
+
+void VulkanShardedApplication::startShards()
+{
+    std::vector<std::string> devices = configuration.devices;
+    bool isAutomatic = devices.empty();
+    
+    if (isAutomatic)
+    {
+        uint32_t physicalDeviceCount = VulkanComputeApplication::getPhysicalDeviceCount();
+        
+        for (uint32_t i = 0; i < physicalDeviceCount; ++i)
+        {
+            devices.push_back(std::to_string(i));
+        }
+    }
+    
+    for (const auto& device : devices)
+    {
+        auto shard = std::make_unique<Shard>();
+        shard->device = device;
+        shards.push_back(std::move(shard));
+    }
+    
+    // Applications are created on their shard's thread, so every device starts up at the same time.
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pendingShards = shards.size();
+    }
+    
+    for (auto& shard : shards)
+    {
+        shard->thread = std::thread(&VulkanShardedApplication::runShard, this, std::ref(*shard));
+    }
+    
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        jobFinished.wait(lock, [&]() { return pendingShards == 0; });
+    }
+    
+    // A shard whose application failed to start has already returned from its thread.
+    std::exception_ptr firstError;
+    
+    for (auto it = shards.begin(); it != shards.end();)
+    {
+        Shard& shard = **it;
+        
+        if (shard.application)
+        {
+            ++it;
+            continue;
+        }
+        
+        shard.thread.join();
+        
+        if (isAutomatic)
+        {
+            try
+            {
+                std::rethrow_exception(shard.error);
+            } catch (const std::exception& error)
+            {
+                std::cerr << "Skipping device " << shard.device << ": " << error.what() << std::endl;
+            } catch (...)
+            {
+                std::cerr << "Skipping device " << shard.device << std::endl;
+            }
+        } else if (!firstError)
+        {
+            firstError = shard.error;
+        }
+        
+        it = shards.erase(it);
+    }
+    
+    if (firstError)
+    {
+        stopShards();
+        std::rethrow_exception(firstError);
+    }
+    
+    if (shards.empty())
+    {
+        throw std::runtime_error("Failed to start on any GPU!");
+    }
+}
+
+void VulkanShardedApplication::stopShards()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        isStopping = true;
+    }
+    
+    jobAvailable.notify_all();
+    
+    for (auto& shard : shards)
+    {
+        if (shard->thread.joinable())
+        {
+            shard->thread.join();
+        }
+    }
+}
+
+void VulkanShardedApplication::runShard(Shard& shard)
+{
+    try
+    {
+        VulkanComputeConfiguration applicationConfiguration = configuration.application;
+        applicationConfiguration.device = shard.device;
+        
+        shard.application = std::make_unique<VulkanComputeApplication>(applicationConfiguration);
+    } catch (...)
+    {
+        shard.error = std::current_exception();
+    }
+    
+    bool isStarted = shard.application != nullptr;
+    
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        --pendingShards;
+    }
+    
+    jobFinished.notify_all();
+    
+    if (!isStarted)
+    {
+        return;
+    }
+    
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            jobAvailable.wait(lock, [&]() { return isStopping || shard.completedJob < jobSerial; });
+            
+            if (isStopping)
+            {
+                return;
+            }
+        }
+        
+        try
+        {
+            runSlice(shard);
+        } catch (...)
+        {
+            shard.error = std::current_exception();
+        }
+        
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            shard.completedJob = jobSerial;
+            --pendingShards;
+        }
+        
+        jobFinished.notify_all();
+    }
+}
+
+// Feeds the slice through the application in storage-buffer-sized chunks. Like main.cpp, it keeps every frame busy
+// and only reads a chunk back once the next submit is about to reuse its frame.
+void VulkanShardedApplication::runSlice(Shard& shard)
+{
+    VulkanComputeApplication& application = *shard.application;
+    const size_t chunkSize = application.getMaxElementCount();
+    
+    std::deque<std::pair<VulkanSubmission, size_t>> submissions;
+    
+    auto collect = [&]() {
+        auto& [submission, offset] = submissions.front();
+        auto output = application.getOutput(submission);
+        std::copy(output.begin(), output.end(), shard.output.begin() + offset);
+        submissions.pop_front();
+    };
+    
+    auto start = std::chrono::steady_clock::now();
+    
+    for (size_t offset = 0; offset < shard.input.size(); offset += chunkSize)
+    {
+        if (submissions.size() == configuration.application.framesInFlight)
+        {
+            collect();
+        }
+        
+        size_t count = std::min(chunkSize, shard.input.size() - offset);
+        submissions.emplace_back(application.submit(shard.input.subspan(offset, count), jobIterations), offset);
+    }
+    
+    while (!submissions.empty())
+    {
+        collect();
+    }
+    
+    shard.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// MARK: - Jobs
+
+void VulkanShardedApplication::execute(uint32_t iterations)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    
+    jobIterations = iterations;
+    pendingShards = shards.size();
+    ++jobSerial;
+    
+    jobAvailable.notify_all();
+    jobFinished.wait(lock, [&]() { return pendingShards == 0; });
+    
+    std::exception_ptr firstError;
+    
+    for (auto& shard : shards)
+    {
+        if (shard->error && !firstError)
+        {
+            firstError = shard->error;
+        }
+        
+        shard->error = nullptr;
+    }
+    
+    if (firstError)
+    {
+        std::rethrow_exception(firstError);
+    }
+}
+
+void VulkanShardedApplication::calibrate()
+{
+    if (configuration.calibrationElementCount == 0)
+    {
+        // Nothing to go on, so start with an even split and let the first jobs sort it out.
+        for (auto& shard : shards)
+        {
+            shard->elementsPerSecond = 1.0;
+        }
+        
+        return;
+    }
+    
+    // Every device runs the same input, so the times compare directly.
+    std::vector<uint32_t> input(configuration.calibrationElementCount, 0);
+    std::vector<std::vector<uint32_t>> outputs(shards.size(), std::vector<uint32_t>(input.size()));
+    
+    for (size_t i = 0; i < shards.size(); ++i)
+    {
+        shards[i]->input = input;
+        shards[i]->output = outputs[i];
+    }
+    
+    execute(1);
+    
+    for (auto& shard : shards)
+    {
+        shard->elementsPerSecond = shard->seconds > 0.0 ? input.size() / shard->seconds : 1.0;
+        shard->input = {};
+        shard->output = {};
+    }
+}
+
+std::vector<size_t> VulkanShardedApplication::partition(size_t elementCount) const
+{
+    double totalThroughput = 0.0;
+    for (const auto& shard : shards)
+    {
+        totalThroughput += shard->elementsPerSecond;
+    }
+    
+    // Round every share down, then hand the leftover elements to the shares that lost the most to rounding.
+    std::vector<size_t> counts(shards.size());
+    std::vector<double> remainders(shards.size());
+    size_t assigned = 0;
+    
+    for (size_t i = 0; i < shards.size(); ++i)
+    {
+        double share = totalThroughput > 0.0
+            ? elementCount * (shards[i]->elementsPerSecond / totalThroughput)
+            : static_cast<double>(elementCount) / shards.size();
+        
+        counts[i] = std::min(static_cast<size_t>(share), elementCount - assigned);
+        remainders[i] = share - counts[i];
+        assigned += counts[i];
+    }
+    
+    std::vector<size_t> order(shards.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return remainders[a] > remainders[b]; });
+    
+    for (size_t i = 0; assigned < elementCount; i = (i + 1) % order.size())
+    {
+        ++counts[order[i]];
+        ++assigned;
+    }
+    
+    return counts;
+}
+
+std::vector<uint32_t> VulkanShardedApplication::run(std::span<const uint32_t> input, uint32_t iterations)
+{
+    std::vector<uint32_t> output(input.size());
+    
+    if (input.empty())
+    {
+        return output;
+    }
+    
+    auto counts = partition(input.size());
+    size_t offset = 0;
+    
+    for (size_t i = 0; i < shards.size(); ++i)
+    {
+        shards[i]->input = input.subspan(offset, counts[i]);
+        shards[i]->output = std::span<uint32_t>(output).subspan(offset, counts[i]);
+        offset += counts[i];
+    }
+    
+    execute(iterations);
+    
+    // Devices that got nothing this time keep their old estimate.
+    for (auto& shard : shards)
+    {
+        if (!shard->input.empty() && shard->seconds > 0.0)
+        {
+            double measured = shard->input.size() / shard->seconds;
+            shard->elementsPerSecond += configuration.smoothing * (measured - shard->elementsPerSecond);
+        }
+    }
+    
+    return output;
+}
+
+// MARK: - Reports
+
+std::vector<VulkanShardReport> VulkanShardedApplication::getShardReports() const
+{
+    std::vector<VulkanShardReport> reports;
+    
+    for (const auto& shard : shards)
+    {
+        VulkanShardReport report;
+        report.deviceName = shard->application->getDeviceName();
+        report.elementsPerSecond = shard->elementsPerSecond;
+        report.elementCount = shard->input.size();
+        report.seconds = shard->seconds;
+        reports.push_back(report);
+    }
+    
+    return reports;
+}
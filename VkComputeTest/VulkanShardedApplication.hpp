@@ -0,0 +1,118 @@
+//
+//  VulkanShardedApplication.hpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/30/21.
+//
+
+#ifndef VulkanShardedApplication_hpp
+#define VulkanShardedApplication_hpp
+
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "VulkanComputeApplication.hpp"
+
+struct VulkanShardedConfiguration
+{
+    // Used for every device. Its device field is ignored, each shard is bound to one of the devices below.
+    VulkanComputeConfiguration application;
+    
+    // Device indices or UUIDs to shard across. Empty to use every device the application can run on, and skip the rest.
+    std::vector<std::string> devices;
+    
+    // Elements each device runs once at startup, to measure its throughput before the first job is split.
+    size_t calibrationElementCount = 16 * 1024;
+    
+    // How far each job moves a device's throughput estimate towards what was just measured. 1 keeps only the latest job.
+    double smoothing = 0.5;
+};
+
+struct VulkanShardReport
+{
+    std::string     deviceName;
+    
+    // The smoothed estimate the next job is split by.
+    double          elementsPerSecond = 0.0;
+    
+    // The share of the last job, and how long the device took to run it.
+    size_t          elementCount = 0;
+    double          seconds = 0.0;
+};
+
+// Splits one job across several devices in proportion to how fast each has been, and gathers the results into a
+// single output. Every device gets its own VulkanComputeApplication, created and driven on its own host thread, so
+// devices start up and run concurrently.
+//
+// Several devices are easy to come by without several GPUs: list the lavapipe ICD more than once in
+// VK_ICD_FILENAMES, through copies of its JSON manifest, and the loader reports one device per copy.
+class VulkanShardedApplication {
+public:
+    VulkanShardedApplication(const VulkanShardedConfiguration& configuration = VulkanShardedConfiguration());
+    ~VulkanShardedApplication();
+    
+    VulkanShardedApplication(const VulkanShardedApplication&) = delete;
+    VulkanShardedApplication& operator=(const VulkanShardedApplication&) = delete;
+    
+    // Runs the kernel over the whole input, `iterations` times, and returns the output in input order.
+    // Blocks until every device has finished its share. Rethrows the first error any device hit.
+    std::vector<uint32_t> run(std::span<const uint32_t> input, uint32_t iterations = 1);
+    
+    size_t getDeviceCount() const { return shards.size(); }
+    
+    std::vector<VulkanShardReport> getShardReports() const;
+
+private:
+    
+    struct Shard
+    {
+        std::string                 device;
+        std::unique_ptr<VulkanComputeApplication> application;
+        std::thread                 thread;
+        
+        // The job this shard last finished. It has work to do while this is behind jobSerial.
+        uint64_t                    completedJob = 0;
+        
+        std::span<const uint32_t>   input;
+        std::span<uint32_t>         output;
+        std::exception_ptr          error;
+        
+        double                      elementsPerSecond = 0.0;
+        double                      seconds = 0.0;
+    };
+    
+    VulkanShardedConfiguration      configuration;
+    std::vector<std::unique_ptr<Shard>> shards;
+    
+    // Guards everything shared between the calling thread and the shard threads.
+    std::mutex                      mutex;
+    std::condition_variable         jobAvailable;
+    std::condition_variable         jobFinished;
+    uint64_t                        jobSerial = 0;
+    uint32_t                        jobIterations = 1;
+    size_t                          pendingShards = 0;
+    bool                            isStopping = false;
+    
+    void startShards();
+    void stopShards();
+    
+    void runShard(Shard& shard);
+    void runSlice(Shard& shard);
+    
+    // Hands every shard its input and output, then waits for all of them.
+    void execute(uint32_t iterations);
+    
+    void calibrate();
+    
+    // Splits elementCount across the shards by their throughput estimates. The counts always add up to elementCount.
+    std::vector<size_t> partition(size_t elementCount) const;
+
+};
+
+#endif /* VulkanShardedApplication_hpp */
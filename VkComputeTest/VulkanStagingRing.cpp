@@ -0,0 +1,101 @@
+//
+//  VulkanStagingRing.cpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/26/21.
+//
+
+#include <algorithm>
+
+#include "VulkanStagingRing.hpp"
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// MARK: - Constructor
+
+VulkanStagingRing::VulkanStagingRing(VulkanMemoryAllocator& allocator, VkDeviceSize capacity, VulkanMemoryUsage usage)
+: allocator(allocator)
+{
+    buffer = allocator.createBuffer(capacity, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, usage);
+}
+
+// MARK: - Destructor
+
+VulkanStagingRing::~VulkanStagingRing()
+{
+    allocator.destroyBuffer(buffer);
+}
+
+// MARK: - Allocation
+
+std::optional<VulkanStagingRing::Region> VulkanStagingRing::allocate(VkDeviceSize size, VkDeviceSize alignment, uint64_t serial)
+{
+    const VkDeviceSize capacity = buffer.size;
+    
+    // Keep regions in separate atoms, so flushing or invalidating one can never touch its neighbours.
+    if (!allocator.isCoherent(buffer.allocation))
+    {
+        alignment = std::max(alignment, allocator.getNonCoherentAtomSize());
+    }
+    
+    if (used == 0)
+    {
+        head = 0;
+        tail = 0;
+    }
+    
+    VkDeviceSize start = alignUp(head, alignment);
+    
+    if (used == 0 || head > tail)
+    {
+        // Free space is [head, capacity) followed by [0, tail). Wrap around if the end doesn't fit.
+        if (start + size > capacity)
+        {
+            start = 0;
+            if (size > capacity || (used > 0 && size > tail))
+            {
+                return std::nullopt;
+            }
+        }
+    } else if (start + size > tail)
+    {
+        // Free space is [head, tail), or nothing at all if head == tail.
+        return std::nullopt;
+    }
+    
+    VkDeviceSize end = start + size;
+    VkDeviceSize consumed = start >= head ? end - head : (capacity - head) + end;
+    
+    inFlightRegions.push_back({ serial, end, consumed });
+    used += consumed;
+    head = end;
+    
+    Region region{};
+    region.offset = start;
+    region.size = size;
+    region.mappedData = static_cast<char*>(buffer.allocation.mappedData) + start;
+    return region;
+}
+
+void VulkanStagingRing::release(uint64_t completedSerial)
+{
+    while (!inFlightRegions.empty() && inFlightRegions.front().serial <= completedSerial)
+    {
+        tail = inFlightRegions.front().end;
+        used -= inFlightRegions.front().consumed;
+        inFlightRegions.pop_front();
+    }
+}
+
+void VulkanStagingRing::flush(const Region& region) const
+{
+    allocator.flush(buffer.allocation, region.offset, region.size);
+}
+
+void VulkanStagingRing::invalidate(const Region& region) const
+{
+    allocator.invalidate(buffer.allocation, region.offset, region.size);
+}
@@ -0,0 +1,65 @@
+//
+//  VulkanStagingRing.hpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/26/21.
+//
+
+#ifndef VulkanStagingRing_hpp
+#define VulkanStagingRing_hpp
+
+#include <deque>
+#include <optional>
+#include <vulkan/vulkan.h>
+
+#include "VulkanMemoryAllocator.hpp"
+
+// A persistently mapped, host-visible buffer that is handed out in FIFO order for uploads and readbacks.
+// Every region is tagged with the serial of the submission that uses it, and is only reused once that serial has been released.
+class VulkanStagingRing {
+public:
+    struct Region
+    {
+        VkDeviceSize    offset;
+        VkDeviceSize    size;
+        void*           mappedData;
+    };
+    
+    VulkanStagingRing(VulkanMemoryAllocator& allocator, VkDeviceSize capacity, VulkanMemoryUsage usage = VulkanMemoryUsage::CpuToGpu);
+    ~VulkanStagingRing();
+    
+    VulkanStagingRing(const VulkanStagingRing&) = delete;
+    VulkanStagingRing& operator=(const VulkanStagingRing&) = delete;
+    
+    // Returns std::nullopt if the ring doesn't currently have room. Releasing older serials makes room.
+    std::optional<Region> allocate(VkDeviceSize size, VkDeviceSize alignment, uint64_t serial);
+    
+    // Releases every region whose serial is less than or equal to completedSerial.
+    void release(uint64_t completedSerial);
+    
+    // Call flush after the host writes a region, and invalidate before the host reads one the device wrote.
+    void flush(const Region& region) const;
+    void invalidate(const Region& region) const;
+    
+    VkBuffer getBuffer() const { return buffer.buffer; }
+    VkDeviceSize getCapacity() const { return buffer.size; }
+
+private:
+    
+    struct InFlightRegion
+    {
+        uint64_t        serial;
+        VkDeviceSize    end;
+        VkDeviceSize    consumed;
+    };
+    
+    VulkanMemoryAllocator&      allocator;
+    VulkanBuffer                buffer;
+    VkDeviceSize                head = 0;
+    VkDeviceSize                tail = 0;
+    VkDeviceSize                used = 0;
+    std::deque<InFlightRegion>  inFlightRegions;
+
+};
+
+#endif /* VulkanStagingRing_hpp */
@@ -0,0 +1,140 @@
+//
+//  VulkanStartupProfile.cpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/28/21.
+//
+
+#include "VulkanStartupProfile.hpp"
+
+#ifdef VKCOMPUTE_STARTUP_PROFILE
+
+#include <cstdlib>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#include "FileUtils.hpp"
+
+using namespace VulkanStartupProfile;
+
+namespace
+{
+
+struct Step
+{
+    std::string                             name;
+    size_t                                  depth;
+    std::chrono::steady_clock::time_point   start;
+    std::chrono::steady_clock::duration     duration{};
+};
+
+std::mutex          stepsMutex;
+std::vector<Step>   steps;
+
+// Startup runs on a single thread, but several applications may start on different threads at once.
+thread_local size_t currentDepth = 0;
+
+// STARTUP_STEP names steps after the call, so "createVulkanInstance()" becomes "createVulkanInstance".
+std::string makeStepName(const char* name)
+{
+    std::string stepName(name);
+    
+    auto parenthesis = stepName.find('(');
+    if (parenthesis != std::string::npos)
+    {
+        stepName.erase(parenthesis);
+    }
+    
+    return stepName;
+}
+
+void writeJsonString(std::ostream& stream, const std::string& string)
+{
+    stream << '"';
+    for (char c : string)
+    {
+        if (c == '"' || c == '\\')
+        {
+            stream << '\\';
+        }
+        stream << c;
+    }
+    stream << '"';
+}
+    
+}
+
+// MARK: - Scoped Timer
+
+ScopedTimer::ScopedTimer(const char* name)
+{
+    ++currentDepth;
+    
+    std::lock_guard<std::mutex> lock(stepsMutex);
+    
+    index = steps.size();
+    start = std::chrono::steady_clock::now();
+    steps.push_back({ makeStepName(name), currentDepth, start });
+}
+
+ScopedTimer::~ScopedTimer()
+{
+    auto end = std::chrono::steady_clock::now();
+    
+    --currentDepth;
+    
+    std::lock_guard<std::mutex> lock(stepsMutex);
+    
+    // writeReport() may have cleared the steps while this timer was running.
+    if (index < steps.size() && steps[index].start == start)
+    {
+        steps[index].duration = end - start;
+    }
+}
+
+// MARK: - Report
+
+void VulkanStartupProfile::writeReport()
+{
+    std::vector<Step> recordedSteps;
+    {
+        std::lock_guard<std::mutex> lock(stepsMutex);
+        recordedSteps.swap(steps);
+    }
+    
+    const char* path = std::getenv("VKCOMPUTE_STARTUP_PROFILE_PATH");
+    if (path == nullptr || recordedSteps.empty())
+    {
+        return;
+    }
+    
+    auto origin = recordedSteps.front().start;
+    auto toMilliseconds = [](std::chrono::steady_clock::duration duration) {
+        return std::chrono::duration<double, std::milli>(duration).count();
+    };
+    
+    std::ostringstream json;
+    json << std::fixed << std::setprecision(3);
+    json << "{\n  \"steps\": [\n";
+    
+    for (size_t i = 0; i < recordedSteps.size(); ++i)
+    {
+        const Step& step = recordedSteps[i];
+        
+        json << "    { \"name\": ";
+        writeJsonString(json, step.name);
+        json << ", \"depth\": " << step.depth
+             << ", \"start_ms\": " << toMilliseconds(step.start - origin)
+             << ", \"duration_ms\": " << toMilliseconds(step.duration)
+             << " }" << (i + 1 < recordedSteps.size() ? "," : "") << "\n";
+    }
+    
+    json << "  ]\n}\n";
+    
+    std::string contents = json.str();
+    FileUtils::writeFileAtomically(path, std::vector<char>(contents.begin(), contents.end()));
+}
+
+#endif
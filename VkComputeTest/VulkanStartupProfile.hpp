@@ -0,0 +1,66 @@
+//
+//  VulkanStartupProfile.hpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/28/21.
+//
+
+#ifndef VulkanStartupProfile_hpp
+#define VulkanStartupProfile_hpp
+
+// Scoped timers around each step of startup, so cold start regressions can be pinned on a step.
+// Define VKCOMPUTE_STARTUP_PROFILE to compile them in. Without it the macros expand to the bare statements,
+// and nothing here is referenced. When compiled in, set VKCOMPUTE_STARTUP_PROFILE_PATH in the environment to
+// have the breakdown written as JSON once startup finishes.
+
+#ifdef VKCOMPUTE_STARTUP_PROFILE
+
+#include <chrono>
+#include <string>
+
+namespace VulkanStartupProfile
+{
+
+// Records how long it lived. Timers nest, and each one remembers how deep it was when it started.
+class ScopedTimer {
+public:
+    ScopedTimer(const char* name);
+    ~ScopedTimer();
+    
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    
+    size_t                                  index;
+    std::chrono::steady_clock::time_point   start;
+
+};
+
+// Writes every step recorded so far to VKCOMPUTE_STARTUP_PROFILE_PATH, if it's set, and clears them.
+// Steps are in the order they started, with start and duration in milliseconds since the first one started:
+// { "steps": [ { "name": "createVulkanInstance", "depth": 1, "start_ms": 0.012, "duration_ms": 48.317 }, ... ] }
+void writeReport();
+    
+}
+
+#define VKCOMPUTE_STARTUP_CONCAT_(a, b) a##b
+#define VKCOMPUTE_STARTUP_CONCAT(a, b) VKCOMPUTE_STARTUP_CONCAT_(a, b)
+
+// Times the rest of the enclosing scope.
+#define STARTUP_SCOPE(name) VulkanStartupProfile::ScopedTimer VKCOMPUTE_STARTUP_CONCAT(startupTimer, __LINE__)(name)
+
+// Times a single call, named after the call itself.
+#define STARTUP_STEP(call) do { VulkanStartupProfile::ScopedTimer startupTimer(#call); call; } while (0)
+
+#define STARTUP_REPORT() VulkanStartupProfile::writeReport()
+
+#else
+
+#define STARTUP_SCOPE(name) do {} while (0)
+#define STARTUP_STEP(call) call
+#define STARTUP_REPORT() do {} while (0)
+
+#endif
+
+#endif /* VulkanStartupProfile_hpp */
@@ -0,0 +1,316 @@
+//
+//  VulkanSubmissionTracker.cpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/26/21.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
+#include "VulkanDebugUtils.hpp"
+#include "VulkanSubmissionTracker.hpp"
+
+// MARK: - Submission
+
+bool VulkanSubmission::poll() const
+{
+    return tracker == nullptr || tracker->poll(serial);
+}
+
+void VulkanSubmission::wait() const
+{
+    wait(UINT64_MAX);
+}
+
+bool VulkanSubmission::wait(uint64_t timeoutNanoseconds) const
+{
+    return tracker == nullptr || tracker->wait(serial, timeoutNanoseconds);
+}
+
+// MARK: - Constructor
+
+VulkanSubmissionTracker::VulkanSubmissionTracker(VkDevice logicalDevice)
+: logicalDevice(logicalDevice)
+{
+    
+}
+
+// MARK: - Destructor
+
+VulkanSubmissionTracker::~VulkanSubmissionTracker()
+{
+    waitAll();
+    
+    for (VkFence fence : allFences)
+    {
+        vkDestroyFence(logicalDevice, fence, nullptr);
+    }
+}
+
+// MARK: - Submit
+
+VkFence VulkanSubmissionTracker::acquireFence()
+{
+    // Fences someone is still waiting on stay signaled until they're done.
+    auto reusable = std::find_if(freeFences.rbegin(), freeFences.rend(), [&](VkFence fence) {
+        return waiterCounts.count(fence) == 0;
+    });
+    
+    if (reusable == freeFences.rend())
+    {
+        VkFenceCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        createInfo.pNext = nullptr;
+        createInfo.flags = 0;
+        
+        VkFence fence;
+        VK_ASSERT_SUCCESS(vkCreateFence(logicalDevice, &createInfo, nullptr, &fence),
+                          "Failed to create fence!");
+        
+        allFences.push_back(fence);
+        return fence;
+    }
+    
+    VkFence fence = *reusable;
+    freeFences.erase(std::next(reusable).base());
+    
+    VK_ASSERT_SUCCESS(vkResetFences(logicalDevice, 1, &fence),
+                      "Failed to reset fence!");
+    
+    return fence;
+}
+
+VulkanSubmission VulkanSubmissionTracker::submit(VkQueue queue, uint32_t submitCount, const VkSubmitInfo* submits)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    
+    // Callers that never poll or wait would otherwise keep every fence pending, and create a new one per submit.
+    retireCompletedFences();
+    
+    VkFence fence = acquireFence();
+    
+    VkResult result = vkQueueSubmit(queue, submitCount, submits, fence);
+    if (result != VK_SUCCESS)
+    {
+        freeFences.push_back(fence);
+        throw std::runtime_error("Failed to submit queue!");
+    }
+    
+    uint64_t serial = ++lastSubmittedSerial;
+    pendingFences.emplace(serial, fence);
+    
+    return VulkanSubmission(this, serial);
+}
+
+// MARK: - Completion
+
+void VulkanSubmissionTracker::retireCompletedFences()
+{
+    for (auto it = pendingFences.begin(); it != pendingFences.end();)
+    {
+        VkResult result = vkGetFenceStatus(logicalDevice, it->second);
+        if (result == VK_NOT_READY)
+        {
+            ++it;
+            continue;
+        }
+        
+        VK_ASSERT_SUCCESS(result, "Failed to get fence status!");
+        
+        freeFences.push_back(it->second);
+        it = pendingFences.erase(it);
+    }
+}
+
+void VulkanSubmissionTracker::addWaiter(VkFence fence)
+{
+    ++waiterCounts[fence];
+}
+
+void VulkanSubmissionTracker::removeWaiter(VkFence fence)
+{
+    auto it = waiterCounts.find(fence);
+    if (--it->second == 0)
+    {
+        waiterCounts.erase(it);
+    }
+}
+
+bool VulkanSubmissionTracker::poll(uint64_t serial)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    
+    return pollLocked(serial);
+}
+
+bool VulkanSubmissionTracker::pollLocked(uint64_t serial)
+{
+    auto it = pendingFences.find(serial);
+    if (it == pendingFences.end())
+    {
+        return true;
+    }
+    
+    VkResult result = vkGetFenceStatus(logicalDevice, it->second);
+    if (result == VK_NOT_READY)
+    {
+        return false;
+    }
+    
+    VK_ASSERT_SUCCESS(result, "Failed to get fence status!");
+    
+    freeFences.push_back(it->second);
+    pendingFences.erase(it);
+    return true;
+}
+
+bool VulkanSubmissionTracker::wait(uint64_t serial, uint64_t timeoutNanoseconds)
+{
+    VkFence fence;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        
+        auto it = pendingFences.find(serial);
+        if (it == pendingFences.end())
+        {
+            return true;
+        }
+        
+        fence = it->second;
+        addWaiter(fence);
+    }
+    
+    // Wait without holding the lock, so other threads can keep submitting and polling.
+    VkResult result = vkWaitForFences(logicalDevice, 1, &fence, VK_TRUE, timeoutNanoseconds);
+    
+    std::lock_guard<std::mutex> lock(mutex);
+    
+    removeWaiter(fence);
+    
+    if (result == VK_TIMEOUT)
+    {
+        return false;
+    }
+    
+    VK_ASSERT_SUCCESS(result, "Failed to wait for fence!");
+    
+    auto it = pendingFences.find(serial);
+    if (it != pendingFences.end())
+    {
+        freeFences.push_back(it->second);
+        pendingFences.erase(it);
+    }
+    
+    return true;
+}
+
+std::optional<size_t> VulkanSubmissionTracker::waitAny(std::span<const VulkanSubmission> submissions, uint64_t timeoutNanoseconds)
+{
+    for (const VulkanSubmission& submission : submissions)
+    {
+        if (submission.tracker != this)
+        {
+            throw std::runtime_error("Submission belongs to a different tracker!");
+        }
+    }
+    
+    // The timeout covers the whole call, however many times it has to go around. Capped so the deadline can't overflow.
+    const bool isInfinite = timeoutNanoseconds == UINT64_MAX;
+    const auto deadline = std::chrono::steady_clock::now()
+                        + std::chrono::nanoseconds(std::min<uint64_t>(timeoutNanoseconds, std::numeric_limits<int64_t>::max() / 2));
+    
+    for (;;)
+    {
+        std::vector<VkFence> fences;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            
+            for (size_t i = 0; i < submissions.size(); ++i)
+            {
+                auto it = pendingFences.find(submissions[i].serial);
+                if (it == pendingFences.end())
+                {
+                    return i;
+                }
+                
+                fences.push_back(it->second);
+            }
+            
+            for (VkFence fence : fences)
+            {
+                addWaiter(fence);
+            }
+        }
+        
+        if (fences.empty())
+        {
+            return std::nullopt;
+        }
+        
+        uint64_t remainingNanoseconds = UINT64_MAX;
+        if (!isInfinite)
+        {
+            auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - std::chrono::steady_clock::now());
+            remainingNanoseconds = static_cast<uint64_t>(std::max<int64_t>(remaining.count(), 0));
+        }
+        
+        VkResult result = vkWaitForFences(logicalDevice, static_cast<uint32_t>(fences.size()), fences.data(), VK_FALSE, remainingNanoseconds);
+        
+        std::lock_guard<std::mutex> lock(mutex);
+        
+        for (VkFence fence : fences)
+        {
+            removeWaiter(fence);
+        }
+        
+        if (result == VK_TIMEOUT)
+        {
+            return std::nullopt;
+        }
+        
+        VK_ASSERT_SUCCESS(result, "Failed to wait for fences!");
+        
+        // None of the fences could be reused while this thread waited on them, so the one that signaled still
+        // belongs to its submission, or has been retired with it.
+        for (size_t i = 0; i < submissions.size(); ++i)
+        {
+            if (pollLocked(submissions[i].serial))
+            {
+                return i;
+            }
+        }
+    }
+}
+
+void VulkanSubmissionTracker::waitAll()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    
+    if (pendingFences.empty())
+    {
+        return;
+    }
+    
+    std::vector<VkFence> fences;
+    for (auto& [serial, fence] : pendingFences)
+    {
+        fences.push_back(fence);
+    }
+    
+    VK_ASSERT_SUCCESS(vkWaitForFences(logicalDevice, static_cast<uint32_t>(fences.size()), fences.data(), VK_TRUE, UINT64_MAX),
+                      "Failed to wait for fences!");
+    
+    freeFences.insert(freeFences.end(), fences.begin(), fences.end());
+    pendingFences.clear();
+}
+
+uint64_t VulkanSubmissionTracker::getCompletedSerial()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    
+    retireCompletedFences();
+    
+    return pendingFences.empty() ? lastSubmittedSerial : pendingFences.begin()->first - 1;
+}
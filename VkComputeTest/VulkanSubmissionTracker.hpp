@@ -0,0 +1,103 @@
+//
+//  VulkanSubmissionTracker.hpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/26/21.
+//
+
+#ifndef VulkanSubmissionTracker_hpp
+#define VulkanSubmissionTracker_hpp
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+class VulkanSubmissionTracker;
+
+// A lightweight handle to a batch of work that has been submitted to a queue.
+// Handles are cheap to copy, and stay usable after the work completes.
+class VulkanSubmission {
+public:
+    VulkanSubmission() = default;
+    
+    // Returns true if the work has finished, without blocking.
+    bool poll() const;
+    
+    // Blocks until the work has finished.
+    void wait() const;
+    
+    // Returns false if the timeout expired before the work finished.
+    bool wait(uint64_t timeoutNanoseconds) const;
+    
+    uint64_t getSerial() const { return serial; }
+    bool isValid() const { return tracker != nullptr; }
+
+private:
+    friend class VulkanSubmissionTracker;
+    
+    VulkanSubmission(VulkanSubmissionTracker* tracker, uint64_t serial) : tracker(tracker), serial(serial) {}
+    
+    VulkanSubmissionTracker*    tracker = nullptr;
+    uint64_t                    serial = 0;
+
+};
+
+// Hands out a fence for every submission, and recycles the fences once the work is done.
+// Serials increase with every submission, so "everything up to serial N has finished" is cheap to answer.
+class VulkanSubmissionTracker {
+public:
+    VulkanSubmissionTracker(VkDevice logicalDevice);
+    
+    // Waits for all pending work before destroying the fences.
+    ~VulkanSubmissionTracker();
+    
+    VulkanSubmissionTracker(const VulkanSubmissionTracker&) = delete;
+    VulkanSubmissionTracker& operator=(const VulkanSubmissionTracker&) = delete;
+    
+    // Submits to the queue with a fence attached, and returns immediately.
+    VulkanSubmission submit(VkQueue queue, uint32_t submitCount, const VkSubmitInfo* submits);
+    
+    bool poll(uint64_t serial);
+    bool wait(uint64_t serial, uint64_t timeoutNanoseconds);
+    
+    // Blocks until at least one of the submissions has finished, and returns its index.
+    // Returns std::nullopt if the timeout, counted from the call, expired first.
+    std::optional<size_t> waitAny(std::span<const VulkanSubmission> submissions, uint64_t timeoutNanoseconds = UINT64_MAX);
+    
+    void waitAll();
+    
+    // Every submission with a serial less than or equal to this one has finished.
+    uint64_t getCompletedSerial();
+
+private:
+    
+    VkDevice                        logicalDevice;
+    std::mutex                      mutex;
+    uint64_t                        lastSubmittedSerial = 0;
+    std::map<uint64_t, VkFence>     pendingFences;
+    
+    // Retired fences are left signaled, and only reset right before they're reused.
+    // That way a thread still waiting on a fence that was just retired can never block forever.
+    std::vector<VkFence>            freeFences;
+    std::vector<VkFence>            allFences;
+    
+    // How many threads are blocked on each fence outside the lock. A retired fence isn't reset and reused until its
+    // last waiter has returned, so a wait can never observe a later submission's fence.
+    std::unordered_map<VkFence, uint32_t> waiterCounts;
+    
+    VkFence acquireFence();
+    void retireCompletedFences();
+    
+    bool pollLocked(uint64_t serial);
+    
+    void addWaiter(VkFence fence);
+    void removeWaiter(VkFence fence);
+
+};
+
+#endif /* VulkanSubmissionTracker_hpp */
@@ -0,0 +1,215 @@
+//
+//  VulkanWorkgroupTuner.cpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/27/21.
+//
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <sstream>
+
+#include "FileUtils.hpp"
+#include "VulkanWorkgroupTuner.hpp"
+
+// The deviceUUID is only available through vkGetPhysicalDeviceProperties2 when the instance and the device are both
+// Vulkan 1.1. Otherwise this falls back to the pipelineCacheUUID, which also changes with the driver.
+static std::string getDeviceUUIDString(VkInstance instance, uint32_t instanceApiVersion, VkPhysicalDevice physicalDevice,
+                                       const VkPhysicalDeviceProperties& properties)
+{
+    uint8_t uuid[VK_UUID_SIZE];
+    std::copy(std::begin(properties.pipelineCacheUUID), std::end(properties.pipelineCacheUUID), uuid);
+    
+    if (instanceApiVersion >= VK_API_VERSION_1_1 && properties.apiVersion >= VK_API_VERSION_1_1)
+    {
+        auto getPhysicalDeviceProperties2 = reinterpret_cast<PFN_vkGetPhysicalDeviceProperties2>(vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceProperties2"));
+        
+        VkPhysicalDeviceIDProperties idProperties{};
+        idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+        idProperties.pNext = nullptr;
+        
+        VkPhysicalDeviceProperties2 properties2{};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties2.pNext = &idProperties;
+        
+        getPhysicalDeviceProperties2(physicalDevice, &properties2);
+        
+        std::copy(std::begin(idProperties.deviceUUID), std::end(idProperties.deviceUUID), uuid);
+    }
+    
+    std::string result;
+    for (uint8_t byte : uuid)
+    {
+        char hex[3];
+        snprintf(hex, sizeof(hex), "%02x", byte);
+        result += hex;
+    }
+    return result;
+}
+
+// MARK: - Constructor
+
+VulkanWorkgroupTuner::VulkanWorkgroupTuner(VkInstance instance, uint32_t instanceApiVersion, VkPhysicalDevice physicalDevice, const std::string& directory)
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    
+    limits = properties.limits;
+    filePath = directory + "/workgroup_sizes_" + getDeviceUUIDString(instance, instanceApiVersion, physicalDevice, properties) + ".txt";
+    
+    std::lock_guard<std::mutex> lock(FileUtils::getCacheMutex());
+    
+    if (auto data = FileUtils::readFileIfPresent(filePath))
+    {
+        tunedSizes = parse(*data);
+    }
+}
+
+// MARK: - Persistence
+
+// "<kernel>/2^<n>", where 2^n is the smallest power of two holding the problem's invocations. The best size for a
+// problem that only fills a few workgroups is rarely the best for one that fills the whole device.
+std::string VulkanWorkgroupTuner::getKey(std::string_view kernel, const VulkanWorkgroupSize& problemSize)
+{
+    const uint64_t invocationCount = uint64_t(problemSize.x) * problemSize.y * problemSize.z;
+    
+    uint32_t sizeClass = 0;
+    while ((uint64_t(1) << sizeClass) < invocationCount)
+    {
+        ++sizeClass;
+    }
+    
+    return std::string(kernel) + "/2^" + std::to_string(sizeClass);
+}
+
+// One kernel and size class per line: "<key> <x> <y> <z>". Malformed lines are skipped.
+std::map<std::string, VulkanWorkgroupSize, std::less<>> VulkanWorkgroupTuner::parse(const std::vector<char>& data)
+{
+    std::map<std::string, VulkanWorkgroupSize, std::less<>> sizes;
+    
+    std::istringstream stream(std::string(data.begin(), data.end()));
+    std::string line;
+    while (std::getline(stream, line))
+    {
+        std::istringstream lineStream(line);
+        std::string kernel;
+        VulkanWorkgroupSize size;
+        
+        if (lineStream >> kernel >> size.x >> size.y >> size.z && size.getInvocationCount() > 0)
+        {
+            sizes[kernel] = size;
+        }
+    }
+    
+    return sizes;
+}
+
+void VulkanWorkgroupTuner::save()
+{
+    // Another application may have tuned other kernels in the meantime, so merge with what's on disk. The lock keeps
+    // the other applications of this process from saving in between.
+    std::lock_guard<std::mutex> lock(FileUtils::getCacheMutex());
+    
+    if (auto data = FileUtils::readFileIfPresent(filePath))
+    {
+        for (auto& [kernel, size] : parse(*data))
+        {
+            tunedSizes.try_emplace(kernel, size);
+        }
+    }
+    
+    std::ostringstream stream;
+    for (auto& [kernel, size] : tunedSizes)
+    {
+        stream << kernel << " " << size.x << " " << size.y << " " << size.z << "\n";
+    }
+    
+    std::string text = stream.str();
+    
+    if (!FileUtils::writeFileAtomically(filePath, std::vector<char>(text.begin(), text.end())))
+    {
+        std::cerr << "Failed to write workgroup sizes to " << filePath << std::endl;
+    }
+}
+
+// MARK: - Tuning
+
+std::optional<VulkanWorkgroupSize> VulkanWorkgroupTuner::lookup(std::string_view kernel, const VulkanWorkgroupSize& problemSize) const
+{
+    auto it = tunedSizes.find(getKey(kernel, problemSize));
+    if (it == tunedSizes.end())
+    {
+        return std::nullopt;
+    }
+    
+    const VulkanWorkgroupSize& size = it->second;
+    
+    // A saved size might not suit this device any more if the driver changed its limits.
+    if (size.x > limits.maxComputeWorkGroupSize[0] ||
+        size.y > limits.maxComputeWorkGroupSize[1] ||
+        size.z > limits.maxComputeWorkGroupSize[2] ||
+        size.getInvocationCount() > limits.maxComputeWorkGroupInvocations)
+    {
+        return std::nullopt;
+    }
+    
+    return size;
+}
+
+std::vector<VulkanWorkgroupSize> VulkanWorkgroupTuner::getCandidates(const VulkanWorkgroupSize& problemSize) const
+{
+    const uint32_t maxX = std::min(limits.maxComputeWorkGroupSize[0], problemSize.x);
+    const uint32_t maxY = std::min(limits.maxComputeWorkGroupSize[1], problemSize.y);
+    const uint32_t maxZ = std::min(limits.maxComputeWorkGroupSize[2], problemSize.z);
+    const uint32_t minimumInvocations = std::min(minimumInvocationCount, problemSize.getInvocationCount());
+    
+    std::vector<VulkanWorkgroupSize> candidates;
+    
+    for (uint32_t x = 1; x <= maxX; x *= 2)
+    {
+        for (uint32_t y = 1; y <= maxY; y *= 2)
+        {
+            for (uint32_t z = 1; z <= maxZ; z *= 2)
+            {
+                VulkanWorkgroupSize size{ x, y, z };
+                
+                uint32_t invocationCount = size.getInvocationCount();
+                if (invocationCount >= minimumInvocations && invocationCount <= limits.maxComputeWorkGroupInvocations)
+                {
+                    candidates.push_back(size);
+                }
+            }
+        }
+    }
+    
+    return candidates;
+}
+
+VulkanWorkgroupSize VulkanWorkgroupTuner::tune(std::string_view kernel, const VulkanWorkgroupSize& problemSize, const Measure& measure)
+{
+    auto candidates = getCandidates(problemSize);
+    if (candidates.empty())
+    {
+        throw std::runtime_error("No workgroup size fits the device limits!");
+    }
+    
+    VulkanWorkgroupSize bestSize = candidates.front();
+    double bestTime = std::numeric_limits<double>::max();
+    
+    for (const VulkanWorkgroupSize& candidate : candidates)
+    {
+        double time = measure(candidate);
+        if (time < bestTime)
+        {
+            bestTime = time;
+            bestSize = candidate;
+        }
+    }
+    
+    tunedSizes[getKey(kernel, problemSize)] = bestSize;
+    save();
+    
+    return bestSize;
+}
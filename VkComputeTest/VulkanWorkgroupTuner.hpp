@@ -0,0 +1,65 @@
+//
+//  VulkanWorkgroupTuner.hpp
+//  VkComputeTest
+//
+//  Created by James Perlman on 10/27/21.
+//
+
+#ifndef VulkanWorkgroupTuner_hpp
+#define VulkanWorkgroupTuner_hpp
+
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+struct VulkanWorkgroupSize
+{
+    uint32_t x = 1;
+    uint32_t y = 1;
+    uint32_t z = 1;
+    
+    uint32_t getInvocationCount() const { return x * y * z; }
+};
+
+// Picks the fastest workgroup size for each kernel by timing every candidate the device allows.
+// Winners are written to a file named after the device UUID, keyed by kernel and by the power of two the problem's
+// invocation count rounds up to, so each kernel is only tuned once per device and size class.
+class VulkanWorkgroupTuner {
+public:
+    // Measures one candidate and returns how long it took, in any unit as long as it's consistent.
+    using Measure = std::function<double(const VulkanWorkgroupSize& workgroupSize)>;
+    
+    // instanceApiVersion is the apiVersion the instance was created with.
+    VulkanWorkgroupTuner(VkInstance instance, uint32_t instanceApiVersion, VkPhysicalDevice physicalDevice, const std::string& directory);
+    
+    // Returns the size saved by a previous tuning run on a problem of the same size class, if there was one.
+    std::optional<VulkanWorkgroupSize> lookup(std::string_view kernel, const VulkanWorkgroupSize& problemSize) const;
+    
+    // Power-of-two sizes that fit the device limits, and don't exceed the problem in any dimension.
+    std::vector<VulkanWorkgroupSize> getCandidates(const VulkanWorkgroupSize& problemSize) const;
+    
+    // Measures every candidate, then saves and returns the fastest.
+    VulkanWorkgroupSize tune(std::string_view kernel, const VulkanWorkgroupSize& problemSize, const Measure& measure);
+
+private:
+    
+    // Workgroups smaller than this leave SIMD lanes idle on every GPU we care about, so they aren't worth timing.
+    static constexpr uint32_t minimumInvocationCount = 32;
+    
+    VkPhysicalDeviceLimits                      limits;
+    std::string                                 filePath;
+    std::map<std::string, VulkanWorkgroupSize, std::less<>> tunedSizes;
+    
+    static std::string getKey(std::string_view kernel, const VulkanWorkgroupSize& problemSize);
+    
+    static std::map<std::string, VulkanWorkgroupSize, std::less<>> parse(const std::vector<char>& data);
+    
+    void save();
+
+};
+
+#endif /* VulkanWorkgroupTuner_hpp */
@@ -5,15 +5,461 @@
 //  Created by James Perlman on 10/23/21.
 //
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
 
+#include "VulkanCompaction.hpp"
 #include "VulkanComputeApplication.hpp"
+#include "VulkanRadixSort.hpp"
+#include "VulkanScan.hpp"
+#include "VulkanShardedApplication.hpp"
+
+// Splits one large job across every device, and prints how it was shared out.
+static int runSharded()
+{
+    VulkanShardedApplication application;
+    
+    std::vector<uint32_t> input(1024 * 1024, 0);
+    
+    for (uint32_t job = 0; job < 4; ++job)
+    {
+        auto output = application.run(input);
+        
+        std::cout << "Job " << job << ": " << output.size() << " values from " << application.getDeviceCount() << " devices" << std::endl;
+        
+        for (const auto& report : application.getShardReports())
+        {
+            std::cout << "  " << report.deviceName << ": " << report.elementCount << " elements in "
+                      << report.seconds * 1000.0 << " ms, next split at " << report.elementsPerSecond << " elements/s" << std::endl;
+        }
+    }
+    
+    return 0;
+}
+
+// Chains four stages into one graph, and checks the last one saw the first one's write.
+static int runGraph()
+{
+    VulkanComputeApplication application;
+    auto& allocator = application.getMemoryAllocator();
+    
+    const uint32_t vectorCount = 4096;
+    const VkDeviceSize size = vectorCount * 16;
+    const VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    
+    VulkanBuffer source = allocator.createBuffer(size, usage, VulkanMemoryUsage::GpuOnly);
+    VulkanBuffer left = allocator.createBuffer(size, usage, VulkanMemoryUsage::GpuOnly);
+    VulkanBuffer right = allocator.createBuffer(size, usage, VulkanMemoryUsage::GpuOnly);
+    VulkanBuffer result = allocator.createBuffer(size, usage, VulkanMemoryUsage::GpuToCpu);
+    
+    {
+        auto graph = application.createComputeGraph();
+        auto copy = graph->addKernel(VulkanKernels::getKernel("copy"), VulkanWorkgroupSize{ 64, 1, 1 });
+        
+        VulkanKernels::CopyParameters parameters;
+        parameters.vectorCount = vectorCount;
+        uint32_t groupCount = vectorCount / graph->getLocalSize(copy).x;
+        
+        // The two copies out of source only read it, so they share a level, and a barrier.
+        const VulkanGraphBinding toLeft[] = { { source.buffer, VulkanAccess::Read }, { left.buffer, VulkanAccess::Write } };
+        const VulkanGraphBinding toRight[] = { { source.buffer, VulkanAccess::Read }, { right.buffer, VulkanAccess::Write } };
+        
+        // left reaches result through three intermediates. The first and last are never live together, so they alias.
+        VulkanTransientBuffer intermediates[] = { graph->createTransientBuffer(size), graph->createTransientBuffer(size), graph->createTransientBuffer(size) };
+        const VulkanGraphBinding toFirst[] = { { left.buffer, VulkanAccess::Read }, VulkanGraphBinding::fromTransient(intermediates[0], VulkanAccess::Write) };
+        const VulkanGraphBinding toSecond[] = { VulkanGraphBinding::fromTransient(intermediates[0], VulkanAccess::Read),
+                                                VulkanGraphBinding::fromTransient(intermediates[1], VulkanAccess::Write) };
+        const VulkanGraphBinding toThird[] = { VulkanGraphBinding::fromTransient(intermediates[1], VulkanAccess::Read),
+                                               VulkanGraphBinding::fromTransient(intermediates[2], VulkanAccess::Write) };
+        const VulkanGraphBinding toResult[] = { VulkanGraphBinding::fromTransient(intermediates[2], VulkanAccess::Read), { result.buffer, VulkanAccess::Write } };
+        
+        graph->fillBuffer(source.buffer, 0, size, 7);
+        graph->dispatch(copy, toLeft, groupCount, 1, 1, parameters);
+        graph->dispatch(copy, toFirst, groupCount, 1, 1, parameters);
+        graph->dispatch(copy, toSecond, groupCount, 1, 1, parameters);
+        graph->dispatch(copy, toThird, groupCount, 1, 1, parameters);
+        graph->dispatch(copy, toResult, groupCount, 1, 1, parameters);
+        graph->dispatch(copy, toRight, groupCount, 1, 1, parameters);
+        
+        graph->submit().wait();
+        
+        allocator.invalidate(result.allocation, 0, size);
+        const uint32_t* values = static_cast<const uint32_t*>(result.allocation.mappedData);
+        bool isCorrect = std::all_of(values, values + vectorCount * 4, [](uint32_t value) { return value == 7; });
+        
+        std::cout << graph->getStageCount() << " stages in " << graph->getLevelCount() << " levels, output "
+                  << (isCorrect ? "correct" : "WRONG") << std::endl;
+        std::cout << "Transient memory: " << graph->getMemoryPlan().plannedBytes << " bytes, "
+                  << graph->getMemoryPlan().naiveBytes << " without aliasing" << std::endl;
+    }
+    
+    allocator.destroyBuffer(result);
+    allocator.destroyBuffer(right);
+    allocator.destroyBuffer(left);
+    allocator.destroyBuffer(source);
+    
+    return 0;
+}
+
+// Sorts keys along with their original positions, and scans a buffer of ones, all in one graph. Nothing but the
+// upload and the final readback crosses the bus.
+static int runSort()
+{
+    VulkanComputeApplication application;
+    auto& allocator = application.getMemoryAllocator();
+    
+    const uint32_t elementCount = 1024 * 1024;
+    const VkDeviceSize size = elementCount * sizeof(uint32_t);
+    const VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    
+    std::vector<uint32_t> keys(elementCount);
+    std::vector<uint32_t> positions(elementCount);
+    std::mt19937 random(1);
+    for (uint32_t i = 0; i < elementCount; ++i)
+    {
+        keys[i] = random();
+        positions[i] = i;
+    }
+    
+    VulkanBuffer upload = allocator.createBuffer(2 * size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VulkanMemoryUsage::CpuToGpu);
+    VulkanBuffer readback = allocator.createBuffer(3 * size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VulkanMemoryUsage::GpuToCpu);
+    VulkanBuffer keyBuffer = allocator.createBuffer(size, usage, VulkanMemoryUsage::GpuOnly);
+    VulkanBuffer valueBuffer = allocator.createBuffer(size, usage, VulkanMemoryUsage::GpuOnly);
+    VulkanBuffer scanBuffer = allocator.createBuffer(size, usage, VulkanMemoryUsage::GpuOnly);
+    
+    memcpy(upload.allocation.mappedData, keys.data(), size);
+    memcpy(static_cast<uint8_t*>(upload.allocation.mappedData) + size, positions.data(), size);
+    allocator.flush(upload.allocation, 0, 2 * size);
+    
+    {
+        auto graph = application.createComputeGraph();
+        VulkanRadixSort sort(*graph, application.getLimits());
+        VulkanScan scan(*graph, application.getLimits());
+        
+        graph->copyBuffer(upload.buffer, keyBuffer.buffer, VkBufferCopy{ 0, 0, size });
+        graph->copyBuffer(upload.buffer, valueBuffer.buffer, VkBufferCopy{ size, 0, size });
+        sort.record(keyBuffer.buffer, valueBuffer.buffer, elementCount, 32);
+        
+        // The sort and the scan touch different buffers, so the graph is free to overlap them.
+        const VulkanGraphBinding scanBinding = { scanBuffer.buffer, VulkanAccess::ReadWrite };
+        graph->fillBuffer(scanBuffer.buffer, 0, size, 1);
+        scan.record(scanBinding, scanBinding, elementCount, VulkanScanMode::Exclusive);
+        
+        graph->copyBuffer(keyBuffer.buffer, readback.buffer, VkBufferCopy{ 0, 0, size });
+        graph->copyBuffer(valueBuffer.buffer, readback.buffer, VkBufferCopy{ 0, size, size });
+        graph->copyBuffer(scanBuffer.buffer, readback.buffer, VkBufferCopy{ 0, 2 * size, size });
+        
+        graph->submit().wait();
+        
+        std::cout << graph->getStageCount() << " stages in " << graph->getLevelCount() << " levels" << std::endl;
+    }
+    
+    allocator.invalidate(readback.allocation, 0, 3 * size);
+    const uint32_t* sortedKeys = static_cast<const uint32_t*>(readback.allocation.mappedData);
+    const uint32_t* sortedPositions = sortedKeys + elementCount;
+    const uint32_t* offsets = sortedKeys + 2 * elementCount;
+    
+    bool isSorted = std::is_sorted(sortedKeys, sortedKeys + elementCount);
+    bool isStable = true;
+    bool isScanned = true;
+    for (uint32_t i = 0; i < elementCount; ++i)
+    {
+        isStable = isStable && keys[sortedPositions[i]] == sortedKeys[i] && (i == 0 || sortedKeys[i - 1] != sortedKeys[i] || sortedPositions[i - 1] < sortedPositions[i]);
+        isScanned = isScanned && offsets[i] == i;
+    }
+    
+    std::cout << "Sort " << (isSorted && isStable ? "correct" : "WRONG") << ", scan " << (isScanned ? "correct" : "WRONG") << std::endl;
+    
+    allocator.destroyBuffer(scanBuffer);
+    allocator.destroyBuffer(valueBuffer);
+    allocator.destroyBuffer(keyBuffer);
+    allocator.destroyBuffer(readback);
+    allocator.destroyBuffer(upload);
+    
+    return 0;
+}
+
+// Filters random values twice on the GPU, the second pass sized from the first one's count, and reads back only the
+// values that survive both.
+static int runCompact()
+{
+    VulkanComputeApplication application;
+    auto& allocator = application.getMemoryAllocator();
+    
+    const uint32_t elementCount = 1024 * 1024;
+    const VkDeviceSize size = elementCount * sizeof(uint32_t);
+    const VkDeviceSize counterSize = sizeof(VulkanKernels::CompactionCounter);
+    const VkBufferUsageFlags counterUsage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                                            VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    
+    std::vector<uint32_t> values(elementCount);
+    std::mt19937 random(1);
+    for (uint32_t i = 0; i < elementCount; ++i)
+    {
+        values[i] = random();
+    }
+    
+    VulkanBuffer upload = allocator.createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VulkanMemoryUsage::CpuToGpu);
+    VulkanBuffer inputBuffer = allocator.createBuffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VulkanMemoryUsage::GpuOnly);
+    VulkanBuffer filteredBuffer = allocator.createBuffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VulkanMemoryUsage::GpuOnly);
+    VulkanBuffer firstCounter = allocator.createBuffer(counterSize, counterUsage, VulkanMemoryUsage::GpuOnly);
+    VulkanBuffer secondCounter = allocator.createBuffer(counterSize, counterUsage, VulkanMemoryUsage::GpuOnly);
+    VulkanBuffer countReadback = allocator.createBuffer(counterSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VulkanMemoryUsage::GpuToCpu);
+    
+    // The last pass writes straight into host-visible memory, so only the survivors cross the bus.
+    VulkanBuffer survivorBuffer = allocator.createBuffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VulkanMemoryUsage::GpuToCpu);
+    
+    memcpy(upload.allocation.mappedData, values.data(), size);
+    allocator.flush(upload.allocation, 0, size);
+    
+    {
+        auto graph = application.createComputeGraph();
+        VulkanCompaction compaction(*graph, application.getLimits());
+        
+        const VulkanGraphBinding filtered = { filteredBuffer.buffer, VulkanAccess::ReadWrite };
+        
+        graph->copyBuffer(upload.buffer, inputBuffer.buffer, VkBufferCopy{ 0, 0, size });
+        compaction.record({ inputBuffer.buffer, VulkanAccess::Read }, filtered, std::nullopt, firstCounter.buffer, elementCount,
+                          VulkanCompactionFilter::compare(VulkanKernels::CompareOperation::Less, 0x10000000u));
+        compaction.recordIndirect(filtered, { survivorBuffer.buffer, VulkanAccess::Write }, std::nullopt, secondCounter.buffer, firstCounter.buffer,
+                                  elementCount, VulkanCompactionFilter::compare(VulkanKernels::CompareOperation::GreaterOrEqual, 0x08000000u));
+        graph->copyBuffer(secondCounter.buffer, countReadback.buffer, VkBufferCopy{ 0, 0, counterSize });
+        
+        graph->submit().wait();
+        
+        std::cout << graph->getStageCount() << " stages in " << graph->getLevelCount() << " levels" << std::endl;
+    }
+    
+    allocator.invalidate(countReadback.allocation, 0, counterSize);
+    const uint32_t survivorCount = static_cast<const VulkanKernels::CompactionCounter*>(countReadback.allocation.mappedData)->count;
+    
+    allocator.invalidate(survivorBuffer.allocation, 0, survivorCount * sizeof(uint32_t));
+    const uint32_t* survivorData = static_cast<const uint32_t*>(survivorBuffer.allocation.mappedData);
+    std::vector<uint32_t> survivors(survivorData, survivorData + survivorCount);
+    
+    std::vector<uint32_t> expected;
+    std::copy_if(values.begin(), values.end(), std::back_inserter(expected), [](uint32_t value) { return value >= 0x08000000u && value < 0x10000000u; });
+    
+    // Compaction doesn't keep the order.
+    std::sort(survivors.begin(), survivors.end());
+    std::sort(expected.begin(), expected.end());
+    
+    std::cout << "Kept " << survivorCount << " of " << elementCount << " values, read back " << survivorCount * sizeof(uint32_t) << " of "
+              << size << " bytes" << std::endl;
+    std::cout << "Compaction " << (survivors == expected ? "correct" : "WRONG") << std::endl;
+    
+    allocator.destroyBuffer(survivorBuffer);
+    allocator.destroyBuffer(countReadback);
+    allocator.destroyBuffer(secondCounter);
+    allocator.destroyBuffer(firstCounter);
+    allocator.destroyBuffer(filteredBuffer);
+    allocator.destroyBuffer(inputBuffer);
+    allocator.destroyBuffer(upload);
+    
+    return 0;
+}
+
+// Sizes a dispatch from arguments a graph pass wrote on the GPU, and checks it covered every element.
+static int runIndirect()
+{
+    VulkanComputeConfiguration configuration;
+    configuration.indirectDispatch = true;
+    
+    VulkanComputeApplication application(configuration);
+    auto& allocator = application.getMemoryAllocator();
+    
+    std::vector<uint32_t> input(64 * 1024, 0);
+    const VkDispatchIndirectCommand groupCount = application.getDispatchGroupCount(static_cast<uint32_t>(input.size()));
+    
+    VulkanBuffer upload = allocator.createBuffer(sizeof(groupCount), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VulkanMemoryUsage::CpuToGpu);
+    VulkanBuffer arguments = allocator.createBuffer(sizeof(groupCount), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                                    VulkanMemoryUsage::GpuOnly);
+    
+    memcpy(upload.allocation.mappedData, &groupCount, sizeof(groupCount));
+    allocator.flush(upload.allocation, 0, sizeof(groupCount));
+    
+    {
+        auto graph = application.createComputeGraph();
+        graph->copyBuffer(upload.buffer, arguments.buffer, VkBufferCopy{ 0, 0, sizeof(groupCount) });
+        graph->submit().wait();
+    }
+    
+    auto output = application.run(input, VulkanDispatchArguments{ arguments.buffer, 0 });
+    bool isCorrect = std::all_of(output.begin(), output.end(), [](uint32_t value) { return value == 1; });
+    
+    std::cout << "Indirect dispatch of " << groupCount.x << "x" << groupCount.y << "x" << groupCount.z << " groups, output "
+              << (isCorrect ? "correct" : "WRONG") << std::endl;
+    
+    allocator.destroyBuffer(arguments);
+    allocator.destroyBuffer(upload);
+    
+    return 0;
+}
+
+// Caps the groups per dispatch far below the device limit, so an ordinary job is split into several dispatches, and
+// checks the pieces between them covered every element.
+static int runChunked()
+{
+    VulkanComputeConfiguration configuration;
+    configuration.maxGroupCountPerDispatch = 3;
+    
+    VulkanComputeApplication application(configuration);
+    
+    std::vector<uint32_t> input(application.getMaxElementCount(), 0);
+    const VkDispatchIndirectCommand groupCount = application.getDispatchGroupCount(static_cast<uint32_t>(input.size()));
+    
+    auto output = application.run(input);
+    bool isCorrect = output.size() == input.size() && std::all_of(output.begin(), output.end(), [](uint32_t value) { return value == 1; });
+    
+    std::cout << groupCount.x << " groups along x in " << (groupCount.x + configuration.maxGroupCountPerDispatch - 1) / configuration.maxGroupCountPerDispatch
+              << " dispatches, output " << (isCorrect ? "correct" : "WRONG") << std::endl;
+    
+    return 0;
+}
+
+// Spreads frames across the compute queues in turn, which never asks a queue how busy it is, and only reads back
+// every frame's output once its frame comes around again.
+static int runRoundRobin()
+{
+    VulkanComputeConfiguration configuration;
+    configuration.framesInFlight = 3;
+    configuration.queuePolicy = VulkanQueuePolicy::RoundRobin;
+    
+    VulkanComputeApplication application(configuration);
+    
+    std::vector<uint32_t> input(256, 0);
+    std::vector<VulkanSubmission> submissions;
+    bool isCorrect = true;
+    
+    auto readBack = [&](const VulkanSubmission& submission) {
+        auto output = application.getOutput(submission);
+        isCorrect = isCorrect && std::all_of(output.begin(), output.end(), [](uint32_t value) { return value == 1; });
+    };
+    
+    const uint32_t batchCount = 1024;
+    for (uint32_t batch = 0; batch < batchCount; ++batch)
+    {
+        if (submissions.size() == configuration.framesInFlight)
+        {
+            readBack(submissions.front());
+            submissions.erase(submissions.begin());
+        }
+        
+        submissions.push_back(application.submit(input));
+    }
+    
+    for (const auto& submission : submissions)
+    {
+        readBack(submission);
+    }
+    
+    std::cout << batchCount << " batches round robin, output " << (isCorrect ? "correct" : "WRONG") << std::endl;
+    
+    return 0;
+}
 
 int main(int argc, const char * argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "--sharded")
+    {
+        return runSharded();
+    }
+    
+    if (argc > 1 && std::string(argv[1]) == "--graph")
+    {
+        return runGraph();
+    }
+    
+    if (argc > 1 && std::string(argv[1]) == "--sort")
+    {
+        return runSort();
+    }
+    
+    if (argc > 1 && std::string(argv[1]) == "--compact")
+    {
+        return runCompact();
+    }
+    
+    if (argc > 1 && std::string(argv[1]) == "--indirect")
+    {
+        return runIndirect();
+    }
+    
+    if (argc > 1 && std::string(argv[1]) == "--chunked")
+    {
+        return runChunked();
+    }
+    
+    if (argc > 1 && std::string(argv[1]) == "--round-robin")
+    {
+        return runRoundRobin();
+    }
+    
     // insert code here...
     
-    auto application = VulkanComputeApplication();
-    application.run();
+    VulkanComputeConfiguration configuration;
+    configuration.framesInFlight = 3;
+    configuration.profile = true;
+    
+    auto application = VulkanComputeApplication(configuration);
+    
+    std::vector<uint32_t> input(256, 0);
+    
+    // Keep every frame busy, and only read a batch back once the next submit is about to reuse its frame.
+    const uint32_t batchCount = 64;
+    std::vector<VulkanSubmission> submissions;
+    size_t valuesReadBack = 0;
+    
+    for (uint32_t batch = 0; batch < batchCount; ++batch)
+    {
+        if (submissions.size() == configuration.framesInFlight)
+        {
+            valuesReadBack += application.getOutput(submissions.front()).size();
+            submissions.erase(submissions.begin());
+        }
+        
+        submissions.push_back(application.submit(input));
+    }
+    
+    // Nothing else will reuse the frames, so the last batches are read back in whatever order they finish.
+    while (!submissions.empty())
+    {
+        size_t index = application.waitAny(submissions).value();
+        valuesReadBack += application.getOutput(submissions[index]).size();
+        submissions.erase(submissions.begin() + index);
+    }
+    
+    auto report = application.getThroughputReport();
+    
+    std::cout << "Read back " << valuesReadBack << " values." << std::endl;
+    std::cout << "Submissions:   " << report.submissionCount << " (" << report.getSubmissionsPerSecond() << "/s)" << std::endl;
+    std::cout << "Transferred:   " << report.bytesUploaded << " bytes up, " << report.bytesReadBack << " bytes down" << std::endl;
+    std::cout << "Elapsed:       " << report.elapsedSeconds * 1000.0 << " ms" << std::endl;
+    std::cout << "Host stalled:  " << report.stallSeconds * 1000.0 << " ms" << std::endl;
+    std::cout << "Average depth: " << report.getAverageDepth() << " of " << configuration.framesInFlight << " frames in flight" << std::endl;
+    
+    if (auto profiler = application.getProfiler())
+    {
+        std::cout << std::endl;
+        
+        for (const auto& statistics : profiler->getStatistics())
+        {
+            std::cout << statistics.name << ": " << statistics.sampleCount << " samples, "
+                      << "min " << statistics.minMilliseconds << " ms, "
+                      << "mean " << statistics.meanMilliseconds << " ms, "
+                      << "p99 " << statistics.p99Milliseconds << " ms" << std::endl;
+        }
+        
+        // Open in chrome://tracing or https://ui.perfetto.dev
+        if (profiler->writeChromeTrace("vkcompute_trace.json"))
+        {
+            std::cout << "Wrote vkcompute_trace.json" << std::endl;
+        }
+    }
     
     return 0;
 }
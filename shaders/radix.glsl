@@ -0,0 +1,40 @@
+// What radix_histogram.comp and radix_scatter.comp share. Each pass of the sort looks at one 4 bit digit of the key.
+
+// The workgroup width is picked at pipeline creation time through specialization constant 0. It must be at least
+// radixSize.
+layout (local_size_x_id = 0) in;
+
+// Mirrors VulkanKernels::scanItemsPerInvocation and VulkanKernels::radixBits.
+const uint itemsPerInvocation = 4;
+const uint radixSize = 16;
+
+// Mirrors VulkanKernels::RadixSortParameters.
+layout (push_constant) uniform Parameters {
+    uint elementCount;
+    
+    // 1 for 32-bit keys, 2 for 64-bit keys stored low word first.
+    uint keyWords;
+    
+    // The bit the digit starts at.
+    uint shift;
+    
+    uint tileCount;
+    uint hasValues;
+    uint padding;
+} parameters;
+
+layout (set = 0, binding = 0) readonly buffer KeysIn {
+    uint data[];
+} keysIn;
+
+uint getDigit(uint index)
+{
+    uint key = keysIn.data[index * parameters.keyWords + parameters.shift / 32];
+    return (key >> (parameters.shift % 32)) & (radixSize - 1);
+}
+
+// Tiles are walked a workgroup's width at a time, in order, which keeps the scatter stable.
+uint getTileIndex(uint round)
+{
+    return (gl_WorkGroupID.x * itemsPerInvocation + round) * gl_WorkGroupSize.x + gl_LocalInvocationIndex;
+}
@@ -0,0 +1,227 @@
+// The body of reduce.comp and reduce_shared.comp, which differ only in whether REDUCE_USE_SUBGROUPS is defined.
+// Each workgroup folds its share of the input into one partial result. The host runs it again over the partials until
+// a single workgroup is left.
+
+// The workgroup width is picked at pipeline creation time through specialization constant 0. Without subgroups it
+// must be a power of two.
+layout (local_size_x_id = 0) in;
+
+// Mirrors VulkanKernels::ReduceOperation.
+const uint OperationSum = 0;
+const uint OperationMin = 1;
+const uint OperationMax = 2;
+const uint OperationArgMax = 3;
+
+// Mirrors VulkanKernels::ElementType.
+const uint TypeU32 = 0;
+const uint TypeI32 = 1;
+const uint TypeF32 = 2;
+const uint TypeF16 = 3;
+
+// Mirrors VulkanKernels::ReduceParameters.
+layout (push_constant) uniform Parameters {
+    uint elementCount;
+    uint operation;
+    uint elementType;
+    uint isPartialInput;
+} parameters;
+
+// Elements, two halves to a word for f16, or the uvec2 partials of an earlier pass.
+layout (set = 0, binding = 0) readonly buffer InputBuffer {
+    uint data[];
+} inputBuffer;
+
+// One partial per workgroup: the bits of the value, and for ArgMax the index of the element it came from.
+layout (set = 0, binding = 1) writeonly buffer OutputBuffer {
+    uvec2 data[];
+} outputBuffer;
+
+const uint noIndex = 0xFFFFFFFFu;
+const uint positiveInfinity = 0x7F800000u;
+const uint negativeInfinity = 0xFF800000u;
+
+// Halves are widened as they're loaded, so values and partials only ever hold u32, i32 or f32 bits.
+uint getValueType()
+{
+    return parameters.elementType == TypeF16 ? TypeF32 : parameters.elementType;
+}
+
+bool isLess(uint a, uint b)
+{
+    switch (getValueType())
+    {
+        case TypeU32: return a < b;
+        case TypeI32: return int(a) < int(b);
+        default: return uintBitsToFloat(a) < uintBitsToFloat(b);
+    }
+}
+
+uvec2 getIdentity()
+{
+    uint type = getValueType();
+    
+    switch (parameters.operation)
+    {
+        case OperationSum:
+            return uvec2(0u, noIndex);
+        case OperationMin:
+            return uvec2(type == TypeU32 ? 0xFFFFFFFFu : type == TypeI32 ? 0x7FFFFFFFu : positiveInfinity, noIndex);
+        default:
+            return uvec2(type == TypeU32 ? 0u : type == TypeI32 ? 0x80000000u : negativeInfinity, noIndex);
+    }
+}
+
+uvec2 combine(uvec2 a, uvec2 b)
+{
+    switch (parameters.operation)
+    {
+        case OperationSum:
+            return uvec2(getValueType() == TypeF32 ? floatBitsToUint(uintBitsToFloat(a.x) + uintBitsToFloat(b.x)) : a.x + b.x, noIndex);
+        case OperationMin:
+            return uvec2(isLess(b.x, a.x) ? b.x : a.x, noIndex);
+        case OperationMax:
+            return uvec2(isLess(a.x, b.x) ? b.x : a.x, noIndex);
+        default:
+            // Ties go to the lower index, so the answer doesn't depend on how the elements were spread out.
+            return isLess(a.x, b.x) || (!isLess(b.x, a.x) && b.y < a.y) ? b : a;
+    }
+}
+
+// Halves are read a word at a time, so VulkanReduction only ever passes an even f16 elementCount, and reduces the last
+// half of an odd one on the host.
+uvec2 load(uint index)
+{
+    if (parameters.isPartialInput != 0)
+    {
+        return uvec2(inputBuffer.data[2 * index], inputBuffer.data[2 * index + 1]);
+    }
+    
+    if (parameters.elementType == TypeF16)
+    {
+        vec2 halves = unpackHalf2x16(inputBuffer.data[index / 2]);
+        return uvec2(floatBitsToUint((index & 1) == 0 ? halves.x : halves.y), index);
+    }
+    
+    return uvec2(inputBuffer.data[index], index);
+}
+
+#ifdef REDUCE_USE_SUBGROUPS
+
+// One partial per subgroup. There are never more subgroups than invocations.
+shared uvec2 subgroupPartials[gl_WorkGroupSize.x];
+
+uint subgroupMinValue(uint value)
+{
+    switch (getValueType())
+    {
+        case TypeU32: return subgroupMin(value);
+        case TypeI32: return uint(subgroupMin(int(value)));
+        default: return floatBitsToUint(subgroupMin(uintBitsToFloat(value)));
+    }
+}
+
+uint subgroupMaxValue(uint value)
+{
+    switch (getValueType())
+    {
+        case TypeU32: return subgroupMax(value);
+        case TypeI32: return uint(subgroupMax(int(value)));
+        default: return floatBitsToUint(subgroupMax(uintBitsToFloat(value)));
+    }
+}
+
+// Every active invocation of the subgroup gets the result.
+uvec2 subgroupCombine(uvec2 value)
+{
+    switch (parameters.operation)
+    {
+        case OperationSum:
+            return uvec2(getValueType() == TypeF32 ? floatBitsToUint(subgroupAdd(uintBitsToFloat(value.x))) : subgroupAdd(value.x), noIndex);
+        case OperationMin:
+            return uvec2(subgroupMinValue(value.x), noIndex);
+        case OperationMax:
+            return uvec2(subgroupMaxValue(value.x), noIndex);
+        default:
+        {
+            uint best = subgroupMaxValue(value.x);
+            return uvec2(best, subgroupMin(isLess(value.x, best) ? noIndex : value.y));
+        }
+    }
+}
+
+void reduceWorkgroup(uvec2 value)
+{
+    value = subgroupCombine(value);
+    
+    if (subgroupElect())
+    {
+        subgroupPartials[gl_SubgroupID] = value;
+    }
+    
+    memoryBarrierShared();
+    barrier();
+    
+    // The first subgroup folds the other subgroups' partials, a subgroup's width at a time.
+    if (gl_SubgroupID == 0)
+    {
+        value = getIdentity();
+        
+        for (uint i = gl_SubgroupInvocationID; i < gl_NumSubgroups; i += gl_SubgroupSize)
+        {
+            value = combine(value, subgroupPartials[i]);
+        }
+        
+        value = subgroupCombine(value);
+        
+        if (subgroupElect())
+        {
+            outputBuffer.data[gl_WorkGroupID.x] = value;
+        }
+    }
+}
+
+#else
+
+shared uvec2 partials[gl_WorkGroupSize.x];
+
+// A tree over shared memory, halving the active invocations each step.
+void reduceWorkgroup(uvec2 value)
+{
+    uint index = gl_LocalInvocationIndex;
+    partials[index] = value;
+    
+    memoryBarrierShared();
+    barrier();
+    
+    for (uint stride = gl_WorkGroupSize.x / 2; stride > 0; stride /= 2)
+    {
+        if (index < stride)
+        {
+            partials[index] = combine(partials[index], partials[index + stride]);
+        }
+        
+        memoryBarrierShared();
+        barrier();
+    }
+    
+    if (index == 0)
+    {
+        outputBuffer.data[gl_WorkGroupID.x] = partials[0];
+    }
+}
+
+#endif
+
+// Every invocation first folds a strided run of the input, so a dispatch of any size covers all of it.
+void main()
+{
+    uvec2 value = getIdentity();
+    uint stride = gl_NumWorkGroups.x * gl_WorkGroupSize.x;
+    
+    for (uint i = gl_GlobalInvocationID.x; i < parameters.elementCount; i += stride)
+    {
+        value = combine(value, load(i));
+    }
+    
+    reduceWorkgroup(value);
+}